@@ -18,24 +18,131 @@
 */
 
 #include "jksn.hpp"
+#include <algorithm>
 #include <array>
+#include <bitset>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <iterator>
+#include <limits>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
+/*
+  Hot path counters and probes, compiled in with -DJKSN_INSTRUMENT. Probes
+  are USDT probes of provider `jksn`, available where <sys/sdt.h> is.
+*/
+#ifdef JKSN_INSTRUMENT
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define JKSN_PROBE(name) DTRACE_PROBE(jksn, name)
+#endif
+#endif
+#define JKSN_COUNT(counter, n) instrumentCounters.counter.fetch_add(uint64_t(n), std::memory_order_relaxed)
+#define JKSN_CALL(kind) JKSNInstrumentCall<&JKSNInstrumentAtomics::kind##_calls, &JKSNInstrumentAtomics::kind##_ns> instrument_call
+#else
+#define JKSN_COUNT(counter, n) ((void) 0)
+#define JKSN_CALL(kind) ((void) 0)
+#endif
+#ifndef JKSN_PROBE
+#define JKSN_PROBE(name) ((void) 0)
+#endif
+
 namespace JKSN {
 
+#ifdef JKSN_INSTRUMENT
+struct JKSNInstrumentAtomics {
+    std::atomic<uint64_t> allocations {0};
+    std::atomic<uint64_t> allocated_bytes {0};
+    std::array<std::atomic<uint64_t>, JKSNEncodeStats::FAMILY_COUNT> parse_values {{}};
+    std::atomic<uint64_t> utf8_to_utf16_bytes {0};
+    std::atomic<uint64_t> utf16_to_utf8_bytes {0};
+    std::atomic<uint64_t> encode_calls {0};
+    std::atomic<uint64_t> encode_ns {0};
+    std::atomic<uint64_t> decode_calls {0};
+    std::atomic<uint64_t> decode_ns {0};
+};
+
+static JKSNInstrumentAtomics instrumentCounters;
+
+/* Times a public call until it returns or throws */
+template<std::atomic<uint64_t> JKSNInstrumentAtomics::*calls, std::atomic<uint64_t> JKSNInstrumentAtomics::*ns>
+class JKSNInstrumentCall {
+public:
+    JKSNInstrumentCall() :
+        start(std::chrono::steady_clock::now()) {
+        if(calls == &JKSNInstrumentAtomics::encode_calls)
+            JKSN_PROBE(dump__entry);
+        else
+            JKSN_PROBE(parse__entry);
+    }
+    ~JKSNInstrumentCall() {
+        (instrumentCounters.*calls).fetch_add(1, std::memory_order_relaxed);
+        (instrumentCounters.*ns).fetch_add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - this->start).count()), std::memory_order_relaxed);
+        if(calls == &JKSNInstrumentAtomics::encode_calls)
+            JKSN_PROBE(dump__return);
+        else
+            JKSN_PROBE(parse__return);
+    }
+private:
+    std::chrono::steady_clock::time_point start;
+};
+#endif
+
+void instrumentAllocation(size_t bytes) {
+    JKSN_COUNT(allocations, 1);
+    JKSN_COUNT(allocated_bytes, bytes);
+    (void) bytes;
+}
+
+JKSNInstrumentCounters instrumentSnapshot() {
+    JKSNInstrumentCounters result = JKSNInstrumentCounters();
+#ifdef JKSN_INSTRUMENT
+    result.enabled = true;
+    result.allocations = instrumentCounters.allocations.load(std::memory_order_relaxed);
+    result.allocated_bytes = instrumentCounters.allocated_bytes.load(std::memory_order_relaxed);
+    for(size_t i = 0; i < JKSNEncodeStats::FAMILY_COUNT; i++)
+        result.parse_values[i] = instrumentCounters.parse_values[i].load(std::memory_order_relaxed);
+    result.utf8_to_utf16_bytes = instrumentCounters.utf8_to_utf16_bytes.load(std::memory_order_relaxed);
+    result.utf16_to_utf8_bytes = instrumentCounters.utf16_to_utf8_bytes.load(std::memory_order_relaxed);
+    result.encode_calls = instrumentCounters.encode_calls.load(std::memory_order_relaxed);
+    result.encode_ns = instrumentCounters.encode_ns.load(std::memory_order_relaxed);
+    result.decode_calls = instrumentCounters.decode_calls.load(std::memory_order_relaxed);
+    result.decode_ns = instrumentCounters.decode_ns.load(std::memory_order_relaxed);
+#endif
+    return result;
+}
+
+void instrumentReset() {
+#ifdef JKSN_INSTRUMENT
+    instrumentCounters.allocations.store(0, std::memory_order_relaxed);
+    instrumentCounters.allocated_bytes.store(0, std::memory_order_relaxed);
+    for(std::atomic<uint64_t> &count : instrumentCounters.parse_values)
+        count.store(0, std::memory_order_relaxed);
+    instrumentCounters.utf8_to_utf16_bytes.store(0, std::memory_order_relaxed);
+    instrumentCounters.utf16_to_utf8_bytes.store(0, std::memory_order_relaxed);
+    instrumentCounters.encode_calls.store(0, std::memory_order_relaxed);
+    instrumentCounters.encode_ns.store(0, std::memory_order_relaxed);
+    instrumentCounters.decode_calls.store(0, std::memory_order_relaxed);
+    instrumentCounters.decode_ns.store(0, std::memory_order_relaxed);
+#endif
+}
+
 class JKSNUnicodeError : public JKSNError {
 public:
     JKSNUnicodeError(const char *what) : JKSNError(what) {}
@@ -73,7 +180,7 @@ public:
             return stream;
         if(!(stream << this->data))
             return stream;
-        if(!(stream << this->buf))
+        if(!(stream << this->bytes()))
             return stream;
         if(recursive)
             for(const JKSNProxy &i : this->children)
@@ -83,17 +190,24 @@ public:
     }
     std::string toString(bool recursive = true) const {
         std::string result;
-        result.reserve(1 + this->data.size() + this->buf.size());
+        result.reserve(1 + this->data.size() + this->bytes().size());
         result += char(this->control);
         result += this->data;
-        result += this->buf;
+        result += this->bytes();
         if(recursive)
             for(const JKSNProxy &i : this->children)
                 result += i.toString();
         return result;
     }
+    void appendTo(std::string &result) const {
+        result += char(this->control);
+        result += this->data;
+        result += this->bytes();
+        for(const JKSNProxy &i : this->children)
+            i.appendTo(result);
+    }
     size_t size(size_t depth = 0) const {
-        size_t result = 1 + this->data.size() + this->buf.size();
+        size_t result = 1 + this->data.size() + this->bytes().size();
         if(depth == 0)
             for(const JKSNProxy &i : this->children)
                 result += i.size();
@@ -102,27 +216,81 @@ public:
                 result += i.size(depth-1);
         return result;
     }
+    /* The string or blob written instead of buf, left in its value by dumpSegments */
+    const std::string &bytes() const {
+        return this->external ? *this->external : this->buf;
+    }
     const JKSNValue *origin = nullptr; /* weak reference */
     uint8_t control;
     std::string data;
     std::string buf;
+    const std::string *external = nullptr; /* weak reference */
     std::list<JKSNProxy> children;
     uint8_t hash = 0;
 };
 
+/*
+  The hashtables are cleared by starting a new generation, and a slot
+  filled in an older one is emptied when it is next looked at.
+*/
+template<typename T>
 class JKSNCache {
 public:
     bool haslastint = false;
     intmax_t lastint;
-    std::array<std::shared_ptr<std::string>, 256> texthash {{nullptr}};
-    std::array<std::shared_ptr<std::string>, 256> blobhash {{nullptr}};
+    T &text(uint8_t hash) {
+        return this->slot(this->texthash, this->textgen, hash);
+    }
+    T &blob(uint8_t hash) {
+        return this->slot(this->blobhash, this->blobgen, hash);
+    }
+    void clear() {
+        if(++this->generation != 0)
+            return;
+        /* Wrapped around, so the stamps would lie */
+        this->texthash.fill(T());
+        this->blobhash.fill(T());
+        this->textgen.fill(0);
+        this->blobgen.fill(0);
+    }
+private:
+    std::array<T, 256> texthash {{}};
+    std::array<T, 256> blobhash {{}};
+    std::array<uint32_t, 256> textgen {{}};
+    std::array<uint32_t, 256> blobgen {{}};
+    uint32_t generation = 0;
+    T &slot(std::array<T, 256> &table, std::array<uint32_t, 256> &stamps, uint8_t hash) {
+        if(stamps[hash] != this->generation) {
+            table[hash] = T();
+            stamps[hash] = this->generation;
+        }
+        return table[hash];
+    }
 };
 
 class JKSNEncoderPrivate {
 public:
-    JKSNProxy dumpToProxy(const JKSNValue &obj);
+    JKSNProxy dumpToProxy(const JKSNValue &obj, size_t segment_min = 0, std::unordered_map<std::string, JKSNProxy> *keys = nullptr);
+    JKSNJSONParser json;
+    JKSNEncodeStats *stats = nullptr; /* weak reference */
+    jksn_effort effort = JKSN_EFFORT_BALANCED;
+    uint64_t time_budget = 0; /* microseconds */
+    bool narrowing = false;
+    bool tag_narrowed = false;
+    bool xor_arrays = false;
+    size_t dedup_blobs = 0;
+    size_t dedup_chunks = 0;
+    size_t dedup_capacity = size_t(64) << 20;
+    /* Blobs from this size on are never referred back to, for JKSNDecoder::setBlobSink, or 0 */
+    size_t streamed_blobs = 65536;
+    void reset();
+    void resetSettings();
 private:
-    JKSNCache cache;
+    JKSNCache<std::shared_ptr<std::string> > cache;
+    /* Blobs sent with 0xe2, in the order the decoder numbers them */
+    std::vector<std::string> dedup_entries;
+    std::unordered_multimap<uint64_t, size_t> dedup_index;
+    size_t dedup_size = 0;
     static JKSNProxy dumpValue(const JKSNValue &obj);
     static JKSNProxy dumpUndefined(const JKSNValue &obj);
     static JKSNProxy dumpNull(const JKSNValue &obj);
@@ -132,34 +300,515 @@ private:
     static JKSNProxy dumpFloat(const JKSNValue &obj);
     static JKSNProxy dumpDouble(const JKSNValue &obj);
     static JKSNProxy dumpLongDouble(const JKSNValue &obj);
+    static bool dumpNarrowed(const JKSNValue &obj, JKSNProxy &result);
     static JKSNProxy dumpString(const JKSNValue &obj);
+    static JKSNProxy dumpKey(const JKSNValue &obj);
     static JKSNProxy dumpBlob(const JKSNValue &obj);
+    static JKSNProxy dumpExternal(const JKSNValue &obj, uint8_t control);
     static JKSNProxy dumpArray(const JKSNValue &obj);
     static JKSNProxy dumpArray(const std::vector<const JKSNValue *> &obj, const JKSNValue *origin = nullptr);
     static bool testSwapAvailability(const std::vector<const JKSNValue *> &obj);
     static JKSNProxy encodeStraightArray(const std::vector<const JKSNValue *> &obj, const JKSNValue *origin = nullptr);
     static JKSNProxy encodeSwappedArray(const std::vector<const JKSNValue *> &obj, const JKSNValue *origin = nullptr);
+    static jksn_data_type testXorAvailability(const std::vector<const JKSNValue *> &obj);
+    static JKSNProxy encodeXorArray(const std::vector<const JKSNValue *> &obj, jksn_data_type type, const JKSNValue *origin = nullptr);
     static JKSNProxy dumpObject(const JKSNValue &obj);
     static JKSNProxy dumpUnspecified(const JKSNValue &obj);
     JKSNProxy &optimize(JKSNProxy &obj);
+    bool dedupBlob(JKSNProxy &obj);
+    bool findDedup(const char *buf, size_t size, uint64_t hash, size_t &index) const;
+    JKSNProxy dedupPiece(const char *buf, size_t size, uint64_t hash);
+    void finish(JKSNProxy &proxy, bool fast);
+    friend class JKSNWriter;
+};
+
+/* What follows each control byte, so that the decoder dispatches with one lookup */
+enum JKSNControlKind : uint8_t {
+    JKSN_CONTROL_INVALID,
+    JKSN_CONTROL_CONSTANT,
+    JKSN_CONTROL_INT,
+    JKSN_CONTROL_FLOAT,
+    JKSN_CONTROL_DOUBLE,
+    JKSN_CONTROL_LONG_DOUBLE,
+    JKSN_CONTROL_UTF16,
+    JKSN_CONTROL_UTF8,
+    JKSN_CONTROL_BLOB,
+    JKSN_CONTROL_TEXT_HASH,
+    JKSN_CONTROL_BLOB_HASH,
+    JKSN_CONTROL_CLEAR_HASH,
+    JKSN_CONTROL_REFRESH,
+    JKSN_CONTROL_ARRAY,
+    JKSN_CONTROL_OBJECT,
+    JKSN_CONTROL_SWAPPED,
+    JKSN_CONTROL_LENGTHLESS,
+    JKSN_CONTROL_PADDING,
+    JKSN_CONTROL_DELTA,
+    JKSN_CONTROL_XOR_DOUBLE,
+    JKSN_CONTROL_XOR_FLOAT,
+    JKSN_CONTROL_DEDUP_BLOB,
+    JKSN_CONTROL_DEDUP_REF,
+    JKSN_CONTROL_DEDUP_CHUNKS,
+    JKSN_CONTROL_CHECKSUM,
+    JKSN_CONTROL_DELAYED_CHECKSUM,
+    JKSN_CONTROL_PRAGMA,
+    JKSN_CONTROL_JSON
+};
+
+/* Constants produced by JKSN_CONTROL_CONSTANT */
+enum JKSNControlConstant : int8_t {
+    JKSN_CONSTANT_UNDEFINED,
+    JKSN_CONSTANT_NULL,
+    JKSN_CONSTANT_FALSE,
+    JKSN_CONSTANT_TRUE,
+    JKSN_CONSTANT_NAN,
+    JKSN_CONSTANT_NEGATIVE_INFINITY,
+    JKSN_CONSTANT_POSITIVE_INFINITY,
+    JKSN_CONSTANT_UNSPECIFIED
+};
+
+struct JKSNControl {
+    uint8_t kind;
+    /* Bytes of the integer or length field: 0 if it is `value` itself, or JKSN_VARINT */
+    uint8_t width;
+    /* Inline integer or length, sign of a varint, or a JKSNControlConstant */
+    int8_t value;
 };
 
+static const uint8_t JKSN_VARINT = 0x80;
+
+#define X { JKSN_CONTROL_INVALID, 0, 0 }
+#define K(constant) { JKSN_CONTROL_CONSTANT, 0, JKSN_CONSTANT_##constant }
+#define L(kind, n) { JKSN_CONTROL_##kind, 0, n }
+#define W(kind, width) { JKSN_CONTROL_##kind, width, 0 }
+#define V(kind, sign) { JKSN_CONTROL_##kind, JKSN_VARINT, sign }
+static const JKSNControl jksn_control_table[256] = {
+    /* 0x00 special values */
+    K(UNDEFINED), K(NULL), K(FALSE), K(TRUE), X, X, X, X, X, X, X, X, X, X, X, W(JSON, 0),
+    /* 0x10 integers */
+    L(INT, 0), L(INT, 1), L(INT, 2), L(INT, 3), L(INT, 4), L(INT, 5), L(INT, 6), L(INT, 7),
+    L(INT, 8), L(INT, 9), L(INT, 10), W(INT, 4), W(INT, 2), W(INT, 1), V(INT, -1), V(INT, 1),
+    /* 0x20 floating point numbers */
+    K(NAN), X, X, X, X, X, X, X, X, X, X, W(LONG_DOUBLE, 10), W(DOUBLE, 8), W(FLOAT, 4), K(NEGATIVE_INFINITY), K(POSITIVE_INFINITY),
+    /* 0x30 UTF-16 strings */
+    L(UTF16, 0), L(UTF16, 1), L(UTF16, 2), L(UTF16, 3), L(UTF16, 4), L(UTF16, 5), L(UTF16, 6), L(UTF16, 7),
+    L(UTF16, 8), L(UTF16, 9), L(UTF16, 10), L(UTF16, 11), L(TEXT_HASH, 0), W(UTF16, 2), W(UTF16, 1), V(UTF16, 1),
+    /* 0x40 UTF-8 strings */
+    L(UTF8, 0), L(UTF8, 1), L(UTF8, 2), L(UTF8, 3), L(UTF8, 4), L(UTF8, 5), L(UTF8, 6), L(UTF8, 7),
+    L(UTF8, 8), L(UTF8, 9), L(UTF8, 10), L(UTF8, 11), L(UTF8, 12), W(UTF8, 2), W(UTF8, 1), V(UTF8, 1),
+    /* 0x50 blob strings */
+    L(BLOB, 0), L(BLOB, 1), L(BLOB, 2), L(BLOB, 3), L(BLOB, 4), L(BLOB, 5), L(BLOB, 6), L(BLOB, 7),
+    L(BLOB, 8), L(BLOB, 9), L(BLOB, 10), L(BLOB, 11), L(BLOB_HASH, 0), W(BLOB, 2), W(BLOB, 1), V(BLOB, 1),
+    /* 0x60 */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    /* 0x70 hashtable refreshers */
+    L(CLEAR_HASH, 0), L(REFRESH, 1), L(REFRESH, 2), L(REFRESH, 3), L(REFRESH, 4), L(REFRESH, 5), L(REFRESH, 6), L(REFRESH, 7),
+    L(REFRESH, 8), L(REFRESH, 9), L(REFRESH, 10), L(REFRESH, 11), L(REFRESH, 12), W(REFRESH, 2), W(REFRESH, 1), V(REFRESH, 1),
+    /* 0x80 arrays */
+    L(ARRAY, 0), L(ARRAY, 1), L(ARRAY, 2), L(ARRAY, 3), L(ARRAY, 4), L(ARRAY, 5), L(ARRAY, 6), L(ARRAY, 7),
+    L(ARRAY, 8), L(ARRAY, 9), L(ARRAY, 10), L(ARRAY, 11), L(ARRAY, 12), W(ARRAY, 2), W(ARRAY, 1), V(ARRAY, 1),
+    /* 0x90 objects */
+    L(OBJECT, 0), L(OBJECT, 1), L(OBJECT, 2), L(OBJECT, 3), L(OBJECT, 4), L(OBJECT, 5), L(OBJECT, 6), L(OBJECT, 7),
+    L(OBJECT, 8), L(OBJECT, 9), L(OBJECT, 10), L(OBJECT, 11), L(OBJECT, 12), W(OBJECT, 2), W(OBJECT, 1), V(OBJECT, 1),
+    /* 0xa0 row-col swapped arrays */
+    K(UNSPECIFIED), L(SWAPPED, 1), L(SWAPPED, 2), L(SWAPPED, 3), L(SWAPPED, 4), L(SWAPPED, 5), L(SWAPPED, 6), L(SWAPPED, 7),
+    L(SWAPPED, 8), L(SWAPPED, 9), L(SWAPPED, 10), L(SWAPPED, 11), L(SWAPPED, 12), W(SWAPPED, 2), W(SWAPPED, 1), V(SWAPPED, 1),
+    /* 0xb0 */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    /* 0xc0 lengthless arrays and padding */
+    X, X, X, X, X, X, X, X, L(LENGTHLESS, 0), X, L(PADDING, 0), X, X, X, X, X,
+    /* 0xd0 delta encoded integers */
+    L(DELTA, 0), L(DELTA, 1), L(DELTA, 2), L(DELTA, 3), L(DELTA, 4), L(DELTA, 5), L(DELTA, -5), L(DELTA, -4),
+    L(DELTA, -3), L(DELTA, -2), L(DELTA, -1), W(DELTA, 4), W(DELTA, 2), W(DELTA, 1), V(DELTA, -1), V(DELTA, 1),
+    /* 0xe0 implementation defined extensions */
+    L(XOR_DOUBLE, 0), L(XOR_FLOAT, 0), V(DEDUP_BLOB, 1), V(DEDUP_REF, 1), V(DEDUP_CHUNKS, 1), X, X, X, X, X, X, X, X, X, X, X,
+    /* 0xf0 checksums and pragmas */
+    W(CHECKSUM, 1), W(CHECKSUM, 4), W(CHECKSUM, 16), W(CHECKSUM, 20), W(CHECKSUM, 32), W(CHECKSUM, 64), X, X,
+    W(DELAYED_CHECKSUM, 1), W(DELAYED_CHECKSUM, 4), W(DELAYED_CHECKSUM, 16), W(DELAYED_CHECKSUM, 20), W(DELAYED_CHECKSUM, 32), W(DELAYED_CHECKSUM, 64), X, L(PRAGMA, 0)
+};
+#undef X
+#undef K
+#undef L
+#undef W
+#undef V
+
 class JKSNDecoderPrivate {
 public:
     JKSNValue parseValue(std::istream &fp);
+    bool skipValue(std::istream &fp);
+    bool intern_keys = false;
+    bool restore_narrowed = false;
+    /* Blobs of at least this size go to blob_sink in chunks, 0 if none */
+    size_t blob_sink_min = 0;
+    std::function<void(const char *, size_t, size_t, size_t)> blob_sink;
+    void reset();
+    void resetSettings();
 private:
-    JKSNCache cache;
+    /* A container being filled, or a prefix waiting for the value after it */
+    struct Frame {
+        enum Kind : uint8_t {
+            ARRAY,
+            OBJECT,
+            SWAPPED,
+            LENGTHLESS,
+            DISCARD,
+            PRAGMA,
+            TRAILER
+        };
+        Kind kind = ARRAY;
+        bool has_key = false;
+        /* Values, columns or values to discard still expected, or trailing bytes to skip */
+        size_t length = 0;
+        std::vector<JKSNValue> items;
+        std::map<JKSNValue, JKSNValue> members;
+        JKSNValue key;
+    };
+
+    class FrameStack {
+    public:
+        Frame &push(Frame::Kind kind, size_t length = 0) {
+            if(this->depth == this->frames.size())
+                this->frames.emplace_back();
+            Frame &frame = this->frames[this->depth++];
+            frame.kind = kind;
+            frame.has_key = false;
+            frame.length = length;
+            /* Normally left empty when the previous container was moved out */
+            frame.items.clear();
+            frame.members.clear();
+            return frame;
+        }
+        Frame &top() {
+            return this->frames[this->depth-1];
+        }
+        void pop() {
+            --this->depth;
+        }
+        bool empty() const {
+            return this->depth == 0;
+        }
+        void clear() {
+            this->depth = 0;
+            this->narrowed = JKSN_UNDEFINED;
+        }
+        /* The original type of the next number, named by a pragma */
+        jksn_data_type narrowed = JKSN_UNDEFINED;
+    private:
+        std::vector<Frame> frames;
+        size_t depth = 0;
+    };
+    /* What skipValue still has to pass over in one container or prefix */
+    struct SkipFrame {
+        enum Kind : uint8_t {
+            CONTAINER,
+            LENGTHLESS,
+            DISCARD,
+            TRAILER
+        };
+        Kind kind;
+        size_t length;
+    };
+    /* Remembered strings are shared with the values returned */
+    JKSNCache<JKSNValue> cache;
+    /*
+      Strings passed over by skipValue are kept as raw bytes, and only
+      turned into hashtable values when a back reference asks for them.
+    */
+    std::array<std::string, 256> skipped_text;
+    std::array<std::string, 256> skipped_blob;
+    std::bitset<256> text_skipped;
+    std::bitset<256> blob_skipped;
+    std::bitset<256> text_utf16;
+    /* Kept between calls, so that containers reuse their frames */
+    FrameStack stack;
+    std::vector<SkipFrame> skip_stack;
+    std::string skip_buffer;
+    /* Blobs of the 0xe2 extension, numbered from 0 for the whole session */
+    std::vector<JKSNValue> dedup;
+    JKSNJSONParser json;
     static uintmax_t decodeInt(std::istream &fp, size_t size);
+    static intmax_t decodeSigned(std::istream &fp, const JKSNControl &entry);
+    static size_t decodeLength(std::istream &fp, uint8_t control);
+    static size_t decodeLength(std::istream &fp, const JKSNControl &entry);
+    static void skipBytes(std::istream &fp, size_t size);
+    JKSNValue parseScalar(std::istream &fp, uint8_t control, const JKSNControl &entry, bool is_key);
+    JKSNValue parseString(std::istream &fp, uint8_t control, bool intern = false);
+    void skipString(std::istream &fp, uint8_t control);
+    void streamBlob(std::istream &fp, size_t size, bool to_sink);
+    JKSNValue &cachedString(bool is_blob, uint8_t hash);
+    void clearHash();
+    JKSNValue parseDedup(std::istream &fp, const JKSNControl &entry);
     static JKSNValue parseFloat(std::istream &fp);
     static JKSNValue parseDouble(std::istream &fp);
     static JKSNValue parseLongDouble(std::istream &fp);
-    JKSNValue parseSwappedArray(std::istream &fp, size_t column_length);
+    static JKSNValue parseXorArray(std::istream &fp, jksn_data_type type);
+    static bool pushValue(FrameStack &stack, JKSNValue &value, std::istream &fp);
+    friend class JKSNReader;
+    friend class JKSNProjection;
+    friend class JKSNSchema;
 };
 
 static std::string UTF8ToUTF16LE(const std::string &utf8str, bool strict = false);
 static std::string UTF16ToUTF8(const std::u16string &utf16str);
 static uint8_t DJBHash(const std::string &obj, uint8_t iv = 0);
+static uint8_t DJBHash(const char *buf, size_t size, uint8_t iv = 0);
+static void skipHeader(std::istream &fp);
+static inline uint64_t hashMix(uint64_t a, uint64_t b);
+static uint64_t hashBytes(const char *buf, size_t size, uint64_t seed);
 static inline bool isLittleEndian();
+static inline bool readBytes(std::istream &fp, char *buffer, size_t size);
+static inline unsigned countLeadingZeros(uint64_t x);
+static inline unsigned countTrailingZeros(uint64_t x);
+static uint32_t CRC32(const char *buf, size_t size);
+static void encodeUint64(char *buf, uint64_t number);
+static uint64_t decodeUint64(const char *buf);
+static size_t formatDouble(double number, char *buffer);
+static size_t formatFloat(float number, char *buffer);
+static size_t formatLongDouble(long double number, char *buffer);
+
+class JKSNBitWriter {
+public:
+    void put(uint64_t bits, unsigned width) {
+        while(width != 0) {
+            unsigned room = 8 - this->used;
+            unsigned take = width < room ? width : room;
+            width -= take;
+            uint8_t chunk = uint8_t((bits >> width) & ((1u << take) - 1));
+            if(this->used == 0)
+                this->buf.push_back(char(chunk << (room - take)));
+            else
+                this->buf.back() = char(uint8_t(this->buf.back()) | uint8_t(chunk << (room - take)));
+            this->used = (this->used + take) & 7;
+        }
+    }
+    std::string buf;
+private:
+    unsigned used = 0;
+};
+
+class JKSNBitReader {
+public:
+    JKSNBitReader(const std::string &buf) :
+        buf(buf) {
+    }
+    uint64_t get(unsigned width) {
+        if(width > (this->buf.size() - this->pos) * 8 - this->used)
+            throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+        uint64_t result = 0;
+        while(width != 0) {
+            unsigned room = 8 - this->used;
+            unsigned take = width < room ? width : room;
+            uint8_t chunk = uint8_t(uint8_t(this->buf[this->pos]) >> (room - take)) & uint8_t((1u << take) - 1);
+            result = (result << take) | chunk;
+            width -= take;
+            this->used += take;
+            if(this->used == 8) {
+                this->used = 0;
+                ++this->pos;
+            }
+        }
+        return result;
+    }
+private:
+    const std::string &buf;
+    size_t pos = 0;
+    unsigned used = 0;
+};
+
+void JKSNEncodeStats::clear() {
+    std::fill(std::begin(this->values), std::end(this->values), 0);
+    std::fill(std::begin(this->bytes), std::end(this->bytes), 0);
+    this->text_hits = this->text_misses = this->text_collisions = 0;
+    this->blob_hits = this->blob_misses = this->blob_collisions = 0;
+    this->swap_candidates = this->swaps = 0;
+    this->swap_bytes_saved = 0;
+    this->xor_candidates = this->xors = 0;
+    this->xor_bytes_saved = 0;
+    this->dumps = 0;
+    this->build_ns = this->optimize_ns = this->output_ns = 0;
+}
+
+const char *JKSNEncodeStats::familyName(Family family) {
+    static const char *const names[FAMILY_COUNT] = {
+        "constant", "int", "delta int", "float", "utf-16", "utf-8", "blob", "text hash",
+        "blob hash", "array", "swapped array", "xor array", "object", "other"
+    };
+    return unsigned(family) < FAMILY_COUNT ? names[family] : "unknown";
+}
+
+std::string JKSNEncodeStats::toString() const {
+    std::string result;
+    char line[128];
+    uint64_t total_values = 0;
+    uint64_t total_bytes = 0;
+    std::snprintf(line, sizeof line, "%llu dumps: build %.3f ms, optimize %.3f ms, output %.3f ms\n",
+                  (unsigned long long) this->dumps, this->build_ns/1e6, this->optimize_ns/1e6, this->output_ns/1e6);
+    result += line;
+    std::snprintf(line, sizeof line, "%-14s %12s %14s\n", "family", "values", "bytes");
+    result += line;
+    for(unsigned i = 0; i < FAMILY_COUNT; i++) {
+        total_values += this->values[i];
+        total_bytes += this->bytes[i];
+        if(this->values[i] == 0)
+            continue;
+        std::snprintf(line, sizeof line, "%-14s %12llu %14llu\n", familyName(Family(i)),
+                      (unsigned long long) this->values[i], (unsigned long long) this->bytes[i]);
+        result += line;
+    }
+    std::snprintf(line, sizeof line, "%-14s %12llu %14llu\n", "total", (unsigned long long) total_values, (unsigned long long) total_bytes);
+    result += line;
+    std::snprintf(line, sizeof line, "text hash: %llu hits, %llu misses, %llu collisions\n",
+                  (unsigned long long) this->text_hits, (unsigned long long) this->text_misses, (unsigned long long) this->text_collisions);
+    result += line;
+    std::snprintf(line, sizeof line, "blob hash: %llu hits, %llu misses, %llu collisions\n",
+                  (unsigned long long) this->blob_hits, (unsigned long long) this->blob_misses, (unsigned long long) this->blob_collisions);
+    result += line;
+    std::snprintf(line, sizeof line, "swapped arrays: %llu of %llu candidates, %lld bytes saved\n",
+                  (unsigned long long) this->swaps, (unsigned long long) this->swap_candidates, (long long) this->swap_bytes_saved);
+    result += line;
+    std::snprintf(line, sizeof line, "xor arrays: %llu of %llu candidates, %lld bytes saved\n",
+                  (unsigned long long) this->xors, (unsigned long long) this->xor_candidates, (long long) this->xor_bytes_saved);
+    result += line;
+    return result;
+}
+
+/* How JKSN_EFFORT_SMALLEST orders the members of objects with the same keys */
+struct JKSNMemberOrder {
+    const JKSNValue *previous = nullptr;
+    bool decided = false;
+    std::vector<size_t> order;
+};
+
+/* The dump in progress on this thread, for the static dump functions */
+struct JKSNDumpContext {
+    JKSNEncodeStats *stats = nullptr;
+    jksn_effort effort = JKSN_EFFORT_BALANCED;
+    /* Set for JKSN_EFFORT_FASTEST, or once the time budget is spent */
+    bool fast = false;
+    bool has_deadline = false;
+    bool narrowing = false;
+    bool tag_narrowed = false;
+    bool xor_arrays = false;
+    /* Strings and blobs from this size on are left in place, for dumpSegments, or 0 */
+    size_t segment_min = 0;
+    unsigned countdown = 0;
+    std::chrono::steady_clock::time_point deadline;
+    /* For JKSN_EFFORT_SMALLEST, by the keys of an object */
+    std::unordered_map<std::string, JKSNMemberOrder> member_orders;
+    /* Keys already encoded by dumpBatch, before optimize, or nullptr */
+    std::unordered_map<std::string, JKSNProxy> *keys = nullptr;
+};
+
+static thread_local JKSNDumpContext *dumpContext = nullptr;
+
+class JKSNDumpScope {
+public:
+    JKSNDumpScope(JKSNDumpContext *context) :
+        saved(dumpContext) {
+        dumpContext = context;
+    }
+    ~JKSNDumpScope() {
+        dumpContext = this->saved;
+    }
+private:
+    JKSNDumpContext *saved;
+};
+
+/* Called for every value, but only reads the clock every 64 values */
+static inline void checkTimeBudget(JKSNDumpContext *context) {
+    if(context && context->has_deadline && !context->fast && ++context->countdown % 64 == 0 &&
+       std::chrono::steady_clock::now() >= context->deadline)
+        context->fast = true;
+}
+
+/*
+  Both layouts of an array are built before one is chosen, and each may
+  contain arrays of its own. The decisions made inside the discarded one
+  are taken back, so that only those in the output are counted.
+*/
+class JKSNLayoutCounters {
+public:
+    JKSNLayoutCounters(const JKSNEncodeStats *stats) {
+        if(stats) {
+            this->swap_candidates = stats->swap_candidates;
+            this->swaps = stats->swaps;
+            this->swap_bytes_saved = stats->swap_bytes_saved;
+            this->xor_candidates = stats->xor_candidates;
+            this->xors = stats->xors;
+            this->xor_bytes_saved = stats->xor_bytes_saved;
+        }
+    }
+    /* Keeps what was counted after that, drops what was counted between this and that */
+    void discardUntil(const JKSNLayoutCounters &that, JKSNEncodeStats *stats) const {
+        stats->swap_candidates -= that.swap_candidates - this->swap_candidates;
+        stats->swaps -= that.swaps - this->swaps;
+        stats->swap_bytes_saved -= that.swap_bytes_saved - this->swap_bytes_saved;
+        stats->xor_candidates -= that.xor_candidates - this->xor_candidates;
+        stats->xors -= that.xors - this->xors;
+        stats->xor_bytes_saved -= that.xor_bytes_saved - this->xor_bytes_saved;
+    }
+    void restore(JKSNEncodeStats *stats) const {
+        stats->swap_candidates = this->swap_candidates;
+        stats->swaps = this->swaps;
+        stats->swap_bytes_saved = this->swap_bytes_saved;
+        stats->xor_candidates = this->xor_candidates;
+        stats->xors = this->xors;
+        stats->xor_bytes_saved = this->xor_bytes_saved;
+    }
+private:
+    uint64_t swap_candidates = 0;
+    uint64_t swaps = 0;
+    int64_t swap_bytes_saved = 0;
+    uint64_t xor_candidates = 0;
+    uint64_t xors = 0;
+    int64_t xor_bytes_saved = 0;
+};
+
+static JKSNEncodeStats::Family controlFamily(uint8_t control) {
+    switch(control & 0xf0) {
+    case 0x00:
+        return control <= 0x03 ? JKSNEncodeStats::CONSTANT : JKSNEncodeStats::OTHER;
+    case 0x10:
+        return JKSNEncodeStats::INT;
+    case 0x20:
+        return control >= 0x2b && control <= 0x2d ? JKSNEncodeStats::FLOAT : JKSNEncodeStats::CONSTANT;
+    case 0x30:
+        return control == 0x3c ? JKSNEncodeStats::TEXT_HASH : JKSNEncodeStats::UTF16;
+    case 0x40:
+        return JKSNEncodeStats::UTF8;
+    case 0x50:
+        return control == 0x5c ? JKSNEncodeStats::BLOB_HASH : JKSNEncodeStats::BLOB;
+    case 0x80:
+        return JKSNEncodeStats::ARRAY;
+    case 0x90:
+        return JKSNEncodeStats::OBJECT;
+    case 0xa0:
+        return control == 0xa0 ? JKSNEncodeStats::CONSTANT : JKSNEncodeStats::SWAPPED_ARRAY;
+    case 0xd0:
+        return JKSNEncodeStats::DELTA_INT;
+    case 0xe0:
+        if(control <= 0xe1)
+            return JKSNEncodeStats::XOR_ARRAY;
+        else if(control == 0xe2)
+            return JKSNEncodeStats::BLOB;
+        else if(control == 0xe3)
+            return JKSNEncodeStats::BLOB_HASH;
+        return JKSNEncodeStats::OTHER;
+    default:
+        return JKSNEncodeStats::OTHER;
+    }
+}
+
+static void countFamilies(JKSNEncodeStats &stats, const JKSNProxy &proxy) {
+    JKSNEncodeStats::Family family = controlFamily(proxy.control);
+    stats.values[family]++;
+    stats.bytes[family] += proxy.size(1);
+    for(const JKSNProxy &child : proxy.children)
+        countFamilies(stats, child);
+}
+
+static uint64_t elapsedNanoseconds(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
 
 JKSNEncoder::JKSNEncoder() :
     p(new JKSNEncoderPrivate) {
@@ -188,11 +837,24 @@ JKSNEncoder &JKSNEncoder::operator=(JKSNEncoder &&that) {
 JKSNEncoder::~JKSNEncoder() {
 }
 
+void JKSNEncoder::reset() {
+    this->p->reset();
+}
+
 std::ostream &JKSNEncoder::dump(const JKSNValue &obj, std::ostream &result, bool header) {
+    JKSN_CALL(encode);
     JKSNProxy proxy = this->p->dumpToProxy(obj);
+    JKSNEncodeStats *stats = this->p->stats;
+    std::chrono::steady_clock::time_point start;
+    if(stats) {
+        stats->dumps++;
+        start = std::chrono::steady_clock::now();
+    }
     if(header && !result.write("jk!", 3))
         return result;
     proxy.output(result);
+    if(stats)
+        stats->output_ns += elapsedNanoseconds(start, std::chrono::steady_clock::now());
     return result;
 }
 
@@ -203,13 +865,260 @@ std::string JKSNEncoder::dump(const JKSNValue &obj, bool header) {
     return result.str();
 }
 
-JKSNProxy JKSNEncoderPrivate::dumpToProxy(const JKSNValue &obj) {
+std::vector<size_t> JKSNEncoder::dumpBatch(const JKSNValue *values, size_t count, std::string &output, bool header, bool shared) {
+    JKSN_CALL(encode);
+    JKSNEncodeStats *stats = this->p->stats;
+    std::vector<size_t> offsets;
+    offsets.reserve(count + 1);
+    output.clear();
+    /* One pass of key interning for the whole batch, whether or not the hashtables are shared */
+    std::unordered_map<std::string, JKSNProxy> keys;
+    if(!shared && count != 0)
+        this->p->reset();
+    for(size_t i = 0; i < count; i++) {
+        offsets.push_back(output.size());
+        if(!shared && i != 0)
+            this->p->reset();
+        JKSNProxy proxy = this->p->dumpToProxy(values[i], 0, &keys);
+        std::chrono::steady_clock::time_point start;
+        if(stats) {
+            stats->dumps++;
+            start = std::chrono::steady_clock::now();
+        }
+        if(header)
+            output.append("jk!", 3);
+        proxy.appendTo(output);
+        if(stats)
+            stats->output_ns += elapsedNanoseconds(start, std::chrono::steady_clock::now());
+    }
+    offsets.push_back(output.size());
+    return offsets;
+}
+
+/*
+  Generated bytes are appended to storage, and only turned into pointers
+  once it has stopped growing.
+*/
+class JKSNSegmentWriter {
+public:
+    JKSNSegmentWriter(std::string &storage) :
+        storage(storage),
+        begin(storage.size()) {
+    }
+    void append(const JKSNProxy &proxy) {
+        this->storage += char(proxy.control);
+        this->storage += proxy.data;
+        if(proxy.external) {
+            this->cut();
+            this->pieces.push_back({proxy.external->data(), 0, proxy.external->size()});
+        } else
+            this->storage += proxy.buf;
+        for(const JKSNProxy &child : proxy.children)
+            this->append(child);
+    }
+    std::vector<JKSNSegment> finish() {
+        this->cut();
+        std::vector<JKSNSegment> result;
+        result.reserve(this->pieces.size());
+        for(const Piece &piece : this->pieces)
+            result.push_back({piece.external ? piece.external : this->storage.data() + piece.offset, piece.size});
+        return result;
+    }
+private:
+    void cut() {
+        if(this->storage.size() != this->begin) {
+            this->pieces.push_back({nullptr, this->begin, this->storage.size() - this->begin});
+            this->begin = this->storage.size();
+        }
+    }
+    struct Piece {
+        const char *external;
+        size_t offset;
+        size_t size;
+    };
+    std::string &storage;
+    size_t begin;
+    std::vector<Piece> pieces;
+};
+
+std::vector<JKSNSegment> JKSNEncoder::dumpSegments(const JKSNValue &obj, std::string &storage, bool header, size_t min_size) {
+    JKSN_CALL(encode);
+    JKSNProxy proxy = this->p->dumpToProxy(obj, min_size);
+    JKSNEncodeStats *stats = this->p->stats;
+    std::chrono::steady_clock::time_point start;
+    if(stats) {
+        stats->dumps++;
+        start = std::chrono::steady_clock::now();
+    }
+    storage.clear();
+    JKSNSegmentWriter writer(storage);
+    if(header)
+        storage.assign("jk!", 3);
+    writer.append(proxy);
+    std::vector<JKSNSegment> result = writer.finish();
+    if(stats)
+        stats->output_ns += elapsedNanoseconds(start, std::chrono::steady_clock::now());
+    return result;
+}
+
+std::string JKSNEncoder::dumpJSON(const std::string &json, bool header) {
+    JKSN_CALL(encode);
+    std::string result;
+    if(header)
+        result.assign("jk!", 3);
+    JKSNWriter writer(*this, result);
+    this->p->json.transcode(json, writer);
+    return result;
+}
+
+void JKSNEncoder::setStats(JKSNEncodeStats *stats) {
+    this->p->stats = stats;
+}
+
+JKSNEncodeStats *JKSNEncoder::getStats() const {
+    return this->p->stats;
+}
+
+void JKSNEncoder::setEffort(jksn_effort effort) {
+    this->p->effort = effort;
+}
+
+jksn_effort JKSNEncoder::getEffort() const {
+    return this->p->effort;
+}
+
+void JKSNEncoder::setTimeBudget(uint64_t microseconds) {
+    this->p->time_budget = microseconds;
+}
+
+uint64_t JKSNEncoder::getTimeBudget() const {
+    return this->p->time_budget;
+}
+
+void JKSNEncoder::setNarrowing(bool narrowing) {
+    this->p->narrowing = narrowing;
+}
+
+bool JKSNEncoder::getNarrowing() const {
+    return this->p->narrowing;
+}
+
+void JKSNEncoder::setTagNarrowed(bool tag_narrowed) {
+    this->p->tag_narrowed = tag_narrowed;
+}
+
+bool JKSNEncoder::getTagNarrowed() const {
+    return this->p->tag_narrowed;
+}
+
+void JKSNEncoder::setXorArrays(bool xor_arrays) {
+    this->p->xor_arrays = xor_arrays;
+}
+
+bool JKSNEncoder::getXorArrays() const {
+    return this->p->xor_arrays;
+}
+
+void JKSNEncoder::setDedupBlobs(size_t min_size) {
+    this->p->dedup_blobs = min_size;
+}
+
+size_t JKSNEncoder::getDedupBlobs() const {
+    return this->p->dedup_blobs;
+}
+
+void JKSNEncoder::setDedupChunks(size_t min_size) {
+    this->p->dedup_chunks = min_size;
+}
+
+size_t JKSNEncoder::getDedupChunks() const {
+    return this->p->dedup_chunks;
+}
+
+void JKSNEncoder::setDedupCapacity(size_t capacity) {
+    this->p->dedup_capacity = capacity;
+}
+
+size_t JKSNEncoder::getDedupCapacity() const {
+    return this->p->dedup_capacity;
+}
+
+void JKSNEncoder::setStreamedBlobs(size_t min_size) {
+    this->p->streamed_blobs = min_size;
+}
+
+size_t JKSNEncoder::getStreamedBlobs() const {
+    return this->p->streamed_blobs;
+}
+
+JKSNProxy JKSNEncoderPrivate::dumpToProxy(const JKSNValue &obj, size_t segment_min, std::unordered_map<std::string, JKSNProxy> *keys) {
+    JKSNDumpContext context;
+    context.segment_min = segment_min;
+    context.keys = keys;
+    context.stats = this->stats;
+    context.effort = this->effort;
+    context.fast = this->effort == JKSN_EFFORT_FASTEST;
+    context.narrowing = this->narrowing;
+    context.tag_narrowed = this->tag_narrowed;
+    context.xor_arrays = this->xor_arrays;
+    if(this->time_budget != 0) {
+        context.has_deadline = true;
+        context.deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(this->time_budget);
+    }
+    JKSNDumpScope scope(&context);
+    if(!this->stats) {
+        JKSNProxy proxy = this->dumpValue(obj);
+        this->finish(proxy, context.fast);
+        return proxy;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
     JKSNProxy proxy = this->dumpValue(obj);
-    this->optimize(proxy);
+    std::chrono::steady_clock::time_point built = std::chrono::steady_clock::now();
+    this->finish(proxy, context.fast);
+    std::chrono::steady_clock::time_point optimized = std::chrono::steady_clock::now();
+    this->stats->build_ns += elapsedNanoseconds(start, built);
+    this->stats->optimize_ns += elapsedNanoseconds(built, optimized);
+    countFamilies(*this->stats, proxy);
     return proxy;
 }
 
+void JKSNEncoderPrivate::reset() {
+    this->cache.haslastint = false;
+    this->cache.clear();
+    this->dedup_entries.clear();
+    this->dedup_index.clear();
+    this->dedup_size = 0;
+}
+
+void JKSNEncoderPrivate::resetSettings() {
+    this->stats = nullptr;
+    this->effort = JKSN_EFFORT_BALANCED;
+    this->time_budget = 0;
+    this->narrowing = false;
+    this->tag_narrowed = false;
+    this->xor_arrays = false;
+    this->dedup_blobs = 0;
+    this->dedup_chunks = 0;
+    this->dedup_capacity = size_t(64) << 20;
+    this->streamed_blobs = 65536;
+}
+
+/*
+  Values built on the fast path carry no hash, so a tree with any of them
+  is not optimized. The decoder still remembers its strings and integers,
+  so the encoder forgets its own to avoid referring to stale ones later.
+*/
+void JKSNEncoderPrivate::finish(JKSNProxy &proxy, bool fast) {
+    if(!fast) {
+        this->optimize(proxy);
+        return;
+    }
+    this->cache.haslastint = false;
+    this->cache.clear();
+}
+
 JKSNProxy JKSNEncoderPrivate::dumpValue(const JKSNValue &obj) {
+    checkTimeBudget(dumpContext);
     switch(obj.getType()) {
     case JKSN_UNDEFINED:
         return dumpUndefined(obj);
@@ -220,11 +1129,19 @@ JKSNProxy JKSNEncoderPrivate::dumpValue(const JKSNValue &obj) {
     case JKSN_INT:
         return dumpInt(obj);
     case JKSN_FLOAT:
-        return dumpFloat(obj);
     case JKSN_DOUBLE:
-        return dumpDouble(obj);
     case JKSN_LONG_DOUBLE:
-        return dumpLongDouble(obj);
+        if(dumpContext && dumpContext->narrowing) {
+            JKSNProxy result(&obj, 0x00);
+            if(dumpNarrowed(obj, result))
+                return result;
+        }
+        if(obj.isFloat())
+            return dumpFloat(obj);
+        else if(obj.isDouble())
+            return dumpDouble(obj);
+        else
+            return dumpLongDouble(obj);
     case JKSN_STRING:
         return dumpString(obj);
     case JKSN_BLOB:
@@ -269,11 +1186,44 @@ JKSNProxy JKSNEncoderPrivate::dumpInt(const JKSNValue &obj) {
         return JKSNProxy(&obj, 0x1e, encodeInt(uintmax_t(-number), 0));
 }
 
+/* The pragmas naming the original type of a narrowed number */
+static const JKSNValue &narrowedTag(jksn_data_type type) {
+    static const JKSNValue float_tag("float");
+    static const JKSNValue double_tag("double");
+    static const JKSNValue long_double_tag("long double");
+    return type == JKSN_FLOAT ? float_tag : type == JKSN_DOUBLE ? double_tag : long_double_tag;
+}
+
+/* The same number as an integer or a narrower float, if there is one */
+bool JKSNEncoderPrivate::dumpNarrowed(const JKSNValue &obj, JKSNProxy &result) {
+    const jksn_data_type type = obj.getType();
+    const long double number = obj.toLongDouble();
+    /* The decoder reads back neither -0 as an integer nor the lowest integer */
+    const long double limit = std::ldexp(1.0L, std::numeric_limits<intmax_t>::digits);
+    if(!std::isfinite(number))
+        return false;
+    else if(number > -limit && number < limit && number == std::floor(number) && !(number == 0 && std::signbit(number)))
+        result = dumpInt(obj);
+    else if(type != JKSN_FLOAT && static_cast<long double>(obj.toFloat()) == number)
+        result = dumpFloat(obj);
+    else if(type == JKSN_LONG_DOUBLE && static_cast<long double>(obj.toDouble()) == number)
+        result = dumpDouble(obj);
+    else
+        return false;
+    if(dumpContext->tag_narrowed) {
+        JKSNProxy pragma(&obj, 0xff);
+        pragma.children.push_back(dumpString(narrowedTag(type)));
+        pragma.children.push_back(std::move(result));
+        result = std::move(pragma);
+    }
+    return true;
+}
+
 JKSNProxy JKSNEncoderPrivate::dumpFloat(const JKSNValue &obj) {
     const float number = obj.toFloat();
-    if(isnan(number))
+    if(std::isnan(number))
         return JKSNProxy(&obj, 0x20);
-    else if(isinf(number))
+    else if(std::isinf(number))
         return JKSNProxy(&obj, number >= 0 ? 0x2f : 0x2e);
     else {
         static_assert(sizeof (float) == 4, "sizeof (float) should be 4");
@@ -294,9 +1244,9 @@ JKSNProxy JKSNEncoderPrivate::dumpFloat(const JKSNValue &obj) {
 
 JKSNProxy JKSNEncoderPrivate::dumpDouble(const JKSNValue &obj) {
     const double number = obj.toDouble();
-    if(isnan(number))
+    if(std::isnan(number))
         return JKSNProxy(&obj, 0x20);
-    else if(isinf(number))
+    else if(std::isinf(number))
         return JKSNProxy(&obj, number >= 0 ? 0x2f : 0x2e);
     else {
         static_assert(sizeof (double) == 8, "sizeof (double) should be 8");
@@ -319,9 +1269,9 @@ JKSNProxy JKSNEncoderPrivate::dumpDouble(const JKSNValue &obj) {
 
 JKSNProxy JKSNEncoderPrivate::dumpLongDouble(const JKSNValue &obj) {
     const long double number = obj.toLongDouble();
-    if(isnan(number))
+    if(std::isnan(number))
         return JKSNProxy(&obj, 0x20);
-    else if(isinf(number))
+    else if(std::isinf(number))
         return JKSNProxy(&obj, number >= 0 ? 0x2f : 0x2e);
     else if(sizeof (long double) == 12) {
         const union {
@@ -362,16 +1312,21 @@ JKSNProxy JKSNEncoderPrivate::dumpLongDouble(const JKSNValue &obj) {
 }
 
 JKSNProxy JKSNEncoderPrivate::dumpString(const JKSNValue &obj) {
+    /* Long strings are left in place for dumpSegments, as UTF-8 */
+    if(dumpContext && dumpContext->segment_min != 0 && obj.toStringRef().size() >= dumpContext->segment_min)
+        return dumpExternal(obj, 0x40);
     std::string obj_short = obj.toString();
     bool is_utf16 = false;
-    try {
-        std::string obj_utf16 = UTF8ToUTF16LE(obj_short, true);
-        if(obj_utf16.size() < obj_short.size()) {
-            obj_short = std::move(obj_utf16);
-            is_utf16 = true;
+    bool fast = dumpContext && dumpContext->fast;
+    if(!fast)
+        try {
+            std::string obj_utf16 = UTF8ToUTF16LE(obj_short, true);
+            if(obj_utf16.size() < obj_short.size()) {
+                obj_short = std::move(obj_utf16);
+                is_utf16 = true;
+            }
+        } catch(JKSNTypeError) {
         }
-    } catch(JKSNTypeError) {
-    }
     uint8_t control = is_utf16 ? 0x30 : 0x40;
     uintmax_t length = is_utf16 ? obj_short.size()/2 : obj_short.size();
     std::unique_ptr<JKSNProxy> result;
@@ -383,11 +1338,27 @@ JKSNProxy JKSNEncoderPrivate::dumpString(const JKSNValue &obj) {
         result.reset(new JKSNProxy(&obj, control | 0xd, encodeInt(length, 2), std::move(obj_short)));
     else
         result.reset(new JKSNProxy(&obj, control | 0xf, encodeInt(length, 0), std::move(obj_short)));
-    result->hash = DJBHash(result->buf);
+    if(!fast)
+        result->hash = DJBHash(result->buf);
     return std::move(*result);
 }
 
+/* Within a batch, a key is only converted and hashed the first time it is seen */
+JKSNProxy JKSNEncoderPrivate::dumpKey(const JKSNValue &obj) {
+    if(!dumpContext || !dumpContext->keys || dumpContext->fast || !obj.isString())
+        return dumpValue(obj);
+    checkTimeBudget(dumpContext);
+    std::unordered_map<std::string, JKSNProxy>::iterator it = dumpContext->keys->find(obj.toStringRef());
+    if(it == dumpContext->keys->end())
+        it = dumpContext->keys->emplace(obj.toStringRef(), dumpString(obj)).first;
+    JKSNProxy result = it->second;
+    result.origin = &obj;
+    return result;
+}
+
 JKSNProxy JKSNEncoderPrivate::dumpBlob(const JKSNValue &obj) {
+    if(dumpContext && dumpContext->segment_min != 0 && obj.toStringRef().size() >= dumpContext->segment_min)
+        return dumpExternal(obj, 0x50);
     std::string blob = obj.toBlob();
     size_t length = blob.size();
     std::unique_ptr<JKSNProxy> result;
@@ -399,7 +1370,27 @@ JKSNProxy JKSNEncoderPrivate::dumpBlob(const JKSNValue &obj) {
         result.reset(new JKSNProxy(&obj, 0x5d, encodeInt(length, 2), std::move(blob)));
     else
         result.reset(new JKSNProxy(&obj, 0x5f, encodeInt(length, 0), std::move(blob)));
-    result->hash = DJBHash(result->buf);
+    if(!(dumpContext && dumpContext->fast))
+        result->hash = DJBHash(result->buf);
+    return std::move(*result);
+}
+
+/* A UTF-8 string or a blob whose bytes are not copied, but written from where obj keeps them */
+JKSNProxy JKSNEncoderPrivate::dumpExternal(const JKSNValue &obj, uint8_t control) {
+    const std::string &bytes = obj.toStringRef();
+    size_t length = bytes.size();
+    std::unique_ptr<JKSNProxy> result;
+    if(length <= (control == 0x40 ? 0xc : 0xb))
+        result.reset(new JKSNProxy(&obj, control | uint8_t(length)));
+    else if(length <= 0xff)
+        result.reset(new JKSNProxy(&obj, control | 0xe, encodeInt(length, 1)));
+    else if(length <= 0xffff)
+        result.reset(new JKSNProxy(&obj, control | 0xd, encodeInt(length, 2)));
+    else
+        result.reset(new JKSNProxy(&obj, control | 0xf, encodeInt(length, 0)));
+    result->external = &bytes;
+    if(!(dumpContext && dumpContext->fast))
+        result->hash = DJBHash(bytes);
     return std::move(*result);
 }
 
@@ -413,6 +1404,86 @@ bool JKSNEncoderPrivate::testSwapAvailability(const std::vector<const JKSNValue
     return columns;
 }
 
+/*
+  JKSN_EFFORT_SMALLEST reorders the members of objects with string keys,
+  which the decoder puts back into maps anyway. Integers are sorted when
+  that turns more of them into small deltas from the one before. Objects
+  with the same keys share one order, since reordering each on its own
+  made them less alike and deflated output larger. Columns of swapped
+  arrays keep their order: chaining similar string columns did not change
+  the deflated size of any corpus in tests/bench_reorder.
+*/
+static size_t reorderIntCost(intmax_t number, bool delta) {
+    if(delta ? number >= -0x5 && number <= 0x5 : number >= 0 && number <= 0xa)
+        return 1;
+    else if(number >= -0x80 && number <= 0x7f)
+        return 2;
+    else if(number >= -0x8000 && number <= 0x7fff)
+        return 3;
+    else if((number >= -0x80000000LL && number <= -0x200000) ||
+            (number >= 0x200000 && number <= 0x7fffffff))
+        return 5;
+    uintmax_t magnitude = number >= 0 ? uintmax_t(number) : -uintmax_t(number);
+    size_t result = 2;
+    while(magnitude >>= 7)
+        result++;
+    return result;
+}
+
+/* What the optimizer makes of integers written one after another, leaving out the first few */
+static size_t reorderChainCost(const std::vector<intmax_t> &numbers, size_t skip) {
+    size_t result = 0;
+    for(size_t i = skip; i < numbers.size(); i++) {
+        size_t cost = reorderIntCost(numbers[i], false);
+        if(i != 0) {
+            intmax_t delta = numbers[i] - numbers[i-1];
+            if(std::abs(delta) < std::abs(numbers[i]))
+                cost = std::min(cost, reorderIntCost(delta, true));
+        }
+        result += cost;
+    }
+    return result;
+}
+
+/*
+  The order of members, as indices in map order, for objects with the keys
+  of obj. previous is the object before it with the same keys, so that the
+  chain from one object to the next is counted as well.
+*/
+static std::vector<size_t> reorderMembers(const JKSNValue &previous, const JKSNValue &obj) {
+    std::vector<const JKSNValue *> values[2];
+    for(const std::pair<const JKSNValue, JKSNValue> &item : previous.toMap())
+        values[0].push_back(&item.second);
+    for(const std::pair<const JKSNValue, JKSNValue> &item : obj.toMap())
+        values[1].push_back(&item.second);
+    std::vector<size_t> original(values[1].size());
+    std::vector<size_t> slots;
+    for(size_t i = 0; i < original.size(); i++) {
+        original[i] = i;
+        if(values[0][i]->isInt() && values[1][i]->isInt())
+            slots.push_back(i);
+    }
+    if(slots.size() < 2)
+        return original;
+    std::vector<size_t> sorted_slots(slots);
+    std::stable_sort(sorted_slots.begin(), sorted_slots.end(), [&values](size_t a, size_t b) {
+        return values[1][a]->toInt() < values[1][b]->toInt();
+    });
+    std::vector<size_t> sorted(original);
+    for(size_t i = 0; i < slots.size(); i++)
+        sorted[slots[i]] = sorted_slots[i];
+    /* Only obj is counted, the previous object just leads into it */
+    auto cost = [&](const std::vector<size_t> &order) {
+        std::vector<intmax_t> numbers;
+        for(size_t round = 0; round < 2; round++)
+            for(size_t i : order)
+                if(std::binary_search(slots.begin(), slots.end(), i))
+                    numbers.push_back(values[round][i]->toInt());
+        return reorderChainCost(numbers, slots.size());
+    };
+    return cost(sorted) < cost(original) ? sorted : original;
+}
+
 JKSNProxy JKSNEncoderPrivate::encodeStraightArray(const std::vector<const JKSNValue *> &obj, const JKSNValue *origin) {
     size_t length = obj.size();
     std::unique_ptr<JKSNProxy> result;
@@ -431,10 +1502,10 @@ JKSNProxy JKSNEncoderPrivate::encodeStraightArray(const std::vector<const JKSNVa
 }
 
 JKSNProxy JKSNEncoderPrivate::encodeSwappedArray(const std::vector<const JKSNValue *> &obj, const JKSNValue *origin) {
-    std::list<JKSNValue> columns;
+    std::vector<JKSNValue> columns;
     std::unordered_set<JKSNValue> columns_set;
     for(const JKSNValue *const row : obj)
-        for(const std::pair<JKSNValue, JKSNValue> &column : row->toMap())
+        for(const std::pair<const JKSNValue, JKSNValue> &column : row->toMap())
             if(columns_set.find(column.first) == columns_set.end()) {
                 columns.push_back(column.first);
                 columns_set.insert(column.first);
@@ -450,7 +1521,7 @@ JKSNProxy JKSNEncoderPrivate::encodeSwappedArray(const std::vector<const JKSNVal
     else
         result.reset(new JKSNProxy(origin, 0xaf, encodeInt(collen, 0)));
     for(const JKSNValue &column : columns) {
-        result->children.push_back(dumpValue(column));
+        result->children.push_back(dumpKey(column));
         std::vector<const JKSNValue *> columns_value;
         columns_value.reserve(obj.size());
         for(const JKSNValue *const row : obj) {
@@ -464,6 +1535,81 @@ JKSNProxy JKSNEncoderPrivate::encodeSwappedArray(const std::vector<const JKSNVal
     return std::move(*result);
 }
 
+jksn_data_type JKSNEncoderPrivate::testXorAvailability(const std::vector<const JKSNValue *> &obj) {
+    if(obj.size() < 2)
+        return JKSN_UNDEFINED;
+    jksn_data_type type = obj[0]->getType();
+    if(type != JKSN_DOUBLE && type != JKSN_FLOAT)
+        return JKSN_UNDEFINED;
+    for(const JKSNValue *const i : obj)
+        if(i->getType() != type)
+            return JKSN_UNDEFINED;
+    return type;
+}
+
+JKSNProxy JKSNEncoderPrivate::encodeXorArray(const std::vector<const JKSNValue *> &obj, jksn_data_type type, const JKSNValue *origin) {
+    /*
+      Gorilla-style XOR compression:
+        The first value is stored verbatim. For each following value, the XOR
+        against its predecessor is stored as a single 0 bit when it is zero,
+        as 10 followed by the meaningful bits when they fit inside the previous
+        window, or as 11 followed by the leading zero count, the meaningful bit
+        count minus one, and the meaningful bits.
+    */
+    const bool is_float = type == JKSN_FLOAT;
+    const unsigned width = is_float ? 32 : 64;
+    const unsigned field_width = is_float ? 5 : 6;
+    static_assert(sizeof (float) == 4, "sizeof (float) should be 4");
+    static_assert(sizeof (double) == 8, "sizeof (double) should be 8");
+    JKSNBitWriter writer;
+    uint64_t prev = 0;
+    unsigned prev_leading = width + 1;
+    unsigned prev_trailing = 0;
+    for(size_t i = 0; i < obj.size(); ++i) {
+        uint64_t bits;
+        if(is_float) {
+            const union {
+                float data_float;
+                uint32_t data_int;
+            } conv = {obj[i]->toFloat()};
+            bits = conv.data_int;
+        } else {
+            const union {
+                double data_double;
+                uint64_t data_int;
+            } conv = {obj[i]->toDouble()};
+            bits = conv.data_int;
+        }
+        if(i == 0)
+            writer.put(bits, width);
+        else {
+            uint64_t delta = bits ^ prev;
+            if(delta == 0)
+                writer.put(0, 1);
+            else {
+                unsigned leading = countLeadingZeros(delta) - (64 - width);
+                unsigned trailing = countTrailingZeros(delta);
+                if(leading >= prev_leading && trailing >= prev_trailing) {
+                    writer.put(0x2, 2);
+                    writer.put(delta >> prev_trailing, width - prev_leading - prev_trailing);
+                } else {
+                    unsigned meaningful = width - leading - trailing;
+                    writer.put(0x3, 2);
+                    writer.put(leading, field_width);
+                    writer.put(meaningful - 1, field_width);
+                    writer.put(delta >> trailing, meaningful);
+                    prev_leading = leading;
+                    prev_trailing = trailing;
+                }
+            }
+        }
+        prev = bits;
+    }
+    std::string data = encodeInt(obj.size(), 0);
+    data += encodeInt(writer.buf.size(), 0);
+    return JKSNProxy(origin, is_float ? 0xe1 : 0xe0, std::move(data), std::move(writer.buf));
+}
+
 JKSNProxy JKSNEncoderPrivate::dumpArray(const JKSNValue &obj) {
     std::vector<const JKSNValue *> obj_vector;
     obj_vector.reserve(obj.toVector().size());
@@ -473,11 +1619,46 @@ JKSNProxy JKSNEncoderPrivate::dumpArray(const JKSNValue &obj) {
 }
 
 JKSNProxy JKSNEncoderPrivate::dumpArray(const std::vector<const JKSNValue *> &obj, const JKSNValue *origin) {
+    JKSNDumpContext *context = dumpContext;
+    JKSNEncodeStats *stats = context ? context->stats : nullptr;
+    JKSNLayoutCounters before_straight(stats);
     JKSNProxy result = encodeStraightArray(obj, origin);
+    if(context && context->fast)
+        return result;
     if(testSwapAvailability(obj)) {
+        JKSNLayoutCounters before_swapped(stats);
         JKSNProxy result_swapped = encodeSwappedArray(obj);
-        if(result_swapped.size(3) < result.size(3))
+        bool swapped = context && context->effort == JKSN_EFFORT_SMALLEST ?
+            result_swapped.size() < result.size() :
+            result_swapped.size(3) < result.size(3);
+        if(stats) {
+            if(swapped)
+                before_straight.discardUntil(before_swapped, stats);
+            else
+                before_swapped.restore(stats);
+            stats->swap_candidates++;
+            if(swapped) {
+                stats->swaps++;
+                stats->swap_bytes_saved += int64_t(result.size()) - int64_t(result_swapped.size());
+            }
+        }
+        if(swapped)
             result = std::move(result_swapped);
+    } else if(context && context->xor_arrays) {
+        jksn_data_type xor_type = testXorAvailability(obj);
+        if(xor_type != JKSN_UNDEFINED) {
+            JKSNProxy result_xor = encodeXorArray(obj, xor_type, origin);
+            bool xored = result_xor.size() < result.size();
+            if(stats) {
+                stats->xor_candidates++;
+                if(xored) {
+                    stats->xors++;
+                    stats->xor_bytes_saved += int64_t(result.size()) - int64_t(result_xor.size());
+                }
+            }
+            if(xored)
+                result = std::move(result_xor);
+        }
     }
     return result;
 }
@@ -493,10 +1674,46 @@ JKSNProxy JKSNEncoderPrivate::dumpObject(const JKSNValue &obj) {
         result.reset(new JKSNProxy(&obj, 0x9d, encodeInt(length, 2)));
     else
         result.reset(new JKSNProxy(&obj, 0x9f, encodeInt(length, 0)));
-    for(const std::pair<JKSNValue, JKSNValue> &item : obj.toMap()) {
-        result->children.push_back(dumpValue(item.first));
-        result->children.push_back(dumpValue(item.second));
-    }
+    JKSNMemberOrder *known = nullptr;
+    if(dumpContext && dumpContext->effort == JKSN_EFFORT_SMALLEST && !dumpContext->fast) {
+        std::string signature;
+        for(const std::pair<const JKSNValue, JKSNValue> &item : obj.toMap())
+            if(!item.first.isString()) {
+                signature.clear();
+                break;
+            } else {
+                signature += std::to_string(item.first.toStringRef().size());
+                signature += ':';
+                signature += item.first.toStringRef();
+            }
+        if(!signature.empty()) {
+            /*
+              Decided on the second one, when the step from one object to the
+              next can be seen. The first keeps map order.
+            */
+            known = &dumpContext->member_orders[signature];
+            if(!known->previous)
+                known->previous = &obj;
+            else if(!known->decided) {
+                known->order = reorderMembers(*known->previous, obj);
+                known->decided = true;
+            }
+        }
+    }
+    if(known && known->decided) {
+        std::vector<const std::pair<const JKSNValue, JKSNValue> *> items;
+        items.reserve(length);
+        for(const std::pair<const JKSNValue, JKSNValue> &item : obj.toMap())
+            items.push_back(&item);
+        for(size_t i : known->order) {
+            result->children.push_back(dumpKey(items[i]->first));
+            result->children.push_back(dumpValue(items[i]->second));
+        }
+    } else
+        for(const std::pair<const JKSNValue, JKSNValue> &item : obj.toMap()) {
+            result->children.push_back(dumpKey(item.first));
+            result->children.push_back(dumpValue(item.second));
+        }
     assert(result->children.size() == length*2);
     return std::move(*result);
 }
@@ -546,23 +1763,52 @@ JKSNProxy &JKSNEncoderPrivate::optimize(JKSNProxy &obj) {
             break;
         case 0x30:
         case 0x40:
-            if(obj.buf.size() > 1) {
-                if(this->cache.texthash[obj.hash] && *this->cache.texthash[obj.hash] == obj.buf) {
-                    obj.control = 0x3c;
-                    obj.data = encodeInt(obj.hash, 1);
-                    obj.buf.clear();
-                } else
-                    this->cache.texthash[obj.hash] = std::make_shared<std::string>(obj.buf);
+            /* The decoder remembers strings and blobs of any length, so do the same */
+            if(obj.bytes().size() > 1 && this->cache.text(obj.hash) && *this->cache.text(obj.hash) == obj.bytes()) {
+                obj.control = 0x3c;
+                obj.data = encodeInt(obj.hash, 1);
+                obj.buf.clear();
+                obj.external = nullptr;
+                if(this->stats)
+                    this->stats->text_hits++;
+            } else {
+                if(this->stats && obj.bytes().size() > 1) {
+                    this->stats->text_misses++;
+                    if(this->cache.text(obj.hash))
+                        this->stats->text_collisions++;
+                }
+                /* Not copied either: the slot is only never referred to */
+                if(obj.external)
+                    this->cache.text(obj.hash).reset();
+                else
+                    this->cache.text(obj.hash) = std::make_shared<std::string>(obj.buf);
             }
             break;
         case 0x50:
-            if(obj.buf.size() > 1) {
-                if(this->cache.blobhash[obj.hash] && *this->cache.blobhash[obj.hash] == obj.buf) {
-                    obj.control = 0x3c;
-                    obj.data = encodeInt(obj.hash, 1);
-                    obj.buf.clear();
-                } else
-                    this->cache.blobhash[obj.hash] = std::make_shared<std::string>(obj.buf);
+            if(this->dedupBlob(obj))
+                break;
+            /* A decoder may have streamed it to a sink instead of remembering it */
+            if(this->streamed_blobs != 0 && obj.bytes().size() >= this->streamed_blobs) {
+                this->cache.blob(obj.hash).reset();
+                break;
+            }
+            if(obj.bytes().size() > 1 && this->cache.blob(obj.hash) && *this->cache.blob(obj.hash) == obj.bytes()) {
+                obj.control = 0x5c;
+                obj.data = encodeInt(obj.hash, 1);
+                obj.buf.clear();
+                obj.external = nullptr;
+                if(this->stats)
+                    this->stats->blob_hits++;
+            } else {
+                if(this->stats && obj.bytes().size() > 1) {
+                    this->stats->blob_misses++;
+                    if(this->cache.blob(obj.hash))
+                        this->stats->blob_collisions++;
+                }
+                if(obj.external)
+                    this->cache.blob(obj.hash).reset();
+                else
+                    this->cache.blob(obj.hash) = std::make_shared<std::string>(obj.buf);
             }
             break;
         default:
@@ -572,6 +1818,121 @@ JKSNProxy &JKSNEncoderPrivate::optimize(JKSNProxy &obj) {
     return obj;
 }
 
+/*
+  Where the next content defined chunk of a blob ends: a gear hash rolls
+  over its bytes, and the chunk is cut where the top bits of the hash are
+  all zero, so that an insertion only moves the cuts next to it. Chunks
+  are 2 KiB to 64 KiB long, and about 10 KiB on average.
+*/
+static size_t contentChunkSize(const char *buf, size_t size) {
+    static const std::array<uint64_t, 256> gear = [] {
+        std::array<uint64_t, 256> table;
+        uint64_t state = 0;
+        for(uint64_t &i : table) {
+            /* splitmix64 */
+            uint64_t z = (state += 0x9e3779b97f4a7c15);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            i = z ^ (z >> 31);
+        }
+        return table;
+    }();
+    const size_t min_size = 2048;
+    const size_t max_size = 65536;
+    const uint64_t mask = uint64_t(0x1fff) << 51;
+    if(size <= min_size)
+        return size;
+    size_t limit = std::min(size, max_size);
+    uint64_t hash = 0;
+    for(size_t i = min_size; i < limit; i++) {
+        hash = (hash << 1) + gear[uint8_t(buf[i])];
+        if((hash & mask) == 0)
+            return i + 1;
+    }
+    return limit;
+}
+
+/*
+  Blobs long enough are looked up by content among all those sent with
+  0xe2 in the session, whole or cut into content defined chunks. Returns
+  false to leave the blob to the hashtable, when it is too short or the
+  encoder has remembered as many bytes as it may.
+*/
+bool JKSNEncoderPrivate::dedupBlob(JKSNProxy &obj) {
+    const std::string &blob = obj.bytes();
+    if(this->dedup_chunks != 0 && blob.size() >= this->dedup_chunks) {
+        struct Chunk {
+            size_t offset;
+            size_t size;
+            uint64_t hash;
+        };
+        std::vector<Chunk> chunks;
+        size_t added = 0;
+        for(size_t offset = 0; offset < blob.size(); ) {
+            size_t size = contentChunkSize(blob.data()+offset, blob.size()-offset);
+            uint64_t hash = hashBytes(blob.data()+offset, size, 0);
+            size_t index;
+            if(!this->findDedup(blob.data()+offset, size, hash, index))
+                added += size;
+            chunks.push_back({offset, size, hash});
+            offset += size;
+        }
+        if(this->dedup_size + added > this->dedup_capacity)
+            return false;
+        std::list<JKSNProxy> pieces;
+        for(const Chunk &chunk : chunks)
+            pieces.push_back(this->dedupPiece(blob.data()+chunk.offset, chunk.size, chunk.hash));
+        obj.control = 0xe4;
+        obj.data = encodeInt(chunks.size(), 0);
+        obj.buf.clear();
+        obj.external = nullptr;
+        obj.children = std::move(pieces);
+        return true;
+    }
+    if(this->dedup_blobs != 0 && blob.size() >= this->dedup_blobs) {
+        uint64_t hash = hashBytes(blob.data(), blob.size(), 0);
+        size_t index;
+        if(!this->findDedup(blob.data(), blob.size(), hash, index) && this->dedup_size + blob.size() > this->dedup_capacity)
+            return false;
+        JKSNProxy piece = this->dedupPiece(blob.data(), blob.size(), hash);
+        obj.control = piece.control;
+        obj.data = std::move(piece.data);
+        obj.buf = std::move(piece.buf);
+        obj.external = nullptr;
+        return true;
+    }
+    return false;
+}
+
+/* The hash only finds candidates, the bytes are compared to be sure */
+bool JKSNEncoderPrivate::findDedup(const char *buf, size_t size, uint64_t hash, size_t &index) const {
+    auto range = this->dedup_index.equal_range(hash);
+    for(auto i = range.first; i != range.second; ++i) {
+        const std::string &entry = this->dedup_entries[i->second];
+        if(entry.size() == size && std::memcmp(entry.data(), buf, size) == 0) {
+            index = i->second;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* A reference to a blob already sent, or the blob itself, remembered from now on */
+JKSNProxy JKSNEncoderPrivate::dedupPiece(const char *buf, size_t size, uint64_t hash) {
+    size_t index;
+    if(this->findDedup(buf, size, hash, index)) {
+        if(this->stats)
+            this->stats->blob_hits++;
+        return JKSNProxy(nullptr, 0xe3, encodeInt(index, 0));
+    }
+    if(this->stats)
+        this->stats->blob_misses++;
+    this->dedup_index.emplace(hash, this->dedup_entries.size());
+    this->dedup_entries.emplace_back(buf, size);
+    this->dedup_size += size;
+    return JKSNProxy(nullptr, 0xe2, encodeInt(size, 0), std::string(buf, size));
+}
+
 std::string JKSNEncoderPrivate::encodeInt(uintmax_t number, size_t size) {
     switch(size) {
     case 1:
@@ -633,12 +1994,35 @@ JKSNDecoder &JKSNDecoder::operator=(JKSNDecoder &&that) {
 JKSNDecoder::~JKSNDecoder() {
 }
 
+void JKSNDecoder::reset() {
+    this->p->reset();
+}
+
+void JKSNDecoder::setInternKeys(bool intern_keys) {
+    this->p->intern_keys = intern_keys;
+}
+
+bool JKSNDecoder::getInternKeys() const {
+    return this->p->intern_keys;
+}
+
+void JKSNDecoder::setRestoreNarrowed(bool restore_narrowed) {
+    this->p->restore_narrowed = restore_narrowed;
+}
+
+bool JKSNDecoder::getRestoreNarrowed() const {
+    return this->p->restore_narrowed;
+}
+
+void JKSNDecoder::setBlobSink(size_t min_size, std::function<void(const char *data, size_t size, size_t offset, size_t total)> sink) {
+    this->p->blob_sink_min = sink ? min_size : 0;
+    this->p->blob_sink = std::move(sink);
+}
+
 JKSNValue JKSNDecoder::parse(std::istream &fp, bool header) {
-    if(header) {
-        char header_buf[3];
-        if(!fp.read(header_buf, 3) || fp.gcount() != 3 || std::memcmp(header_buf, "jk!", 3))
-            fp.seekg(-fp.gcount(), fp.cur);
-    }
+    JKSN_CALL(decode);
+    if(header)
+        skipHeader(fp);
     return this->p->parseValue(fp);
 }
 
@@ -647,404 +2031,418 @@ JKSNValue JKSNDecoder::parse(const std::string &str, bool header) {
     return this->parse(stream, header);
 }
 
+/* Objects given back to a pool, taken and returned by swapping pointers */
+template<typename T>
+struct JKSNPoolSlots {
+    std::array<std::atomic<T *>, 64> items;
+    JKSNPoolSlots() {
+        for(std::atomic<T *> &item : this->items)
+            item.store(nullptr);
+    }
+    ~JKSNPoolSlots() {
+        for(std::atomic<T *> &item : this->items)
+            delete item.exchange(nullptr);
+    }
+};
+
+template<typename T>
+static JKSNPoolSlots<T> &poolSlots() {
+    static JKSNPoolSlots<T> slots;
+    return slots;
+}
+
+template<typename T>
+static std::unique_ptr<T> &poolCached() {
+    static thread_local std::unique_ptr<T> cached;
+    return cached;
+}
+
+template<typename T>
+typename JKSNPool<T>::Handle JKSNPool<T>::acquire() {
+    std::unique_ptr<T> &cached = poolCached<T>();
+    if(cached)
+        return Handle(cached.release());
+    for(std::atomic<T *> &item : poolSlots<T>().items)
+        if(item.load(std::memory_order_relaxed))
+            if(T *obj = item.exchange(nullptr, std::memory_order_acquire))
+                return Handle(obj);
+    return Handle(new T);
+}
+
+template<typename T>
+void JKSNPool<T>::Release::operator()(T *obj) const {
+    obj->p->reset();
+    obj->p->resetSettings();
+    std::unique_ptr<T> &cached = poolCached<T>();
+    if(!cached) {
+        cached.reset(obj);
+        return;
+    }
+    for(std::atomic<T *> &item : poolSlots<T>().items) {
+        T *expected = nullptr;
+        if(item.compare_exchange_strong(expected, obj, std::memory_order_release, std::memory_order_relaxed))
+            return;
+    }
+    delete obj;
+}
+
+template class JKSNPool<JKSNEncoder>;
+template class JKSNPool<JKSNDecoder>;
+
 JKSNValue JKSNDecoderPrivate::parseValue(std::istream &fp) {
+    std::streambuf *input = fp.rdbuf();
+    FrameStack &stack = this->stack;
+    /* Anything left by an exception is abandoned */
+    stack.clear();
     for(;;) {
-        char signed_control;
-        if(!fp.get(signed_control))
+        std::streambuf::int_type signed_control = input->sbumpc();
+        if(signed_control == std::streambuf::traits_type::eof()) {
+            fp.setstate(std::ios_base::eofbit | std::ios_base::failbit);
             throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+        }
         uint8_t control = uint8_t(signed_control);
-        uint8_t ctrlhi = control & 0xf0;
-        switch(ctrlhi) {
-        /* Special values */
-        case 0x00:
-            switch(control) {
-            case 0x00:
-                return JKSNValue();
-            case 0x01:
-                return JKSNValue(nullptr);
-            case 0x02:
-                return JKSNValue(false);
-            case 0x03:
-                return JKSNValue(true);
-            case 0x0f:
-                throw JKSNDecodeError("this JKSN decoder does not support JSON literals");
+        const JKSNControl &entry = jksn_control_table[control];
+        JKSN_COUNT(parse_values[controlFamily(control)], 1);
+        switch(entry.kind) {
+        case JKSN_CONTROL_CLEAR_HASH:
+            this->clearHash();
+            continue;
+        case JKSN_CONTROL_REFRESH:
+            {
+                size_t length = decodeLength(fp, entry);
+                if(length != 0)
+                    stack.push(Frame::DISCARD, length);
+                continue;
+            }
+        /* Empty containers are complete values, left to parseScalar */
+        case JKSN_CONTROL_ARRAY:
+        case JKSN_CONTROL_OBJECT:
+        case JKSN_CONTROL_SWAPPED:
+            {
+                size_t length = decodeLength(fp, entry);
+                if(length == 0)
+                    break;
+                /* The length is not backed by the stream yet, so do not trust it for the reservation */
+                if(entry.kind == JKSN_CONTROL_ARRAY) {
+                    stack.push(Frame::ARRAY, length).items.reserve(std::min<size_t>(length, 4096));
+                } else
+                    stack.push(entry.kind == JKSN_CONTROL_OBJECT ? Frame::OBJECT : Frame::SWAPPED, length);
+                continue;
             }
+        case JKSN_CONTROL_LENGTHLESS:
+            stack.push(Frame::LENGTHLESS);
+            continue;
+        case JKSN_CONTROL_PADDING:
+            continue;
+        /* Ignore checksums */
+        case JKSN_CONTROL_CHECKSUM:
+            skipBytes(fp, entry.width);
+            continue;
+        case JKSN_CONTROL_DELAYED_CHECKSUM:
+            stack.push(Frame::TRAILER, entry.width);
+            continue;
+        /* Ignore pragmas, except for the type of a narrowed number */
+        case JKSN_CONTROL_PRAGMA:
+            stack.push(this->restore_narrowed ? Frame::PRAGMA : Frame::DISCARD, 1);
+            continue;
+        default:
             break;
-        /* Integers */
-        case 0x10:
+        }
+        /* Object keys and column names may be interned */
+        bool is_key = this->intern_keys && !stack.empty() && !stack.top().has_key &&
+            (stack.top().kind == Frame::OBJECT || stack.top().kind == Frame::SWAPPED);
+        JKSNValue value = this->parseScalar(fp, control, entry, is_key);
+        if(pushValue(stack, value, fp))
+            return value;
+    }
+}
+
+/*
+  Pass over a value without building it, only keeping the hashtables and
+  the last integer up to date. Returns true if the value was the
+  unspecified value, which ends a lengthless array.
+*/
+bool JKSNDecoderPrivate::skipValue(std::istream &fp) {
+    std::streambuf *input = fp.rdbuf();
+    std::vector<SkipFrame> &stack = this->skip_stack;
+    stack.clear();
+    for(;;) {
+        std::streambuf::int_type signed_control = input->sbumpc();
+        if(signed_control == std::streambuf::traits_type::eof()) {
+            fp.setstate(std::ios_base::eofbit | std::ios_base::failbit);
+            throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+        }
+        uint8_t control = uint8_t(signed_control);
+        const JKSNControl &entry = jksn_control_table[control];
+        bool unspecified = false;
+        switch(entry.kind) {
+        case JKSN_CONTROL_CONSTANT:
+            unspecified = entry.value == JKSN_CONSTANT_UNSPECIFIED;
+            break;
+        case JKSN_CONTROL_INT:
             this->cache.haslastint = true;
-            switch(control) {
-            case 0x1b:
-                this->cache.lastint = intmax_t(int32_t(this->decodeInt(fp, 4)));
-                break;
-            case 0x1c:
-                this->cache.lastint = intmax_t(int16_t(this->decodeInt(fp, 2)));
-                break;
-            case 0x1d:
-                this->cache.lastint = intmax_t(int8_t(this->decodeInt(fp, 1)));
-                break;
-            case 0x1e:
-                this->cache.lastint = -intmax_t(this->decodeInt(fp, 0));
-                if(this->cache.lastint >= 0)
-                    throw JKSNDecodeError("this build of JKSN decoder does not support variable length integers");
-                break;
-            case 0x1f:
-                this->cache.lastint = intmax_t(this->decodeInt(fp, 0));
-                if(this->cache.lastint < 0)
-                    throw JKSNDecodeError("this build of JKSN decoder does not support variable length integers");
+            this->cache.lastint = decodeSigned(fp, entry);
+            break;
+        case JKSN_CONTROL_DELTA:
+            {
+                intmax_t delta = decodeSigned(fp, entry);
+                if(!this->cache.haslastint)
+                    throw JKSNDecodeError("JKSN stream contains an invalid delta encoded integer");
+                this->cache.lastint += delta;
                 break;
-            default:
-                this->cache.lastint = control & 0xf;
-            }
-            return JKSNValue(this->cache.lastint);
-        /* Floating point numbers */
-        case 0x20:
-            switch(control) {
-            case 0x20:
-                return JKSNValue(NAN);
-            case 0x2b:
-                return this->parseLongDouble(fp);
-            case 0x2c:
-                return this->parseDouble(fp);
-            case 0x2d:
-                return this->parseFloat(fp);
-            case 0x2e:
-                return JKSNValue(-INFINITY);
-            case 0x2f:
-                return JKSNValue(INFINITY);
             }
+        case JKSN_CONTROL_FLOAT:
+        case JKSN_CONTROL_DOUBLE:
+        case JKSN_CONTROL_LONG_DOUBLE:
+            skipBytes(fp, entry.width);
             break;
-        /* UTF-16 strings */
-        case 0x30:
+        case JKSN_CONTROL_UTF16:
+        case JKSN_CONTROL_UTF8:
+        case JKSN_CONTROL_BLOB:
+        case JKSN_CONTROL_TEXT_HASH:
+        case JKSN_CONTROL_BLOB_HASH:
+            this->skipString(fp, control);
+            break;
+        case JKSN_CONTROL_CLEAR_HASH:
+            this->clearHash();
+            continue;
+        case JKSN_CONTROL_REFRESH:
             {
-                size_t strsize;
-                switch(control) {
-                case 0x3c:
-                    {
-                        char hashvalue;
-                        if(!fp.get(hashvalue))
-                            throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                        if(this->cache.texthash[uint8_t(hashvalue)])
-                            return JKSNValue(*this->cache.texthash[uint8_t(hashvalue)]);
-                        else
-                            throw JKSNDecodeError("JKSN stream requires a non-existing hash");
-                    }
-                case 0x3d:
-                    strsize = this->decodeInt(fp, 2);
-                    break;
-                case 0x3e:
-                    strsize = this->decodeInt(fp, 1);
-                    break;
-                case 0x3f:
-                    strsize = this->decodeInt(fp, 0);
-                    break;
-                default:
-                    strsize = control & 0xf;
-                }
-                std::vector<char16_t> strbuf(strsize);
-                if(!fp.read(reinterpret_cast<char *>(strbuf.data()), std::streamsize(strsize*2)))
-                    throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                if(!isLittleEndian())
-                    for(char16_t &i : strbuf)
-                        i = char16_t(uint16_t(i) >> 8 | uint16_t(i) << 8);
-                std::string result = UTF16ToUTF8(std::u16string(strbuf.cbegin(), strbuf.cend()));
-                this->cache.texthash[DJBHash(result)].reset(new std::string(result));
-                return JKSNValue(std::move(result));
+                size_t length = decodeLength(fp, entry);
+                if(length != 0)
+                    stack.push_back({SkipFrame::DISCARD, length});
+                continue;
             }
-        /* UTF-8 strings */
-        case 0x40:
+        case JKSN_CONTROL_ARRAY:
+        case JKSN_CONTROL_OBJECT:
+        case JKSN_CONTROL_SWAPPED:
             {
-                size_t strsize;
-                switch(control) {
-                case 0x4d:
-                    strsize = this->decodeInt(fp, 2);
-                    break;
-                case 0x4e:
-                    strsize = this->decodeInt(fp, 1);
+                size_t length = decodeLength(fp, entry);
+                if(length == 0)
                     break;
-                case 0x3f:
-                    strsize = this->decodeInt(fp, 0);
-                    break;
-                default:
-                    strsize = control & 0xf;
+                /* Objects hold a key and a value per member, swapped arrays a name and a column */
+                if(entry.kind != JKSN_CONTROL_ARRAY) {
+                    if(length > SIZE_MAX / 2)
+                        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+                    length *= 2;
                 }
-                std::vector<char> strbuf(strsize);
-                if(!fp.read(strbuf.data(), std::streamsize(strsize)))
-                    throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                std::string result = std::string(strbuf.cbegin(), strbuf.cend());
-                this->cache.texthash[DJBHash(result)].reset(new std::string(result));
-                return JKSNValue(std::move(result));
+                stack.push_back({SkipFrame::CONTAINER, length});
+                continue;
             }
-        /* Blob strings */
-        case 0x50:
+        case JKSN_CONTROL_LENGTHLESS:
+            stack.push_back({SkipFrame::LENGTHLESS, 0});
+            continue;
+        case JKSN_CONTROL_PADDING:
+            continue;
+        case JKSN_CONTROL_CHECKSUM:
+            skipBytes(fp, entry.width);
+            continue;
+        case JKSN_CONTROL_DELAYED_CHECKSUM:
+            stack.push_back({SkipFrame::TRAILER, entry.width});
+            continue;
+        case JKSN_CONTROL_PRAGMA:
+            stack.push_back({SkipFrame::DISCARD, 1});
+            continue;
+        case JKSN_CONTROL_XOR_DOUBLE:
+        case JKSN_CONTROL_XOR_FLOAT:
             {
-                size_t strsize;
-                switch(control) {
-                case 0x5c:
-                    {
-                        char hashvalue;
-                        if(!fp.get(hashvalue))
-                            throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                        if(this->cache.blobhash[uint8_t(hashvalue)])
-                            return JKSNValue(*this->cache.blobhash[uint8_t(hashvalue)]);
-                        else
-                            throw JKSNDecodeError("JKSN stream requires a non-existing hash");
-                    }
-                case 0x5d:
-                    strsize = this->decodeInt(fp, 2);
-                    break;
-                case 0x5e:
-                    strsize = this->decodeInt(fp, 1);
-                    break;
-                case 0x5f:
-                    strsize = this->decodeInt(fp, 0);
-                    break;
-                default:
-                    strsize = control & 0xf;
-                }
-                std::vector<char> strbuf(strsize);
-                if(!fp.read(strbuf.data(), std::streamsize(strsize)))
+                decodeInt(fp, 0);
+                size_t size = decodeInt(fp, 0);
+                if(size > size_t(std::numeric_limits<std::streamsize>::max()) || fp.ignore(std::streamsize(size)).gcount() != std::streamsize(size))
                     throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                std::string result = std::string(strbuf.cbegin(), strbuf.cend());
-                this->cache.blobhash[DJBHash(result)].reset(new std::string(result));
-                return JKSNValue(std::move(result), true);
+                break;
             }
-        /* Hashtable refreshers */
-        case 0x70:
-            {
-                size_t objlen;
-                switch(control) {
-                case 0x70:
-                    this->cache.texthash.fill(nullptr);
-                    this->cache.texthash.fill(nullptr);
-                    continue;
-                case 0x7d:
-                    objlen = this->decodeInt(fp, 2);
-                    break;
-                case 0x7e:
-                    objlen = this->decodeInt(fp, 1);
-                    break;
-                case 0x7f:
-                    objlen = this->decodeInt(fp, 0);
-                    break;
-                default:
-                    objlen = control & 0xf;
-                }
-                while(objlen--)
-                    this->parseValue(fp);
-                continue;
+        /* Read to keep the numbering of the blobs */
+        case JKSN_CONTROL_DEDUP_BLOB:
+        case JKSN_CONTROL_DEDUP_REF:
+        case JKSN_CONTROL_DEDUP_CHUNKS:
+            this->parseDedup(fp, entry);
+            break;
+        /* The string holding the text is passed over as the value */
+        case JKSN_CONTROL_JSON:
+            continue;
+        default:
+            throw JKSNDecodeError("JKSN stream contains an invalid control byte");
+        }
+        /* A complete value, counted against the innermost frame as pushValue does */
+        for(;;) {
+            if(stack.empty())
+                return unspecified;
+            SkipFrame &top = stack.back();
+            if(top.kind == SkipFrame::TRAILER)
+                skipBytes(fp, top.length);
+            else if(top.kind == SkipFrame::DISCARD) {
+                if(--top.length == 0)
+                    stack.pop_back();
+                break;
+            } else if(top.kind == SkipFrame::LENGTHLESS ? !unspecified : --top.length != 0)
+                break;
+            else
+                unspecified = false;
+            stack.pop_back();
+        }
+    }
+}
+
+JKSNValue JKSNDecoderPrivate::parseScalar(std::istream &fp, uint8_t control, const JKSNControl &entry, bool is_key) {
+    switch(entry.kind) {
+    case JKSN_CONTROL_CONSTANT:
+        switch(entry.value) {
+        case JKSN_CONSTANT_UNDEFINED:
+            return JKSNValue();
+        case JKSN_CONSTANT_NULL:
+            return JKSNValue(nullptr);
+        case JKSN_CONSTANT_FALSE:
+            return JKSNValue(false);
+        case JKSN_CONSTANT_TRUE:
+            return JKSNValue(true);
+        case JKSN_CONSTANT_NAN:
+            return JKSNValue(NAN);
+        case JKSN_CONSTANT_NEGATIVE_INFINITY:
+            return JKSNValue(-INFINITY);
+        case JKSN_CONSTANT_POSITIVE_INFINITY:
+            return JKSNValue(INFINITY);
+        default:
+            return JKSNValue::fromUnspecified();
+        }
+    case JKSN_CONTROL_INT:
+        this->cache.haslastint = true;
+        this->cache.lastint = decodeSigned(fp, entry);
+        return JKSNValue(this->cache.lastint);
+    case JKSN_CONTROL_FLOAT:
+        return parseFloat(fp);
+    case JKSN_CONTROL_DOUBLE:
+        return parseDouble(fp);
+    case JKSN_CONTROL_LONG_DOUBLE:
+        return parseLongDouble(fp);
+    case JKSN_CONTROL_UTF16:
+    case JKSN_CONTROL_UTF8:
+    case JKSN_CONTROL_BLOB:
+    case JKSN_CONTROL_TEXT_HASH:
+    case JKSN_CONTROL_BLOB_HASH:
+        return this->parseString(fp, control, is_key);
+    case JKSN_CONTROL_ARRAY:
+    case JKSN_CONTROL_SWAPPED:
+        return JKSNValue(std::vector<JKSNValue>());
+    case JKSN_CONTROL_OBJECT:
+        return JKSNValue(std::map<JKSNValue, JKSNValue>());
+    case JKSN_CONTROL_DELTA:
+        {
+            intmax_t delta = decodeSigned(fp, entry);
+            if(!this->cache.haslastint)
+                throw JKSNDecodeError("JKSN stream contains an invalid delta encoded integer");
+            this->cache.lastint += delta;
+            return JKSNValue(this->cache.lastint);
+        }
+    case JKSN_CONTROL_XOR_DOUBLE:
+        return parseXorArray(fp, JKSN_DOUBLE);
+    case JKSN_CONTROL_XOR_FLOAT:
+        return parseXorArray(fp, JKSN_FLOAT);
+    case JKSN_CONTROL_DEDUP_BLOB:
+    case JKSN_CONTROL_DEDUP_REF:
+    case JKSN_CONTROL_DEDUP_CHUNKS:
+        return this->parseDedup(fp, entry);
+    case JKSN_CONTROL_JSON:
+        {
+            /* The JSON text follows as a string */
+            std::streambuf::int_type text_control = fp.rdbuf()->sbumpc();
+            if(text_control == std::streambuf::traits_type::eof())
+                throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+            switch(jksn_control_table[uint8_t(text_control)].kind) {
+            case JKSN_CONTROL_UTF16:
+            case JKSN_CONTROL_UTF8:
+            case JKSN_CONTROL_BLOB:
+            case JKSN_CONTROL_TEXT_HASH:
+            case JKSN_CONTROL_BLOB_HASH:
+                return this->json.parse(this->parseString(fp, uint8_t(text_control)).toStringRef());
+            default:
+                throw JKSNDecodeError("JKSN stream contains an invalid JSON literal");
             }
-        /* Arrays */
-        case 0x80:
-            {
-                size_t objlen;
-                switch(control) {
-                case 0x8d:
-                    objlen = this->decodeInt(fp, 2);
-                    break;
-                case 0x8e:
-                    objlen = this->decodeInt(fp, 1);
-                    break;
-                case 0x8f:
-                    objlen = this->decodeInt(fp, 0);
-                    break;
-                default:
-                    objlen = control & 0xf;
-                }
-                std::vector<JKSNValue> result;
-                result.reserve(objlen);
-                while(objlen--)
-                    result.push_back(this->parseValue(fp));
-                return JKSNValue(std::move(result));
+        }
+    default:
+        throw JKSNDecodeError("JKSN stream contains an invalid control byte");
+    }
+}
+
+/* Hand a complete value to the innermost frame; true if it is the result */
+bool JKSNDecoderPrivate::pushValue(FrameStack &stack, JKSNValue &value, std::istream &fp) {
+    if(stack.narrowed != JKSN_UNDEFINED) {
+        if(stack.narrowed == JKSN_FLOAT && value.isNumber())
+            value = JKSNValue(value.toFloat());
+        else if(stack.narrowed == JKSN_DOUBLE && value.isNumber())
+            value = JKSNValue(value.toDouble());
+        else if(stack.narrowed == JKSN_LONG_DOUBLE && value.isNumber())
+            value = JKSNValue(value.toLongDouble());
+        stack.narrowed = JKSN_UNDEFINED;
+    }
+    while(!stack.empty()) {
+        Frame &top = stack.top();
+        switch(top.kind) {
+        case Frame::ARRAY:
+            top.items.push_back(std::move(value));
+            if(--top.length != 0)
+                return false;
+            value = JKSNValue(std::move(top.items));
+            break;
+        case Frame::OBJECT:
+            if(!top.has_key) {
+                top.key = std::move(value);
+                top.has_key = true;
+                return false;
             }
-        /* Objects */
-        case 0x90:
-            {
-                size_t objlen;
-                switch(control) {
-                case 0x9d:
-                    objlen = this->decodeInt(fp, 2);
-                    break;
-                case 0x9e:
-                    objlen = this->decodeInt(fp, 1);
-                    break;
-                case 0x9f:
-                    objlen = this->decodeInt(fp, 0);
-                    break;
-                default:
-                    objlen = control & 0xf;
-                }
-                std::map<JKSNValue, JKSNValue> result;
-                while(objlen--) {
-                    JKSNValue key = this->parseValue(fp);
-                    result[std::move(key)] = this->parseValue(fp);
-                }
-                return JKSNValue(std::move(result));
+            top.members[std::move(top.key)] = std::move(value);
+            top.has_key = false;
+            if(--top.length != 0)
+                return false;
+            value = JKSNValue(std::move(top.members));
+            break;
+        case Frame::SWAPPED:
+            if(!top.has_key) {
+                top.key = std::move(value);
+                top.has_key = true;
+                return false;
             }
-        /* Row-col swapped arrays */
-        case 0xa0:
+            if(!value.isArray())
+                throw JKSNDecodeError("JKSN row-col swapped array requires an array but not found");
             {
-                size_t collen;
-                switch(control) {
-                case 0xa0:
-                    return JKSNValue::fromUnspecified();
-                case 0xad:
-                    collen = this->decodeInt(fp, 2);
-                    break;
-                case 0xae:
-                    collen = this->decodeInt(fp, 1);
-                    break;
-                case 0xaf:
-                    collen = this->decodeInt(fp, 0);
-                    break;
-                default:
-                    collen = control & 0xf;
-                }
-                return this->parseSwappedArray(fp, collen);
-            }
-        case 0xc0:
-            switch(control) {
-            /* Lengthless arrays */
-            case 0xc8:
-                {
-                    std::vector<JKSNValue> result;
-                    for(;;) {
-                        JKSNValue item = this->parseValue(fp);
-                        if(!item.isUnspecified())
-                            result.push_back(std::move(item));
-                        else
-                            return JKSNValue(std::move(result));
-                    }
-                    break;
+                std::vector<JKSNValue> &column_values = value.mutableVector();
+                for(size_t i = 0; i < column_values.size(); ++i) {
+                    if(i == top.items.size())
+                        top.items.push_back(JKSNValue::fromMap(std::map<JKSNValue, JKSNValue>()));
+                    if(!column_values[i].isUnspecified())
+                        top.items[i].mutableMap()[top.key] = std::move(column_values[i]);
                 }
-            /* Padding byte */
-            case 0xca:
-                continue;
             }
+            top.has_key = false;
+            if(--top.length != 0)
+                return false;
+            value = JKSNValue(std::move(top.items));
             break;
-        /* Delta encoded integers */
-        case 0xd0:
-            {
-                intmax_t delta;
-                switch(control) {
-                case 0xd0: case 0xd1: case 0xd2: case 0xd3: case 0xd4: case 0xd5:
-                    delta = control & 0xf;
-                    break;
-                case 0xd6: case 0xd7: case 0xd8: case 0xd9: case 0xda:
-                    delta = intmax_t(control & 0xf)-11;
-                    break;
-                case 0xdb:
-                    delta = intmax_t(int32_t(this->decodeInt(fp, 4)));
-                    break;
-                case 0xdc:
-                    delta = intmax_t(int16_t(this->decodeInt(fp, 2)));
-                    break;
-                case 0xdd:
-                    delta = intmax_t(int8_t(this->decodeInt(fp, 1)));
-                    break;
-                case 0xde:
-                    delta = -intmax_t(this->decodeInt(fp, 0));
-                    if(delta >= 0)
-                        throw JKSNDecodeError("this build of JKSN decoder does not support variable length integers");
-                    break;
-                case 0xdf:
-                    delta = intmax_t(this->decodeInt(fp, 0));
-                    if(delta < 0)
-                        throw JKSNDecodeError("this build of JKSN decoder does not support variable length integers");
-                    break;
-                }
-                if(!this->cache.haslastint)
-                    throw JKSNDecodeError("JKSN stream contains an invalid delta encoded integer");
-                this->cache.haslastint = true;
-                this->cache.lastint += delta;
-                return JKSNValue(this->cache.lastint);
+        case Frame::LENGTHLESS:
+            if(!value.isUnspecified()) {
+                top.items.push_back(std::move(value));
+                return false;
             }
-        case 0xf0:
-            /* Ignore checksums */
-            if(control <= 0xf5) {
-                std::vector<char> buf;
-                switch(control) {
-                case 0xf0:
-                    buf.reserve(1);
-                    if(!fp.read(buf.data(), 1))
-                        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                    continue;
-                case 0xf1:
-                    buf.reserve(4);
-                    if(!fp.read(buf.data(), 4))
-                        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                    continue;
-                case 0xf2:
-                    buf.reserve(16);
-                    if(!fp.read(buf.data(), 16))
-                        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                    continue;
-                case 0xf3:
-                    buf.reserve(20);
-                    if(!fp.read(buf.data(), 20))
-                        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                    continue;
-                case 0xf4:
-                    buf.reserve(32);
-                    if(!fp.read(buf.data(), 32))
-                        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                    continue;
-                case 0xf5:
-                    buf.reserve(64);
-                    if(!fp.read(buf.data(), 64))
-                        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                    continue;
-                }
-            } else if (control >= 0xf8 && control <= 0xfd) {
-                std::vector<char> buf;
-                JKSNValue result;
-                switch(control) {
-                case 0xf8:
-                    result = parseValue(fp);
-                    buf.reserve(1);
-                    if(!fp.read(buf.data(), 1))
-                        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                    continue;
-                case 0xf9:
-                    result = parseValue(fp);
-                    buf.reserve(4);
-                    if(!fp.read(buf.data(), 4))
-                        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                    continue;
-                case 0xfa:
-                    result = parseValue(fp);
-                    buf.reserve(16);
-                    if(!fp.read(buf.data(), 16))
-                        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                    continue;
-                case 0xfb:
-                    result = parseValue(fp);
-                    buf.reserve(20);
-                    if(!fp.read(buf.data(), 20))
-                        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                    continue;
-                case 0xfc:
-                    result = parseValue(fp);
-                    buf.reserve(32);
-                    if(!fp.read(buf.data(), 32))
-                        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                    continue;
-                case 0xfd:
-                    result = parseValue(fp);
-                    buf.reserve(64);
-                    if(!fp.read(buf.data(), 64))
-                        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-                    continue;
-                }
-                return result;
-            /* Ignore pragmas */
-            } else if(control == 0xff) {
-                parseValue(fp);
-                continue;
+            value = JKSNValue(std::move(top.items));
+            break;
+        case Frame::DISCARD:
+            if(--top.length == 0)
+                stack.pop();
+            return false;
+        case Frame::PRAGMA:
+            stack.pop();
+            if(value.isString()) {
+                const std::string &name = value.toStringRef();
+                stack.narrowed = name == "float" ? JKSN_FLOAT : name == "double" ? JKSN_DOUBLE : name == "long double" ? JKSN_LONG_DOUBLE : JKSN_UNDEFINED;
             }
+            return false;
+        case Frame::TRAILER:
+            skipBytes(fp, top.length);
+            break;
         }
-        throw JKSNDecodeError("cannot encode unrecognizable type of value");
+        stack.pop();
     }
+    return true;
 }
 
 uintmax_t JKSNDecoderPrivate::decodeInt(std::istream &fp, size_t size) {
@@ -1052,14 +2450,14 @@ uintmax_t JKSNDecoderPrivate::decodeInt(std::istream &fp, size_t size) {
     case 1:
         {
             char buffer;
-            if(!fp.get(buffer))
+            if(!readBytes(fp, &buffer, 1))
                 throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
             return uintmax_t(uint8_t(buffer));
         }
     case 2:
         {
             char buffer[2];
-            if(!fp.read(buffer, 2))
+            if(!readBytes(fp, buffer, 2))
                 throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
             return uintmax_t(uint8_t(buffer[0])) << 8 |
                    uintmax_t(uint8_t(buffer[1]));
@@ -1067,7 +2465,7 @@ uintmax_t JKSNDecoderPrivate::decodeInt(std::istream &fp, size_t size) {
     case 4:
         {
             char buffer[4];
-            if(!fp.read(buffer, 4))
+            if(!readBytes(fp, buffer, 4))
                 throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
             return uintmax_t(uint8_t(buffer[0])) << 24 |
                    uintmax_t(uint8_t(buffer[1])) << 16 |
@@ -1081,7 +2479,7 @@ uintmax_t JKSNDecoderPrivate::decodeInt(std::istream &fp, size_t size) {
             do {
                 if(result & ~(~ uintmax_t(0) >> 7))
                     throw JKSNDecodeError("this build of JKSN decoder does not support variable length integers");
-                if(!fp.get(thisbyte))
+                if(!readBytes(fp, &thisbyte, 1))
                     throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
                 result = (result << 7) | (uint8_t(thisbyte) & 0x7f);
             } while(uint8_t(thisbyte) & 0x80);
@@ -1093,18 +2491,268 @@ uintmax_t JKSNDecoderPrivate::decodeInt(std::istream &fp, size_t size) {
     }
 }
 
-JKSNValue JKSNDecoderPrivate::parseFloat(std::istream &fp) {
-    static_assert(sizeof (float) == 4, "sizeof (float) should be 4");
-    char buffer[4];
-    if(!fp.read(buffer, 4))
-        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
-    const union {
-        uint32_t data_int;
-        float data_float;
-    } conv = {
-        uint32_t(uint8_t(buffer[0])) << 24 |
-        uint32_t(uint8_t(buffer[1])) << 16 |
-        uint32_t(uint8_t(buffer[2])) << 8 |
+intmax_t JKSNDecoderPrivate::decodeSigned(std::istream &fp, const JKSNControl &entry) {
+    switch(entry.width) {
+    case 0:
+        return entry.value;
+    case 1:
+        return intmax_t(int8_t(decodeInt(fp, 1)));
+    case 2:
+        return intmax_t(int16_t(decodeInt(fp, 2)));
+    case 4:
+        return intmax_t(int32_t(decodeInt(fp, 4)));
+    default:
+        {
+            intmax_t result = intmax_t(decodeInt(fp, 0));
+            if(result < 0)
+                throw JKSNDecodeError("this build of JKSN decoder does not support variable length integers");
+            return entry.value < 0 ? -result : result;
+        }
+    }
+}
+
+size_t JKSNDecoderPrivate::decodeLength(std::istream &fp, uint8_t control) {
+    return decodeLength(fp, jksn_control_table[control]);
+}
+
+size_t JKSNDecoderPrivate::decodeLength(std::istream &fp, const JKSNControl &entry) {
+    switch(entry.width) {
+    case 0:
+        return size_t(uint8_t(entry.value));
+    case JKSN_VARINT:
+        return decodeInt(fp, 0);
+    default:
+        return decodeInt(fp, entry.width);
+    }
+}
+
+void JKSNDecoderPrivate::skipBytes(std::istream &fp, size_t size) {
+    /* Checksums are at most 64 bytes */
+    char buffer[64];
+    assert(size <= sizeof buffer);
+    if(!readBytes(fp, buffer, size))
+        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+}
+
+JKSNValue JKSNDecoderPrivate::parseString(std::istream &fp, uint8_t control, bool intern) {
+    switch(control) {
+    case 0x3c:
+    case 0x5c:
+        {
+            char hashvalue;
+            if(!readBytes(fp, &hashvalue, 1))
+                throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+            JKSNValue &cached = this->cachedString(control == 0x5c, uint8_t(hashvalue));
+            if(cached.isUndefined())
+                throw JKSNDecodeError("JKSN stream requires a non-existing hash");
+            /* Keep the symbol in the hashtable, so that later references are already interned */
+            if(intern && control == 0x3c && !cached.isInterned())
+                cached = JKSNValue::intern(cached);
+            return cached;
+        }
+    }
+    size_t strsize = decodeLength(fp, control);
+    switch(control & 0xf0) {
+    /* UTF-16 strings */
+    case 0x30:
+        {
+            std::vector<char16_t> strbuf(strsize);
+            if(!readBytes(fp, reinterpret_cast<char *>(strbuf.data()), strsize*2))
+                throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+            /* The hash is taken over the bytes in the stream, as the encoder does */
+            uint8_t hash = DJBHash(reinterpret_cast<const char *>(strbuf.data()), strsize*2);
+            if(!isLittleEndian())
+                for(char16_t &i : strbuf)
+                    i = char16_t(uint16_t(i) >> 8 | uint16_t(i) << 8);
+            JKSNValue result(UTF16ToUTF8(std::u16string(strbuf.cbegin(), strbuf.cend())));
+            if(intern)
+                result = JKSNValue::intern(result);
+            this->cache.text(hash) = result;
+            this->text_skipped.reset(hash);
+            return result;
+        }
+    /* UTF-8 strings */
+    case 0x40:
+    /* Blob strings */
+    case 0x50:
+        if((control & 0xf0) == 0x50 && this->blob_sink_min != 0 && strsize >= this->blob_sink_min) {
+            this->streamBlob(fp, strsize, true);
+            return JKSNValue::fromBlob(std::string());
+        }
+        {
+            std::string buf(strsize, '\0');
+            if(strsize != 0 && !readBytes(fp, &buf[0], strsize))
+                throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+            uint8_t hash = DJBHash(buf);
+            bool is_blob = (control & 0xf0) == 0x50;
+            JKSNValue result(std::move(buf), is_blob);
+            if(intern && !is_blob)
+                result = JKSNValue::intern(result);
+            (is_blob ? this->cache.blob(hash) : this->cache.text(hash)) = result;
+            (is_blob ? this->blob_skipped : this->text_skipped).reset(hash);
+            return result;
+        }
+    default:
+        throw JKSNTypeError();
+    }
+}
+
+void JKSNDecoderPrivate::skipString(std::istream &fp, uint8_t control) {
+    if(control == 0x3c || control == 0x5c) {
+        char hashvalue;
+        if(!readBytes(fp, &hashvalue, 1))
+            throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+        uint8_t hash = uint8_t(hashvalue);
+        bool found = control == 0x3c ? this->text_skipped[hash] || !this->cache.text(hash).isUndefined() :
+                                       this->blob_skipped[hash] || !this->cache.blob(hash).isUndefined();
+        if(!found)
+            throw JKSNDecodeError("JKSN stream requires a non-existing hash");
+        return;
+    }
+    size_t strsize = decodeLength(fp, control);
+    bool is_utf16 = (control & 0xf0) == 0x30;
+    if(is_utf16) {
+        if(strsize > SIZE_MAX / 2)
+            throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+        strsize *= 2;
+    } else if((control & 0xf0) == 0x50 && this->blob_sink_min != 0 && strsize >= this->blob_sink_min) {
+        this->streamBlob(fp, strsize, false);
+        return;
+    }
+    /* Swapped with the slot, so that buffers are reused instead of allocated */
+    std::string &buf = this->skip_buffer;
+    buf.resize(strsize);
+    if(strsize != 0 && !readBytes(fp, &buf[0], strsize))
+        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+    uint8_t hash = DJBHash(buf);
+    if((control & 0xf0) == 0x50) {
+        this->skipped_blob[hash].swap(buf);
+        this->blob_skipped.set(hash);
+    } else {
+        this->skipped_text[hash].swap(buf);
+        this->text_skipped.set(hash);
+        this->text_utf16[hash] = is_utf16;
+    }
+}
+
+/*
+  Reads a blob in chunks, handing them to the sink or dropping them. It is
+  not remembered, so a back reference to its slot fails instead of
+  finding an older blob.
+*/
+void JKSNDecoderPrivate::streamBlob(std::istream &fp, size_t size, bool to_sink) {
+    char buffer[65536];
+    uint8_t hash = 0;
+    for(size_t offset = 0; offset < size;) {
+        size_t chunk = std::min(size - offset, sizeof buffer);
+        if(!readBytes(fp, buffer, chunk))
+            throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+        hash = DJBHash(buffer, chunk, hash);
+        if(to_sink)
+            this->blob_sink(buffer, chunk, offset, size);
+        offset += chunk;
+    }
+    this->cache.blob(hash) = JKSNValue();
+    this->blob_skipped.reset(hash);
+}
+
+/* The hashtable entry for a back reference, built now if skipValue passed over it */
+JKSNValue &JKSNDecoderPrivate::cachedString(bool is_blob, uint8_t hash) {
+    if(is_blob) {
+        if(this->blob_skipped[hash]) {
+            this->cache.blob(hash) = JKSNValue(this->skipped_blob[hash], true);
+            this->blob_skipped.reset(hash);
+        }
+        return this->cache.blob(hash);
+    }
+    if(this->text_skipped[hash]) {
+        const std::string &raw = this->skipped_text[hash];
+        if(this->text_utf16[hash]) {
+            std::u16string utf16str(raw.size() / 2, u'\0');
+            if(!utf16str.empty())
+                std::memcpy(&utf16str[0], raw.data(), raw.size());
+            if(!isLittleEndian())
+                for(char16_t &i : utf16str)
+                    i = char16_t(uint16_t(i) >> 8 | uint16_t(i) << 8);
+            this->cache.text(hash) = JKSNValue(UTF16ToUTF8(utf16str));
+        } else
+            this->cache.text(hash) = JKSNValue(raw);
+        this->text_skipped.reset(hash);
+    }
+    return this->cache.text(hash);
+}
+
+void JKSNDecoderPrivate::reset() {
+    this->cache.haslastint = false;
+    this->clearHash();
+}
+
+void JKSNDecoderPrivate::resetSettings() {
+    this->intern_keys = false;
+    this->restore_narrowed = false;
+    this->blob_sink_min = 0;
+    this->blob_sink = nullptr;
+}
+
+void JKSNDecoderPrivate::clearHash() {
+    this->cache.clear();
+    this->text_skipped.reset();
+    this->blob_skipped.reset();
+    this->dedup.clear();
+}
+
+/*
+  0xe2 is a blob numbered in the order it comes, 0xe3 the blob with that
+  number, and 0xe4 one made of as many of them as its count says.
+*/
+JKSNValue JKSNDecoderPrivate::parseDedup(std::istream &fp, const JKSNControl &entry) {
+    switch(entry.kind) {
+    case JKSN_CONTROL_DEDUP_BLOB:
+        {
+            size_t size = decodeLength(fp, entry);
+            std::string buf(size, '\0');
+            if(size != 0 && !readBytes(fp, &buf[0], size))
+                throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+            this->dedup.push_back(JKSNValue::fromBlob(std::move(buf)));
+            return this->dedup.back();
+        }
+    case JKSN_CONTROL_DEDUP_REF:
+        {
+            size_t index = decodeLength(fp, entry);
+            if(index >= this->dedup.size())
+                throw JKSNDecodeError("JKSN stream requires a non-existing deduplicated blob");
+            return this->dedup[index];
+        }
+    default:
+        {
+            size_t count = decodeLength(fp, entry);
+            std::string result;
+            for(size_t i = 0; i < count; i++) {
+                std::streambuf::int_type control = fp.rdbuf()->sbumpc();
+                if(control == std::streambuf::traits_type::eof())
+                    throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+                const JKSNControl &piece = jksn_control_table[uint8_t(control)];
+                if(piece.kind != JKSN_CONTROL_DEDUP_BLOB && piece.kind != JKSN_CONTROL_DEDUP_REF)
+                    throw JKSNDecodeError("JKSN stream contains an invalid deduplicated chunk");
+                result += this->parseDedup(fp, piece).toStringRef();
+            }
+            return JKSNValue::fromBlob(std::move(result));
+        }
+    }
+}
+
+JKSNValue JKSNDecoderPrivate::parseFloat(std::istream &fp) {
+    static_assert(sizeof (float) == 4, "sizeof (float) should be 4");
+    char buffer[4];
+    if(!readBytes(fp, buffer, 4))
+        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+    const union {
+        uint32_t data_int;
+        float data_float;
+    } conv = {
+        uint32_t(uint8_t(buffer[0])) << 24 |
+        uint32_t(uint8_t(buffer[1])) << 16 |
+        uint32_t(uint8_t(buffer[2])) << 8 |
         uint32_t(uint8_t(buffer[3]))
     };
     return JKSNValue(conv.data_float);
@@ -1113,7 +2761,7 @@ JKSNValue JKSNDecoderPrivate::parseFloat(std::istream &fp) {
 JKSNValue JKSNDecoderPrivate::parseDouble(std::istream &fp) {
     static_assert(sizeof (double) == 8, "sizeof (double) should be 8");
     char buffer[8];
-    if(!fp.read(buffer, 8))
+    if(!readBytes(fp, buffer, 8))
         throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
     const union {
         uint64_t data_int;
@@ -1134,7 +2782,7 @@ JKSNValue JKSNDecoderPrivate::parseDouble(std::istream &fp) {
 JKSNValue JKSNDecoderPrivate::parseLongDouble(std::istream &fp) {
     if(sizeof (long double) == 12) {
         char buffer[10];
-        if(!fp.read(buffer, 10))
+        if(!readBytes(fp, buffer, 10))
             throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
         union {
             uint8_t data_int[12];
@@ -1170,7 +2818,7 @@ JKSNValue JKSNDecoderPrivate::parseLongDouble(std::istream &fp) {
         return JKSNValue(conv.data_long_double);
     } else if(sizeof (long double) == 16) {
         char buffer[10];
-        if(!fp.read(buffer, 10))
+        if(!readBytes(fp, buffer, 10))
             throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
         union {
             uint8_t data_int[16];
@@ -1211,29 +2859,2037 @@ JKSNValue JKSNDecoderPrivate::parseLongDouble(std::istream &fp) {
             conv.data_int[14] = uint8_t(buffer[8]);
             conv.data_int[15] = uint8_t(buffer[9]);
         }
-        return JKSNValue(conv.data_long_double);
-    } else
-        throw JKSNEncodeError("this build of JKSN decoder does not support long double numbers");
+        return JKSNValue(conv.data_long_double);
+    } else
+        throw JKSNEncodeError("this build of JKSN decoder does not support long double numbers");
+}
+
+JKSNValue JKSNDecoderPrivate::parseXorArray(std::istream &fp, jksn_data_type type) {
+    const bool is_float = type == JKSN_FLOAT;
+    const unsigned width = is_float ? 32 : 64;
+    const unsigned field_width = is_float ? 5 : 6;
+    /* The first item takes width bits, each of the others from 1 bit to a 11 record */
+    const size_t max_item_bits = 2 + 2*field_width + width;
+    size_t count = decodeInt(fp, 0);
+    size_t bufsize = decodeInt(fp, 0);
+    if(count > SIZE_MAX / max_item_bits ||
+       bufsize > (count * max_item_bits + 7) / 8 ||
+       (count != 0 && bufsize < (width + count - 1 + 7) / 8))
+        throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+    /* Read in chunks, so that a length the stream does not hold is not allocated up front */
+    std::string buf;
+    while(buf.size() < bufsize) {
+        size_t offset = buf.size();
+        size_t chunk = std::min<size_t>(bufsize - offset, 65536);
+        buf.resize(offset + chunk);
+        if(!readBytes(fp, &buf[offset], chunk))
+            throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+    }
+    JKSNBitReader reader(buf);
+    std::vector<JKSNValue> result;
+    result.reserve(std::min<size_t>(count, 4096));
+    uint64_t bits = 0;
+    bool has_window = false;
+    unsigned leading = 0;
+    unsigned trailing = 0;
+    for(size_t i = 0; i < count; ++i) {
+        if(i == 0)
+            bits = reader.get(width);
+        else if(reader.get(1)) {
+            if(reader.get(1)) {
+                leading = unsigned(reader.get(field_width));
+                unsigned meaningful = unsigned(reader.get(field_width)) + 1;
+                if(leading + meaningful > width)
+                    throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+                trailing = width - leading - meaningful;
+                has_window = true;
+            } else if(!has_window)
+                throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+            bits ^= reader.get(width - leading - trailing) << trailing;
+        }
+        if(is_float) {
+            const union {
+                uint32_t data_int;
+                float data_float;
+            } conv = {uint32_t(bits)};
+            result.push_back(JKSNValue(conv.data_float));
+        } else {
+            const union {
+                uint64_t data_int;
+                double data_double;
+            } conv = {bits};
+            result.push_back(JKSNValue(conv.data_double));
+        }
+    }
+    return JKSNValue(std::move(result));
+}
+
+void JKSNWriter::writeNull() {
+    this->output += char(0x01);
+}
+
+void JKSNWriter::writeBool(bool value) {
+    this->output += char(value ? 0x03 : 0x02);
+}
+
+void JKSNWriter::writeInt(intmax_t value) {
+    const JKSNValue obj(value);
+    JKSNProxy proxy = JKSNEncoderPrivate::dumpInt(obj);
+    if(this->encoder.p->effort == JKSN_EFFORT_FASTEST)
+        this->encoder.p->cache.haslastint = false;
+    else
+        this->encoder.p->optimize(proxy);
+    this->output += char(proxy.control);
+    this->output += proxy.data;
+}
+
+void JKSNWriter::writeFloat(float value) {
+    const JKSNValue obj(value);
+    if(this->encoder.p->narrowing) {
+        this->writeValue(obj);
+        return;
+    }
+    JKSNProxy proxy = JKSNEncoderPrivate::dumpFloat(obj);
+    this->output += char(proxy.control);
+    this->output += proxy.data;
+}
+
+void JKSNWriter::writeDouble(double value) {
+    const JKSNValue obj(value);
+    if(this->encoder.p->narrowing) {
+        this->writeValue(obj);
+        return;
+    }
+    JKSNProxy proxy = JKSNEncoderPrivate::dumpDouble(obj);
+    this->output += char(proxy.control);
+    this->output += proxy.data;
+}
+
+void JKSNWriter::writeString(const char *str, size_t size, bool is_blob) {
+    /* Text is always written in UTF-8, JKSNEncoder::dump tries UTF-16 as well */
+    this->writeText(str, size, DJBHash(str, size), is_blob);
+}
+
+void JKSNWriter::writeKey(const JKSNKey &key) {
+    this->writeText(key.str, key.size, key.hash, false);
+}
+
+/* Writes a back reference if the hashtable holds the text, or remembers it for next time */
+bool JKSNWriter::writeReference(const char *str, size_t size, uint8_t hash, bool is_blob) {
+    JKSNCache<std::shared_ptr<std::string> > &cache = this->encoder.p->cache;
+    std::shared_ptr<std::string> &cached = is_blob ? cache.blob(hash) : cache.text(hash);
+    size_t streamed = this->encoder.p->streamed_blobs;
+    if(this->encoder.p->effort == JKSN_EFFORT_FASTEST || (is_blob && streamed != 0 && size >= streamed))
+        cached.reset();
+    else if(size > 1 && cached && cached->size() == size && std::memcmp(cached->data(), str, size) == 0) {
+        this->output += char(is_blob ? 0x5c : 0x3c);
+        this->output += char(hash);
+        return true;
+    } else
+        cached = std::make_shared<std::string>(str, size);
+    return false;
+}
+
+/* A key whose literal was encoded beforehand, as writeText would write it */
+void JKSNWriter::writeEncodedKey(const JKSNKey &key, const std::string &encoded) {
+    if(!this->writeReference(key.str, key.size, key.hash, false))
+        this->output += encoded;
+}
+
+void JKSNWriter::writeText(const char *str, size_t size, uint8_t hash, bool is_blob) {
+    if(this->writeReference(str, size, hash, is_blob))
+        return;
+    if(is_blob)
+        this->writeLength(0x50, size, 0xb);
+    else
+        this->writeLength(0x40, size, 0xc);
+    this->output.append(str, size);
+}
+
+void JKSNWriter::writeBlob(size_t size, const std::function<void(char *buf, size_t size)> &read, std::ostream &fp) {
+    this->writeLength(0x50, size, 0xb);
+    fp.write(this->output.data(), std::streamsize(this->output.size()));
+    this->output.clear();
+    char buffer[65536];
+    uint8_t hash = 0;
+    for(size_t offset = 0; offset < size;) {
+        size_t chunk = std::min(size - offset, sizeof buffer);
+        read(buffer, chunk);
+        hash = DJBHash(buffer, chunk, hash);
+        fp.write(buffer, std::streamsize(chunk));
+        offset += chunk;
+    }
+    /* The decoder remembers it, but the encoder does not, so the slot is never referred to */
+    this->encoder.p->cache.blob(hash).reset();
+}
+
+void JKSNWriter::writeArrayHeader(size_t length) {
+    this->writeLength(0x80, length, 0xc);
+}
+
+void JKSNWriter::writeObjectHeader(size_t length) {
+    this->writeLength(0x90, length, 0xc);
+}
+
+void JKSNWriter::writeSwappedArrayHeader(size_t columns) {
+    assert(columns != 0);
+    this->writeLength(0xa0, columns, 0xc);
+}
+
+void JKSNWriter::writeUnspecified() {
+    this->output += char(0xa0);
+}
+
+void JKSNWriter::writePragma(const std::string &pragma) {
+    this->output += char(0xff);
+    this->writeString(pragma);
+}
+
+void JKSNWriter::writeValue(const JKSNValue &value) {
+    JKSNProxy proxy = this->encoder.p->dumpToProxy(value);
+    proxy.appendTo(this->output);
+}
+
+void JKSNWriter::writeLength(uint8_t control, size_t length, size_t short_limit) {
+    if(length <= short_limit)
+        this->output += char(control | uint8_t(length));
+    else if(length <= 0xff) {
+        this->output += char(control | 0xe);
+        this->output += JKSNEncoderPrivate::encodeInt(length, 1);
+    } else if(length <= 0xffff) {
+        this->output += char(control | 0xd);
+        this->output += JKSNEncoderPrivate::encodeInt(length, 2);
+    } else {
+        this->output += char(control | 0xf);
+        this->output += JKSNEncoderPrivate::encodeInt(length, 0);
+    }
+}
+
+JKSNReader::JKSNReader(JKSNDecoder &decoder, std::istream &fp, bool header) :
+    decoder(decoder),
+    fp(fp) {
+    if(header)
+        skipHeader(fp);
+}
+
+uint8_t JKSNReader::peekControl() {
+    for(;;) {
+        std::istream::int_type control = this->fp.peek();
+        if(control == std::istream::traits_type::eof())
+            throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+        switch(uint8_t(control)) {
+        /* Padding byte */
+        case 0xca:
+            this->fp.get();
+            continue;
+        /* Ignore pragmas */
+        case 0xff:
+            this->fp.get();
+            this->decoder.p->skipValue(this->fp);
+            continue;
+        default:
+            return uint8_t(control);
+        }
+    }
+}
+
+JKSNValue JKSNReader::readValue() {
+    return this->decoder.p->parseValue(this->fp);
+}
+
+void JKSNReader::skipValue() {
+    this->decoder.p->skipValue(this->fp);
+}
+
+bool JKSNReader::readBool() {
+    return this->readValue().toBool();
+}
+
+intmax_t JKSNReader::readInt() {
+    return this->readValue().toInt();
+}
+
+double JKSNReader::readDouble() {
+    return this->readValue().toDouble();
+}
+
+std::string &JKSNReader::readString(std::string &result) {
+    uint8_t control = this->peekControl();
+    switch(control & 0xf0) {
+    case 0x30:
+    case 0x40:
+    case 0x50:
+        this->fp.get();
+        result = this->decoder.p->parseString(this->fp, control).toStringRef();
+        break;
+    default:
+        result = this->readValue().toString();
+    }
+    return result;
+}
+
+bool JKSNReader::readArrayHeader(size_t &length) {
+    uint8_t control = this->peekControl();
+    if((control & 0xf0) != 0x80)
+        return false;
+    this->fp.get();
+    length = JKSNDecoderPrivate::decodeLength(this->fp, control);
+    return true;
+}
+
+bool JKSNReader::readObjectHeader(size_t &length) {
+    uint8_t control = this->peekControl();
+    if((control & 0xf0) != 0x90)
+        return false;
+    this->fp.get();
+    length = JKSNDecoderPrivate::decodeLength(this->fp, control);
+    return true;
+}
+
+bool JKSNReader::readSwappedArrayHeader(size_t &columns) {
+    uint8_t control = this->peekControl();
+    if((control & 0xf0) != 0xa0 || control == 0xa0)
+        return false;
+    this->fp.get();
+    columns = JKSNDecoderPrivate::decodeLength(this->fp, control);
+    return true;
+}
+
+bool JKSNReader::readUnspecified() {
+    if(this->peekControl() != 0xa0)
+        return false;
+    this->fp.get();
+    return true;
+}
+
+bool JKSNReader::readPragma(JKSNValue &pragma) {
+    for(;;) {
+        std::istream::int_type control = this->fp.peek();
+        if(control == std::istream::traits_type::eof())
+            return false;
+        switch(uint8_t(control)) {
+        case 0xca:
+            this->fp.get();
+            continue;
+        case 0xff:
+            this->fp.get();
+            pragma = this->decoder.p->parseValue(this->fp);
+            return true;
+        default:
+            return false;
+        }
+    }
+}
+
+void JKSNJSONWriter::separate() {
+    if(this->need_comma && this->depth != 0)
+        this->output.push_back(',');
+    this->need_comma = true;
+}
+
+void JKSNJSONWriter::writeNull() {
+    this->separate();
+    this->output.append("null", 4);
+}
+
+void JKSNJSONWriter::writeBool(bool value) {
+    this->separate();
+    if(value)
+        this->output.append("true", 4);
+    else
+        this->output.append("false", 5);
+}
+
+void JKSNJSONWriter::writeInt(intmax_t value) {
+    char buffer[24];
+    char *end = buffer + sizeof buffer;
+    char *start = end;
+    uintmax_t magnitude = value < 0 ? uintmax_t(0) - uintmax_t(value) : uintmax_t(value);
+    do {
+        *--start = char('0' + magnitude % 10);
+        magnitude /= 10;
+    } while(magnitude != 0);
+    if(value < 0)
+        *--start = '-';
+    this->separate();
+    this->output.append(start, size_t(end - start));
+}
+
+void JKSNJSONWriter::writeFloat(float value) {
+    if(std::isfinite(value)) {
+        char buffer[32];
+        size_t size = formatFloat(value, buffer);
+        this->separate();
+        this->output.append(buffer, size);
+    } else
+        this->writeNull();
+}
+
+void JKSNJSONWriter::writeDouble(double value) {
+    if(std::isfinite(value)) {
+        char buffer[32];
+        size_t size = formatDouble(value, buffer);
+        this->separate();
+        this->output.append(buffer, size);
+    } else
+        this->writeNull();
+}
+
+void JKSNJSONWriter::writeLongDouble(long double value) {
+    if(std::isfinite(value)) {
+        char buffer[64];
+        size_t size = formatLongDouble(value, buffer);
+        this->separate();
+        this->output.append(buffer, size);
+    } else
+        this->writeNull();
+}
+
+void JKSNJSONWriter::writeString(const char *str, size_t size) {
+    this->separate();
+    this->appendString(str, size);
+}
+
+void JKSNJSONWriter::writeBlob(const char *buf, size_t size) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    this->separate();
+    size_t start = this->output.size();
+    this->output.resize(start + (size+2)/3*4 + 2);
+    char *out = &this->output[start];
+    *out++ = '"';
+    size_t i = 0;
+    for(; i + 3 <= size; i += 3) {
+        uint32_t triple = uint32_t(uint8_t(buf[i])) << 16 | uint32_t(uint8_t(buf[i+1])) << 8 | uint8_t(buf[i+2]);
+        *out++ = alphabet[triple >> 18];
+        *out++ = alphabet[(triple >> 12) & 0x3f];
+        *out++ = alphabet[(triple >> 6) & 0x3f];
+        *out++ = alphabet[triple & 0x3f];
+    }
+    if(i < size) {
+        uint32_t triple = uint32_t(uint8_t(buf[i])) << 16;
+        if(i + 1 < size)
+            triple |= uint32_t(uint8_t(buf[i+1])) << 8;
+        *out++ = alphabet[triple >> 18];
+        *out++ = alphabet[(triple >> 12) & 0x3f];
+        *out++ = i + 1 < size ? alphabet[(triple >> 6) & 0x3f] : '=';
+        *out++ = '=';
+    }
+    *out = '"';
+}
+
+void JKSNJSONWriter::writeKey(const char *str, size_t size) {
+    this->separate();
+    this->appendString(str, size);
+    this->output.push_back(':');
+    this->need_comma = false;
+}
+
+void JKSNJSONWriter::writeKey(const JKSNValue &key) {
+    if(key.isString())
+        this->writeKey(key.toStringRef());
+    else
+        this->writeKey(key.toString());
+}
+
+void JKSNJSONWriter::beginArray() {
+    this->separate();
+    this->output.push_back('[');
+    this->depth++;
+    this->need_comma = false;
+}
+
+void JKSNJSONWriter::endArray() {
+    this->output.push_back(']');
+    this->depth--;
+    this->need_comma = true;
+}
+
+void JKSNJSONWriter::beginObject() {
+    this->separate();
+    this->output.push_back('{');
+    this->depth++;
+    this->need_comma = false;
+}
+
+void JKSNJSONWriter::endObject() {
+    this->output.push_back('}');
+    this->depth--;
+    this->need_comma = true;
+}
+
+void JKSNJSONWriter::writeValue(const JKSNValue &value) {
+    /* An explicit stack, so that deep nesting does not overflow the call stack */
+    struct Frame {
+        const std::vector<JKSNValue> *items;
+        size_t index;
+        std::map<JKSNValue, JKSNValue>::const_iterator member;
+        std::map<JKSNValue, JKSNValue>::const_iterator end;
+    };
+    std::vector<Frame> stack;
+    const JKSNValue *current = &value;
+    for(;;) {
+        if(current) {
+            switch(current->getType()) {
+            case JKSN_ARRAY:
+                this->beginArray();
+                stack.push_back(Frame{&current->toVector(), 0, {}, {}});
+                break;
+            case JKSN_OBJECT:
+                this->beginObject();
+                stack.push_back(Frame{nullptr, 0, current->toMap().begin(), current->toMap().end()});
+                break;
+            default:
+                this->writeScalar(*current);
+            }
+            current = nullptr;
+        }
+        if(stack.empty())
+            return;
+        Frame &top = stack.back();
+        if(top.items) {
+            if(top.index == top.items->size()) {
+                this->endArray();
+                stack.pop_back();
+            } else
+                current = &(*top.items)[top.index++];
+        } else if(top.member == top.end) {
+            this->endObject();
+            stack.pop_back();
+        } else {
+            const std::pair<const JKSNValue, JKSNValue> &member = *top.member++;
+            jksn_data_type type = member.second.getType();
+            if(type != JKSN_UNDEFINED && type != JKSN_UNSPECIFIED) {
+                this->writeKey(member.first);
+                current = &member.second;
+            }
+        }
+    }
+}
+
+void JKSNJSONWriter::writeScalar(const JKSNValue &value) {
+    switch(value.getType()) {
+    case JKSN_BOOL:
+        this->writeBool(value.toBool());
+        break;
+    case JKSN_INT:
+        this->writeInt(value.toInt());
+        break;
+    case JKSN_FLOAT:
+        this->writeFloat(value.toFloat());
+        break;
+    case JKSN_DOUBLE:
+        this->writeDouble(value.toDouble());
+        break;
+    case JKSN_LONG_DOUBLE:
+        this->writeLongDouble(value.toLongDouble());
+        break;
+    case JKSN_STRING:
+        this->writeString(value.toStringRef());
+        break;
+    case JKSN_BLOB:
+        this->writeBlob(value.toStringRef());
+        break;
+    case JKSN_ARRAY:
+    case JKSN_OBJECT:
+        this->writeValue(value);
+        break;
+    default:
+        this->writeNull();
+    }
+}
+
+void JKSNJSONWriter::transcode(JKSNReader &reader) {
+    /* Items left in each open container, and whether it is an object */
+    std::vector<std::pair<size_t, bool> > stack;
+    do {
+        if(!stack.empty()) {
+            std::pair<size_t, bool> &top = stack.back();
+            if(top.first == 0) {
+                if(top.second)
+                    this->endObject();
+                else
+                    this->endArray();
+                stack.pop_back();
+                continue;
+            }
+            top.first--;
+            if(top.second) {
+                JKSNValue key = reader.readValue();
+                uint8_t control = reader.peekControl();
+                if(control == 0x00 || control == 0xa0) {
+                    reader.skipValue();
+                    continue;
+                }
+                this->writeKey(key);
+            }
+        }
+        size_t length;
+        if(reader.readArrayHeader(length)) {
+            this->beginArray();
+            stack.push_back(std::make_pair(length, false));
+        } else if(reader.readObjectHeader(length)) {
+            this->beginObject();
+            stack.push_back(std::make_pair(length, true));
+        } else
+            /* Scalars, and the array encodings that need the whole array */
+            this->writeScalar(reader.readValue());
+    } while(!stack.empty());
+}
+
+static inline bool JSONNeedsEscape(const char *str) {
+    /* Whether any of 8 bytes is a control character, a quote or a backslash */
+    static const uint64_t ones = 0x0101010101010101ull;
+    static const uint64_t highs = ones * 0x80;
+    uint64_t word;
+    std::memcpy(&word, str, 8);
+    uint64_t quote = word ^ (ones * '"');
+    uint64_t backslash = word ^ (ones * '\\');
+    return (((word - ones*0x20) & ~word) | ((quote - ones) & ~quote) | ((backslash - ones) & ~backslash)) & highs;
+}
+
+void JKSNJSONWriter::appendString(const char *str, size_t size) {
+    static const char hex[] = "0123456789abcdef";
+    this->output.push_back('"');
+    size_t run = 0;
+    size_t i = 0;
+    for(;;) {
+        while(i + 8 <= size && !JSONNeedsEscape(str+i))
+            i += 8;
+        size_t stop = std::min(i + 8, size);
+        for(; i < stop; i++) {
+            uint8_t c = uint8_t(str[i]);
+            if(c >= 0x20 && c != '"' && c != '\\')
+                continue;
+            this->output.append(str+run, i-run);
+            run = i+1;
+            char escape[6] = {'\\', char(c), 0, 0, 0, 0};
+            size_t escape_size = 2;
+            switch(c) {
+            case '"':
+            case '\\':
+                break;
+            case '\b':
+                escape[1] = 'b';
+                break;
+            case '\f':
+                escape[1] = 'f';
+                break;
+            case '\n':
+                escape[1] = 'n';
+                break;
+            case '\r':
+                escape[1] = 'r';
+                break;
+            case '\t':
+                escape[1] = 't';
+                break;
+            default:
+                escape[1] = 'u';
+                escape[2] = '0';
+                escape[3] = '0';
+                escape[4] = hex[c >> 4];
+                escape[5] = hex[c & 0xf];
+                escape_size = 6;
+            }
+            this->output.append(escape, escape_size);
+        }
+        if(i >= size)
+            break;
+    }
+    this->output.append(str+run, size-run);
+    this->output.push_back('"');
+}
+
+void JKSNJSONParser::fail(size_t pos) const {
+    throw JKSNDecodeError(("invalid JSON text at offset " + std::to_string(pos)).c_str());
+}
+
+size_t JKSNJSONParser::skipSpace(size_t pos) const {
+    static const uint64_t spaces = 0x2020202020202020ull;
+    while(pos < this->size) {
+        uint64_t word;
+        if(pos + 8 <= this->size && (std::memcpy(&word, this->json+pos, 8), word == spaces)) {
+            pos += 8;
+            continue;
+        }
+        char c = this->json[pos];
+        if(c != ' ' && c != '\n' && c != '\r' && c != '\t')
+            break;
+        pos++;
+    }
+    return pos;
+}
+
+size_t JKSNJSONParser::scanString(size_t pos) {
+    const char *json = this->json;
+    size_t begin = ++pos;
+    bool escaped = false;
+    for(;;) {
+        while(pos + 8 <= this->size && !JSONNeedsEscape(json+pos))
+            pos += 8;
+        if(pos >= this->size)
+            this->fail(begin-1);
+        uint8_t c = uint8_t(json[pos]);
+        if(c == '"')
+            break;
+        else if(c == '\\') {
+            escaped = true;
+            pos += 2;
+        } else if(c < 0x20)
+            this->fail(pos);
+        else
+            pos++;
+    }
+    this->tape.push_back(Token{Token::STRING, escaped, begin, pos, 0, this->tape.size() + 1});
+    return pos + 1;
+}
+
+size_t JKSNJSONParser::scanKey(size_t pos) {
+    if(pos >= this->size || this->json[pos] != '"')
+        this->fail(pos);
+    pos = this->skipSpace(this->scanString(pos));
+    if(pos >= this->size || this->json[pos] != ':')
+        this->fail(pos);
+    return this->skipSpace(pos + 1);
+}
+
+size_t JKSNJSONParser::scanNumber(size_t pos) {
+    const char *json = this->json;
+    size_t size = this->size;
+    size_t begin = pos;
+    bool fraction = false;
+    if(pos < size && json[pos] == '-')
+        pos++;
+    if(pos < size && json[pos] == '0')
+        pos++;
+    else if(pos < size && json[pos] >= '1' && json[pos] <= '9')
+        while(pos < size && json[pos] >= '0' && json[pos] <= '9')
+            pos++;
+    else
+        this->fail(begin);
+    if(pos < size && json[pos] == '.') {
+        fraction = true;
+        if(++pos >= size || json[pos] < '0' || json[pos] > '9')
+            this->fail(pos);
+        while(pos < size && json[pos] >= '0' && json[pos] <= '9')
+            pos++;
+    }
+    if(pos < size && (json[pos] == 'e' || json[pos] == 'E')) {
+        fraction = true;
+        if(++pos < size && (json[pos] == '+' || json[pos] == '-'))
+            pos++;
+        if(pos >= size || json[pos] < '0' || json[pos] > '9')
+            this->fail(pos);
+        while(pos < size && json[pos] >= '0' && json[pos] <= '9')
+            pos++;
+    }
+    this->tape.push_back(Token{Token::NUMBER, fraction, begin, pos, 0, this->tape.size() + 1});
+    return pos;
+}
+
+void JKSNJSONParser::scan(const char *json, size_t size) {
+    this->json = json;
+    this->size = size;
+    std::vector<Token> &tape = this->tape;
+    std::vector<size_t> &open = this->open;
+    tape.clear();
+    open.clear();
+    size_t pos = this->skipSpace(0);
+    for(;;) {
+        if(pos >= size)
+            this->fail(pos);
+        switch(json[pos]) {
+        case '[':
+        case '{':
+            {
+                bool is_object = json[pos] == '{';
+                open.push_back(tape.size());
+                tape.push_back(Token{is_object ? Token::OBJECT : Token::ARRAY, false, pos, pos, 0, 0});
+                pos = this->skipSpace(pos + 1);
+                if(pos < size && json[pos] == (is_object ? '}' : ']')) {
+                    Token &container = tape[open.back()];
+                    container.end = ++pos;
+                    container.next = tape.size();
+                    open.pop_back();
+                    break;
+                }
+                if(is_object)
+                    pos = this->scanKey(pos);
+                continue;
+            }
+        case '"':
+            pos = this->scanString(pos);
+            break;
+        case 'n':
+            if(size - pos < 4 || std::memcmp(json+pos, "null", 4) != 0)
+                this->fail(pos);
+            tape.push_back(Token{Token::NULL_LITERAL, false, pos, pos + 4, 0, tape.size() + 1});
+            pos += 4;
+            break;
+        case 'f':
+            if(size - pos < 5 || std::memcmp(json+pos, "false", 5) != 0)
+                this->fail(pos);
+            tape.push_back(Token{Token::FALSE_LITERAL, false, pos, pos + 5, 0, tape.size() + 1});
+            pos += 5;
+            break;
+        case 't':
+            if(size - pos < 4 || std::memcmp(json+pos, "true", 4) != 0)
+                this->fail(pos);
+            tape.push_back(Token{Token::TRUE_LITERAL, false, pos, pos + 4, 0, tape.size() + 1});
+            pos += 4;
+            break;
+        default:
+            pos = this->scanNumber(pos);
+        }
+        /* A complete value, counted in the innermost container, which may end with it */
+        for(;;) {
+            pos = this->skipSpace(pos);
+            if(open.empty()) {
+                if(pos != size)
+                    this->fail(pos);
+                return;
+            }
+            Token &container = tape[open.back()];
+            container.count++;
+            if(pos < size && json[pos] == ',') {
+                pos = this->skipSpace(pos + 1);
+                if(container.kind == Token::OBJECT)
+                    pos = this->scanKey(pos);
+                break;
+            } else if(pos < size && json[pos] == (container.kind == Token::OBJECT ? '}' : ']')) {
+                container.end = ++pos;
+                container.next = tape.size();
+                open.pop_back();
+            } else
+                this->fail(pos);
+        }
+    }
+}
+
+void JKSNJSONParser::decodeString(const Token &token, const char *&str, size_t &size) {
+    const char *json = this->json;
+    if(!token.flag) {
+        str = json + token.begin;
+        size = token.end - token.begin;
+        return;
+    }
+    std::string &text = this->text;
+    text.clear();
+    auto hex4 = [&](size_t pos) -> uint32_t {
+        if(token.end - pos < 4)
+            this->fail(pos);
+        uint32_t result = 0;
+        for(size_t i = pos; i < pos + 4; i++) {
+            char c = json[i];
+            if(c >= '0' && c <= '9')
+                result = (result << 4) | uint32_t(c - '0');
+            else if(c >= 'a' && c <= 'f')
+                result = (result << 4) | uint32_t(c - 'a' + 10);
+            else if(c >= 'A' && c <= 'F')
+                result = (result << 4) | uint32_t(c - 'A' + 10);
+            else
+                this->fail(i);
+        }
+        return result;
+    };
+    size_t pos = token.begin;
+    for(;;) {
+        const char *backslash = static_cast<const char *>(std::memchr(json+pos, '\\', token.end - pos));
+        size_t stop = backslash ? size_t(backslash - json) : token.end;
+        text.append(json+pos, stop - pos);
+        if(stop == token.end)
+            break;
+        pos = stop + 2;
+        switch(json[stop+1]) {
+        case '"':
+        case '\\':
+        case '/':
+            text += json[stop+1];
+            break;
+        case 'b':
+            text += '\b';
+            break;
+        case 'f':
+            text += '\f';
+            break;
+        case 'n':
+            text += '\n';
+            break;
+        case 'r':
+            text += '\r';
+            break;
+        case 't':
+            text += '\t';
+            break;
+        case 'u':
+            {
+                uint32_t code = hex4(pos);
+                pos += 4;
+                /* Lone surrogates are kept as they are, in three bytes */
+                if(code >= 0xd800 && code < 0xdc00 && token.end - pos >= 6 && json[pos] == '\\' && json[pos+1] == 'u') {
+                    uint32_t low = hex4(pos + 2);
+                    if(low >= 0xdc00 && low < 0xe000) {
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                        pos += 6;
+                    }
+                }
+                if(code < 0x80)
+                    text += char(code);
+                else if(code < 0x800) {
+                    text += char(0xc0 | (code >> 6));
+                    text += char(0x80 | (code & 0x3f));
+                } else if(code < 0x10000) {
+                    text += char(0xe0 | (code >> 12));
+                    text += char(0x80 | ((code >> 6) & 0x3f));
+                    text += char(0x80 | (code & 0x3f));
+                } else {
+                    text += char(0xf0 | (code >> 18));
+                    text += char(0x80 | ((code >> 12) & 0x3f));
+                    text += char(0x80 | ((code >> 6) & 0x3f));
+                    text += char(0x80 | (code & 0x3f));
+                }
+                break;
+            }
+        default:
+            this->fail(stop);
+        }
+    }
+    str = text.data();
+    size = text.size();
+}
+
+JKSNValue JKSNJSONParser::decodeNumber(const Token &token) {
+    static const double pow10[23] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char *str = this->json + token.begin;
+    const char *end = this->json + token.end;
+    bool negative = *str == '-';
+    const char *p = str + (negative ? 1 : 0);
+    if(!token.flag) {
+        uintmax_t magnitude = 0;
+        for(; p != end; p++) {
+            unsigned digit = unsigned(*p - '0');
+            if(magnitude > (std::numeric_limits<uintmax_t>::max() - digit) / 10)
+                break;
+            magnitude = magnitude*10 + digit;
+        }
+        if(p == end) {
+            if(!negative && magnitude <= uintmax_t(std::numeric_limits<intmax_t>::max()))
+                return JKSNValue(intmax_t(magnitude));
+            else if(negative && magnitude != 0 && magnitude - 1 <= uintmax_t(std::numeric_limits<intmax_t>::max()))
+                return JKSNValue(-intmax_t(magnitude - 1) - 1);
+        }
+        p = str + (negative ? 1 : 0);
+    }
+    /* Exact when the digits and the power of ten are both exact doubles */
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    for(; p != end && *p >= '0' && *p <= '9'; p++) {
+        mantissa = mantissa*10 + unsigned(*p - '0');
+        if(mantissa != 0 && ++digits > 15)
+            break;
+    }
+    if(digits <= 15 && p != end && *p == '.')
+        for(p++; p != end && *p >= '0' && *p <= '9'; p++) {
+            mantissa = mantissa*10 + unsigned(*p - '0');
+            exponent--;
+            if(mantissa != 0 && ++digits > 15)
+                break;
+        }
+    if(digits <= 15 && p != end && (*p == 'e' || *p == 'E')) {
+        bool negative_exponent = *++p == '-';
+        if(*p == '+' || *p == '-')
+            p++;
+        int value = 0;
+        for(; p != end && value < 10000; p++)
+            value = value*10 + (*p - '0');
+        exponent += negative_exponent ? -value : value;
+    }
+    if(digits <= 15 && -22 <= exponent && exponent <= 22) {
+        double result = double(mantissa);
+        result = exponent < 0 ? result / pow10[-exponent] : result * pow10[exponent];
+        return JKSNValue(negative ? -result : result);
+    }
+    this->text.assign(str, end);
+    return JKSNValue(std::strtod(this->text.c_str(), nullptr));
+}
+
+JKSNValue JKSNJSONParser::parse(const char *json, size_t size) {
+    this->scan(json, size);
+    struct Frame {
+        bool is_object;
+        bool has_key;
+        size_t remaining;
+        std::vector<JKSNValue> items;
+        std::map<JKSNValue, JKSNValue> members;
+        JKSNValue key;
+    };
+    std::vector<Frame> stack;
+    size_t index = 0;
+    for(;;) {
+        const Token &token = this->tape[index++];
+        JKSNValue value;
+        switch(token.kind) {
+        case Token::NULL_LITERAL:
+            value = JKSNValue(nullptr);
+            break;
+        case Token::FALSE_LITERAL:
+            value = JKSNValue(false);
+            break;
+        case Token::TRUE_LITERAL:
+            value = JKSNValue(true);
+            break;
+        case Token::NUMBER:
+            value = this->decodeNumber(token);
+            break;
+        case Token::STRING:
+            {
+                const char *str;
+                size_t size;
+                this->decodeString(token, str, size);
+                value = JKSNValue(std::string(str, size));
+                break;
+            }
+        case Token::ARRAY:
+        case Token::OBJECT:
+            if(token.count != 0) {
+                stack.emplace_back();
+                Frame &frame = stack.back();
+                frame.is_object = token.kind == Token::OBJECT;
+                frame.has_key = false;
+                frame.remaining = token.count;
+                if(!frame.is_object)
+                    frame.items.reserve(token.count);
+                continue;
+            } else if(token.kind == Token::OBJECT)
+                value = JKSNValue(std::map<JKSNValue, JKSNValue>());
+            else
+                value = JKSNValue(std::vector<JKSNValue>());
+            break;
+        }
+        /* Hand the value to the innermost container, closing the ones it completes */
+        for(;;) {
+            if(stack.empty())
+                return value;
+            Frame &top = stack.back();
+            if(top.is_object) {
+                if(!top.has_key) {
+                    top.key = std::move(value);
+                    top.has_key = true;
+                    break;
+                }
+                /* The last of repeated keys wins, as in JavaScript */
+                top.members[std::move(top.key)] = std::move(value);
+                top.has_key = false;
+            } else
+                top.items.push_back(std::move(value));
+            if(--top.remaining != 0)
+                break;
+            if(top.is_object)
+                value = JKSNValue(std::move(top.members));
+            else
+                value = JKSNValue(std::move(top.items));
+            stack.pop_back();
+        }
+    }
+}
+
+/*
+  Lists the columns of an array of objects in order of appearance, and the
+  value of each column in each row, 0 meaning a missing one. False if the
+  array is better written straight: fewer than two rows, other items than
+  objects, or more than half of the cells missing.
+*/
+bool JKSNJSONParser::swapColumns(size_t index, std::vector<size_t> &keys, std::vector<size_t> &cells) {
+    const Token &array = this->tape[index];
+    size_t rows = array.count;
+    if(rows < 2)
+        return false;
+    size_t members = 0;
+    for(size_t row = index + 1; row != array.next; row = this->tape[row].next)
+        if(this->tape[row].kind != Token::OBJECT)
+            return false;
+        else
+            members += this->tape[row].count;
+    if(members == 0)
+        return false;
+    std::vector<std::string> &names = this->column_names;
+    std::vector<std::pair<size_t, size_t> > &found = this->column_cells;
+    names.clear();
+    keys.clear();
+    found.clear();
+    for(size_t row = index + 1; row != array.next; row = this->tape[row].next) {
+        /* Rows usually list their keys in the same order, so try the next column first */
+        size_t column = 0;
+        for(size_t key = row + 1; key != this->tape[row].next; key = this->tape[key + 1].next) {
+            const char *str;
+            size_t size;
+            this->decodeString(this->tape[key], str, size);
+            if(column >= names.size() || names[column].size() != size || std::memcmp(names[column].data(), str, size) != 0) {
+                column = 0;
+                while(column < names.size() && (names[column].size() != size || std::memcmp(names[column].data(), str, size) != 0))
+                    column++;
+                if(column == names.size()) {
+                    names.push_back(std::string(str, size));
+                    keys.push_back(key);
+                }
+            }
+            found.push_back(std::make_pair(column, key + 1));
+            column++;
+        }
+    }
+    if(names.size() * rows > members * 2)
+        return false;
+    cells.assign(names.size() * rows, 0);
+    size_t cell = 0;
+    for(size_t row = index + 1, row_index = 0; row != array.next; row = this->tape[row].next, row_index++)
+        for(size_t i = 0; i < this->tape[row].count; i++, cell++)
+            cells[found[cell].first * rows + row_index] = found[cell].second;
+    return true;
+}
+
+void JKSNJSONParser::transcode(const char *json, size_t size, JKSNWriter &writer) {
+    this->scan(json, size);
+    /* Subtrees left to write in turn, or the cells of a swapped array column by column */
+    struct Frame {
+        size_t at;
+        size_t remaining;
+        size_t rows; /* 0 unless swapped */
+        size_t column;
+        size_t row;
+        std::vector<size_t> keys;
+        std::vector<size_t> cells;
+    };
+    std::vector<Frame> stack;
+    std::vector<size_t> keys;
+    std::vector<size_t> cells;
+    /* Arrays of numbers with a fraction go through the encoder, which may XOR compress them */
+    std::vector<size_t> items;
+    auto writeNumbers = [&]() -> bool {
+        bool fraction = false;
+        for(size_t item : items)
+            if(item == 0 || this->tape[item].kind != Token::NUMBER)
+                return false;
+            else
+                fraction = fraction || this->tape[item].flag;
+        if(!fraction || items.size() < 2)
+            return false;
+        std::vector<JKSNValue> numbers;
+        numbers.reserve(items.size());
+        for(size_t item : items)
+            numbers.push_back(this->decodeNumber(this->tape[item]));
+        writer.writeValue(JKSNValue(std::move(numbers)));
+        return true;
+    };
+    size_t index = 0;
+    bool pending = true;
+    for(;;) {
+        if(pending) {
+            const Token &token = this->tape[index];
+            switch(token.kind) {
+            case Token::NULL_LITERAL:
+                writer.writeNull();
+                break;
+            case Token::FALSE_LITERAL:
+            case Token::TRUE_LITERAL:
+                writer.writeBool(token.kind == Token::TRUE_LITERAL);
+                break;
+            case Token::NUMBER:
+                {
+                    JKSNValue number = this->decodeNumber(token);
+                    if(number.isInt())
+                        writer.writeInt(number.toInt());
+                    else
+                        writer.writeDouble(number.toDouble());
+                    break;
+                }
+            case Token::STRING:
+                {
+                    const char *str;
+                    size_t size;
+                    this->decodeString(token, str, size);
+                    writer.writeString(str, size);
+                    break;
+                }
+            case Token::ARRAY:
+                if(this->swapColumns(index, keys, cells)) {
+                    writer.writeSwappedArrayHeader(keys.size());
+                    stack.push_back(Frame{0, 0, token.count, 0, 0, std::move(keys), std::move(cells)});
+                    break;
+                }
+                items.clear();
+                if(token.next == index + 1 + token.count)
+                    for(size_t item = index + 1; item != token.next; item++)
+                        items.push_back(item);
+                if(writeNumbers())
+                    break;
+                writer.writeArrayHeader(token.count);
+                stack.push_back(Frame{index + 1, token.count, 0, 0, 0, {}, {}});
+                break;
+            case Token::OBJECT:
+                writer.writeObjectHeader(token.count);
+                stack.push_back(Frame{index + 1, token.count * 2, 0, 0, 0, {}, {}});
+                break;
+            }
+            pending = false;
+        }
+        if(stack.empty())
+            return;
+        Frame &top = stack.back();
+        if(top.rows == 0) {
+            if(top.remaining == 0) {
+                stack.pop_back();
+                continue;
+            }
+            top.remaining--;
+            index = top.at;
+            top.at = this->tape[index].next;
+            pending = true;
+        } else {
+            if(top.column == top.keys.size()) {
+                stack.pop_back();
+                continue;
+            }
+            if(top.row == 0) {
+                const char *str;
+                size_t size;
+                this->decodeString(this->tape[top.keys[top.column]], str, size);
+                writer.writeString(str, size);
+                const size_t *column = top.cells.data() + top.column * top.rows;
+                items.assign(column, column + top.rows);
+                if(writeNumbers()) {
+                    top.column++;
+                    continue;
+                }
+                writer.writeArrayHeader(top.rows);
+            }
+            index = top.cells[top.column * top.rows + top.row];
+            if(++top.row == top.rows) {
+                top.row = 0;
+                top.column++;
+            }
+            if(index != 0)
+                pending = true;
+            else
+                writer.writeUnspecified();
+        }
+    }
+}
+
+JKSNSchema::JKSNSchema(const JKSNValue &schema, const std::string &name) :
+    name(name) {
+    if(!schema.isObject())
+        throw JKSNTypeError("JKSN schema must be an object");
+    this->compile(schema, std::string());
+}
+
+/* The control bytes a value of the type usually comes in, none of which start a container */
+static uint32_t valueKinds(jksn_data_type type) {
+    switch(type) {
+    case JKSN_NULL:
+    case JKSN_BOOL:
+        return 1u << JKSN_CONTROL_CONSTANT;
+    case JKSN_INT:
+        return 1u << JKSN_CONTROL_INT | 1u << JKSN_CONTROL_DELTA;
+    case JKSN_FLOAT:
+        return 1u << JKSN_CONTROL_FLOAT;
+    case JKSN_DOUBLE:
+        return 1u << JKSN_CONTROL_DOUBLE;
+    case JKSN_STRING:
+        return 1u << JKSN_CONTROL_UTF8 | 1u << JKSN_CONTROL_UTF16 | 1u << JKSN_CONTROL_TEXT_HASH;
+    case JKSN_BLOB:
+        return 1u << JKSN_CONTROL_BLOB | 1u << JKSN_CONTROL_BLOB_HASH;
+    default:
+        return 0;
+    }
+}
+
+void JKSNSchema::compile(const JKSNValue &schema, const std::string &prefix) {
+    size_t index = this->steps.size();
+    this->steps.push_back(Step{true, JKSN_OBJECT, JKSN_UNDEFINED, std::string(), 0, 0, 0, std::string(), JKSNValue(), 0});
+    for(const std::pair<const JKSNValue, JKSNValue> &field : schema.toMap()) {
+        std::string key = field.first.toString();
+        std::string path = prefix.empty() ? key : prefix + '.' + key;
+        size_t child = this->steps.size();
+        if(field.second.isObject())
+            this->compile(field.second, path);
+        else {
+            Step step = {false, JKSN_UNDEFINED, JKSN_UNDEFINED, std::string(), 0, this->slot_names.size(), child+1, std::string(), JKSNValue(), 0};
+            compileType(field.second, step.type, step.element_type);
+            this->steps.push_back(std::move(step));
+            this->slot_names.push_back(std::move(path));
+        }
+        Step &step = this->steps[child];
+        step.key_hash = JKSNKey(key).hash;
+        {
+            JKSNEncoder encoder;
+            std::string encoded;
+            JKSNWriter writer(encoder, encoded);
+            writer.writeText(key.data(), key.size(), step.key_hash, false);
+            step.key_bytes = std::move(encoded);
+        }
+        step.key_value = JKSNValue(key);
+        step.value_kinds = step.is_object ? 0 : valueKinds(step.type);
+        step.key = std::move(key);
+    }
+    this->steps[index].end = this->steps.size();
+}
+
+void JKSNSchema::compileType(const JKSNValue &type, jksn_data_type &result, jksn_data_type &element_type) {
+    static const std::map<std::string, jksn_data_type> type_names = {
+        {"any", JKSN_UNDEFINED},
+        {"null", JKSN_NULL},
+        {"bool", JKSN_BOOL},
+        {"int", JKSN_INT},
+        {"float", JKSN_FLOAT},
+        {"double", JKSN_DOUBLE},
+        {"string", JKSN_STRING},
+        {"blob", JKSN_BLOB}
+    };
+    if(type.isArray()) {
+        if(type.toVector().size() != 1)
+            throw JKSNTypeError("JKSN schema array must hold one element type");
+        const JKSNValue &element = type.toVector()[0];
+        jksn_data_type unused;
+        result = JKSN_ARRAY;
+        if(element.isString())
+            compileType(element, element_type, unused);
+        else
+            element_type = JKSN_UNDEFINED;
+        if(element_type == JKSN_ARRAY)
+            element_type = JKSN_UNDEFINED;
+        return;
+    }
+    std::map<std::string, jksn_data_type>::const_iterator it = type.isString() ? type_names.find(type.toString()) : type_names.end();
+    if(it == type_names.end())
+        throw JKSNTypeError("invalid JKSN schema type");
+    result = it->second;
+}
+
+size_t JKSNSchema::slotIndex(const std::string &path) const {
+    for(size_t i = 0; i < this->slot_names.size(); ++i)
+        if(this->slot_names[i] == path)
+            return i;
+    throw std::out_of_range("JKSN schema has no such field");
+}
+
+std::ostream &JKSNSchema::dump(const std::vector<JKSNValue> &slots, JKSNEncoder &encoder, std::ostream &result, bool header) const {
+    return result << this->dump(slots, encoder, header);
+}
+
+std::string JKSNSchema::dump(const std::vector<JKSNValue> &slots, JKSNEncoder &encoder, bool header) const {
+    if(slots.size() != this->slotCount())
+        throw JKSNEncodeError("JKSN record does not match the schema");
+    std::string result;
+    if(header)
+        result.assign("jk!", 3);
+    JKSNWriter writer(encoder, result);
+    if(!this->name.empty())
+        writer.writePragma(this->name);
+    this->dumpObject(writer, 0, slots);
+    return result;
+}
+
+void JKSNSchema::dumpObject(JKSNWriter &writer, size_t index, const std::vector<JKSNValue> &slots) const {
+    size_t end = this->steps[index].end;
+    size_t count = 0;
+    for(size_t i = index+1; i < end; i = this->steps[i].end)
+        if(this->steps[i].is_object || !slots[this->steps[i].slot].isUndefined())
+            ++count;
+    writer.writeObjectHeader(count);
+    for(size_t i = index+1; i < end; i = this->steps[i].end) {
+        const Step &field = this->steps[i];
+        if(!field.is_object && slots[field.slot].isUndefined())
+            continue;
+        writer.writeEncodedKey(JKSNKey(field.key.data(), field.key.size(), field.key_hash), field.key_bytes);
+        if(field.is_object)
+            this->dumpObject(writer, i, slots);
+        else
+            this->dumpField(writer, field.type, field.element_type, slots[field.slot]);
+    }
+}
+
+void JKSNSchema::dumpField(JKSNWriter &writer, jksn_data_type type, jksn_data_type element_type, const JKSNValue &value) const {
+    if(value.getType() == type)
+        switch(type) {
+        case JKSN_BOOL:
+            writer.writeBool(value.toBool());
+            return;
+        case JKSN_INT:
+            writer.writeInt(value.toInt());
+            return;
+        case JKSN_FLOAT:
+            writer.writeFloat(value.toFloat());
+            return;
+        case JKSN_DOUBLE:
+            writer.writeDouble(value.toDouble());
+            return;
+        case JKSN_STRING:
+            writer.writeString(value.toString());
+            return;
+        case JKSN_BLOB:
+            writer.writeString(value.toString(), true);
+            return;
+        case JKSN_ARRAY:
+            /* Let the generic encoder find a compact form for arrays of numbers */
+            if(element_type == JKSN_BOOL || element_type == JKSN_INT || element_type == JKSN_STRING || element_type == JKSN_BLOB) {
+                writer.writeArrayHeader(value.toVector().size());
+                for(const JKSNValue &item : value.toVector())
+                    this->dumpField(writer, element_type, JKSN_UNDEFINED, item);
+                return;
+            }
+            break;
+        default:
+            break;
+        }
+    writer.writeValue(value);
+}
+
+std::vector<JKSNValue> &JKSNSchema::parse(std::istream &fp, JKSNDecoder &decoder, std::vector<JKSNValue> &slots, bool header) const {
+    JKSNReader reader(decoder, fp, header);
+    slots.assign(this->slotCount(), JKSNValue());
+    this->parseObject(*decoder.p, reader, fp, 0, slots);
+    return slots;
+}
+
+std::vector<JKSNValue> &JKSNSchema::parse(const std::string &str, JKSNDecoder &decoder, std::vector<JKSNValue> &slots, bool header) const {
+    std::istringstream stream(str);
+    return this->parse(stream, decoder, slots, header);
+}
+
+size_t JKSNSchema::findField(size_t index, const std::string &key) const {
+    size_t end = this->steps[index].end;
+    size_t i;
+    for(i = index+1; i < end; i = this->steps[i].end)
+        if(this->steps[i].key == key)
+            break;
+    return i;
+}
+
+/*
+  Fields usually arrive in schema order, so the key of the next one is
+  matched against the stream first: a back reference by its hash, a
+  literal by its encoded bytes. The decoder's hashtable is updated as
+  parseString would, sharing the key value of the step.
+*/
+size_t JKSNSchema::readField(JKSNDecoderPrivate &decoder, JKSNReader &reader, std::istream &fp, size_t index, size_t expected, std::string &key) const {
+    size_t end = this->steps[index].end;
+    uint8_t control = reader.peekControl();
+    if(expected < end && !decoder.intern_keys) {
+        const Step &step = this->steps[expected];
+        if(control == 0x3c) {
+            char hash;
+            fp.get();
+            if(!readBytes(fp, &hash, 1))
+                throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+            const JKSNValue &cached = decoder.cachedString(false, uint8_t(hash));
+            if(cached.isUndefined())
+                throw JKSNDecodeError("JKSN stream requires a non-existing hash");
+            if(uint8_t(hash) == step.key_hash && cached.toStringRef() == step.key)
+                return expected;
+            key = cached.toString();
+            return this->findField(index, key);
+        }
+        /* A short literal holds its length in the control byte, so its bytes can be read blindly */
+        if(control == uint8_t(step.key_bytes[0]) && step.key.size() <= 0xc) {
+            fp.get();
+            key.resize(step.key.size());
+            if(!key.empty() && !readBytes(fp, &key[0], key.size()))
+                throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+            bool matched = key == step.key;
+            uint8_t hash = matched ? step.key_hash : DJBHash(key);
+            decoder.cache.text(hash) = matched ? step.key_value : JKSNValue(key);
+            decoder.text_skipped.reset(hash);
+            return matched ? expected : this->findField(index, key);
+        }
+    }
+    reader.readString(key);
+    return expected < end && this->steps[expected].key == key ? expected : this->findField(index, key);
+}
+
+void JKSNSchema::parseObject(JKSNDecoderPrivate &decoder, JKSNReader &reader, std::istream &fp, size_t index, std::vector<JKSNValue> &slots) const {
+    size_t length;
+    if(!reader.readObjectHeader(length)) {
+        this->scatterObject(reader.readValue(), index, slots);
+        return;
+    }
+    size_t end = this->steps[index].end;
+    size_t expected = index+1;
+    std::string key;
+    for(size_t i = 0; i < length; ++i) {
+        size_t field = this->readField(decoder, reader, fp, index, expected, key);
+        if(field == end) {
+            reader.skipValue();
+            continue;
+        }
+        const Step &step = this->steps[field];
+        if(step.is_object)
+            this->parseObject(decoder, reader, fp, field, slots);
+        else {
+            /* Scalars of the expected kinds skip the generic decoder's frame stack */
+            uint8_t control = reader.peekControl();
+            const JKSNControl &entry = jksn_control_table[control];
+            if(step.value_kinds >> entry.kind & 1) {
+                fp.get();
+                JKSN_COUNT(parse_values[controlFamily(control)], 1);
+                slots[step.slot] = decoder.parseScalar(fp, control, entry, false);
+            } else
+                slots[step.slot] = reader.readValue();
+        }
+        expected = step.end;
+    }
+}
+
+JKSNValue JKSNSchema::toValue(const std::vector<JKSNValue> &slots) const {
+    if(slots.size() != this->slotCount())
+        throw JKSNEncodeError("JKSN record does not match the schema");
+    return this->gatherObject(0, slots);
+}
+
+JKSNValue JKSNSchema::gatherObject(size_t index, const std::vector<JKSNValue> &slots) const {
+    std::map<JKSNValue, JKSNValue> result;
+    size_t end = this->steps[index].end;
+    for(size_t i = index+1; i < end; i = this->steps[i].end) {
+        const Step &field = this->steps[i];
+        if(field.is_object)
+            result[JKSNValue(field.key)] = this->gatherObject(i, slots);
+        else if(!slots[field.slot].isUndefined())
+            result[JKSNValue(field.key)] = slots[field.slot];
+    }
+    return JKSNValue::fromMap(std::move(result));
+}
+
+std::vector<JKSNValue> &JKSNSchema::fromValue(const JKSNValue &value, std::vector<JKSNValue> &slots) const {
+    slots.assign(this->slotCount(), JKSNValue());
+    this->scatterObject(value, 0, slots);
+    return slots;
+}
+
+void JKSNSchema::scatterObject(const JKSNValue &value, size_t index, std::vector<JKSNValue> &slots) const {
+    if(!value.isObject())
+        return;
+    const std::map<JKSNValue, JKSNValue> &fields = value.toMap();
+    size_t end = this->steps[index].end;
+    for(size_t i = index+1; i < end; i = this->steps[i].end) {
+        const Step &field = this->steps[i];
+        std::map<JKSNValue, JKSNValue>::const_iterator it = fields.find(JKSNValue(field.key));
+        if(it == fields.end())
+            continue;
+        if(field.is_object)
+            this->scatterObject(it->second, i, slots);
+        else
+            slots[field.slot] = it->second;
+    }
+}
+
+bool JKSNSchema::peekName(std::istream &fp, JKSNDecoder &decoder, std::string &name, bool header) {
+    /* Reading the name again in parse() stores the same hashtable entry, so this is safe */
+    std::istream::pos_type pos = fp.tellg();
+    JKSNReader reader(decoder, fp, header);
+    JKSNValue pragma;
+    bool found = reader.readPragma(pragma) && pragma.isString();
+    if(found)
+        name = pragma.toString();
+    fp.clear();
+    fp.seekg(pos);
+    return found;
+}
+
+JKSNProjection::JKSNProjection(const std::vector<std::string> &paths) :
+    nodes(1) {
+    for(const std::string &path : paths)
+        this->compile(path);
+}
+
+JKSNValue JKSNProjection::parse(std::istream &fp, JKSNDecoder &decoder, bool header) const {
+    if(header)
+        skipHeader(fp);
+    return this->project(*decoder.p, fp, 0, nullptr);
+}
+
+JKSNValue JKSNProjection::parse(const std::string &str, JKSNDecoder &decoder, bool header) const {
+    std::istringstream stream(str);
+    return this->parse(stream, decoder, header);
+}
+
+void JKSNProjection::compile(const std::string &path) {
+    /* A subscript of * reaches every item, including the indices listed by other paths */
+    std::vector<size_t> current(1, 0);
+    size_t pos = 0;
+    bool expect_key = !path.empty() && path[0] != '[';
+    while(expect_key || pos != path.size()) {
+        std::vector<size_t> next;
+        if(expect_key) {
+            size_t end = path.find_first_of(".[", pos);
+            if(end == std::string::npos)
+                end = path.size();
+            if(end == pos)
+                throw JKSNError("invalid JKSN projection path");
+            std::string key = path.substr(pos, end-pos);
+            for(size_t node : current) {
+                auto it = this->nodes[node].keys.find(key);
+                if(it != this->nodes[node].keys.end())
+                    next.push_back(it->second);
+                else {
+                    this->nodes.emplace_back();
+                    this->nodes[node].keys[key] = this->nodes.size()-1;
+                    next.push_back(this->nodes.size()-1);
+                }
+            }
+            pos = end;
+            expect_key = false;
+        } else if(path[pos] == '.') {
+            pos++;
+            expect_key = true;
+            continue;
+        } else if(path[pos] == '[') {
+            size_t end = path.find(']', pos);
+            if(end == std::string::npos || end == pos+1)
+                throw JKSNError("invalid JKSN projection path");
+            if(end == pos+2 && path[pos+1] == '*')
+                for(size_t node : current) {
+                    if(this->nodes[node].every == 0) {
+                        this->nodes.emplace_back();
+                        this->nodes[node].every = this->nodes.size()-1;
+                    }
+                    next.push_back(this->nodes[node].every);
+                    for(const auto &i : this->nodes[node].indices)
+                        next.push_back(i.second);
+                }
+            else {
+                size_t index = 0;
+                for(size_t i = pos+1; i != end; i++) {
+                    if(path[i] < '0' || path[i] > '9' || index > (SIZE_MAX - 9) / 10)
+                        throw JKSNError("invalid JKSN projection path");
+                    index = index*10 + size_t(path[i] - '0');
+                }
+                for(size_t node : current) {
+                    auto it = this->nodes[node].indices.find(index);
+                    if(it != this->nodes[node].indices.end())
+                        next.push_back(it->second);
+                    else {
+                        /* An index also gets what earlier paths selected for every item */
+                        size_t item;
+                        if(this->nodes[node].every != 0)
+                            item = this->copyNode(this->nodes[node].every);
+                        else {
+                            this->nodes.emplace_back();
+                            item = this->nodes.size()-1;
+                        }
+                        this->nodes[node].indices[index] = item;
+                        next.push_back(item);
+                    }
+                }
+            }
+            pos = end+1;
+        } else
+            throw JKSNError("invalid JKSN projection path");
+        current.swap(next);
+    }
+    for(size_t node : current)
+        this->nodes[node].whole = true;
+}
+
+size_t JKSNProjection::copyNode(size_t node) {
+    Node copy = this->nodes[node];
+    for(auto &i : copy.keys)
+        i.second = this->copyNode(i.second);
+    for(auto &i : copy.indices)
+        i.second = this->copyNode(i.second);
+    if(copy.every != 0)
+        copy.every = this->copyNode(copy.every);
+    this->nodes.push_back(std::move(copy));
+    return this->nodes.size()-1;
+}
+
+/* The node for an item of an array, or for one cell of the rows of a swapped array */
+size_t JKSNProjection::itemNode(size_t node, size_t index, const std::string *column) const {
+    const Node &current = this->nodes[node];
+    auto it = current.indices.find(index);
+    size_t item = it != current.indices.end() ? it->second : current.every;
+    if(item == 0 || !column || this->nodes[item].whole)
+        return item;
+    auto cell = this->nodes[item].keys.find(*column);
+    return cell != this->nodes[item].keys.end() ? cell->second : 0;
+}
+
+/* Items from here on are passed over and left out */
+size_t JKSNProjection::itemLimit(size_t node) const {
+    const Node &current = this->nodes[node];
+    if(current.every != 0)
+        return SIZE_MAX;
+    else
+        return current.indices.empty() ? 0 : current.indices.crbegin()->first + 1;
+}
+
+bool JKSNProjection::hasColumn(size_t node, const std::string &column) const {
+    const Node &current = this->nodes[node];
+    auto selects = [&](size_t item) {
+        return item != 0 && (this->nodes[item].whole || this->nodes[item].keys.count(column) != 0);
+    };
+    if(selects(current.every))
+        return true;
+    for(const auto &i : current.indices)
+        if(selects(i.second))
+            return true;
+    return false;
+}
+
+/*
+  Decode the value selected by node. With a column, the value is a column
+  of a row-col swapped array, and node selects the rows.
+*/
+JKSNValue JKSNProjection::project(JKSNDecoderPrivate &decoder, std::istream &fp, size_t node, const std::string *column) const {
+    if(!column && this->nodes[node].whole)
+        return decoder.parseValue(fp);
+    std::streambuf *input = fp.rdbuf();
+    /* Widths of delayed checksums, which follow the value */
+    std::vector<uint8_t> trailers;
+    JKSNValue result;
+    for(;;) {
+        std::streambuf::int_type signed_control = input->sbumpc();
+        if(signed_control == std::streambuf::traits_type::eof()) {
+            fp.setstate(std::ios_base::eofbit | std::ios_base::failbit);
+            throw JKSNDecodeError("JKSN stream may be truncated or corrupted");
+        }
+        uint8_t control = uint8_t(signed_control);
+        const JKSNControl &entry = jksn_control_table[control];
+        switch(entry.kind) {
+        case JKSN_CONTROL_CLEAR_HASH:
+            decoder.clearHash();
+            continue;
+        case JKSN_CONTROL_REFRESH:
+            for(size_t length = decoder.decodeLength(fp, entry); length != 0; --length)
+                decoder.skipValue(fp);
+            continue;
+        case JKSN_CONTROL_PADDING:
+            continue;
+        case JKSN_CONTROL_CHECKSUM:
+            decoder.skipBytes(fp, entry.width);
+            continue;
+        case JKSN_CONTROL_DELAYED_CHECKSUM:
+            trailers.push_back(entry.width);
+            continue;
+        case JKSN_CONTROL_PRAGMA:
+            decoder.skipValue(fp);
+            continue;
+        case JKSN_CONTROL_ARRAY:
+        case JKSN_CONTROL_LENGTHLESS:
+            result = this->projectArray(decoder, fp, control, node, column);
+            break;
+        case JKSN_CONTROL_OBJECT:
+        case JKSN_CONTROL_SWAPPED:
+            if(column)
+                throw JKSNDecodeError("JKSN row-col swapped array requires an array but not found");
+            if(entry.kind == JKSN_CONTROL_OBJECT)
+                result = this->projectObject(decoder, fp, control, node);
+            else
+                result = this->projectSwapped(decoder, fp, control, node);
+            break;
+        default:
+            /* Scalars are small, XOR compressed arrays have to be decoded anyway */
+            result = this->select(decoder.parseScalar(fp, control, entry, false), node, column);
+            break;
+        }
+        break;
+    }
+    for(auto it = trailers.crbegin(); it != trailers.crend(); ++it)
+        decoder.skipBytes(fp, *it);
+    return result;
 }
 
-JKSNValue JKSNDecoderPrivate::parseSwappedArray(std::istream &fp, size_t column_length) {
+JKSNValue JKSNProjection::projectArray(JKSNDecoderPrivate &decoder, std::istream &fp, uint8_t control, size_t node, const std::string *column) const {
+    const JKSNControl &entry = jksn_control_table[control];
+    bool lengthless = entry.kind == JKSN_CONTROL_LENGTHLESS;
+    size_t length = lengthless ? 0 : decoder.decodeLength(fp, entry);
+    size_t limit = this->itemLimit(node);
     std::vector<JKSNValue> result;
-    while(column_length--) {
-        JKSNValue column_name = this->parseValue(fp);
-        JKSNValue column_values = this->parseValue(fp);
-        if(!column_values.isArray())
-            throw JKSNDecodeError("JKSN row-col swapped array requires an array but not found");
-        std::vector<JKSNValue> &column_values_vector = column_values.toVector();
-        for(size_t i = 0; i < column_values_vector.size(); ++i) {
-            if(i == result.size())
-                result.push_back(JKSNValue::fromMap(std::map<JKSNValue, JKSNValue>()));
-            if(!column_values_vector[i].isUnspecified())
-                result[i].toMap()[column_name] = std::move(column_values_vector[i]);
+    for(size_t i = 0; lengthless || i < length; i++) {
+        size_t item = i < limit ? this->itemNode(node, i, column) : 0;
+        if(item != 0) {
+            JKSNValue value = this->project(decoder, fp, item, nullptr);
+            if(lengthless && value.isUnspecified())
+                break;
+            result.push_back(std::move(value));
+        } else {
+            if(decoder.skipValue(fp) && lengthless)
+                break;
+            if(i < limit)
+                result.emplace_back();
+        }
+    }
+    return JKSNValue(std::move(result));
+}
+
+JKSNValue JKSNProjection::projectObject(JKSNDecoderPrivate &decoder, std::istream &fp, uint8_t control, size_t node) const {
+    const Node &current = this->nodes[node];
+    std::map<JKSNValue, JKSNValue> result;
+    for(size_t length = decoder.decodeLength(fp, control); length != 0; --length) {
+        JKSNValue key = decoder.parseValue(fp);
+        auto it = key.isString() ? current.keys.find(key.toStringRef()) : current.keys.end();
+        if(it == current.keys.end()) {
+            decoder.skipValue(fp);
+            continue;
+        }
+        JKSNValue value = this->project(decoder, fp, it->second, nullptr);
+        if(!value.isUndefined()) {
+            if(decoder.intern_keys)
+                key = JKSNValue::intern(key);
+            result[std::move(key)] = std::move(value);
         }
     }
     return JKSNValue(std::move(result));
 }
 
+JKSNValue JKSNProjection::projectSwapped(JKSNDecoderPrivate &decoder, std::istream &fp, uint8_t control, size_t node) const {
+    std::vector<JKSNValue> rows;
+    for(size_t columns = decoder.decodeLength(fp, control); columns != 0; --columns) {
+        JKSNValue key = decoder.parseValue(fp);
+        if(!key.isString() || !this->hasColumn(node, key.toStringRef())) {
+            decoder.skipValue(fp);
+            continue;
+        }
+        if(decoder.intern_keys)
+            key = JKSNValue::intern(key);
+        JKSNValue column = this->project(decoder, fp, node, &key.toStringRef());
+        std::vector<JKSNValue> &cells = column.mutableVector();
+        for(size_t i = 0; i < cells.size(); ++i) {
+            /* Rows nobody asked for stay undefined, as in arrays */
+            if(i == rows.size())
+                rows.push_back(this->itemNode(node, i, nullptr) != 0 ? JKSNValue(std::map<JKSNValue, JKSNValue>()) : JKSNValue());
+            if(!cells[i].isUndefined() && !cells[i].isUnspecified())
+                rows[i].mutableMap()[key] = std::move(cells[i]);
+        }
+    }
+    return JKSNValue(std::move(rows));
+}
+
+/* Project a value that is already decoded */
+JKSNValue JKSNProjection::select(const JKSNValue &value, size_t node, const std::string *column) const {
+    const Node &current = this->nodes[node];
+    if(!column && current.whole)
+        return value;
+    if(value.isArray()) {
+        const std::vector<JKSNValue> &items = value.toVector();
+        size_t limit = std::min(items.size(), this->itemLimit(node));
+        std::vector<JKSNValue> result;
+        result.reserve(limit);
+        for(size_t i = 0; i < limit; ++i) {
+            size_t item = this->itemNode(node, i, column);
+            result.push_back(item != 0 ? this->select(items[i], item, nullptr) : JKSNValue());
+        }
+        return JKSNValue(std::move(result));
+    } else if(column)
+        throw JKSNDecodeError("JKSN row-col swapped array requires an array but not found");
+    else if(value.isObject()) {
+        std::map<JKSNValue, JKSNValue> result;
+        for(const auto &member : value.toMap()) {
+            if(!member.first.isString())
+                continue;
+            auto it = current.keys.find(member.first.toStringRef());
+            if(it == current.keys.end())
+                continue;
+            JKSNValue selected = this->select(member.second, it->second, nullptr);
+            if(!selected.isUndefined())
+                result[member.first] = std::move(selected);
+        }
+        return JKSNValue(std::move(result));
+    } else
+        return value.isUnspecified() ? value : JKSNValue();
+}
+
+/* A block archive starts with block_magic and ends with the block count and block_trailer */
+static const char block_magic[8] = {'j', 'k', '!', 'b', 'l', 'o', 'c', 'k'};
+static const char block_trailer[8] = {'j', 'k', '!', 'i', 'n', 'd', 'e', 'x'};
+static const size_t block_entry_size = 24;
+static const size_t block_trailer_size = 16;
+
+static std::vector<JKSNBlockInfo> readBlockIndex(std::istream &fp, uint64_t &end) {
+    char buf[block_entry_size];
+    fp.seekg(0, std::ios::end);
+    std::istream::pos_type file_end = fp.tellg();
+    if(!fp || file_end < std::istream::pos_type(sizeof block_magic + block_trailer_size))
+        throw JKSNDecodeError("not a JKSN block archive");
+    uint64_t file_size = uint64_t(std::streamoff(file_end));
+    fp.seekg(0);
+    if(!readBytes(fp, buf, sizeof block_magic))
+        throw JKSNError("cannot read the JKSN block archive");
+    if(std::memcmp(buf, block_magic, sizeof block_magic))
+        throw JKSNDecodeError("not a JKSN block archive");
+    fp.seekg(std::streamoff(file_size - block_trailer_size));
+    if(!readBytes(fp, buf, block_trailer_size))
+        throw JKSNError("cannot read the JKSN block archive");
+    if(std::memcmp(buf + 8, block_trailer, sizeof block_trailer))
+        throw JKSNDecodeError("not a JKSN block archive");
+    uint64_t block_count = decodeUint64(buf);
+    if(block_count > (file_size - sizeof block_magic - block_trailer_size) / block_entry_size)
+        throw JKSNDecodeError("not a JKSN block archive");
+    end = file_size - block_trailer_size - block_count * block_entry_size;
+    fp.seekg(std::streamoff(end));
+    std::vector<JKSNBlockInfo> result(static_cast<size_t>(block_count));
+    uint64_t offset = sizeof block_magic;
+    uint64_t first = 0;
+    for(JKSNBlockInfo &entry : result) {
+        if(!readBytes(fp, buf, block_entry_size))
+            throw JKSNError("cannot read the JKSN block archive");
+        entry.offset = decodeUint64(buf);
+        entry.size = decodeUint64(buf + 8);
+        entry.records = decodeUint64(buf + 16);
+        entry.first = first;
+        /* Blocks are in file order and lie between the magic and the index */
+        if(entry.offset < offset || entry.offset > end || entry.size > end - entry.offset || entry.records > uint64_t(-1) - first)
+            throw JKSNDecodeError("not a JKSN block archive");
+        offset = entry.offset + entry.size;
+        first += entry.records;
+    }
+    return result;
+}
+
+JKSNBlockWriter::JKSNBlockWriter(std::ostream &fp) :
+    fp(fp),
+    offset(sizeof block_magic),
+    closed(false) {
+    fp.seekp(0);
+    if(!fp.write(block_magic, sizeof block_magic))
+        throw JKSNError("cannot write the JKSN block archive");
+}
+
+JKSNBlockWriter::JKSNBlockWriter(std::iostream &fp, bool append) :
+    fp(fp),
+    offset(sizeof block_magic),
+    closed(false) {
+    if(append)
+        /* New blocks overwrite the old index, a longer one is written on close */
+        this->blocks = readBlockIndex(fp, this->offset);
+    else {
+        fp.seekp(0);
+        if(!fp.write(block_magic, sizeof block_magic))
+            throw JKSNError("cannot write the JKSN block archive");
+    }
+}
+
+JKSNBlockWriter::~JKSNBlockWriter() {
+    try {
+        this->close();
+    } catch(const JKSNError &) {
+    }
+}
+
+void JKSNBlockWriter::write(const JKSNValue &records) {
+    if(this->closed)
+        throw JKSNError("JKSN block archive is already closed");
+    const std::vector<JKSNValue> &items = records.toVector();
+    /* A new encoder refers to no hash or integer of the blocks before */
+    std::string stream = JKSNEncoder().dump(records, false);
+    uint32_t crc = CRC32(stream.data(), stream.size());
+    char checksum[5] = {
+        char(0xf1),
+        char(uint8_t(crc >> 24)),
+        char(uint8_t(crc >> 16)),
+        char(uint8_t(crc >> 8)),
+        char(uint8_t(crc))
+    };
+    this->fp.seekp(std::streamoff(this->offset));
+    if(!this->fp.write(checksum, sizeof checksum) || !this->fp.write(stream.data(), std::streamsize(stream.size())))
+        throw JKSNError("cannot write the JKSN block archive");
+    JKSNBlockInfo entry;
+    entry.offset = this->offset;
+    entry.size = sizeof checksum + stream.size();
+    entry.records = items.size();
+    entry.first = this->blocks.empty() ? 0 : this->blocks.back().first + this->blocks.back().records;
+    this->blocks.push_back(entry);
+    this->offset += entry.size;
+}
+
+void JKSNBlockWriter::close() {
+    if(this->closed)
+        return;
+    this->closed = true;
+    char buf[block_entry_size];
+    this->fp.seekp(std::streamoff(this->offset));
+    for(const JKSNBlockInfo &entry : this->blocks) {
+        encodeUint64(buf, entry.offset);
+        encodeUint64(buf + 8, entry.size);
+        encodeUint64(buf + 16, entry.records);
+        this->fp.write(buf, block_entry_size);
+    }
+    encodeUint64(buf, this->blocks.size());
+    std::memcpy(buf + 8, block_trailer, sizeof block_trailer);
+    if(!this->fp.write(buf, block_trailer_size) || !this->fp.flush())
+        throw JKSNError("cannot write the JKSN block archive");
+}
+
+JKSNBlockReader::JKSNBlockReader(std::istream &fp) :
+    fp(fp) {
+    uint64_t end;
+    this->blocks = readBlockIndex(fp, end);
+}
+
+uint64_t JKSNBlockReader::recordCount() const {
+    return this->blocks.empty() ? 0 : this->blocks.back().first + this->blocks.back().records;
+}
+
+std::string JKSNBlockReader::loadBlock(size_t block) {
+    const JKSNBlockInfo &entry = this->blocks.at(block);
+    std::string result(size_t(entry.size), '\0');
+    this->fp.clear();
+    this->fp.seekg(std::streamoff(entry.offset));
+    if(!readBytes(this->fp, &result[0], result.size()))
+        throw JKSNError("cannot read the JKSN block archive");
+    return result;
+}
+
+JKSNValue JKSNBlockReader::parseBlock(const std::string &block) {
+    if(block.size() < 5 || uint8_t(block[0]) != 0xf1)
+        throw JKSNDecodeError("not a JKSN block archive");
+    uint32_t crc = uint32_t(uint8_t(block[1])) << 24 | uint32_t(uint8_t(block[2])) << 16 |
+                   uint32_t(uint8_t(block[3])) << 8 | uint32_t(uint8_t(block[4]));
+    if(CRC32(block.data() + 5, block.size() - 5) != crc)
+        throw JKSNChecksumError();
+    /* The decoder passes over the checksum by itself */
+    std::istringstream fp(block);
+    JKSNValue result = JKSNDecoder().parse(fp, false);
+    if(!result.isArray() || fp.peek() != std::istream::traits_type::eof())
+        throw JKSNDecodeError("not a JKSN block archive");
+    return result;
+}
+
+JKSNValue JKSNBlockReader::readBlock(size_t block) {
+    JKSNValue result = parseBlock(this->loadBlock(block));
+    if(result.toVector().size() != this->blocks[block].records)
+        throw JKSNDecodeError("not a JKSN block archive");
+    return result;
+}
+
+JKSNValue JKSNBlockReader::readRecord(uint64_t record) {
+    if(record >= this->recordCount())
+        throw std::out_of_range("JKSN block archive has no such record");
+    /* The last block starting at or before the record holds it, empty blocks are passed over */
+    auto it = std::upper_bound(this->blocks.cbegin(), this->blocks.cend(), record, [](uint64_t record, const JKSNBlockInfo &entry) {
+        return record < entry.first;
+    }) - 1;
+    JKSNValue block = this->readBlock(size_t(it - this->blocks.cbegin()));
+    return std::move(block.toVector()[size_t(record - it->first)]);
+}
+
+static void skipHeader(std::istream &fp) {
+    char header_buf[3];
+    if(!fp.read(header_buf, 3) || fp.gcount() != 3 || std::memcmp(header_buf, "jk!", 3)) {
+        fp.clear();
+        fp.seekg(-fp.gcount(), fp.cur);
+    }
+}
+
+/* Unformatted reads straight from the stream buffer, skipping the sentry of istream::read */
+static inline bool readBytes(std::istream &fp, char *buffer, size_t size) {
+    if(size_t(fp.rdbuf()->sgetn(buffer, std::streamsize(size))) == size)
+        return true;
+    fp.setstate(std::ios_base::eofbit | std::ios_base::failbit);
+    return false;
+}
 
 static inline bool isLittleEndian() {
     static const union {
@@ -1243,6 +4899,28 @@ static inline bool isLittleEndian() {
     return endiantest.byte == 1;
 }
 
+static inline unsigned countLeadingZeros(uint64_t x) {
+#if defined(__GNUC__)
+    return x != 0 ? unsigned(__builtin_clzll(x)) : 64;
+#else
+    unsigned result = 0;
+    for(uint64_t mask = uint64_t(1) << 63; mask != 0 && !(x & mask); mask >>= 1)
+        ++result;
+    return result;
+#endif
+}
+
+static inline unsigned countTrailingZeros(uint64_t x) {
+#if defined(__GNUC__)
+    return x != 0 ? unsigned(__builtin_ctzll(x)) : 64;
+#else
+    unsigned result = 0;
+    for(uint64_t mask = 1; mask != 0 && !(x & mask); mask <<= 1)
+        ++result;
+    return result;
+#endif
+}
+
 static bool UTF8CheckContinuation(const std::string &utf8str, size_t start, size_t check_length) {
     if(utf8str.size() > start + check_length) {
         while(check_length--)
@@ -1256,6 +4934,7 @@ static bool UTF8CheckContinuation(const std::string &utf8str, size_t start, size
 static std::string UTF8ToUTF16LE(const std::string &utf8str, bool strict) {
     std::string utf16str;
     size_t i = 0;
+    JKSN_COUNT(utf8_to_utf16_bytes, utf8str.size());
     utf16str.reserve(utf8str.size());
     while(i < utf8str.size()) {
         if(uint8_t(utf8str[i]) < 0x80) {
@@ -1317,6 +4996,7 @@ static std::string UTF8ToUTF16LE(const std::string &utf8str, bool strict) {
 static std::string UTF16ToUTF8(const std::u16string &utf16str) {
     std::string utf8str;
     size_t i = 0;
+    JKSN_COUNT(utf16_to_utf8_bytes, utf16str.size()*2);
     utf8str.reserve(utf16str.size()*2);
     while(i < utf16str.size()) {
         if(uint16_t(utf16str[i]) < 0x80) {
@@ -1354,12 +5034,466 @@ static std::string UTF16ToUTF8(const std::u16string &utf16str) {
 }
 
 static uint8_t DJBHash(const std::string &buf, uint8_t iv) {
+    return DJBHash(buf.data(), buf.size(), iv);
+}
+
+static uint8_t DJBHash(const char *buf, size_t size, uint8_t iv) {
     unsigned int result = iv;
-    for(char i : buf)
-        result += (result << 5) + uint8_t(i);
+    for(size_t i = 0; i < size; ++i)
+        result += (result << 5) + uint8_t(buf[i]);
+    return uint8_t(result);
+}
+
+/* Constants and mixing function after wyhash */
+static uint32_t CRC32(const char *buf, size_t size) {
+    /* The CRC-32 of zlib, half a byte at a time */
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+    };
+    uint32_t crc = 0xffffffff;
+    for(size_t i = 0; i < size; i++) {
+        crc ^= uint8_t(buf[i]);
+        crc = (crc >> 4) ^ table[crc & 0xf];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+    }
+    return ~crc;
+}
+
+static void encodeUint64(char *buf, uint64_t number) {
+    for(size_t i = 0; i < 8; i++)
+        buf[i] = char(uint8_t(number >> (56 - i*8)));
+}
+
+static uint64_t decodeUint64(const char *buf) {
+    uint64_t result = 0;
+    for(size_t i = 0; i < 8; i++)
+        result = (result << 8) | uint8_t(buf[i]);
     return result;
 }
 
+/*
+  Shortest decimal digits that read back to the same number, after Grisu2
+  by Florian Loitsch. Numbers are f * 2^e, and the digits are produced
+  with 64-bit arithmetic from a table of cached powers of ten.
+*/
+struct DiyFp {
+    uint64_t f;
+    int e;
+};
+
+static inline DiyFp DiyFpMultiply(DiyFp x, DiyFp y) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t product = __uint128_t(x.f) * y.f;
+    uint64_t high = uint64_t(product >> 64);
+    /* Round half up */
+    if(uint64_t(product) >> 63)
+        high++;
+    return DiyFp{high, x.e + y.e + 64};
+#else
+    uint64_t a = x.f >> 32, b = uint32_t(x.f), c = y.f >> 32, d = uint32_t(y.f);
+    uint64_t ac = a*c, bc = b*c, ad = a*d, bd = b*d;
+    uint64_t middle = (bd >> 32) + uint32_t(ad) + uint32_t(bc) + (uint64_t(1) << 31);
+    return DiyFp{ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e + y.e + 64};
+#endif
+}
+
+static inline DiyFp DiyFpNormalize(DiyFp x) {
+    unsigned shift = countLeadingZeros(x.f);
+    return DiyFp{x.f << shift, x.e - int(shift)};
+}
+
+/* The closest cached power c with -60 <= e + c.e + 64 <= -32, with c = 10^-K */
+static DiyFp GrisuCachedPower(int e, int &K) {
+    /* 10^-348, 10^-340, ..., 10^340 */
+    static const DiyFp powers[87] = {
+    {0xfa8fd5a0081c0288, -1220}, {0xbaaee17fa23ebf76, -1193}, {0x8b16fb203055ac76, -1166},
+    {0xcf42894a5dce35ea, -1140}, {0x9a6bb0aa55653b2d, -1113}, {0xe61acf033d1a45df, -1087},
+    {0xab70fe17c79ac6ca, -1060}, {0xff77b1fcbebcdc4f, -1034}, {0xbe5691ef416bd60c, -1007},
+    {0x8dd01fad907ffc3c, -980}, {0xd3515c2831559a83, -954}, {0x9d71ac8fada6c9b5, -927},
+    {0xea9c227723ee8bcb, -901}, {0xaecc49914078536d, -874}, {0x823c12795db6ce57, -847},
+    {0xc21094364dfb5637, -821}, {0x9096ea6f3848984f, -794}, {0xd77485cb25823ac7, -768},
+    {0xa086cfcd97bf97f4, -741}, {0xef340a98172aace5, -715}, {0xb23867fb2a35b28e, -688},
+    {0x84c8d4dfd2c63f3b, -661}, {0xc5dd44271ad3cdba, -635}, {0x936b9fcebb25c996, -608},
+    {0xdbac6c247d62a584, -582}, {0xa3ab66580d5fdaf6, -555}, {0xf3e2f893dec3f126, -529},
+    {0xb5b5ada8aaff80b8, -502}, {0x87625f056c7c4a8b, -475}, {0xc9bcff6034c13053, -449},
+    {0x964e858c91ba2655, -422}, {0xdff9772470297ebd, -396}, {0xa6dfbd9fb8e5b88f, -369},
+    {0xf8a95fcf88747d94, -343}, {0xb94470938fa89bcf, -316}, {0x8a08f0f8bf0f156b, -289},
+    {0xcdb02555653131b6, -263}, {0x993fe2c6d07b7fac, -236}, {0xe45c10c42a2b3b06, -210},
+    {0xaa242499697392d3, -183}, {0xfd87b5f28300ca0e, -157}, {0xbce5086492111aeb, -130},
+    {0x8cbccc096f5088cc, -103}, {0xd1b71758e219652c, -77}, {0x9c40000000000000, -50},
+    {0xe8d4a51000000000, -24}, {0xad78ebc5ac620000, 3}, {0x813f3978f8940984, 30},
+    {0xc097ce7bc90715b3, 56}, {0x8f7e32ce7bea5c70, 83}, {0xd5d238a4abe98068, 109},
+    {0x9f4f2726179a2245, 136}, {0xed63a231d4c4fb27, 162}, {0xb0de65388cc8ada8, 189},
+    {0x83c7088e1aab65db, 216}, {0xc45d1df942711d9a, 242}, {0x924d692ca61be758, 269},
+    {0xda01ee641a708dea, 295}, {0xa26da3999aef774a, 322}, {0xf209787bb47d6b85, 348},
+    {0xb454e4a179dd1877, 375}, {0x865b86925b9bc5c2, 402}, {0xc83553c5c8965d3d, 428},
+    {0x952ab45cfa97a0b3, 455}, {0xde469fbd99a05fe3, 481}, {0xa59bc234db398c25, 508},
+    {0xf6c69a72a3989f5c, 534}, {0xb7dcbf5354e9bece, 561}, {0x88fcf317f22241e2, 588},
+    {0xcc20ce9bd35c78a5, 614}, {0x98165af37b2153df, 641}, {0xe2a0b5dc971f303a, 667},
+    {0xa8d9d1535ce3b396, 694}, {0xfb9b7cd9a4a7443c, 720}, {0xbb764c4ca7a44410, 747},
+    {0x8bab8eefb6409c1a, 774}, {0xd01fef10a657842c, 800}, {0x9b10a4e5e9913129, 827},
+    {0xe7109bfba19c0c9d, 853}, {0xac2820d9623bf429, 880}, {0x80444b5e7aa7cf85, 907},
+    {0xbf21e44003acdd2d, 933}, {0x8e679c2f5e44ff8f, 960}, {0xd433179d9c8cb841, 986},
+    {0x9e19db92b4e31ba9, 1013}, {0xeb96bf6ebadf77d9, 1039}, {0xaf87023b9bf0ee6b, 1066},
+    };
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int k = int(dk);
+    if(dk - k > 0.0)
+        k++;
+    unsigned index = unsigned((k >> 3) + 1);
+    K = -(-348 + int(index << 3));
+    return powers[index];
+}
+
+static const uint64_t grisu_pow10[20] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull, 1000000000ull,
+    10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull, 100000000000000ull,
+    1000000000000000ull, 10000000000000000ull, 100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull
+};
+
+static inline void GrisuRound(char *buffer, int length, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+    while(rest < wp_w && delta - rest >= ten_kappa && (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buffer[length-1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int GrisuDigits(DiyFp w, DiyFp mp, uint64_t delta, char *buffer, int &K) {
+    DiyFp one = {uint64_t(1) << -mp.e, mp.e};
+    uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = uint32_t(mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = 1;
+    while(kappa < 10 && p1 >= grisu_pow10[kappa])
+        kappa++;
+    int length = 0;
+    while(kappa > 0) {
+        uint32_t digit = uint32_t(p1 / grisu_pow10[kappa-1]);
+        p1 = uint32_t(p1 % grisu_pow10[kappa-1]);
+        if(digit != 0 || length != 0)
+            buffer[length++] = char('0' + digit);
+        kappa--;
+        uint64_t rest = (uint64_t(p1) << -one.e) + p2;
+        if(rest <= delta) {
+            K += kappa;
+            GrisuRound(buffer, length, delta, rest, grisu_pow10[kappa] << -one.e, wp_w);
+            return length;
+        }
+    }
+    for(;;) {
+        p2 *= 10;
+        delta *= 10;
+        char digit = char(p2 >> -one.e);
+        if(digit != 0 || length != 0)
+            buffer[length++] = char('0' + digit);
+        p2 &= one.f - 1;
+        kappa--;
+        if(p2 < delta) {
+            K += kappa;
+            GrisuRound(buffer, length, delta, p2, one.f, wp_w * (-kappa < 20 ? grisu_pow10[-kappa] : 0));
+            return length;
+        }
+    }
+}
+
+/* Writes f * 2^e, f > 0, as JavaScript would write a number */
+static size_t GrisuFormat(uint64_t f, int e, bool lower_closer, bool negative, char *buffer) {
+    char *start = buffer;
+    if(negative)
+        *buffer++ = '-';
+    DiyFp plus = DiyFpNormalize(DiyFp{(f << 1) + 1, e - 1});
+    DiyFp minus = lower_closer ? DiyFp{(f << 2) - 1, e - 2} : DiyFp{(f << 1) - 1, e - 1};
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+    int K;
+    DiyFp cached = GrisuCachedPower(plus.e, K);
+    DiyFp w = DiyFpMultiply(DiyFpNormalize(DiyFp{f, e}), cached);
+    DiyFp wp = DiyFpMultiply(plus, cached);
+    DiyFp wm = DiyFpMultiply(minus, cached);
+    wm.f++;
+    wp.f--;
+    int length = GrisuDigits(w, wp, wp.f - wm.f, buffer, K);
+    /* The number is 0.ddd * 10^point */
+    int point = length + K;
+    if(length <= point && point <= 21) {
+        std::memset(buffer + length, '0', size_t(point - length));
+        buffer += point;
+    } else if(0 < point && point <= 21) {
+        std::memmove(buffer + point + 1, buffer + point, size_t(length - point));
+        buffer[point] = '.';
+        buffer += length + 1;
+    } else if(-6 < point && point <= 0) {
+        int offset = 2 - point;
+        std::memmove(buffer + offset, buffer, size_t(length));
+        buffer[0] = '0';
+        buffer[1] = '.';
+        std::memset(buffer + 2, '0', size_t(offset - 2));
+        buffer += length + offset;
+    } else {
+        if(length != 1) {
+            std::memmove(buffer + 2, buffer + 1, size_t(length - 1));
+            buffer[1] = '.';
+            buffer += length + 1;
+        } else
+            buffer++;
+        int exponent = point - 1;
+        *buffer++ = 'e';
+        *buffer++ = exponent < 0 ? '-' : '+';
+        if(exponent < 0)
+            exponent = -exponent;
+        if(exponent >= 100)
+            *buffer++ = char('0' + exponent / 100);
+        if(exponent >= 10)
+            *buffer++ = char('0' + exponent / 10 % 10);
+        *buffer++ = char('0' + exponent % 10);
+    }
+    return size_t(buffer - start);
+}
+
+/* Finite numbers only, the buffer holds at least 32 bytes */
+static size_t formatDouble(double number, char *buffer) {
+    uint64_t bits;
+    std::memcpy(&bits, &number, sizeof bits);
+    bool negative = bits >> 63;
+    unsigned biased = unsigned(bits >> 52) & 0x7ff;
+    uint64_t f = bits & ((uint64_t(1) << 52) - 1);
+    if(biased == 0 && f == 0) {
+        if(negative)
+            std::memcpy(buffer, "-0", 2);
+        else
+            buffer[0] = '0';
+        return negative ? 2 : 1;
+    }
+    if(biased != 0)
+        return GrisuFormat(f | (uint64_t(1) << 52), int(biased) - 1075, f == 0 && biased > 1, negative, buffer);
+    else
+        return GrisuFormat(f, -1074, false, negative, buffer);
+}
+
+static size_t formatFloat(float number, char *buffer) {
+    uint32_t bits;
+    std::memcpy(&bits, &number, sizeof bits);
+    bool negative = bits >> 31;
+    unsigned biased = (bits >> 23) & 0xff;
+    uint64_t f = bits & ((uint32_t(1) << 23) - 1);
+    if(biased == 0 && f == 0) {
+        if(negative)
+            std::memcpy(buffer, "-0", 2);
+        else
+            buffer[0] = '0';
+        return negative ? 2 : 1;
+    }
+    if(biased != 0)
+        return GrisuFormat(f | (uint64_t(1) << 23), int(biased) - 150, f == 0 && biased > 1, negative, buffer);
+    else
+        return GrisuFormat(f, -149, false, negative, buffer);
+}
+
+/* The buffer holds at least 64 bytes */
+static size_t formatLongDouble(long double number, char *buffer) {
+    double narrowed = double(number);
+    if((long double) narrowed == number)
+        return formatDouble(narrowed, buffer);
+    int size = std::snprintf(buffer, 64, "%.*Lg", std::numeric_limits<long double>::max_digits10, number);
+    return size > 0 ? std::min(size_t(size), size_t(63)) : 0;
+}
+
+static const uint64_t hash_secret[4] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+
+static inline uint64_t hashMix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t product = __uint128_t(a) * b;
+    return uint64_t(product) ^ uint64_t(product >> 64);
+#else
+    uint64_t ha = a >> 32, la = uint32_t(a), hb = b >> 32, lb = uint32_t(b);
+    uint64_t hi = ha*hb, mid1 = ha*lb, mid2 = la*hb, lo = la*lb;
+    uint64_t carry = ((lo >> 32) + uint32_t(mid1) + uint32_t(mid2)) >> 32;
+    lo += (mid1 << 32) + (mid2 << 32);
+    hi += (mid1 >> 32) + (mid2 >> 32) + carry;
+    return lo ^ hi;
+#endif
+}
+
+static uint64_t hashBytes(const char *buf, size_t size, uint64_t seed) {
+    uint64_t state = seed ^ hash_secret[0];
+    size_t i = 0;
+    for(; i + 16 <= size; i += 16) {
+        uint64_t a, b;
+        std::memcpy(&a, buf+i, 8);
+        std::memcpy(&b, buf+i+8, 8);
+        state = hashMix(a ^ hash_secret[1], b ^ state);
+    }
+    uint64_t a = 0, b = 0;
+    size_t tail = size - i;
+    if(tail > 8) {
+        std::memcpy(&a, buf+i, 8);
+        std::memcpy(&b, buf+i+8, tail-8);
+    } else
+        std::memcpy(&a, buf+i, tail);
+    return hashMix(hash_secret[1] ^ uint64_t(size), hashMix(a ^ hash_secret[1], b ^ state));
+}
+
+/* Clears cacheable if a box in the subtree may change behind its cached hash */
+size_t JKSNValue::hash(bool &cacheable) const {
+    /* Each type gets its own seed, but all numbers share one since 1 == 1.0 */
+    enum : uint64_t {
+        seed_number = 0x10, seed_string = 0x40, seed_blob = 0x50,
+        seed_array = 0x80, seed_object = 0x90, seed_unspecified = 0xa0
+    };
+    std::atomic<size_t> *cached = nullptr;
+    switch(this->getType()) {
+    case JKSN_STRING:
+    case JKSN_BLOB:
+        cached = &this->data_string->hash;
+        break;
+    case JKSN_ARRAY:
+        cached = &this->data_array->hash;
+        break;
+    case JKSN_OBJECT:
+        cached = &this->data_object->hash;
+        break;
+    default:
+        break;
+    }
+    if(cached) {
+        size_t result = cached->load(std::memory_order_relaxed);
+        if(result != 0)
+            return result;
+    }
+    uint64_t result;
+    /* Boxes that handed out a mutable reference may change without being detached */
+    bool subtree_cacheable = !(this->isArray() && this->data_array->leaked) && !(this->isObject() && this->data_object->leaked);
+    switch(this->getType()) {
+    case JKSN_UNDEFINED:
+    case JKSN_NULL:
+    case JKSN_BOOL:
+    case JKSN_UNSPECIFIED:
+        result = hashMix(uint64_t(this->getType()) ^ hash_secret[0], (this->getType() == JKSN_BOOL && this->data_bool) ^ hash_secret[1]);
+        break;
+    case JKSN_INT:
+    case JKSN_FLOAT:
+    case JKSN_DOUBLE:
+    case JKSN_LONG_DOUBLE:
+        {
+            /* Integral values hash as integers, others by their value as double */
+            uint64_t bits;
+            if(this->getType() == JKSN_INT)
+                bits = uint64_t(this->data_int);
+            else {
+                long double number = this->toLongDouble();
+                if(number >= -9223372036854775808.0L && number < 9223372036854775808.0L && number == std::trunc(number))
+                    bits = uint64_t(intmax_t(number));
+                else {
+                    double rounded = double(number);
+                    std::memcpy(&bits, &rounded, sizeof bits);
+                    bits ^= hash_secret[3];
+                }
+            }
+            result = hashMix(seed_number ^ hash_secret[0], bits ^ hash_secret[1]);
+        }
+        break;
+    case JKSN_STRING:
+    case JKSN_BLOB:
+        result = hashBytes(this->data_string->value.data(), this->data_string->value.size(), this->getType() == JKSN_STRING ? seed_string : seed_blob);
+        break;
+    case JKSN_ARRAY:
+        result = seed_array ^ hash_secret[0];
+        for(const JKSNValue &i : this->data_array->value)
+            result = hashMix(result ^ hash_secret[1], uint64_t(i.hash(subtree_cacheable)) ^ hash_secret[2]);
+        result = hashMix(result, uint64_t(this->data_array->value.size()) ^ hash_secret[3]);
+        break;
+    case JKSN_OBJECT:
+        result = seed_object ^ hash_secret[0];
+        for(const std::pair<const JKSNValue, JKSNValue> &i : this->data_object->value)
+            result = hashMix(result ^ uint64_t(i.first.hash(subtree_cacheable)), uint64_t(i.second.hash(subtree_cacheable)) ^ hash_secret[2]);
+        result = hashMix(result, uint64_t(this->data_object->value.size()) ^ hash_secret[3]);
+        break;
+    default:
+        throw JKSNTypeError();
+    }
+    size_t truncated = sizeof (size_t) >= 8 ? size_t(result) : size_t(result ^ (result >> 32));
+    cacheable = cacheable && subtree_cacheable;
+    if(cached && subtree_cacheable) {
+        if(truncated == 0)
+            truncated = 1;
+        cached->store(truncated, std::memory_order_relaxed);
+    }
+    return truncated;
+}
+
+/* Symbols stay alive in the table until purgeInterned() */
+static std::mutex &internMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+static std::unordered_set<JKSNValue> &internTable() {
+    static std::unordered_set<JKSNValue> table;
+    return table;
+}
+
+/*
+  Symbols a thread looked up recently, by hash, so that repeated keys do
+  not take the lock. A purge moves the epoch on, and each thread empties
+  its front cache on its next lookup. Until then the symbols it holds
+  count as used, so they may outlive one purge.
+*/
+static std::atomic<uint64_t> internEpoch(0);
+
+struct JKSNInternFront {
+    uint64_t epoch = 0;
+    JKSNValue symbols[256];
+    void clear(uint64_t epoch) {
+        for(JKSNValue &i : this->symbols)
+            i = JKSNValue();
+        this->epoch = epoch;
+    }
+};
+
+static thread_local JKSNInternFront internFront;
+
+JKSNValue JKSNValue::intern(const JKSNValue &value) {
+    if(!value.isString() || value.data_string->interned)
+        return value;
+    JKSNInternFront &front = internFront;
+    uint64_t epoch = internEpoch.load(std::memory_order_acquire);
+    if(front.epoch != epoch)
+        front.clear(epoch);
+    JKSNValue &recent = front.symbols[value.hash() & 0xff];
+    if(recent.isString() && recent.data_string->value == value.data_string->value)
+        return recent;
+    std::lock_guard<std::mutex> lock(internMutex());
+    std::unordered_set<JKSNValue> &table = internTable();
+    std::unordered_set<JKSNValue>::const_iterator it = table.find(value);
+    if(it != table.end()) {
+        recent = *it;
+        return recent;
+    }
+    /* Use a box of our own, since the one of value may be visible to other threads */
+    JKSNValue symbol(value.data_string->value);
+    symbol.data_string->interned = true;
+    table.insert(symbol);
+    recent = symbol;
+    return symbol;
+}
+
+size_t JKSNValue::purgeInterned() {
+    internFront.clear(internEpoch.fetch_add(1, std::memory_order_acq_rel) + 1);
+    std::lock_guard<std::mutex> lock(internMutex());
+    std::unordered_set<JKSNValue> &table = internTable();
+    size_t purged = 0;
+    for(std::unordered_set<JKSNValue>::const_iterator it = table.begin(); it != table.end(); )
+        if(!it->isShared()) {
+            it = table.erase(it);
+            ++purged;
+        } else
+            ++it;
+    return purged;
+}
+
 bool JKSNValue::toBool() const {
     switch(this->getType()) {
     case JKSN_BOOL:
@@ -1377,11 +5511,11 @@ bool JKSNValue::toBool() const {
         return this->data_long_double != 0.0L;
     case JKSN_STRING:
     case JKSN_BLOB:
-        return !this->data_string->empty();
+        return !this->data_string->value.empty();
     case JKSN_ARRAY:
-        return !this->data_array->empty();
+        return !this->data_array->value.empty();
     case JKSN_OBJECT:
-        return !this->data_object->empty();
+        return !this->data_object->value.empty();
     default:
         throw JKSNTypeError();
     }
@@ -1403,7 +5537,7 @@ intmax_t JKSNValue::toInt() const {
         return 0;
     case JKSN_STRING:
         try {
-            return std::stoll(*this->data_string);
+            return std::stoll(this->data_string->value);
         } catch(std::invalid_argument) {
             throw JKSNTypeError();
         } catch(std::out_of_range) {
@@ -1431,7 +5565,7 @@ T JKSNValue::toNumber() const {
         return 0;
     case JKSN_STRING:
         try {
-            return std::stoll(*this->data_string);
+            return std::stoll(this->data_string->value);
         } catch(std::invalid_argument) {
             return NAN;
         } catch(std::out_of_range) {
@@ -1457,30 +5591,36 @@ std::string JKSNValue::toString() const {
             return "NaN";
         else if(std::isinf(this->data_float))
             return this->data_float >= 0 ? "Infinity" : "-Infinity";
-        else
-            return std::to_string(this->data_float);
+        else {
+            char buffer[32];
+            return std::string(buffer, formatFloat(this->data_float, buffer));
+        }
     case JKSN_DOUBLE:
         if(std::isnan(this->data_double))
             return "NaN";
         else if(std::isinf(this->data_double))
             return this->data_double >= 0 ? "Infinity" : "-Infinity";
-        else
-            return std::to_string(this->data_double);
+        else {
+            char buffer[32];
+            return std::string(buffer, formatDouble(this->data_double, buffer));
+        }
     case JKSN_LONG_DOUBLE:
         if(std::isnan(this->data_long_double))
             return "NaN";
         else if(std::isinf(this->data_long_double))
             return this->data_long_double >= 0 ? "Infinity" : "-Infinity";
-        else
-            return std::to_string(this->data_long_double);
+        else {
+            char buffer[64];
+            return std::string(buffer, formatLongDouble(this->data_long_double, buffer));
+        }
     case JKSN_STRING:
     case JKSN_BLOB:
-        return *this->data_string;
+        return this->data_string->value;
     case JKSN_ARRAY:
         {
             std::string res;
             bool first = true;
-            for(const JKSNValue &i : *this->data_array) {
+            for(const JKSNValue &i : this->data_array->value) {
                 if(!first)
                     res.append(1, ',');
                 first = false;
@@ -1554,7 +5694,12 @@ bool JKSNValue::operator==(const JKSNValue &that) const {
             }
         case JKSN_STRING:
         case JKSN_BLOB:
-            return this->toString() == that.toString();
+            if(this->data_string == that.data_string)
+                return true;
+            else if(this->data_string->interned && that.data_string->interned)
+                return false;
+            else
+                return this->data_string->value == that.data_string->value;
         case JKSN_ARRAY:
             {
                 const std::vector<JKSNValue> &this_vector = this->toVector();
@@ -1648,7 +5793,7 @@ bool JKSNValue::operator<(const JKSNValue &that) const {
             }
         case JKSN_STRING:
         case JKSN_BLOB:
-            return this->toString() < that.toString();
+            return this->data_string != that.data_string && this->data_string->value < that.data_string->value;
         case JKSN_ARRAY:
             {
                 const std::vector<JKSNValue> &this_vector = this->toVector();
@@ -1694,59 +5839,99 @@ bool JKSNValue::operator<(const JKSNValue &that) const {
 
 JKSNValue &JKSNValue::operator=(const JKSNValue &that) {
     if(this != &that) {
-        union {
-            std::string *new_string = nullptr;
-            std::vector<JKSNValue> *new_array;
-            std::map<JKSNValue, JKSNValue> *new_object;
-        } new_data;
+        /* Share the data of that, retain it first in case we are releasing the same data */
         switch(that.getType()) {
-        case JKSN_BOOL:
-            this->data_bool = that.toBool();
-            break;
-        case JKSN_INT:
-            this->data_int = that.toInt();
-            break;
-        case JKSN_FLOAT:
-            this->data_float = that.toFloat();
-            break;
-        case JKSN_DOUBLE:
-            this->data_double = that.toDouble();
-            break;
-        case JKSN_LONG_DOUBLE:
-            this->data_long_double = that.toLongDouble();
-            break;
         case JKSN_STRING:
         case JKSN_BLOB:
-            new_data.new_string = new std::string(that.toString());
+            retain(that.data_string);
+            this->release();
+            this->data_string = that.data_string;
             break;
         case JKSN_ARRAY:
-            new_data.new_array = new std::vector<JKSNValue>(that.toVector());
+            {
+                Shared<std::vector<JKSNValue> > *data = share(that.data_array);
+                this->release();
+                this->data_array = data;
+            }
             break;
         case JKSN_OBJECT:
-            new_data.new_object = new std::map<JKSNValue, JKSNValue>(that.toMap());
+            {
+                Shared<std::map<JKSNValue, JKSNValue> > *data = share(that.data_object);
+                this->release();
+                this->data_object = data;
+            }
             break;
-        default:
+        case JKSN_BOOL:
+            this->release();
+            this->data_bool = that.data_bool;
             break;
-        }
-        this->~JKSNValue();
-        switch((this->data_type = that.getType())) {
-        case JKSN_STRING:
-        case JKSN_BLOB:
-            this->data_string = new_data.new_string;
+        case JKSN_INT:
+            this->release();
+            this->data_int = that.data_int;
             break;
-        case JKSN_ARRAY:
-            this->data_array = new_data.new_array;
+        case JKSN_FLOAT:
+            this->release();
+            this->data_float = that.data_float;
             break;
-        case JKSN_OBJECT:
-            this->data_object = new_data.new_object;
+        case JKSN_DOUBLE:
+            this->release();
+            this->data_double = that.data_double;
+            break;
+        case JKSN_LONG_DOUBLE:
+            this->release();
+            this->data_long_double = that.data_long_double;
             break;
         default:
+            this->release();
             break;
         }
+        this->data_type = that.data_type;
     }
     return *this;
 }
 
+/* Nested containers waiting to be freed by the outermost destroy on this thread */
+static thread_local std::vector<JKSNValue> *teardownQueue = nullptr;
+
+static void queueTeardown(JKSNValue &child) {
+    if(child.isArray() || child.isObject())
+        teardownQueue->push_back(std::move(child));
+}
+
+static void drainTeardown(std::vector<JKSNValue> &queue) {
+    while(!queue.empty()) {
+        /* Dropping it may queue its own children */
+        JKSNValue child = std::move(queue.back());
+        queue.pop_back();
+    }
+    teardownQueue = nullptr;
+}
+
+void JKSNValue::destroy(Shared<std::vector<JKSNValue> > *data) {
+    std::vector<JKSNValue> queue;
+    bool outermost = !teardownQueue;
+    if(outermost)
+        teardownQueue = &queue;
+    for(JKSNValue &child : data->value)
+        queueTeardown(child);
+    delete data;
+    if(outermost)
+        drainTeardown(queue);
+}
+
+void JKSNValue::destroy(Shared<std::map<JKSNValue, JKSNValue> > *data) {
+    std::vector<JKSNValue> queue;
+    bool outermost = !teardownQueue;
+    if(outermost)
+        teardownQueue = &queue;
+    /* Keys are const, only values are unlinked */
+    for(auto &child : data->value)
+        queueTeardown(child.second);
+    delete data;
+    if(outermost)
+        drainTeardown(queue);
+}
+
 JKSNValue &JKSNValue::operator=(JKSNValue &&that) {
     if(this != &that) {
         this->~JKSNValue();
@@ -21,6 +21,7 @@
 #ifndef _JKSN_HPP_INCLUDED
 #define _JKSN_HPP_INCLUDED
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
@@ -29,8 +30,10 @@
 #include <map>
 #include <memory>
 #include <ostream>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -59,6 +62,9 @@ public:
     JKSNTypeError() : JKSNDecodeError("invalid JKSN data type") {}
 };
 
+/* Counts a value box in builds with JKSN_INSTRUMENT, see JKSNInstrumentCounters */
+void instrumentAllocation(size_t bytes);
+
 typedef enum {
     JKSN_UNDEFINED,
     JKSN_NULL,
@@ -125,35 +131,35 @@ public:
     }
     JKSNValue(const std::string &data, bool is_blob = false) :
         data_type(is_blob ? JKSN_BLOB : JKSN_STRING),
-        data_string(new std::string(data)) {
+        data_string(new Shared<std::string>(data)) {
     }
     JKSNValue(std::string &&data, bool is_blob = false) :
         data_type(is_blob ? JKSN_BLOB : JKSN_STRING),
-        data_string(new std::string(std::move(data))) {
+        data_string(new Shared<std::string>(std::move(data))) {
     }
     JKSNValue(const char *data, bool is_blob = false) :
         data_type(is_blob ? JKSN_BLOB : JKSN_STRING),
-        data_string(new std::string(data)) {
+        data_string(new Shared<std::string>(data)) {
     }
     JKSNValue(const std::vector<JKSNValue> &data) :
         data_type(JKSN_ARRAY),
-        data_array(new std::vector<JKSNValue>(data)) {
+        data_array(new Shared<std::vector<JKSNValue> >(data)) {
     }
     JKSNValue(std::vector<JKSNValue> &&data) :
         data_type(JKSN_ARRAY),
-        data_array(new std::vector<JKSNValue>(std::move(data))) {
+        data_array(new Shared<std::vector<JKSNValue> >(std::move(data))) {
     }
     JKSNValue(std::initializer_list<JKSNValue> data) :
         data_type(JKSN_ARRAY),
-        data_array(new std::vector<JKSNValue>(data)) {
+        data_array(new Shared<std::vector<JKSNValue> >(data)) {
     }
     JKSNValue(const std::map<JKSNValue, JKSNValue> &data) :
         data_type(JKSN_OBJECT),
-        data_object(new std::map<JKSNValue, JKSNValue>(data)) {
+        data_object(new Shared<std::map<JKSNValue, JKSNValue> >(data)) {
     }
     JKSNValue(std::map<JKSNValue, JKSNValue> &&data) :
         data_type(JKSN_OBJECT),
-        data_object(new std::map<JKSNValue, JKSNValue>(std::move(data))) {
+        data_object(new Shared<std::map<JKSNValue, JKSNValue> >(std::move(data))) {
     }
     JKSNValue(const Unspecified &) :
         data_type(JKSN_UNSPECIFIED) {
@@ -244,19 +250,7 @@ public:
         return JKSNValue(data);
     }
     ~JKSNValue() {
-        switch(this->getType()) {
-        case JKSN_STRING:
-            delete this->data_string;
-            break;
-        case JKSN_ARRAY:
-            delete this->data_array;
-            break;
-        case JKSN_OBJECT:
-            delete this->data_object;
-            break;
-        default:
-            break;
-        };
+        this->release();
         this->data_type = JKSN_UNDEFINED;
     }
 
@@ -344,30 +338,85 @@ public:
     std::string toBlob() const {
         return this->toString();
     };
+    const std::string &toStringRef() const {
+        if(this->isStringOrBlob())
+            return this->data_string->value;
+        else
+            throw JKSNTypeError();
+    }
+    /*
+      Strings, arrays and objects are shared between copies and copied on
+      write. The non-const accessors below make a private copy first if the
+      data is shared, and stop sharing it from then on: later copies of the
+      value take their own, so a mutable reference kept around only changes
+      this value. Read through a const reference where possible.
+    */
     const std::vector<JKSNValue> &toVector() const {
         if(this->isArray())
-            return *this->data_array;
+            return this->data_array->value;
         else
             throw JKSNTypeError();
     }
     std::vector<JKSNValue> &toVector() {
         if(this->isArray())
-            return *this->data_array;
+            return this->leak(this->data_array)->value;
         else
             throw JKSNTypeError();
     }
     const std::map<JKSNValue, JKSNValue> &toMap() const {
         if(this->isObject())
-            return *this->data_object;
+            return this->data_object->value;
         else
             throw JKSNTypeError();
     }
     std::map<JKSNValue, JKSNValue> &toMap() {
         if(this->isObject())
-            return *this->data_object;
+            return this->leak(this->data_object)->value;
         else
             throw JKSNTypeError();
     }
+    /*
+      Order-sensitive structural hash, consistent with operator== for
+      numbers that convert exactly. The hash of strings, arrays and objects
+      is cached, except for those that handed out a mutable reference, or
+      contain one that did.
+    */
+    size_t hash() const {
+        bool cacheable = true;
+        return this->hash(cacheable);
+    }
+    /*
+      Interned strings are kept in a global symbol table, equal interned
+      strings share storage and compare by identity. Use them for object
+      keys that repeat a lot. purgeInterned() drops symbols that are no longer
+      used elsewhere and returns how many were dropped. Each thread also
+      holds on to the last few hundred symbols it looked up until its next
+      lookup, so those may survive one purge.
+    */
+    static JKSNValue intern(const JKSNValue &value);
+    static JKSNValue intern(const std::string &value) {
+        return intern(JKSNValue(value));
+    }
+    static JKSNValue intern(const char *value) {
+        return intern(JKSNValue(value));
+    }
+    static size_t purgeInterned();
+    bool isInterned() const {
+        return this->isString() && this->data_string->interned;
+    }
+    bool isShared() const {
+        switch(this->getType()) {
+        case JKSN_STRING:
+        case JKSN_BLOB:
+            return this->data_string->refcount.load(std::memory_order_acquire) != 1;
+        case JKSN_ARRAY:
+            return this->data_array->refcount.load(std::memory_order_acquire) != 1;
+        case JKSN_OBJECT:
+            return this->data_object->refcount.load(std::memory_order_acquire) != 1;
+        default:
+            return false;
+        }
+    }
     Unspecified toUnspecified() const {
         if(this->isUnspecified())
             return Unspecified();
@@ -551,6 +600,81 @@ public:
     }
 
 private:
+    template<typename T>
+    class Shared {
+    public:
+        template<typename... Args>
+        explicit Shared(Args &&...args) :
+            value(std::forward<Args>(args)...) {
+#ifdef JKSN_INSTRUMENT
+            instrumentAllocation(sizeof *this);
+#endif
+        }
+        std::atomic<size_t> refcount {1};
+        std::atomic<size_t> hash {0}; /* 0 if not yet computed */
+        bool interned = false; /* only set before the box is published */
+        bool leaked = false; /* a mutable reference was handed out, so copies take their own */
+        T value;
+    };
+    template<typename T>
+    static Shared<T> *retain(Shared<T> *data) {
+        data->refcount.fetch_add(1, std::memory_order_relaxed);
+        return data;
+    }
+    template<typename T>
+    static Shared<T> *share(Shared<T> *data) {
+        return data->leaked ? new Shared<T>(data->value) : retain(data);
+    }
+    template<typename T>
+    static void release(Shared<T> *data) {
+        if(data->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            destroy(data);
+    }
+    static void destroy(Shared<std::string> *data) {
+        delete data;
+    }
+    /* Containers are torn down without recursing into nested containers */
+    static void destroy(Shared<std::vector<JKSNValue> > *data);
+    static void destroy(Shared<std::map<JKSNValue, JKSNValue> > *data);
+    template<typename T>
+    static Shared<T> *detach(Shared<T> *&data) {
+        if(data->refcount.load(std::memory_order_acquire) != 1) {
+            Shared<T> *copy = new Shared<T>(data->value);
+            release(data);
+            data = copy;
+        } else
+            data->hash.store(0, std::memory_order_relaxed);
+        return data;
+    }
+    template<typename T>
+    static Shared<T> *leak(Shared<T> *&data) {
+        detach(data)->leaked = true;
+        return data;
+    }
+    /* For the decoder, which lets go of the reference before anyone copies the value */
+    std::vector<JKSNValue> &mutableVector() {
+        return this->detach(this->data_array)->value;
+    }
+    std::map<JKSNValue, JKSNValue> &mutableMap() {
+        return this->detach(this->data_object)->value;
+    }
+    void release() {
+        switch(this->getType()) {
+        case JKSN_STRING:
+        case JKSN_BLOB:
+            release(this->data_string);
+            break;
+        case JKSN_ARRAY:
+            release(this->data_array);
+            break;
+        case JKSN_OBJECT:
+            release(this->data_object);
+            break;
+        default:
+            break;
+        }
+    }
+
     jksn_data_type data_type = JKSN_UNDEFINED;
     union {
         const void *data_padding = nullptr;
@@ -559,12 +683,112 @@ private:
         float data_float;
         double data_double;
         long double data_long_double;
-        std::string *data_string;
-        std::vector<JKSNValue> *data_array;
-        std::map<JKSNValue, JKSNValue> *data_object;
+        Shared<std::string> *data_string;
+        Shared<std::vector<JKSNValue> > *data_array;
+        Shared<std::map<JKSNValue, JKSNValue> > *data_object;
     };
 
     template<typename T> T toNumber() const;
+    size_t hash(bool &cacheable) const;
+    friend class JKSNDecoderPrivate;
+    friend class JKSNProjection;
+};
+
+/*
+  How hard an encoder tries to make the output small:
+  FASTEST writes every string as UTF-8, never tries row-col swapped or
+  XOR compressed arrays, and writes no back references or delta
+  integers. The encoder forgets its hashtables and last integer after
+  such a dump, so later dumps stay in step with the decoder.
+  BALANCED, the default, tries every representation, and decides
+  between straight and swapped arrays from their first few levels.
+  SMALLEST compares the whole subtrees of both layouts instead, and
+  reorders the integer members of objects for delta integers.
+*/
+typedef enum {
+    JKSN_EFFORT_FASTEST,
+    JKSN_EFFORT_BALANCED,
+    JKSN_EFFORT_SMALLEST
+} jksn_effort;
+
+/*
+  Counters for tuning payloads, collected by an encoder after setStats.
+  They add up over every dump until clear is called. Values encoded with
+  JKSNWriter are counted only when they go through writeValue.
+*/
+struct JKSNEncodeStats {
+    /* Control byte families, after hashing and delta encoding */
+    enum Family {
+        CONSTANT, /* undefined, null, booleans, NaN, infinities, unspecified */
+        INT,
+        DELTA_INT,
+        FLOAT, /* float, double and long double */
+        UTF16,
+        UTF8,
+        BLOB,
+        TEXT_HASH, /* back-references to a remembered string */
+        BLOB_HASH,
+        ARRAY,
+        SWAPPED_ARRAY,
+        XOR_ARRAY,
+        OBJECT,
+        OTHER,
+        FAMILY_COUNT
+    };
+    JKSNEncodeStats() { this->clear(); }
+    void clear();
+    std::string toString() const;
+    static const char *familyName(Family family);
+    /* The bytes of arrays and objects do not include their children */
+    uint64_t values[FAMILY_COUNT];
+    uint64_t bytes[FAMILY_COUNT];
+    /* Strings longer than one byte looked up in the hashtables. A collision is a miss that evicts another string */
+    uint64_t text_hits;
+    uint64_t text_misses;
+    uint64_t text_collisions;
+    uint64_t blob_hits;
+    uint64_t blob_misses;
+    uint64_t blob_collisions;
+    /* Layouts tried for arrays that are kept in the output, and their size against a straight array before hashing */
+    uint64_t swap_candidates;
+    uint64_t swaps;
+    int64_t swap_bytes_saved;
+    uint64_t xor_candidates;
+    uint64_t xors;
+    int64_t xor_bytes_saved;
+    uint64_t dumps;
+    uint64_t build_ns;
+    uint64_t optimize_ns;
+    uint64_t output_ns;
+};
+
+/*
+  Process-wide counters of a build with JKSN_INSTRUMENT defined, for the
+  library and every file that includes this header, for metrics agents to
+  poll from any thread. Without it nothing is counted and enabled is false.
+*/
+struct JKSNInstrumentCounters {
+    bool enabled;
+    /* Boxes of strings, arrays and objects, not the storage of their containers */
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+    /* Control bytes read by JKSNDecoder::parse, by family */
+    uint64_t parse_values[JKSNEncodeStats::FAMILY_COUNT];
+    /* Input bytes of each conversion */
+    uint64_t utf8_to_utf16_bytes;
+    uint64_t utf16_to_utf8_bytes;
+    uint64_t encode_calls;
+    uint64_t encode_ns;
+    uint64_t decode_calls;
+    uint64_t decode_ns;
+};
+JKSNInstrumentCounters instrumentSnapshot();
+void instrumentReset();
+
+/* A piece of scatter-gather output, see JKSNEncoder::dumpSegments */
+struct JKSNSegment {
+    const char *data;
+    size_t size;
 };
 
 class JKSNEncoder {
@@ -576,10 +800,88 @@ public:
     JKSNEncoder &operator=(const JKSNEncoder &that);
     JKSNEncoder &operator=(JKSNEncoder &&that);
     ~JKSNEncoder();
+    /* Forget the strings, blobs and integer remembered so far, keeping the settings */
+    void reset();
     std::ostream &dump(const JKSNValue &obj, std::ostream &result, bool header = true);
     std::string dump(const JKSNValue &obj, bool header = true);
+    template<typename T> std::ostream &dumpTyped(const T &obj, std::ostream &result, bool header = true);
+    template<typename T> std::string dumpTyped(const T &obj, bool header = true);
+    /*
+      Scatter-gather output, for writev or sendmsg. Strings and blobs of at
+      least min_size bytes are not copied: their segments point into obj,
+      which must be kept alive and unchanged until they are written, and
+      such strings stay UTF-8. The other segments point into storage.
+    */
+    std::vector<JKSNSegment> dumpSegments(const JKSNValue &obj, std::string &storage, bool header = true, size_t min_size = 4096);
+    /*
+      Many messages into output, which is cleared first: message i runs from
+      offsets[i] to offsets[i + 1]. With shared set, later messages may refer
+      to the strings and the last integer of earlier ones, and must be
+      decoded in order by one decoder. Otherwise the encoder is reset before
+      each message, so each decodes on its own. Either way, each distinct
+      key is converted and hashed once for the whole batch.
+    */
+    std::vector<size_t> dumpBatch(const JKSNValue *values, size_t count, std::string &output, bool header = true, bool shared = false);
+    std::vector<size_t> dumpBatch(const std::vector<JKSNValue> &values, std::string &output, bool header = true, bool shared = false) {
+        return this->dumpBatch(values.data(), values.size(), output, header, shared);
+    }
+    /* JSON text is encoded without building a JKSNValue, see JKSNJSONParser */
+    std::string dumpJSON(const std::string &json, bool header = true);
+    /* The encoder does not own stats, nullptr stops collecting */
+    void setStats(JKSNEncodeStats *stats);
+    JKSNEncodeStats *getStats() const;
+    void setEffort(jksn_effort effort);
+    jksn_effort getEffort() const;
+    /*
+      Once a dump has taken this long, the values left are encoded as with
+      JKSN_EFFORT_FASTEST. 0, the default, means no limit.
+    */
+    void setTimeBudget(uint64_t microseconds);
+    uint64_t getTimeBudget() const;
+    /*
+      Lossless narrowing, off by default: floating point numbers holding an
+      integer are written as integers, and doubles or long doubles a float
+      holds exactly as floats. They decode as the narrower type, unless
+      tagging is on as well: then a pragma naming the original type comes
+      before each of them, for JKSNDecoder::setRestoreNarrowed.
+    */
+    void setNarrowing(bool narrowing);
+    bool getNarrowing() const;
+    void setTagNarrowed(bool tag_narrowed);
+    bool getTagNarrowed() const;
+    /*
+      XOR compressed arrays of doubles or floats, off by default. They use
+      extension bytes 0xe0 and 0xe1, which only JKSNDecoder understands.
+    */
+    void setXorArrays(bool xor_arrays);
+    bool getXorArrays() const;
+    /*
+      Deduplication of large blobs, off (0) by default: blobs of at least
+      min_size bytes are remembered by content for the whole session, and
+      sent again as an index. From setDedupChunks's size on, blobs are cut
+      into content defined chunks first, so that near identical ones share
+      most of them. The output uses extension bytes 0xe2 to 0xe4, which
+      only JKSNDecoder understands. Once the encoder remembers capacity
+      bytes, 64 MiB by default, new blobs are sent as they are.
+    */
+    void setDedupBlobs(size_t min_size);
+    size_t getDedupBlobs() const;
+    void setDedupChunks(size_t min_size);
+    size_t getDedupChunks() const;
+    void setDedupCapacity(size_t capacity);
+    size_t getDedupCapacity() const;
+    /*
+      Blobs of at least min_size bytes, 64 KiB by default, are always sent
+      in full and never as a back reference, so that a JKSNDecoder with a
+      blob sink from that size on can decode the output. 0 turns it off.
+      Deduplicated blobs are not affected, the decoder keeps those.
+    */
+    void setStreamedBlobs(size_t min_size);
+    size_t getStreamedBlobs() const;
 private:
     std::unique_ptr<class JKSNEncoderPrivate> p;
+    friend class JKSNWriter;
+    template<typename T> friend class JKSNPool;
 };
 
 class JKSNDecoder {
@@ -591,12 +893,781 @@ public:
     JKSNDecoder &operator=(const JKSNDecoder &that);
     JKSNDecoder &operator=(JKSNDecoder &&that);
     ~JKSNDecoder();
+    /* Forget the strings, blobs and integer remembered so far, keeping the settings */
+    void reset();
     JKSNValue parse(std::istream &fp, bool header = true);
     JKSNValue parse(const std::string &str, bool header = true);
+    template<typename T> T &parseTyped(std::istream &fp, T &result, bool header = true);
+    template<typename T> T &parseTyped(const std::string &str, T &result, bool header = true);
+    /* Intern object keys and column names with JKSNValue::intern */
+    void setInternKeys(bool intern_keys);
+    bool getInternKeys() const;
+    /* Give numbers tagged by JKSNEncoder::setTagNarrowed their original type back */
+    void setRestoreNarrowed(bool restore_narrowed);
+    bool getRestoreNarrowed() const;
+    /*
+      Hand blobs of at least min_size bytes to sink in chunks of up to 64 KiB
+      as they are read, and put an empty blob in their place, so that they
+      are never held in memory. offset is where the chunk starts in a blob
+      of total bytes. Such blobs are not remembered, so a back reference to
+      one fails: min_size must be at least JKSNEncoder::setStreamedBlobs's
+      size, 64 KiB by default, on the encoder side. A min_size of 0 turns it
+      off.
+    */
+    void setBlobSink(size_t min_size, std::function<void(const char *data, size_t size, size_t offset, size_t total)> sink);
 private:
     std::unique_ptr<class JKSNDecoderPrivate> p;
+    friend class JKSNReader;
+    friend class JKSNProjection;
+    friend class JKSNSchema;
+    template<typename T> friend class JKSNPool;
 };
 
+/*
+  Ready encoders or decoders, so that a server does not build one for
+  every message. acquire() takes the one the calling thread gave back
+  last, or one of up to 64 shared by all threads, or makes a new one.
+  When the handle goes, the object is reset, settings included, and given
+  back. Neither takes a lock.
+*/
+template<typename T>
+class JKSNPool {
+public:
+    struct Release {
+        void operator()(T *obj) const;
+    };
+    typedef std::unique_ptr<T, Release> Handle;
+    static Handle acquire();
+};
+typedef JKSNPool<JKSNEncoder> JKSNEncoderPool;
+typedef JKSNPool<JKSNDecoder> JKSNDecoderPool;
+
+/*
+  Typed binding: encode and decode C++ types directly, without building a
+  JKSNValue tree.
+
+  Supported types are bool, integers, float, double, std::string, JKSNValue,
+  std::vector<T>, std::map<std::string, T>, and structs that list their
+  fields with a member template:
+
+      struct Point {
+          intmax_t x;
+          double y;
+          template<typename Binder> void jksnBind(Binder &binder) {
+              binder("x", x);
+              binder("y", y);
+          }
+      };
+
+  A std::vector of such structs is encoded as a row-col swapped array.
+  Input that does not match the expected shape is parsed with the generic
+  decoder and converted, so any valid JKSN stream is accepted.
+*/
+
+class JKSNKey {
+public:
+    template<size_t N>
+    constexpr JKSNKey(const char (&str)[N]) :
+        str(str),
+        size(N-1),
+        hash(uint8_t(DJBHash(str, N-1, 0))) {
+    }
+    JKSNKey(const std::string &str) :
+        str(str.data()),
+        size(str.size()),
+        hash(0) {
+        unsigned result = 0;
+        for(char i : str)
+            result += (result << 5) + uint8_t(i);
+        this->hash = uint8_t(result);
+    }
+    JKSNKey(const char *str, size_t size, uint8_t hash) :
+        str(str),
+        size(size),
+        hash(hash) {
+    }
+    const char *str;
+    size_t size;
+    uint8_t hash;
+private:
+    static constexpr unsigned DJBHash(const char *str, size_t size, unsigned result) {
+        return size == 0 ? result & 0xff : DJBHash(str+1, size-1, result + (result << 5) + uint8_t(*str));
+    }
+};
+
+class JKSNWriter {
+public:
+    JKSNWriter(JKSNEncoder &encoder, std::string &output) :
+        encoder(encoder),
+        output(output) {
+    }
+    void writeNull();
+    void writeBool(bool value);
+    void writeInt(intmax_t value);
+    void writeFloat(float value);
+    void writeDouble(double value);
+    void writeString(const char *str, size_t size, bool is_blob = false);
+    void writeString(const std::string &str, bool is_blob = false) {
+        this->writeString(str.data(), str.size(), is_blob);
+    }
+    void writeKey(const JKSNKey &key);
+    /*
+      Write the output so far to fp and clear it, then a blob of size bytes
+      straight to fp, filled by read in chunks of up to 64 KiB
+    */
+    void writeBlob(size_t size, const std::function<void(char *buf, size_t size)> &read, std::ostream &fp);
+    void writeArrayHeader(size_t length);
+    void writeObjectHeader(size_t length);
+    void writeSwappedArrayHeader(size_t columns);
+    void writeUnspecified();
+    void writePragma(const std::string &pragma);
+    void writeValue(const JKSNValue &value);
+private:
+    void writeText(const char *str, size_t size, uint8_t hash, bool is_blob);
+    bool writeReference(const char *str, size_t size, uint8_t hash, bool is_blob);
+    void writeEncodedKey(const JKSNKey &key, const std::string &encoded);
+    void writeLength(uint8_t control, size_t length, size_t short_limit);
+    JKSNEncoder &encoder;
+    std::string &output;
+    friend class JKSNSchema;
+};
+
+class JKSNReader {
+public:
+    JKSNReader(JKSNDecoder &decoder, std::istream &fp, bool header = true);
+    uint8_t peekControl();
+    JKSNValue readValue();
+    void skipValue();
+    bool readBool();
+    intmax_t readInt();
+    double readDouble();
+    std::string &readString(std::string &result);
+    bool readArrayHeader(size_t &length);
+    bool readObjectHeader(size_t &length);
+    bool readSwappedArrayHeader(size_t &columns);
+    bool readUnspecified();
+    bool readPragma(JKSNValue &pragma);
+private:
+    JKSNDecoder &decoder;
+    std::istream &fp;
+};
+
+/*
+  JSON output, appended to a string that can be cleared and reused.
+
+  Numbers are written in the shortest form that reads back to the same
+  value, NaN and infinities as null. Blobs become base64 strings, other
+  keys than strings are converted with toString(). Undefined and
+  unspecified values are left out of objects and written as null
+  elsewhere.
+
+  Values are written either from a JKSNValue, from the events below, or
+  by transcode(), which reads the next value of a JKSNReader and writes it
+  without building the tree. Consecutive top-level values are not
+  separated.
+*/
+class JKSNJSONWriter {
+public:
+    JKSNJSONWriter(std::string &output) :
+        output(output) {
+    }
+    void writeNull();
+    void writeBool(bool value);
+    void writeInt(intmax_t value);
+    void writeFloat(float value);
+    void writeDouble(double value);
+    void writeLongDouble(long double value);
+    void writeString(const char *str, size_t size);
+    void writeString(const std::string &str) {
+        this->writeString(str.data(), str.size());
+    }
+    void writeBlob(const char *buf, size_t size);
+    void writeBlob(const std::string &buf) {
+        this->writeBlob(buf.data(), buf.size());
+    }
+    void writeKey(const char *str, size_t size);
+    void writeKey(const std::string &key) {
+        this->writeKey(key.data(), key.size());
+    }
+    void writeKey(const JKSNValue &key);
+    void beginArray();
+    void endArray();
+    void beginObject();
+    void endObject();
+    void writeValue(const JKSNValue &value);
+    void transcode(JKSNReader &reader);
+private:
+    void separate();
+    void writeScalar(const JKSNValue &value);
+    void appendString(const char *str, size_t size);
+    std::string &output;
+    size_t depth = 0;
+    bool need_comma = false;
+};
+
+/*
+  JSON input. The text is first scanned into a flat list of tokens, which
+  also counts the items of every array and object, then either built into
+  a JKSNValue or written with a JKSNWriter without building the tree.
+  Arrays of two or more objects that mostly share their keys are written
+  as row-col swapped arrays.
+
+  Numbers without a fraction or exponent that fit in intmax_t become
+  integers, other numbers doubles. A parser keeps its buffers between
+  calls; decoders use one for JSON literals (0x0f).
+*/
+class JKSNJSONParser {
+public:
+    JKSNValue parse(const char *json, size_t size);
+    JKSNValue parse(const std::string &json) {
+        return this->parse(json.data(), json.size());
+    }
+    void transcode(const char *json, size_t size, JKSNWriter &writer);
+    void transcode(const std::string &json, JKSNWriter &writer) {
+        this->transcode(json.data(), json.size(), writer);
+    }
+private:
+    /* Containers are followed by their items, or by keys and values in turn */
+    struct Token {
+        enum Kind : uint8_t {
+            NULL_LITERAL,
+            FALSE_LITERAL,
+            TRUE_LITERAL,
+            NUMBER,
+            STRING,
+            ARRAY,
+            OBJECT
+        };
+        Kind kind;
+        /* Strings with escapes, numbers with a fraction or exponent */
+        bool flag;
+        size_t begin;
+        size_t end;
+        /* Items or members of a container */
+        size_t count;
+        /* The token after this one and its items */
+        size_t next;
+    };
+    void scan(const char *json, size_t size);
+    size_t scanString(size_t pos);
+    size_t scanKey(size_t pos);
+    size_t scanNumber(size_t pos);
+    size_t skipSpace(size_t pos) const;
+    void decodeString(const Token &token, const char *&str, size_t &size);
+    JKSNValue decodeNumber(const Token &token);
+    bool swapColumns(size_t index, std::vector<size_t> &keys, std::vector<size_t> &cells);
+    [[noreturn]] void fail(size_t pos) const;
+    const char *json = nullptr;
+    size_t size = 0;
+    std::vector<Token> tape;
+    /* Containers not yet closed while scanning */
+    std::vector<size_t> open;
+    /* Unescaped strings and numbers for strtod */
+    std::string text;
+    std::vector<std::string> column_names;
+    std::vector<std::pair<size_t, size_t> > column_cells;
+};
+
+/*
+  Schema plans: a schema only known at runtime is compiled once into a flat
+  list of steps, then used to encode and decode many records.
+
+  The schema is an object mapping field names to "any", "null", "bool",
+  "int", "float", "double", "string", "blob", a nested schema object, or an
+  array holding one element type. A record is a vector of slots, one for each
+  non-object field in depth-first order, named by its dotted path.
+
+  Undefined slots are omitted when encoding. When decoding, fields arriving
+  out of order or of an unexpected shape are parsed with the generic decoder,
+  unknown fields are skipped and missing ones are left undefined.
+
+  A named schema writes its name as a string pragma in front of each record,
+  peekName() reads it back to choose a schema.
+*/
+class JKSNSchema {
+public:
+    JKSNSchema(const JKSNValue &schema, const std::string &name = std::string());
+    const std::string &getName() const {
+        return this->name;
+    }
+    size_t slotCount() const {
+        return this->slot_names.size();
+    }
+    const std::string &slotName(size_t slot) const {
+        return this->slot_names.at(slot);
+    }
+    size_t slotIndex(const std::string &path) const;
+    std::ostream &dump(const std::vector<JKSNValue> &slots, JKSNEncoder &encoder, std::ostream &result, bool header = true) const;
+    std::string dump(const std::vector<JKSNValue> &slots, JKSNEncoder &encoder, bool header = true) const;
+    std::vector<JKSNValue> &parse(std::istream &fp, JKSNDecoder &decoder, std::vector<JKSNValue> &slots, bool header = true) const;
+    std::vector<JKSNValue> &parse(const std::string &str, JKSNDecoder &decoder, std::vector<JKSNValue> &slots, bool header = true) const;
+    JKSNValue toValue(const std::vector<JKSNValue> &slots) const;
+    std::vector<JKSNValue> &fromValue(const JKSNValue &value, std::vector<JKSNValue> &slots) const;
+    static bool peekName(std::istream &fp, JKSNDecoder &decoder, std::string &name, bool header = true);
+private:
+    struct Step {
+        bool is_object;
+        jksn_data_type type;
+        jksn_data_type element_type;
+        std::string key;
+        uint8_t key_hash;
+        size_t slot;
+        size_t end;
+        /* The key as JKSNWriter encodes it, and as the decoder remembers it */
+        std::string key_bytes;
+        JKSNValue key_value;
+        /* Control byte kinds of the values decoded without the generic decoder */
+        uint32_t value_kinds;
+    };
+    void compile(const JKSNValue &schema, const std::string &prefix);
+    static void compileType(const JKSNValue &type, jksn_data_type &result, jksn_data_type &element_type);
+    size_t findField(size_t index, const std::string &key) const;
+    void dumpObject(JKSNWriter &writer, size_t index, const std::vector<JKSNValue> &slots) const;
+    void dumpField(JKSNWriter &writer, jksn_data_type type, jksn_data_type element_type, const JKSNValue &value) const;
+    void parseObject(class JKSNDecoderPrivate &decoder, JKSNReader &reader, std::istream &fp, size_t index, std::vector<JKSNValue> &slots) const;
+    size_t readField(class JKSNDecoderPrivate &decoder, JKSNReader &reader, std::istream &fp, size_t index, size_t expected, std::string &key) const;
+    void scatterObject(const JKSNValue &value, size_t index, std::vector<JKSNValue> &slots) const;
+    JKSNValue gatherObject(size_t index, const std::vector<JKSNValue> &slots) const;
+    std::string name;
+    std::vector<Step> steps;
+    std::vector<std::string> slot_names;
+};
+
+/*
+  Projections decode only the parts of a stream named by a list of paths,
+  such as "users[*].email" or "meta.version". A path is a chain of object
+  keys separated by dots, each optionally followed by array subscripts,
+  either an index or * for every item; an empty path selects everything.
+  The rest is passed over without being built, only keeping the
+  hashtables of the decoder up to date.
+
+  Objects keep the selected members only. Arrays keep their items up to
+  the last selected one, leaving the others undefined.
+*/
+class JKSNProjection {
+public:
+    JKSNProjection(const std::vector<std::string> &paths);
+    JKSNValue parse(std::istream &fp, JKSNDecoder &decoder, bool header = true) const;
+    JKSNValue parse(const std::string &str, JKSNDecoder &decoder, bool header = true) const;
+private:
+    /* Child nodes are indices into nodes, 0 (the root) meaning none */
+    struct Node {
+        bool whole = false;
+        std::map<std::string, size_t> keys;
+        std::map<size_t, size_t> indices;
+        size_t every = 0;
+    };
+    void compile(const std::string &path);
+    size_t copyNode(size_t node);
+    size_t itemNode(size_t node, size_t index, const std::string *column) const;
+    size_t itemLimit(size_t node) const;
+    bool hasColumn(size_t node, const std::string &column) const;
+    JKSNValue project(class JKSNDecoderPrivate &decoder, std::istream &fp, size_t node, const std::string *column) const;
+    JKSNValue projectArray(class JKSNDecoderPrivate &decoder, std::istream &fp, uint8_t control, size_t node, const std::string *column) const;
+    JKSNValue projectObject(class JKSNDecoderPrivate &decoder, std::istream &fp, uint8_t control, size_t node) const;
+    JKSNValue projectSwapped(class JKSNDecoderPrivate &decoder, std::istream &fp, uint8_t control, size_t node) const;
+    JKSNValue select(const JKSNValue &value, size_t node, const std::string *column) const;
+    std::vector<Node> nodes;
+};
+
+/*
+  Block archives: many records stored in blocks that decode on their own,
+  followed by an index of where each block is, so that a record is read
+  without parsing the blocks before it. write() stores the items of an
+  array as one block, close() writes the index. Appending to an archive
+  opened for reading and writing overwrites its index with a longer one.
+
+  To decode blocks in parallel, load them with loadBlock(), then call
+  parseBlock() from any thread.
+*/
+struct JKSNBlockInfo {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t records;
+    uint64_t first; /* records in the blocks before */
+};
+
+class JKSNBlockWriter {
+public:
+    JKSNBlockWriter(std::ostream &fp);
+    JKSNBlockWriter(std::iostream &fp, bool append);
+    ~JKSNBlockWriter();
+    void write(const JKSNValue &records);
+    void close();
+    size_t blockCount() const {
+        return this->blocks.size();
+    }
+private:
+    std::ostream &fp;
+    uint64_t offset;
+    bool closed;
+    std::vector<JKSNBlockInfo> blocks;
+};
+
+class JKSNBlockReader {
+public:
+    JKSNBlockReader(std::istream &fp);
+    size_t blockCount() const {
+        return this->blocks.size();
+    }
+    uint64_t recordCount() const;
+    const JKSNBlockInfo &blockInfo(size_t block) const {
+        return this->blocks.at(block);
+    }
+    JKSNValue readBlock(size_t block);
+    JKSNValue readRecord(uint64_t record);
+    std::string loadBlock(size_t block);
+    static JKSNValue parseBlock(const std::string &block);
+private:
+    std::istream &fp;
+    std::vector<JKSNBlockInfo> blocks;
+};
+
+template<typename T, typename Enable = void>
+struct JKSNBinding;
+
+class JKSNFieldCounter {
+public:
+    template<typename V>
+    void operator()(const JKSNKey &, V &) {
+        ++this->count;
+    }
+    size_t count = 0;
+};
+
+template<typename T>
+class JKSNHasBind {
+    template<typename U>
+    static auto test(int) -> decltype(std::declval<U &>().jksnBind(std::declval<JKSNFieldCounter &>()), std::true_type());
+    template<typename U>
+    static std::false_type test(...);
+public:
+    static const bool value = decltype(test<T>(0))::value;
+};
+
+class JKSNFieldWriter {
+public:
+    JKSNFieldWriter(JKSNWriter &writer, size_t column = ~size_t(0), bool write_key = true, bool write_value = true) :
+        writer(writer),
+        column(column),
+        write_key(write_key),
+        write_value(write_value) {
+    }
+    template<typename V>
+    void operator()(const JKSNKey &key, V &value) {
+        if(this->column == ~size_t(0) || this->column == this->index) {
+            if(this->write_key)
+                this->writer.writeKey(key);
+            if(this->write_value)
+                JKSNBinding<typename std::remove_const<V>::type>::dump(this->writer, value);
+        }
+        ++this->index;
+    }
+private:
+    JKSNWriter &writer;
+    size_t column;
+    bool write_key;
+    bool write_value;
+    size_t index = 0;
+};
+
+class JKSNFieldReader {
+public:
+    JKSNFieldReader(JKSNReader &reader, const std::string &key) :
+        reader(reader),
+        key(key) {
+    }
+    template<typename V>
+    void operator()(const JKSNKey &key, V &value) {
+        if(!this->found && key.size == this->key.size() && this->key.compare(0, key.size, key.str, key.size) == 0) {
+            JKSNBinding<V>::parse(this->reader, value);
+            this->found = true;
+        }
+    }
+    bool found = false;
+private:
+    JKSNReader &reader;
+    const std::string &key;
+};
+
+class JKSNFieldConverter {
+public:
+    JKSNFieldConverter(const std::map<JKSNValue, JKSNValue> &map) :
+        map(map) {
+    }
+    template<typename V>
+    void operator()(const JKSNKey &key, V &value) {
+        std::map<JKSNValue, JKSNValue>::const_iterator it = this->map.find(JKSNValue(std::string(key.str, key.size)));
+        if(it != this->map.end() && !it->second.isUnspecified())
+            JKSNBinding<V>::fromValue(it->second, value);
+    }
+private:
+    const std::map<JKSNValue, JKSNValue> &map;
+};
+
+template<>
+struct JKSNBinding<bool> {
+    static void dump(JKSNWriter &writer, bool obj) {
+        writer.writeBool(obj);
+    }
+    static void parse(JKSNReader &reader, bool &obj) {
+        obj = reader.readBool();
+    }
+    static void fromValue(const JKSNValue &value, bool &obj) {
+        obj = value.toBool();
+    }
+};
+
+template<typename T>
+struct JKSNBinding<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type> {
+    static void dump(JKSNWriter &writer, T obj) {
+        if(std::is_unsigned<T>::value && uintmax_t(obj) > uintmax_t(INTMAX_MAX))
+            throw std::overflow_error("JKSN value too large");
+        writer.writeInt(intmax_t(obj));
+    }
+    static void parse(JKSNReader &reader, T &obj) {
+        obj = convert(reader.readInt());
+    }
+    static void fromValue(const JKSNValue &value, T &obj) {
+        obj = convert(value.toInt());
+    }
+private:
+    static T convert(intmax_t value) {
+        if((std::is_unsigned<T>::value && value < 0) || intmax_t(T(value)) != value)
+            throw JKSNTypeError();
+        return T(value);
+    }
+};
+
+template<typename T>
+struct JKSNBinding<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static void dump(JKSNWriter &writer, T obj) {
+        if(std::is_same<T, float>::value)
+            writer.writeFloat(float(obj));
+        else if(std::is_same<T, double>::value)
+            writer.writeDouble(double(obj));
+        else
+            writer.writeValue(JKSNValue(obj));
+    }
+    static void parse(JKSNReader &reader, T &obj) {
+        if(std::is_same<T, long double>::value)
+            obj = T(reader.readValue().toLongDouble());
+        else
+            obj = T(reader.readDouble());
+    }
+    static void fromValue(const JKSNValue &value, T &obj) {
+        obj = T(value.toLongDouble());
+    }
+};
+
+template<>
+struct JKSNBinding<std::string> {
+    static void dump(JKSNWriter &writer, const std::string &obj) {
+        writer.writeString(obj);
+    }
+    static void parse(JKSNReader &reader, std::string &obj) {
+        reader.readString(obj);
+    }
+    static void fromValue(const JKSNValue &value, std::string &obj) {
+        obj = value.toString();
+    }
+};
+
+template<>
+struct JKSNBinding<JKSNValue> {
+    static void dump(JKSNWriter &writer, const JKSNValue &obj) {
+        writer.writeValue(obj);
+    }
+    static void parse(JKSNReader &reader, JKSNValue &obj) {
+        obj = reader.readValue();
+    }
+    static void fromValue(const JKSNValue &value, JKSNValue &obj) {
+        obj = value;
+    }
+};
+
+template<typename T>
+struct JKSNBinding<T, typename std::enable_if<JKSNHasBind<T>::value>::type> {
+    static size_t fieldCount(const T &obj) {
+        JKSNFieldCounter counter;
+        const_cast<T &>(obj).jksnBind(counter);
+        return counter.count;
+    }
+    static void dump(JKSNWriter &writer, const T &obj) {
+        writer.writeObjectHeader(fieldCount(obj));
+        JKSNFieldWriter field_writer(writer);
+        const_cast<T &>(obj).jksnBind(field_writer);
+    }
+    static void parse(JKSNReader &reader, T &obj) {
+        size_t length;
+        if(reader.readObjectHeader(length)) {
+            std::string key;
+            while(length--) {
+                reader.readString(key);
+                parseField(reader, key, obj);
+            }
+        } else
+            fromValue(reader.readValue(), obj);
+    }
+    static void parseField(JKSNReader &reader, const std::string &key, T &obj) {
+        if(reader.readUnspecified())
+            return;
+        JKSNFieldReader field_reader(reader, key);
+        obj.jksnBind(field_reader);
+        if(!field_reader.found)
+            reader.skipValue();
+    }
+    static void fromValue(const JKSNValue &value, T &obj) {
+        JKSNFieldConverter converter(value.toMap());
+        obj.jksnBind(converter);
+    }
+};
+
+template<typename T>
+struct JKSNBinding<std::vector<T>> {
+    static void dump(JKSNWriter &writer, const std::vector<T> &obj) {
+        dumpVector(writer, obj, std::integral_constant<bool, JKSNHasBind<T>::value>());
+    }
+    static void parse(JKSNReader &reader, std::vector<T> &obj) {
+        size_t length;
+        if(reader.readArrayHeader(length)) {
+            obj.clear();
+            obj.reserve(length);
+            while(length--) {
+                T item = T();
+                JKSNBinding<T>::parse(reader, item);
+                obj.push_back(std::move(item));
+            }
+        } else
+            parseSwapped(reader, obj, std::integral_constant<bool, JKSNHasBind<T>::value>());
+    }
+    static void fromValue(const JKSNValue &value, std::vector<T> &obj) {
+        const std::vector<JKSNValue> &value_vector = value.toVector();
+        obj.clear();
+        obj.reserve(value_vector.size());
+        for(const JKSNValue &i : value_vector) {
+            T item = T();
+            JKSNBinding<T>::fromValue(i, item);
+            obj.push_back(std::move(item));
+        }
+    }
+private:
+    static void dumpVector(JKSNWriter &writer, const std::vector<T> &obj, std::false_type) {
+        writer.writeArrayHeader(obj.size());
+        for(const T &i : obj)
+            JKSNBinding<T>::dump(writer, i);
+    }
+    static void dumpVector(JKSNWriter &writer, const std::vector<T> &obj, std::true_type) {
+        size_t columns = obj.size() >= 2 ? JKSNBinding<T>::fieldCount(obj[0]) : 0;
+        if(columns == 0) {
+            dumpVector(writer, obj, std::false_type());
+            return;
+        }
+        writer.writeSwappedArrayHeader(columns);
+        for(size_t column = 0; column < columns; ++column) {
+            JKSNFieldWriter key_writer(writer, column, true, false);
+            const_cast<T &>(obj[0]).jksnBind(key_writer);
+            writer.writeArrayHeader(obj.size());
+            for(const T &row : obj) {
+                JKSNFieldWriter value_writer(writer, column, false, true);
+                const_cast<T &>(row).jksnBind(value_writer);
+            }
+        }
+    }
+    static void parseSwapped(JKSNReader &reader, std::vector<T> &obj, std::false_type) {
+        fromValue(reader.readValue(), obj);
+    }
+    static void parseSwapped(JKSNReader &reader, std::vector<T> &obj, std::true_type) {
+        size_t columns;
+        if(!reader.readSwappedArrayHeader(columns)) {
+            fromValue(reader.readValue(), obj);
+            return;
+        }
+        obj.clear();
+        std::string key;
+        while(columns--) {
+            reader.readString(key);
+            size_t length;
+            if(reader.readArrayHeader(length)) {
+                if(obj.size() < length)
+                    obj.resize(length);
+                for(size_t row = 0; row < length; ++row)
+                    JKSNBinding<T>::parseField(reader, key, obj[row]);
+            } else {
+                JKSNValue column_values = reader.readValue();
+                if(!column_values.isArray())
+                    throw JKSNDecodeError("JKSN row-col swapped array requires an array but not found");
+                const std::vector<JKSNValue> &column_vector = column_values.toVector();
+                if(obj.size() < column_vector.size())
+                    obj.resize(column_vector.size());
+                for(size_t row = 0; row < column_vector.size(); ++row)
+                    if(!column_vector[row].isUnspecified()) {
+                        std::map<JKSNValue, JKSNValue> cell;
+                        cell.insert(std::make_pair(JKSNValue(key), column_vector[row]));
+                        JKSNFieldConverter converter(cell);
+                        obj[row].jksnBind(converter);
+                    }
+            }
+        }
+    }
+};
+
+template<typename T>
+struct JKSNBinding<std::map<std::string, T>> {
+    static void dump(JKSNWriter &writer, const std::map<std::string, T> &obj) {
+        writer.writeObjectHeader(obj.size());
+        for(const std::pair<const std::string, T> &i : obj) {
+            writer.writeString(i.first);
+            JKSNBinding<T>::dump(writer, i.second);
+        }
+    }
+    static void parse(JKSNReader &reader, std::map<std::string, T> &obj) {
+        size_t length;
+        if(reader.readObjectHeader(length)) {
+            obj.clear();
+            std::string key;
+            while(length--) {
+                reader.readString(key);
+                JKSNBinding<T>::parse(reader, obj[key]);
+            }
+        } else
+            fromValue(reader.readValue(), obj);
+    }
+    static void fromValue(const JKSNValue &value, std::map<std::string, T> &obj) {
+        obj.clear();
+        for(const std::pair<const JKSNValue, JKSNValue> &i : value.toMap())
+            JKSNBinding<T>::fromValue(i.second, obj[i.first.toString()]);
+    }
+};
+
+template<typename T>
+std::ostream &JKSNEncoder::dumpTyped(const T &obj, std::ostream &result, bool header) {
+    return result << this->dumpTyped(obj, header);
+}
+
+template<typename T>
+std::string JKSNEncoder::dumpTyped(const T &obj, bool header) {
+    std::string result;
+    if(header)
+        result.assign("jk!", 3);
+    JKSNWriter writer(*this, result);
+    JKSNBinding<T>::dump(writer, obj);
+    return result;
+}
+
+template<typename T>
+T &JKSNDecoder::parseTyped(std::istream &fp, T &result, bool header) {
+    JKSNReader reader(*this, fp, header);
+    JKSNBinding<T>::parse(reader, result);
+    return result;
+}
+
+template<typename T>
+T &JKSNDecoder::parseTyped(const std::string &str, T &result, bool header) {
+    std::istringstream stream(str);
+    return this->parseTyped(stream, result, header);
+}
+
 inline std::ostream &dump(const JKSNValue &obj, std::ostream &result, bool header = true) {
     return JKSNEncoder().dump(obj, result, header);
 }
@@ -609,6 +1680,33 @@ inline JKSNValue parse(std::istream &fp, bool header = true) {
 inline JKSNValue parse(const std::string &str, bool header = true) {
     return JKSNDecoder().parse(str, header);
 }
+inline std::string dumpJSON(const std::string &json, bool header = true) {
+    return JKSNEncoder().dumpJSON(json, header);
+}
+inline JKSNValue parseJSON(const std::string &json) {
+    return JKSNJSONParser().parse(json);
+}
+inline std::string toJSON(const JKSNValue &obj) {
+    std::string result;
+    JKSNJSONWriter(result).writeValue(obj);
+    return result;
+}
+template<typename T>
+inline std::ostream &dumpTyped(const T &obj, std::ostream &result, bool header = true) {
+    return JKSNEncoder().dumpTyped(obj, result, header);
+}
+template<typename T>
+inline std::string dumpTyped(const T &obj, bool header = true) {
+    return JKSNEncoder().dumpTyped(obj, header);
+}
+template<typename T>
+inline T &parseTyped(std::istream &fp, T &result, bool header = true) {
+    return JKSNDecoder().parseTyped(fp, result, header);
+}
+template<typename T>
+inline T &parseTyped(const std::string &str, T &result, bool header = true) {
+    return JKSNDecoder().parseTyped(str, result, header);
+}
 
 }
 
@@ -617,50 +1715,7 @@ namespace std {
 template<>
 struct hash<JKSN::JKSNValue> {
     size_t operator()(const JKSN::JKSNValue &value) const {
-        size_t result = 0;
-        switch(value.getType()) {
-        case JKSN::JKSN_UNDEFINED:
-            result = 0x0;
-            break;
-        case JKSN::JKSN_NULL:
-            result = 0x1;
-            break;
-        case JKSN::JKSN_BOOL:
-            result = hash<bool>()(value.toBool());
-            break;
-        case JKSN::JKSN_INT:
-            result = hash<intmax_t>()(value.toInt());
-            break;
-        case JKSN::JKSN_FLOAT:
-            result = hash<float>()(value.toFloat());
-            break;
-        case JKSN::JKSN_DOUBLE:
-            result = hash<double>()(value.toDouble());
-            break;
-        case JKSN::JKSN_LONG_DOUBLE:
-            result = hash<long double>()(value.toLongDouble());
-            break;
-        case JKSN::JKSN_STRING:
-        case JKSN::JKSN_BLOB:
-            result = hash<string>()(value.toString());
-            break;
-        case JKSN::JKSN_ARRAY:
-            for(const JKSN::JKSNValue &i : value.toVector())
-                result ^= (*this)(i);
-            break;
-        case JKSN::JKSN_OBJECT:
-            for(const pair<JKSN::JKSNValue, JKSN::JKSNValue> &i : value.toMap()) {
-                result ^= (*this)(i.first);
-                result ^= (*this)(i.second);
-            }
-            break;
-        case JKSN::JKSN_UNSPECIFIED:
-            result = 0xa0;
-            break;
-        default:
-            result = ~ size_t(0);
-        }
-        return result;
+        return value.hash();
     }
 };
 
@@ -0,0 +1,56 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "jksn.hpp"
+
+template<typename F>
+static void bench(const char *name, size_t messages, int rounds, F encode) {
+    size_t size = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < rounds; ++i)
+        size = encode();
+    auto stop = std::chrono::steady_clock::now();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count()/rounds/int64_t(messages);
+    std::cout << name << ": " << size << " bytes, " << ns << " ns per message" << std::endl;
+}
+
+int main() {
+    /* A tick's worth of small messages */
+    static const size_t messages = 500;
+    std::vector<JKSN::JKSNValue> batch;
+    for(size_t i = 0; i < messages; ++i)
+        batch.push_back(JKSN::JKSNValue::fromMap({
+            {"type", "quote"},
+            {"symbol", "SYM" + std::to_string(i % 40)},
+            {"seq", intmax_t(100000 + i)},
+            {"bid", double(i % 97) * 0.5},
+            {"size", intmax_t(i % 13 * 100)}
+        }));
+    bench("dump, new encoder each", messages, 200, [&]() {
+        size_t size = 0;
+        for(const JKSN::JKSNValue &message : batch)
+            size += JKSN::JKSNEncoder().dump(message).size();
+        return size;
+    });
+    bench("dumpBatch", messages, 200, [&]() {
+        static JKSN::JKSNEncoder encoder;
+        static std::string output;
+        encoder.dumpBatch(batch, output);
+        return output.size();
+    });
+    bench("dump, one encoder", messages, 200, [&]() {
+        JKSN::JKSNEncoder encoder;
+        size_t size = 0;
+        for(const JKSN::JKSNValue &message : batch)
+            size += encoder.dump(message, false).size();
+        return size;
+    });
+    bench("dumpBatch, shared", messages, 200, [&]() {
+        JKSN::JKSNEncoder encoder;
+        static std::string output;
+        encoder.dumpBatch(batch, output, false, true);
+        return output.size();
+    });
+    return 0;
+}
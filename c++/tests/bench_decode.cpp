@@ -0,0 +1,107 @@
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "jksn.hpp"
+
+static void bench(const char *name, const std::string &stream, int rounds) {
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < rounds; ++i) {
+        std::istringstream fp(stream);
+        JKSN::JKSNDecoder().parse(fp);
+    }
+    auto stop = std::chrono::steady_clock::now();
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count()/rounds;
+    std::cout << name << ": " << stream.size() << " bytes, "
+              << us << " us per parse, "
+              << (us ? double(stream.size())/double(us) : 0.0) << " MB/s" << std::endl;
+}
+
+static void benchProjection(const char *name, const std::string &stream, const JKSN::JKSNProjection &projection, int rounds) {
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < rounds; ++i) {
+        std::istringstream fp(stream);
+        JKSN::JKSNDecoder decoder;
+        projection.parse(fp, decoder);
+    }
+    auto stop = std::chrono::steady_clock::now();
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count()/rounds;
+    std::cout << name << ": " << stream.size() << " bytes, "
+              << us << " us per parse, "
+              << (us ? double(stream.size())/double(us) : 0.0) << " MB/s" << std::endl;
+}
+
+static void benchJSON(const char *name, const std::string &stream, int rounds) {
+    /* Transcoded straight from the stream, into a buffer reused between rounds */
+    std::string output;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < rounds; ++i) {
+        std::istringstream fp(stream);
+        JKSN::JKSNDecoder decoder;
+        JKSN::JKSNReader reader(decoder, fp);
+        output.clear();
+        JKSN::JKSNJSONWriter(output).transcode(reader);
+    }
+    auto stop = std::chrono::steady_clock::now();
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count()/rounds;
+    std::cout << name << ": " << output.size() << " bytes of JSON, "
+              << us << " us per conversion, "
+              << (us ? double(output.size())/double(us) : 0.0) << " MB/s" << std::endl;
+}
+
+int main() {
+    static const size_t records = 20000;
+    std::vector<JKSN::JKSNValue> table;
+    table.reserve(records);
+    for(size_t i = 0; i < records; ++i) {
+        std::map<JKSN::JKSNValue, JKSN::JKSNValue> record;
+        record[JKSN::JKSNValue("id")] = JKSN::JKSNValue(intmax_t(i));
+        record[JKSN::JKSNValue("name")] = JKSN::JKSNValue("user_" + std::to_string(i % 1000));
+        record[JKSN::JKSNValue("score")] = JKSN::JKSNValue(double(i) * 0.25);
+        record[JKSN::JKSNValue("active")] = JKSN::JKSNValue(i % 3 != 0);
+        record[JKSN::JKSNValue("tags")] = JKSN::JKSNValue(std::vector<JKSN::JKSNValue>{
+            JKSN::JKSNValue("tag_" + std::to_string(i % 7)), JKSN::JKSNValue(intmax_t(i % 100))
+        });
+        table.push_back(JKSN::JKSNValue(std::move(record)));
+    }
+    /* Plain arrays of objects, not swapped, to exercise the per-value path */
+    std::string records_stream;
+    {
+        std::vector<JKSN::JKSNValue> wrapped;
+        for(JKSN::JKSNValue &record : table)
+            wrapped.push_back(JKSN::JKSNValue(std::vector<JKSN::JKSNValue>{record}));
+        records_stream = JKSN::dump(JKSN::JKSNValue(std::move(wrapped)), false);
+    }
+    bench("records", records_stream, 10);
+    benchJSON("records to JSON", records_stream, 10);
+    bench("swapped records", JKSN::dump(JKSN::JKSNValue(std::move(table)), false), 10);
+    /* Wide records of which a filter needs 2 of 40 fields */
+    std::vector<JKSN::JKSNValue> wide;
+    for(size_t i = 0; i < records; ++i) {
+        std::map<JKSN::JKSNValue, JKSN::JKSNValue> record;
+        for(size_t j = 0; j < 40; ++j)
+            if(j % 2)
+                record[JKSN::JKSNValue("field_" + std::to_string(j))] = JKSN::JKSNValue("value_" + std::to_string((i + j) % 500));
+            else
+                record[JKSN::JKSNValue("field_" + std::to_string(j))] = JKSN::JKSNValue(intmax_t(i * j));
+        wide.push_back(JKSN::JKSNValue(std::vector<JKSN::JKSNValue>{JKSN::JKSNValue(std::move(record))}));
+    }
+    std::string wide_stream = JKSN::dump(JKSN::JKSNValue(std::move(wide)), false);
+    bench("wide records", wide_stream, 5);
+    benchProjection("wide records, 2 fields", wide_stream, JKSN::JKSNProjection({"[*][0].field_3", "[*][0].field_8"}), 5);
+    std::vector<JKSN::JKSNValue> ints;
+    for(size_t i = 0; i < 200000; ++i)
+        ints.push_back(JKSN::JKSNValue(intmax_t(i * 37 % 1000)));
+    bench("integers", JKSN::dump(JKSN::JKSNValue(std::move(ints)), false), 10);
+    /* Nesting deep enough to overflow a recursive decoder */
+    static const size_t depth = 1000000;
+    std::string deep(depth, char(0x81));
+    deep += char(0x80);
+    try {
+        bench("deep nesting", deep, 1);
+    } catch(const JKSN::JKSNError &e) {
+        std::cout << "deep nesting: " << e.what() << std::endl;
+    }
+    return 0;
+}
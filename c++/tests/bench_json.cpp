@@ -0,0 +1,45 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include "jksn.hpp"
+
+template<typename F>
+static void bench(const char *name, const std::string &json, int rounds, F convert) {
+    size_t size = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < rounds; ++i)
+        size = convert(json);
+    auto stop = std::chrono::steady_clock::now();
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count()/rounds;
+    std::cout << name << ": " << json.size() << " bytes of JSON to " << size << " bytes, "
+              << us << " us per conversion, "
+              << (us ? double(json.size())/double(us) : 0.0) << " MB/s" << std::endl;
+}
+
+int main() {
+    static const size_t records = 20000;
+    std::string json = "[";
+    for(size_t i = 0; i < records; ++i) {
+        if(i != 0)
+            json += ",\n";
+        json += "{\"id\": " + std::to_string(i) +
+            ", \"name\": \"user_" + std::to_string(i % 1000) +
+            "\", \"score\": " + std::to_string(double(i) * 0.25) +
+            ", \"active\": " + (i % 3 != 0 ? "true" : "false") +
+            ", \"tags\": [\"tag_" + std::to_string(i % 7) + "\", " + std::to_string(i % 100) + "]}";
+    }
+    json += "]";
+    /* Parsing into a JKSNValue, then encoding it, as a separate JSON library would */
+    bench("JSON to JKSNValue to JKSN", json, 10, [](const std::string &json) {
+        return JKSN::JKSNEncoder().dump(JKSN::JKSNJSONParser().parse(json)).size();
+    });
+    bench("JSON to JKSNValue", json, 10, [](const std::string &json) {
+        return JKSN::JKSNJSONParser().parse(json).toVector().size();
+    });
+    JKSN::JKSNEncoder encoder;
+    bench("JSON to JKSN directly", json, 10, [&encoder](const std::string &json) {
+        encoder = JKSN::JKSNEncoder();
+        return encoder.dumpJSON(json).size();
+    });
+    return 0;
+}
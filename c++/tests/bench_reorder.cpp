@@ -0,0 +1,110 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "jksn.hpp"
+
+static size_t deflatedSize(const std::string &stream) {
+    /* The same deflate stream gzip writes by default, without its 18 bytes of framing */
+    uLongf size = compressBound(uLong(stream.size()));
+    std::vector<Bytef> buf(size);
+    if(compress2(buf.data(), &size, reinterpret_cast<const Bytef *>(stream.data()), uLong(stream.size()), 6) != Z_OK)
+        return 0;
+    return size;
+}
+
+static void bench(const char *name, const JKSN::JKSNValue &value) {
+    JKSN::JKSNEncoder balanced;
+    JKSN::JKSNEncoder smallest;
+    smallest.setEffort(JKSN::JKSN_EFFORT_SMALLEST);
+    std::string before = balanced.dump(value, false);
+    std::string after = smallest.dump(value, false);
+    size_t before_deflated = deflatedSize(before);
+    size_t after_deflated = deflatedSize(after);
+    std::cout << name << ": " << before.size() << " -> " << after.size() << " bytes, "
+              << before_deflated << " -> " << after_deflated << " bytes deflated ("
+              << 100.0 * (double(before_deflated) - double(after_deflated)) / double(before_deflated) << "% smaller)" << std::endl;
+}
+
+int main() {
+    static const char *const countries[] = {"Germany", "Japan", "Brazil", "Canada", "Kenya"};
+    static const char *const kinds[] = {"login", "click", "purchase"};
+    /* A table of users, swapped into columns */
+    std::vector<JKSN::JKSNValue> users;
+    for(intmax_t i = 0; i < 5000; ++i) {
+        intmax_t created = 1700000000 + i*37;
+        users.push_back(JKSN::JKSNValue::fromMap({
+            {"id", i},
+            {"name", "user_" + std::to_string(i)},
+            {"email", "user_" + std::to_string(i) + "@example.com"},
+            {"country", countries[i % 5]},
+            {"created", created},
+            {"updated", created + i % 500},
+            {"score", double(i % 1000) * 0.25},
+            {"active", i % 3 != 0}
+        }));
+    }
+    bench("users", JKSN::JKSNValue(std::move(users)));
+    /* A log of events of several kinds, which stay objects */
+    std::vector<JKSN::JKSNValue> events;
+    for(intmax_t i = 0; i < 5000; ++i) {
+        const char *kind = kinds[i % 3];
+        intmax_t time = 1700000000000 + i*250;
+        events.push_back(JKSN::JKSNValue(kind));
+        events.push_back(JKSN::JKSNValue::fromMap({
+            {"user", i % 97},
+            {"session", "s" + std::to_string(i / 20)},
+            {"page", std::string("/shop/") + kind + "/" + std::to_string(i % 13)},
+            {"referrer", std::string("/shop/") + kinds[(i + 1) % 3] + "/" + std::to_string(i % 11)},
+            {"start", time},
+            {"end", time + i % 90},
+            {"bytes", i * 3 % 4096}
+        }));
+    }
+    bench("events", JKSN::JKSNValue(std::move(events)));
+    /* Counters of many hosts, keyed by host name */
+    std::map<JKSN::JKSNValue, JKSN::JKSNValue> hosts;
+    for(intmax_t i = 0; i < 2000; ++i) {
+        intmax_t boot = 1699000000 + i*11;
+        hosts[JKSN::JKSNValue("host-" + std::to_string(i) + ".example.net")] = JKSN::JKSNValue::fromMap({
+            {"boot", boot},
+            {"checked", boot + 86400 + i},
+            {"cpu", i % 64},
+            {"disk_read", 1000000 + i*7},
+            {"disk_written", 1000000 + i*9},
+            {"memory", 16384 - i % 4096},
+            {"rack", "rack-" + std::to_string(i / 40)},
+            {"zone", "zone-" + std::to_string(i / 400)}
+        });
+    }
+    bench("hosts", JKSN::JKSNValue(std::move(hosts)));
+    /* Orders keyed by number, each with a timestamp on either side of its other fields */
+    std::map<JKSN::JKSNValue, JKSN::JKSNValue> orders;
+    for(intmax_t i = 0; i < 5000; ++i) {
+        intmax_t created = 1700000000 + i*61;
+        orders[JKSN::JKSNValue("order-" + std::to_string(100000 + i))] = JKSN::JKSNValue::fromMap({
+            {"created_at", created},
+            {"customer", "customer-" + std::to_string(i * 7 % 1000)},
+            {"id", 100000 + i},
+            {"items", 1 + i % 5},
+            {"total", 500 + i * 13 % 20000},
+            {"updated_at", created + 30 + i % 600}
+        });
+    }
+    bench("orders", JKSN::JKSNValue(std::move(orders)));
+    /* Sessions of unrelated users, with a counter sorting between their two timestamps */
+    std::vector<JKSN::JKSNValue> sessions;
+    uint32_t seed = 1;
+    for(intmax_t i = 0; i < 5000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        intmax_t begin = 1690000000 + intmax_t(seed % 10000000);
+        sessions.push_back(JKSN::JKSNValue(std::vector<JKSN::JKSNValue>{JKSN::JKSNValue::fromMap({
+            {"begin", begin},
+            {"clicks", i % 40},
+            {"end", begin + 60 + i % 1800},
+            {"user", "user_" + std::to_string(seed % 100000)}
+        })}));
+    }
+    bench("sessions", JKSN::JKSNValue(std::move(sessions)));
+    return 0;
+}
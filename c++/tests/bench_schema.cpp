@@ -0,0 +1,85 @@
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "jksn.hpp"
+
+template<typename F>
+static void bench(const char *name, size_t records, int rounds, F run) {
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < rounds; ++i)
+        run();
+    auto stop = std::chrono::steady_clock::now();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count()/rounds/int64_t(records);
+    std::cout << name << ": " << ns << " ns per record" << std::endl;
+}
+
+int main() {
+    JKSN::JKSNSchema schema(JKSN::JKSNValue::fromMap({
+        {"id", "int"},
+        {"user", "string"},
+        {"active", "bool"},
+        {"score", "double"},
+        {"position", JKSN::JKSNValue::fromMap({
+            {"lat", "double"},
+            {"lon", "double"}
+        })},
+        {"tags", std::vector<JKSN::JKSNValue>({"string"})}
+    }), "event");
+    /* A stream of records sent as messages one after another, as a server would */
+    static const size_t records = 20000;
+    std::vector<std::vector<JKSN::JKSNValue> > slots(records, std::vector<JKSN::JKSNValue>(schema.slotCount()));
+    for(size_t i = 0; i < records; ++i) {
+        slots[i][schema.slotIndex("id")] = intmax_t(100000 + i);
+        slots[i][schema.slotIndex("user")] = "user_" + std::to_string(i % 1000);
+        slots[i][schema.slotIndex("active")] = i % 3 != 0;
+        slots[i][schema.slotIndex("score")] = double(i) * 0.25;
+        slots[i][schema.slotIndex("position.lat")] = 31.0 + double(i % 100) / 128;
+        slots[i][schema.slotIndex("position.lon")] = 121.0 + double(i % 50) / 64;
+        slots[i][schema.slotIndex("tags")] = std::vector<JKSN::JKSNValue>({"tag_" + std::to_string(i % 7)});
+    }
+    std::vector<JKSN::JKSNValue> values;
+    for(const std::vector<JKSN::JKSNValue> &record : slots)
+        values.push_back(schema.toValue(record));
+    std::vector<std::string> messages;
+    {
+        JKSN::JKSNEncoder encoder;
+        for(const std::vector<JKSN::JKSNValue> &record : slots)
+            messages.push_back(schema.dump(record, encoder, false));
+    }
+    bench("schema dump", records, 10, [&]() {
+        JKSN::JKSNEncoder encoder;
+        for(const std::vector<JKSN::JKSNValue> &record : slots)
+            schema.dump(record, encoder, false);
+    });
+    bench("generic dump", records, 10, [&]() {
+        JKSN::JKSNEncoder encoder;
+        for(const JKSN::JKSNValue &value : values)
+            encoder.dump(value, false);
+    });
+    bench("schema parse", records, 10, [&]() {
+        JKSN::JKSNDecoder decoder;
+        std::vector<JKSN::JKSNValue> record;
+        for(const std::string &message : messages) {
+            std::istringstream fp(message);
+            schema.parse(fp, decoder, record, false);
+        }
+    });
+    bench("generic parse", records, 10, [&]() {
+        JKSN::JKSNDecoder decoder;
+        for(const std::string &message : messages) {
+            std::istringstream fp(message);
+            decoder.parse(fp, false);
+        }
+    });
+    bench("generic parse and fromValue", records, 10, [&]() {
+        JKSN::JKSNDecoder decoder;
+        std::vector<JKSN::JKSNValue> record;
+        for(const std::string &message : messages) {
+            std::istringstream fp(message);
+            schema.fromValue(decoder.parse(fp, false), record);
+        }
+    });
+    return 0;
+}
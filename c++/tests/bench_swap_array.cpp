@@ -0,0 +1,32 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "jksn.hpp"
+
+int main() {
+    static const size_t rows = 20000;
+    static const size_t columns = 8;
+    static const int rounds = 10;
+    std::vector<JKSN::JKSNValue> keys;
+    for(size_t i = 0; i < columns; ++i)
+        keys.push_back(JKSN::JKSNValue("column_name_" + std::to_string(i)));
+    std::vector<JKSN::JKSNValue> table;
+    table.reserve(rows);
+    for(size_t i = 0; i < rows; ++i) {
+        std::map<JKSN::JKSNValue, JKSN::JKSNValue> row;
+        for(size_t j = 0; j < columns; ++j)
+            row[keys[j]] = JKSN::JKSNValue(intmax_t(i*columns + j));
+        table.push_back(JKSN::JKSNValue(std::move(row)));
+    }
+    JKSN::JKSNValue value(std::move(table));
+    size_t size = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < rounds; ++i)
+        size += JKSN::dump(value).size();
+    auto stop = std::chrono::steady_clock::now();
+    std::cout << "swapped array: " << rows << " rows x " << columns << " columns, "
+              << size/rounds << " bytes, "
+              << std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count()/rounds << " us per dump" << std::endl;
+    return 0;
+}
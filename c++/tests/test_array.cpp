@@ -1,3 +1,4 @@
+#include <cassert>
 #include <iostream>
 #include "jksn.hpp"
 
@@ -5,6 +6,14 @@ int main() {
     JKSN::JKSNValue value = {
         "element", "元素", "element", "元素"
     };
+    /* A length the stream cannot back is an error, not a huge allocation */
+    bool rejected = false;
+    try {
+        JKSN::parse(std::string("jk!\x8f\xff\xff\xff\xff\xff\xff\xff\x7f", 12));
+    } catch(const JKSN::JKSNDecodeError &) {
+        rejected = true;
+    }
+    assert(rejected);
     JKSN::dump(value, std::cout);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,48 @@
+#include <cassert>
+#include <iostream>
+#include "jksn.hpp"
+
+int main() {
+    std::vector<JKSN::JKSNValue> messages;
+    for(int i = 0; i < 100; i++)
+        messages.push_back(JKSN::JKSNValue::fromMap({
+            {"type", "tick"},
+            {"seq", 1000 + i},
+            {"symbol", i % 2 ? "AAPL" : "MSFT"}
+        }));
+    /* Keys are interned across the batch, including ones kept as UTF-16 and column names */
+    for(int i = 0; i < 4; i++)
+        messages.push_back(JKSN::JKSNValue::fromMap({
+            {"元素", i},
+            {"rows", JKSN::JKSNValue({
+                JKSN::JKSNValue::fromMap({{"元素", "a"}, {"type", i}}),
+                JKSN::JKSNValue::fromMap({{"元素", "b"}, {"type", i + 1}})
+            })}
+        }));
+    /* Independent messages are what separate encoders write */
+    JKSN::JKSNEncoder encoder;
+    std::string output;
+    std::vector<size_t> offsets = encoder.dumpBatch(messages, output);
+    assert(offsets.size() == messages.size() + 1 && offsets.front() == 0 && offsets.back() == output.size());
+    for(size_t i = 0; i < messages.size(); i++) {
+        std::string message = output.substr(offsets[i], offsets[i + 1] - offsets[i]);
+        assert(message == JKSN::JKSNEncoder().dump(messages[i]));
+        assert(JKSN::JKSNDecoder().parse(message) == messages[i]);
+    }
+    /* Shared ones are what one encoder writes, and need one decoder */
+    JKSN::JKSNEncoder shared_encoder;
+    JKSN::JKSNEncoder single;
+    std::string shared_output;
+    offsets = shared_encoder.dumpBatch(messages, shared_output, false, true);
+    assert(shared_output.size() < output.size() - 3 * messages.size());
+    JKSN::JKSNDecoder decoder;
+    for(size_t i = 0; i < messages.size(); i++) {
+        std::string message = shared_output.substr(offsets[i], offsets[i + 1] - offsets[i]);
+        assert(message == single.dump(messages[i], false));
+        assert(decoder.parse(message, false) == messages[i]);
+    }
+    offsets = encoder.dumpBatch(nullptr, 0, output);
+    assert(offsets.size() == 1 && offsets[0] == 0 && output.empty());
+    JKSN::dump(JKSN::JKSNValue(messages), std::cout);
+    return 0;
+}
@@ -0,0 +1,49 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include "jksn.hpp"
+
+static void writeBlocks(JKSN::JKSNBlockWriter &writer, intmax_t first, size_t blocks) {
+    for(size_t i = 0; i < blocks; i++) {
+        std::vector<JKSN::JKSNValue> records;
+        for(intmax_t j = 0; j < 100; j++)
+            records.push_back(JKSN::JKSNValue::fromMap({
+                {"id", first + intmax_t(i)*100 + j},
+                {"name", "record"}
+            }));
+        writer.write(records);
+    }
+    writer.close();
+}
+
+int main() {
+    std::stringstream archive;
+    {
+        JKSN::JKSNBlockWriter writer(archive);
+        writeBlocks(writer, 0, 3);
+    }
+    {
+        /* Appending leaves the first blocks where they are */
+        JKSN::JKSNBlockWriter writer(archive, true);
+        writeBlocks(writer, 300, 2);
+    }
+    JKSN::JKSNBlockReader reader(archive);
+    for(size_t i = 0; i < reader.blockCount(); i++) {
+        const JKSN::JKSNBlockInfo &info = reader.blockInfo(i);
+        std::cerr << "block " << i << ": offset " << info.offset << ", " << info.size << " bytes, " << info.records << " records" << std::endl;
+    }
+    std::vector<JKSN::JKSNValue> result;
+    for(uint64_t i = 0; i < reader.recordCount(); i += 99)
+        result.push_back(reader.readRecord(i));
+    std::string block = reader.loadBlock(4);
+    result.push_back(JKSN::JKSNBlockReader::parseBlock(block).toVector().back());
+    /* A damaged block fails its checksum */
+    block[block.size()-1] ^= 1;
+    try {
+        JKSN::JKSNBlockReader::parseBlock(block);
+    } catch(const JKSN::JKSNChecksumError &e) {
+        std::cerr << e.what() << std::endl;
+    }
+    JKSN::dump(result, std::cout);
+    return 0;
+}
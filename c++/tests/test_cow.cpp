@@ -0,0 +1,39 @@
+#include <cassert>
+#include <iostream>
+#include "jksn.hpp"
+
+int main() {
+    JKSN::JKSNValue value = JKSN::JKSNValue::fromMap({
+        {"k", 1},
+        {"list", std::vector<JKSN::JKSNValue>({1, 2, 3})}
+    });
+    /* Copies share their data until one of them is written to */
+    JKSN::JKSNValue copy = value;
+    assert(value.isShared() && copy.isShared());
+    copy["k"] = 2;
+    assert(!value.isShared() && value["k"] == 1 && copy["k"] == 2);
+    /* A reference kept across a copy only ever changes its own value */
+    JKSN::JKSNValue &member = value["k"];
+    JKSN::JKSNValue later = value;
+    member = 99;
+    assert(value["k"] == 99 && later["k"] == 1);
+    JKSN::JKSNValue array = std::vector<JKSN::JKSNValue>({1, 2, 3});
+    std::vector<JKSN::JKSNValue> &items = array.toVector();
+    JKSN::JKSNValue grown = array;
+    items.push_back(4);
+    assert(array.toVector().size() == 4 && static_cast<const JKSN::JKSNValue &>(grown).toVector().size() == 3);
+    /* Also when the reference is into a nested container */
+    JKSN::JKSNValue &nested = value["list"][size_t(0)];
+    JKSN::JKSNValue outer = value;
+    JKSN::JKSNValue inner = value["list"];
+    nested = 7;
+    const JKSN::JKSNValue &const_outer = outer;
+    assert(const_outer.at("list").toVector()[0] == 1 && static_cast<const JKSN::JKSNValue &>(inner).toVector()[0] == 1);
+    assert(value["list"][size_t(0)] == 7);
+    /* Values that never handed out a reference are still shared */
+    const JKSN::JKSNValue untouched = std::vector<JKSN::JKSNValue>({"a", "b"});
+    JKSN::JKSNValue shared = untouched;
+    assert(untouched.isShared() && shared.isShared());
+    JKSN::dump(value, std::cout);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include "jksn.hpp"
+
+static std::string randomBlob(size_t size, uint32_t seed) {
+    std::string result(size, '\0');
+    for(char &i : result) {
+        seed = seed * 1103515245 + 12345;
+        i = char(seed >> 16);
+    }
+    return result;
+}
+
+int main() {
+    /* More thumbnails than the blob hashtable holds, each sent twice, and two versions of an attachment */
+    std::vector<std::string> thumbnails;
+    for(uint32_t i = 0; i < 300; i++)
+        thumbnails.push_back(randomBlob(1200, i));
+    std::string attachment = randomBlob(100000, 1000);
+    std::string edited = attachment.substr(0, 50000) + "a few more bytes" + attachment.substr(50000);
+    std::vector<JKSN::JKSNValue> records;
+    for(int i = 0; i < 600; i++)
+        records.push_back(JKSN::JKSNValue::fromMap({
+            {"id", i},
+            {"thumbnail", JKSN::JKSNValue::fromBlob(thumbnails[size_t(i) % 300])}
+        }));
+    records.push_back(JKSN::JKSNValue::fromBlob(attachment));
+    records.push_back(JKSN::JKSNValue::fromBlob(edited));
+    JKSN::JKSNValue value(records);
+    JKSN::JKSNEncoder plain;
+    JKSN::JKSNEncoder whole;
+    whole.setDedupBlobs(1024);
+    JKSN::JKSNEncoder chunked;
+    chunked.setDedupBlobs(1024);
+    chunked.setDedupChunks(16384);
+    std::string plain_output = plain.dump(value, false);
+    std::string whole_output = whole.dump(value, false);
+    std::string chunked_output = chunked.dump(value, false);
+    std::cerr << "plain " << plain_output.size() << ", whole " << whole_output.size() << ", chunked " << chunked_output.size() << std::endl;
+    assert(whole_output.size() < plain_output.size() - 50 * thumbnails[0].size());
+    assert(chunked_output.size() < whole_output.size() - attachment.size() / 2);
+    /* The decoder numbers the blobs as the encoder does, across dumps too */
+    JKSN::JKSNDecoder decoder;
+    std::istringstream input(chunked_output);
+    assert(decoder.parse(input, false) == value);
+    std::string again = chunked.dump(JKSN::JKSNValue::fromBlob(edited), false);
+    assert(again.size() < 64);
+    std::istringstream input_again(again);
+    assert(decoder.parse(input_again, false) == JKSN::JKSNValue::fromBlob(edited));
+    std::istringstream whole_input(whole_output);
+    assert(JKSN::JKSNDecoder().parse(whole_input, false) == value);
+    /* Past the capacity, blobs are sent as they are */
+    JKSN::JKSNEncoder small;
+    small.setDedupBlobs(1024);
+    small.setDedupCapacity(1000);
+    assert(small.dump(value, false) == plain_output);
+    JKSN::dump(value, std::cout);
+    return 0;
+}
@@ -0,0 +1,37 @@
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include "jksn.hpp"
+
+int main() {
+    std::vector<JKSN::JKSNValue> records;
+    for(int i = 0; i < 50; i++)
+        records.push_back(JKSN::JKSNValue::fromMap({
+            {"id", 1000 + i},
+            {"name", i % 2 ? "\xe5\x90\x8d\xe5\x89\x8d" : "name"},
+            {"score", 12.5 + i / 8.0}
+        }));
+    JKSN::JKSNValue value(records);
+    JKSN::JKSNEncoder encoder;
+    std::ostringstream stream;
+    const JKSN::jksn_effort efforts[] = {JKSN::JKSN_EFFORT_BALANCED, JKSN::JKSN_EFFORT_FASTEST, JKSN::JKSN_EFFORT_BALANCED, JKSN::JKSN_EFFORT_SMALLEST};
+    size_t sizes[4];
+    for(int i = 0; i < 4; i++) {
+        encoder.setEffort(efforts[i]);
+        std::string encoded = encoder.dump(value, false);
+        sizes[i] = encoded.size();
+        stream << encoded;
+    }
+    std::cerr << "fastest " << sizes[1] << ", balanced " << sizes[0] << ", smallest " << sizes[3] << std::endl;
+    assert(sizes[1] > sizes[0] && sizes[3] <= sizes[0]);
+    /* A later dump must not refer back to what the fastest one left out */
+    encoder.setEffort(JKSN::JKSN_EFFORT_BALANCED);
+    encoder.setTimeBudget(1);
+    stream << encoder.dump(value, false);
+    JKSN::JKSNDecoder decoder;
+    std::istringstream input(stream.str());
+    for(int i = 0; i < 5; i++)
+        assert(decoder.parse(input, false) == value);
+    JKSN::dump(value, std::cout);
+    return 0;
+}
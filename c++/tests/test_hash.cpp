@@ -0,0 +1,37 @@
+#include <cassert>
+#include <iostream>
+#include <unordered_set>
+#include "jksn.hpp"
+
+int main() {
+    /* Equal values hash equally, whatever their numeric type */
+    assert(JKSN::JKSNValue(1).hash() == JKSN::JKSNValue(1.0).hash());
+    assert(JKSN::JKSNValue(std::vector<JKSN::JKSNValue>({1, 2})).hash() != JKSN::JKSNValue(std::vector<JKSN::JKSNValue>({2, 1})).hash());
+    /* A cached hash goes when the value is written to */
+    JKSN::JKSNValue value = std::vector<JKSN::JKSNValue>({1, 2});
+    size_t before = value.hash();
+    value.toVector().push_back(3);
+    JKSN::JKSNValue expected = std::vector<JKSN::JKSNValue>({1, 2, 3});
+    assert(value.hash() != before && value.hash() == expected.hash());
+    /* Also when it is written through a reference taken before the hash */
+    JKSN::JKSNValue kept = std::vector<JKSN::JKSNValue>({1, 2});
+    std::vector<JKSN::JKSNValue> &items = kept.toVector();
+    kept.hash();
+    items.push_back(3);
+    assert(kept.hash() == expected.hash());
+    /* And when such a value was moved into another one */
+    JKSN::JKSNValue inner = std::vector<JKSN::JKSNValue>({1, 2});
+    std::vector<JKSN::JKSNValue> &inner_items = inner.toVector();
+    std::vector<JKSN::JKSNValue> outer_items;
+    outer_items.push_back(std::move(inner));
+    JKSN::JKSNValue outer(std::move(outer_items));
+    outer.hash();
+    inner_items.push_back(3);
+    assert(outer.hash() == JKSN::JKSNValue(std::vector<JKSN::JKSNValue>({expected})).hash());
+    /* Hashed containers find values built separately */
+    std::unordered_set<JKSN::JKSNValue> set;
+    set.insert(JKSN::JKSNValue::fromMap({{"a", 1}, {"b", expected}}));
+    assert(set.count(JKSN::JKSNValue::fromMap({{"b", kept}, {"a", 1.0}})) == 1);
+    JKSN::dump(outer, std::cout);
+    return 0;
+}
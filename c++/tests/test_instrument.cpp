@@ -0,0 +1,22 @@
+#include <cassert>
+#include <iostream>
+#include "jksn.hpp"
+
+int main() {
+    JKSN::instrumentReset();
+    JKSN::JKSNValue value = {"name", "\xe5\x90\x8d\xe5\x89\x8d", 1000, 1001};
+    std::string encoded = JKSN::dump(value);
+    JKSN::JKSNValue decoded = JKSN::parse(encoded);
+    JKSN::JKSNInstrumentCounters counters = JKSN::instrumentSnapshot();
+    std::cerr << "instrumented: " << counters.enabled << std::endl;
+    std::cerr << "allocations: " << counters.allocations << ", " << counters.allocated_bytes << " bytes" << std::endl;
+    if(counters.enabled) {
+        assert(counters.allocations != 0 && counters.encode_calls == 1 && counters.decode_calls == 1);
+        assert(counters.parse_values[JKSN::JKSNEncodeStats::ARRAY] == 1 && counters.parse_values[JKSN::JKSNEncodeStats::UTF16] == 1);
+        assert(counters.parse_values[JKSN::JKSNEncodeStats::INT] == 1 && counters.parse_values[JKSN::JKSNEncodeStats::DELTA_INT] == 1);
+        assert(counters.utf16_to_utf8_bytes == 4);
+    } else
+        assert(counters.allocations == 0 && counters.encode_calls == 0);
+    JKSN::dump(decoded, std::cout);
+    return 0;
+}
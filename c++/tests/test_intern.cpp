@@ -0,0 +1,50 @@
+#include <cassert>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "jksn.hpp"
+
+int main() {
+    /* Equal interned strings share storage, and compare equal to plain ones */
+    JKSN::JKSNValue plain = std::string("interned key");
+    JKSN::JKSNValue symbol = JKSN::JKSNValue::intern(plain);
+    JKSN::JKSNValue again = JKSN::JKSNValue::intern("interned key");
+    assert(!plain.isInterned() && symbol.isInterned() && again.isInterned());
+    assert(symbol.toStringRef().data() == again.toStringRef().data());
+    assert(symbol == again && symbol == plain && plain == symbol);
+    assert(JKSN::JKSNValue::intern("other key") != symbol);
+    assert(!JKSN::JKSNValue::intern(JKSN::JKSNValue(42)).isInterned());
+    assert(!JKSN::JKSNValue::intern(JKSN::JKSNValue::fromBlob("interned key")).isInterned());
+    /* Every thread gets the same symbol */
+    std::vector<const char *> seen(8);
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < seen.size(); i++)
+        threads.emplace_back([&seen, i]() {
+            for(int j = 0; j < 1000; j++) {
+                JKSN::JKSNValue::intern("key " + std::to_string(j));
+                seen[i] = JKSN::JKSNValue::intern("interned key").toStringRef().data();
+            }
+        });
+    for(std::thread &thread : threads)
+        thread.join();
+    for(const char *data : seen)
+        assert(data == symbol.toStringRef().data());
+    /* Decoded object keys are interned on request, values are not */
+    std::string stream = JKSN::dump(JKSN::JKSNValue::fromMap({{"interned key", "plain value"}}));
+    JKSN::JKSNDecoder decoder;
+    assert(!decoder.getInternKeys());
+    JKSN::JKSNValue parsed = decoder.parse(stream);
+    assert(!parsed.toMap().begin()->first.isInterned());
+    decoder.setInternKeys(true);
+    parsed = decoder.parse(stream);
+    const JKSN::JKSNValue &key = parsed.toMap().begin()->first;
+    assert(key.isInterned() && key.toStringRef().data() == symbol.toStringRef().data());
+    assert(!parsed.toMap().begin()->second.isInterned());
+    /* Purging drops the symbols nobody holds, the others stay */
+    parsed = JKSN::JKSNValue();
+    again = JKSN::JKSNValue();
+    assert(JKSN::JKSNValue::purgeInterned() >= 1000);
+    assert(JKSN::JKSNValue::intern("interned key").toStringRef().data() == symbol.toStringRef().data());
+    JKSN::dump(symbol, std::cout);
+    return 0;
+}
@@ -0,0 +1,35 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "jksn.hpp"
+
+int main() {
+    std::vector<JKSN::JKSNValue> rows;
+    for(intmax_t i = 0; i < 3; i++)
+        rows.push_back(JKSN::JKSNValue::fromMap({
+            {"id", i},
+            {"score", double(i) / 3},
+            {"label", "row \"" + std::to_string(i) + "\"\n"}
+        }));
+    JKSN::JKSNValue value = JKSN::JKSNValue::fromMap({
+        {"rows", rows},
+        {"numbers", JKSN::JKSNValue::fromVector({0.1, 1e21, 1e-7, -0.0, 0.1f, -42, JKSN::JKSNValue::fromNull(), JKSN::JKSNValue()})},
+        {"text", "tab\there, a long line with \\ backslashes and \x01 control bytes"},
+        {"blob", JKSN::JKSNValue::fromBlob("JKSN!")},
+        {"missing", JKSN::JKSNValue()},
+        {"flags", JKSN::JKSNValue::fromVector({true, false})}
+    });
+    /* The same JSON from the tree and straight from the stream */
+    std::string output;
+    JKSN::JKSNJSONWriter writer(output);
+    writer.writeValue(value);
+    output.push_back('\n');
+    std::istringstream stream(JKSN::dump(value));
+    JKSN::JKSNDecoder decoder;
+    JKSN::JKSNReader reader(decoder, stream);
+    writer.transcode(reader);
+    output.push_back('\n');
+    std::cout << output;
+    return 0;
+}
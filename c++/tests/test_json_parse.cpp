@@ -0,0 +1,21 @@
+#include <iostream>
+#include <string>
+#include "jksn.hpp"
+
+int main() {
+    static const std::string json =
+        "{\"users\": [\n"
+        "    {\"id\": 1, \"name\": \"Alice\", \"score\": 0.5, \"admin\": true},\n"
+        "    {\"id\": 2, \"name\": \"Bob \\\"B\\\" \\u00e9\\ud83d\\ude00\", \"score\": -1.25e-3},\n"
+        "    {\"id\": 3, \"name\": \"Carol\", \"admin\": false, \"tags\": [null, [], {}]}\n"
+        "], \"big\": 123456789012345678901234567890, \"count\": -9007199254740993}";
+    /* Encoded straight from the text, and as a JSON literal (0x0f) */
+    JKSN::JKSNValue direct = JKSN::parse(JKSN::dumpJSON(json));
+    std::string literal("jk!\x0f\x4d", 5);
+    literal += char(json.size() >> 8);
+    literal += char(json.size());
+    literal += json;
+    JKSN::JKSNValue embedded = JKSN::parse(literal);
+    JKSN::dump(JKSN::JKSNValue::fromVector({direct, embedded, direct == embedded}), std::cout);
+    return 0;
+}
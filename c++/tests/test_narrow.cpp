@@ -0,0 +1,47 @@
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include "jksn.hpp"
+
+int main() {
+    std::vector<JKSN::JKSNValue> numbers;
+    for(int i = 0; i < 20; i++)
+        numbers.push_back(JKSN::JKSNValue(double(1000 + i)));
+    numbers.push_back(JKSN::JKSNValue(0.5));
+    numbers.push_back(JKSN::JKSNValue(0.1));
+    numbers.push_back(JKSN::JKSNValue(-0.0));
+    numbers.push_back(JKSN::JKSNValue(1e20));
+    numbers.push_back(JKSN::JKSNValue(4.0f));
+    numbers.push_back(JKSN::JKSNValue(2.5L));
+    JKSN::JKSNValue value(numbers);
+    JKSN::JKSNEncoder plain;
+    JKSN::JKSNEncoder narrowing;
+    narrowing.setNarrowing(true);
+    JKSN::JKSNEncoder tagging;
+    tagging.setNarrowing(true);
+    tagging.setTagNarrowed(true);
+    std::string plain_output = plain.dump(value);
+    std::string narrowed_output = narrowing.dump(value);
+    std::string tagged_output = tagging.dump(value);
+    std::cerr << "plain " << plain_output.size() << ", narrowed " << narrowed_output.size() << ", tagged " << tagged_output.size() << std::endl;
+    assert(narrowed_output.size() < tagged_output.size() && tagged_output.size() < plain_output.size());
+    /* Without the tags, integers and floats come back */
+    JKSN::JKSNValue narrowed_value = JKSN::parse(narrowed_output);
+    const std::vector<JKSN::JKSNValue> &narrowed = narrowed_value.toVector();
+    assert(narrowed[0].isInt() && narrowed[0].toInt() == 1000 && narrowed[19].toInt() == 1019);
+    assert(narrowed[20].isFloat() && narrowed[20].toDouble() == 0.5);
+    assert(narrowed[21].isDouble() && narrowed[21].toDouble() == 0.1);
+    assert(narrowed[22].isFloat() && std::signbit(narrowed[22].toDouble()));
+    assert(narrowed[23].isDouble() && narrowed[24].isInt() && narrowed[25].isFloat());
+    /* With them, a decoder that asks for it gets the original types */
+    JKSN::JKSNDecoder decoder;
+    decoder.setRestoreNarrowed(true);
+    assert(decoder.parse(tagged_output) == value);
+    assert(JKSN::JKSNDecoder().parse(tagged_output) == narrowed_value);
+    /* Numbers from JSON are narrowed too */
+    std::string json_output = tagging.dumpJSON("[1.0, 2.0, 2.5, 1e300]");
+    const std::vector<JKSN::JKSNValue> json_value = decoder.parse(json_output).toVector();
+    assert(json_value[0].isDouble() && json_value[0].toDouble() == 1.0 && json_value[3].toDouble() == 1e300);
+    JKSN::dump(value, std::cout);
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include <cassert>
+#include <iostream>
+#include <thread>
+#include "jksn.hpp"
+
+int main() {
+    JKSN::JKSNValue value = JKSN::JKSNValue::fromMap({
+        {"user", "alice"},
+        {"path", "/inbox/messages"},
+        {"count", 1000}
+    });
+    /* After reset, an encoder writes and a decoder reads as new ones do */
+    JKSN::JKSNEncoder encoder;
+    JKSN::JKSNDecoder decoder;
+    std::string first = encoder.dump(value);
+    std::string second = encoder.dump(value);
+    assert(second.size() < first.size());
+    assert(decoder.parse(first) == value && decoder.parse(second) == value);
+    encoder.reset();
+    decoder.reset();
+    assert(encoder.dump(value) == first);
+    bool failed = false;
+    try {
+        decoder.parse(second);
+    } catch(const JKSN::JKSNDecodeError &) {
+        failed = true;
+    }
+    assert(failed);
+    decoder.reset();
+    assert(decoder.parse(first) == value);
+    /* A thread gets back what it gave, reset and with default settings */
+    JKSN::JKSNEncoder *given;
+    {
+        JKSN::JKSNEncoderPool::Handle pooled = JKSN::JKSNEncoderPool::acquire();
+        pooled->setEffort(JKSN::JKSN_EFFORT_FASTEST);
+        pooled->dump(value);
+        given = pooled.get();
+    }
+    {
+        JKSN::JKSNEncoderPool::Handle pooled = JKSN::JKSNEncoderPool::acquire();
+        assert(pooled.get() == given && pooled->getEffort() == JKSN::JKSN_EFFORT_BALANCED);
+        assert(pooled->dump(value) == first);
+    }
+    /* Handles move between threads, and every thread gets its own objects */
+    std::vector<std::thread> threads;
+    for(int i = 0; i < 8; i++)
+        threads.emplace_back([&value, &first]() {
+            for(int j = 0; j < 1000; j++) {
+                JKSN::JKSNEncoderPool::Handle pooled_encoder = JKSN::JKSNEncoderPool::acquire();
+                JKSN::JKSNDecoderPool::Handle pooled_decoder = JKSN::JKSNDecoderPool::acquire();
+                std::string output = pooled_encoder->dump(value);
+                assert(output == first);
+                assert(pooled_decoder->parse(output) == value);
+                if(j % 100 == 0)
+                    std::thread([&pooled_encoder]() {
+                        pooled_encoder.reset();
+                    }).join();
+            }
+        });
+    for(std::thread &thread : threads)
+        thread.join();
+    JKSN::dump(value, std::cout);
+    return 0;
+}
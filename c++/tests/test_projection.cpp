@@ -0,0 +1,25 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "jksn.hpp"
+
+int main() {
+    std::vector<JKSN::JKSNValue> users;
+    for(intmax_t i = 0; i < 4; i++)
+        users.push_back(JKSN::JKSNValue::fromMap({
+            {"id", i},
+            {"email", "user" + std::to_string(i) + "@example.com"},
+            {"name", "user" + std::to_string(i)}
+        }));
+    std::string stream = JKSN::dump(JKSN::JKSNValue::fromMap({
+        {"users", users},
+        {"meta", JKSN::JKSNValue::fromMap({
+            {"version", 3},
+            {"generator", "test_projection"}
+        })}
+    }));
+    JKSN::JKSNDecoder decoder;
+    JKSN::JKSNProjection projection({"users[*].email", "users[2]", "meta.version"});
+    JKSN::dump(projection.parse(stream, decoder), std::cout);
+    return 0;
+}
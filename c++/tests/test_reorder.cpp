@@ -0,0 +1,41 @@
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include "jksn.hpp"
+
+int main() {
+    /* Objects kept apart by a string, so that they are not swapped into columns */
+    std::vector<JKSN::JKSNValue> sessions;
+    for(intmax_t i = 0; i < 20; i++) {
+        intmax_t begin = 1690000000 + (i % 2 ? 5000000 : 0) + i*1000;
+        sessions.push_back(JKSN::JKSNValue("session"));
+        sessions.push_back(JKSN::JKSNValue::fromMap({
+            {"begin", begin},
+            {"clicks", i},
+            {"end", begin + 60 + i},
+            {"user", "user_" + std::to_string(i)}
+        }));
+    }
+    /* And a table, whose columns keep their order */
+    std::vector<JKSN::JKSNValue> users;
+    for(intmax_t i = 0; i < 20; i++)
+        users.push_back(JKSN::JKSNValue::fromMap({
+            {"country", i % 2 ? "Japan" : "Kenya"},
+            {"email", "user_" + std::to_string(i) + "@example.com"},
+            {"id", i},
+            {"name", "user_" + std::to_string(i)},
+            {"score", double(i) / 4}
+        }));
+    JKSN::JKSNValue value = JKSN::JKSNValue::fromMap({{"sessions", sessions}, {"users", users}});
+    JKSN::JKSNEncoder balanced;
+    JKSN::JKSNEncoder smallest;
+    smallest.setEffort(JKSN::JKSN_EFFORT_SMALLEST);
+    std::string before = balanced.dump(value, false);
+    std::string after = smallest.dump(value, false);
+    std::cerr << "balanced " << before.size() << ", smallest " << after.size() << std::endl;
+    assert(after.size() < before.size());
+    std::istringstream input(after);
+    assert(JKSN::JKSNDecoder().parse(input, false) == value);
+    JKSN::dump(value, std::cout);
+    return 0;
+}
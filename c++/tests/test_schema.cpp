@@ -0,0 +1,79 @@
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include "jksn.hpp"
+
+int main() {
+    JKSN::JKSNSchema schema(JKSN::JKSNValue::fromMap({
+        {"id", "int"},
+        {"name", "string"},
+        {"position", JKSN::JKSNValue::fromMap({
+            {"lat", "double"},
+            {"lon", "double"}
+        })},
+        {"tags", std::vector<JKSN::JKSNValue>({"string"})}
+    }), "place");
+    std::vector<JKSN::JKSNValue> record(schema.slotCount());
+    record[schema.slotIndex("id")] = 42;
+    record[schema.slotIndex("name")] = "harbour";
+    record[schema.slotIndex("position.lat")] = 31.25;
+    record[schema.slotIndex("position.lon")] = 121.5;
+    record[schema.slotIndex("tags")] = std::vector<JKSN::JKSNValue>({"sea", "port"});
+    /* Records read back slot by slot, and the name is found without consuming anything */
+    JKSN::JKSNEncoder encoder;
+    JKSN::JKSNDecoder decoder;
+    std::vector<JKSN::JKSNValue> parsed;
+    std::string stream = schema.dump(record, encoder);
+    std::istringstream fp(stream);
+    std::string name;
+    assert(JKSN::JKSNSchema::peekName(fp, decoder, name) && name == "place");
+    assert(schema.parse(fp, decoder, parsed) == record);
+    /* Later records through the same encoder refer back to keys and strings, and to the last int */
+    JKSN::JKSNEncoder stream_encoder;
+    JKSN::JKSNDecoder stream_decoder;
+    size_t first_size = 0;
+    for(int i = 0; i < 3; i++) {
+        record[schema.slotIndex("id")] = 42 + i;
+        std::string message = schema.dump(record, stream_encoder, false);
+        if(i == 0)
+            first_size = message.size();
+        else
+            assert(message.size() < first_size);
+        assert(schema.parse(message, stream_decoder, parsed, false) == record);
+    }
+    /* Generic encodings: members in any order, unknown ones skipped, missing ones undefined */
+    JKSN::JKSNValue generic = JKSN::JKSNValue::fromMap({
+        {"tags", std::vector<JKSN::JKSNValue>({"lake"})},
+        {"extra", JKSN::JKSNValue::fromMap({{"id", 7}})},
+        {"position", JKSN::JKSNValue::fromMap({{"lon", 2.5}})},
+        {"id", 7}
+    });
+    schema.parse(JKSN::dump(generic), decoder, parsed);
+    assert(parsed[schema.slotIndex("id")] == 7 && parsed[schema.slotIndex("name")].isUndefined());
+    assert(parsed[schema.slotIndex("position.lat")].isUndefined() && parsed[schema.slotIndex("position.lon")] == 2.5);
+    assert(parsed[schema.slotIndex("tags")] == std::vector<JKSN::JKSNValue>({"lake"}));
+    /* A key of the expected length but another name is still remembered for back references */
+    JKSN::JKSNSchema pair(JKSN::JKSNValue::fromMap({{"ab", "int"}, {"cd", "int"}}));
+    std::vector<JKSN::JKSNValue> pair_slots;
+    JKSN::JKSNEncoder pair_encoder;
+    JKSN::JKSNValue swapped = JKSN::JKSNValue::fromMap({{"cd", 1}, {"zz", 2}});
+    for(int i = 0; i < 2; i++) {
+        pair.parse(pair_encoder.dump(swapped), decoder, pair_slots);
+        assert(pair_slots[pair.slotIndex("ab")].isUndefined() && pair_slots[pair.slotIndex("cd")] == 1);
+    }
+    /* Values of another type than declared go through the generic decoder */
+    JKSN::JKSNValue mistyped = JKSN::JKSNValue::fromMap({{"id", "seven"}, {"name", 7.5}, {"position", 1}});
+    schema.parse(JKSN::dump(mistyped), decoder, parsed);
+    assert(parsed[schema.slotIndex("id")] == "seven" && parsed[schema.slotIndex("name")] == 7.5);
+    assert(parsed[schema.slotIndex("position.lat")].isUndefined());
+    /* A record as a 0x0f literal is parsed whole and scattered */
+    std::string json = "\x0f" + JKSN::JKSNEncoder().dump(JKSN::JKSNValue("{\"name\": \"bay\", \"position\": {\"lat\": 1.5}}"), false);
+    schema.parse(json, decoder, parsed, false);
+    assert(parsed[schema.slotIndex("name")] == "bay" && parsed[schema.slotIndex("position.lat")] == 1.5);
+    assert(parsed[schema.slotIndex("id")].isUndefined());
+    record[schema.slotIndex("id")] = 42;
+    JKSN::JKSNEncoder output_encoder;
+    schema.dump(record, output_encoder, std::cout);
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include "jksn.hpp"
+
+static std::string join(const std::vector<JKSN::JKSNSegment> &segments) {
+    std::string result;
+    for(const JKSN::JKSNSegment &segment : segments)
+        result.append(segment.data, segment.size);
+    return result;
+}
+
+int main() {
+    JKSN::JKSNValue attachment = JKSN::JKSNValue::fromBlob(std::string(1 << 20, '\x5a'));
+    JKSN::JKSNValue body(std::string(8192, 'b'));
+    JKSN::JKSNValue value = JKSN::JKSNValue::fromMap({
+        {"attachment", attachment},
+        {"body", body},
+        {"id", 42},
+        {"tags", std::vector<JKSN::JKSNValue>{"mail", "inbox"}}
+    });
+    JKSN::JKSNEncoder encoder;
+    std::string storage;
+    std::vector<JKSN::JKSNSegment> segments = encoder.dumpSegments(value, storage);
+    /* The large values are referenced where they are, the rest is small */
+    bool found = false;
+    for(const JKSN::JKSNSegment &segment : segments)
+        found = found || segment.data == attachment.toStringRef().data();
+    std::cerr << segments.size() << " segments, " << storage.size() << " bytes of storage" << std::endl;
+    assert(found && storage.size() < 64);
+    assert(join(segments) == JKSN::JKSNEncoder().dump(value));
+    /* Values left in place are not remembered, so later dumps still decode */
+    JKSN::JKSNDecoder decoder;
+    assert(decoder.parse(join(segments)) == value);
+    segments = encoder.dumpSegments(value, storage);
+    assert(decoder.parse(join(segments)) == value);
+    segments = encoder.dumpSegments(value, storage, false, 0);
+    std::istringstream copied(join(segments));
+    assert(decoder.parse(copied, false) == value && storage.size() > attachment.toStringRef().size());
+    JKSN::dump(JKSN::JKSNValue::fromMap({{"id", 42}, {"tags", value["tags"]}}), std::cout);
+    return 0;
+}
@@ -0,0 +1,39 @@
+#include <cassert>
+#include <iostream>
+#include "jksn.hpp"
+
+int main() {
+    JKSN::JKSNValue records = {
+        JKSN::JKSNValue::fromMap({
+            {"name", "Jason"},
+            {"email", "jason@example.com"},
+            {"scores", {12.5, 12.5, 12.75, 12.625, 13.0}}
+        }),
+        JKSN::JKSNValue::fromMap({
+            {"name", "Jackson"},
+            {"age", 17},
+            {"email", "jackson@example.com"},
+            {"scores", {12.5, 13.0}}
+        })
+    };
+    JKSN::JKSNValue value = JKSN::JKSNValue::fromMap({
+        {"records", records},
+        {"ids", {1000, 1001, 1003}}
+    });
+    JKSN::JKSNEncodeStats stats;
+    JKSN::JKSNEncoder encoder;
+    encoder.setStats(&stats);
+    encoder.setXorArrays(true);
+    std::string first = encoder.dump(value);
+    /* The second dump refers back to every string of the first */
+    std::string second = encoder.dump(value, false);
+    std::cerr << stats.toString();
+    uint64_t bytes = 0;
+    for(uint64_t family_bytes : stats.bytes)
+        bytes += family_bytes;
+    assert(stats.dumps == 2 && bytes + 3 == first.size() + second.size());
+    assert(stats.swaps == 2 && stats.swap_candidates == 2 && stats.xors == 4);
+    assert(stats.text_hits == 10 && stats.text_misses == 10 && stats.text_collisions == 0);
+    std::cout << first << second;
+    return 0;
+}
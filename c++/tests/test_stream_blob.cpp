@@ -0,0 +1,79 @@
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include "jksn.hpp"
+
+static char pattern(size_t offset) {
+    return char(offset * 7 + offset / 251);
+}
+
+int main() {
+    /* An envelope whose attachment never exists in memory as a whole */
+    const size_t size = 3 * 65536 + 1000;
+    JKSN::JKSNEncoder encoder;
+    std::string output;
+    std::ostringstream fp;
+    JKSN::JKSNWriter writer(encoder, output);
+    writer.writeObjectHeader(2);
+    writer.writeString("name");
+    writer.writeString("report.bin");
+    writer.writeString("data");
+    size_t produced = 0;
+    writer.writeBlob(size, [&](char *buf, size_t chunk) {
+        assert(chunk <= 65536);
+        for(size_t i = 0; i < chunk; i++)
+            buf[i] = pattern(produced++);
+    }, fp);
+    assert(produced == size && output.empty());
+    fp << output;
+    std::string attachment(size, '\0');
+    for(size_t i = 0; i < size; i++)
+        attachment[i] = pattern(i);
+    JKSN::JKSNValue expected = JKSN::JKSNValue::fromMap({{"name", "report.bin"}, {"data", JKSN::JKSNValue::fromBlob(attachment)}});
+    assert(JKSN::parse(fp.str(), false) == expected);
+    /* The slot was not remembered, so the same blob is sent in full again */
+    assert(encoder.dump(JKSN::JKSNValue::fromBlob(attachment), false).size() > size);
+    /* Large blobs are handed over in chunks, smaller ones are kept */
+    JKSN::JKSNDecoder decoder;
+    size_t received = 0;
+    decoder.setBlobSink(65536, [&](const char *data, size_t chunk, size_t offset, size_t total) {
+        assert(offset == received % size && total == size);
+        for(size_t i = 0; i < chunk; i++)
+            assert(data[i] == pattern(offset + i));
+        received += chunk;
+    });
+    JKSN::JKSNValue envelope = decoder.parse(fp.str(), false);
+    assert(received == size);
+    assert(envelope["name"] == "report.bin" && envelope["data"].isBlob() && envelope["data"].toStringRef().empty());
+    /* The encoder sends large blobs in full each time, within a message and across messages */
+    JKSN::JKSNValue twice(std::vector<JKSN::JKSNValue>{JKSN::JKSNValue::fromBlob(attachment), JKSN::JKSNValue::fromBlob(attachment)});
+    JKSN::JKSNValue parsed = decoder.parse(JKSN::dump(twice), true);
+    assert(received == 3 * size && parsed.toVector().size() == 2);
+    JKSN::JKSNEncoder session;
+    for(int i = 0; i < 2; i++)
+        assert(decoder.parse(session.dump(JKSN::JKSNValue::fromBlob(attachment)), true).isBlob());
+    assert(received == 5 * size);
+    /* Unless told not to, and then a back reference to a streamed blob fails instead of finding another one */
+    JKSN::JKSNEncoder referring;
+    referring.setStreamedBlobs(0);
+    bool failed = false;
+    try {
+        decoder.parse(referring.dump(twice, false), false);
+    } catch(const JKSN::JKSNDecodeError &) {
+        failed = true;
+    }
+    assert(failed && received == 6 * size);
+    /* Skipped blobs are not buffered either */
+    std::istringstream input(fp.str());
+    JKSN::JKSNReader reader(decoder, input, false);
+    size_t length;
+    assert(reader.readObjectHeader(length) && length == 2);
+    std::string key;
+    for(size_t i = 0; i < length; i++) {
+        reader.readString(key);
+        reader.skipValue();
+    }
+    assert(received == 6 * size);
+    JKSN::dump(envelope, std::cout);
+    return 0;
+}
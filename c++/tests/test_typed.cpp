@@ -0,0 +1,107 @@
+#include <cassert>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "jksn.hpp"
+
+struct Point {
+    intmax_t x;
+    intmax_t y;
+    std::string label;
+    template<typename Binder> void jksnBind(Binder &binder) {
+        binder("x", x);
+        binder("y", y);
+        binder("label", label);
+    }
+    bool operator==(const Point &that) const {
+        return x == that.x && y == that.y && label == that.label;
+    }
+};
+
+struct Shape {
+    bool closed;
+    double scale;
+    Point origin;
+    std::vector<Point> points;
+    std::vector<int> weights;
+    std::map<std::string, double> metrics;
+    template<typename Binder> void jksnBind(Binder &binder) {
+        binder("closed", closed);
+        binder("scale", scale);
+        binder("origin", origin);
+        binder("points", points);
+        binder("weights", weights);
+        binder("metrics", metrics);
+    }
+};
+
+/* A 0x0f literal: the decoder parses the JSON text inside */
+static std::string jsonLiteral(const std::string &json) {
+    return "\x0f" + JKSN::JKSNEncoder().dump(JKSN::JKSNValue(json), false);
+}
+
+template<typename T>
+static T parseTyped(const std::string &stream, bool header = true) {
+    T result = T();
+    JKSN::parseTyped(stream, result, header);
+    return result;
+}
+
+int main() {
+    std::vector<Point> points = {
+        {1, 2, "start"},
+        {3, 5, "middle"},
+        {8, 13, "end"}
+    };
+    /* A vector of structs round trips through a row-col swapped array */
+    assert(parseTyped<std::vector<Point> >(JKSN::dumpTyped(points)) == points);
+    Shape shape;
+    shape.closed = true;
+    shape.scale = 1.5;
+    shape.origin = Point{0, 0, "origin"};
+    shape.points = points;
+    shape.weights = {4, -2, 7};
+    shape.metrics = {{"area", 12.25}, {"perimeter", 14.0}};
+    Shape parsed = parseTyped<Shape>(JKSN::dumpTyped(shape));
+    assert(parsed.closed && parsed.scale == 1.5 && parsed.origin == shape.origin && parsed.points == points);
+    assert(parsed.weights == shape.weights && parsed.metrics == shape.metrics);
+    /* Generic encodings: members in any order, unknown ones skipped, missing ones left alone */
+    JKSN::JKSNValue generic_point = JKSN::JKSNValue::fromMap({{"label", "p"}, {"extra", std::vector<JKSN::JKSNValue>{1, 2}}, {"x", 9}});
+    Point point = {0, 42, ""};
+    JKSN::parseTyped(JKSN::dump(generic_point), point);
+    assert(point == (Point{9, 42, "p"}));
+    /* The generic encoder swaps an array of objects, which is read column by column */
+    std::vector<JKSN::JKSNValue> generic_points;
+    for(const Point &i : points)
+        generic_points.push_back(JKSN::JKSNValue::fromMap({{"x", i.x}, {"y", i.y}, {"label", i.label}}));
+    assert(parseTyped<std::vector<Point> >(JKSN::dump(JKSN::JKSNValue(generic_points))) == points);
+    /* Shapes the binding does not expect fall back to the generic decoder and are converted */
+    assert(parseTyped<Point>(jsonLiteral("{\"x\": 1, \"y\": 2, \"label\": \"start\"}"), false) == points[0]);
+    assert(parseTyped<std::vector<int> >(jsonLiteral("[4, -2, 7]"), false) == shape.weights);
+    assert((parseTyped<std::map<std::string, double> >(jsonLiteral("{\"area\": 12.25, \"perimeter\": 14}"), false) == shape.metrics));
+    assert(parseTyped<std::vector<Point> >(jsonLiteral("[{\"x\": 1, \"y\": 2, \"label\": \"start\"}]"), false) == std::vector<Point>{points[0]});
+    /* A swapped column that is not a plain array is converted as a whole */
+    std::string output;
+    JKSN::JKSNEncoder encoder;
+    JKSN::JKSNWriter writer(encoder, output);
+    writer.writeSwappedArrayHeader(2);
+    writer.writeString("x");
+    output += jsonLiteral("[1, 3]");
+    writer.writeString("label");
+    writer.writeArrayHeader(2);
+    writer.writeString("start");
+    writer.writeString("middle");
+    std::vector<Point> columns = parseTyped<std::vector<Point> >(output, false);
+    assert(columns.size() == 2 && columns[0] == (Point{1, 0, "start"}) && columns[1] == (Point{3, 0, "middle"}));
+    /* Integers that do not fit are rejected */
+    bool failed = false;
+    try {
+        parseTyped<int8_t>(JKSN::dump(JKSN::JKSNValue(1000)));
+    } catch(const JKSN::JKSNTypeError &) {
+        failed = true;
+    }
+    assert(failed);
+    JKSN::dumpTyped(points, std::cout);
+    return 0;
+}
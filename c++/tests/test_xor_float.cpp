@@ -0,0 +1,95 @@
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include "jksn.hpp"
+
+/* Compares numbers by their bits, so that NaN matches itself and -0.0 does not match 0.0 */
+static bool sameBits(const JKSN::JKSNValue &a, const JKSN::JKSNValue &b) {
+    if(a.getType() != b.getType())
+        return false;
+    switch(a.getType()) {
+    case JKSN::JKSN_FLOAT:
+        {
+            float x = a.toFloat(), y = b.toFloat();
+            return std::memcmp(&x, &y, sizeof x) == 0;
+        }
+    case JKSN::JKSN_DOUBLE:
+        {
+            double x = a.toDouble(), y = b.toDouble();
+            return std::memcmp(&x, &y, sizeof x) == 0;
+        }
+    case JKSN::JKSN_ARRAY:
+        if(a.toVector().size() != b.toVector().size())
+            return false;
+        for(size_t i = 0; i < a.toVector().size(); i++)
+            if(!sameBits(a.toVector()[i], b.toVector()[i]))
+                return false;
+        return true;
+    case JKSN::JKSN_OBJECT:
+        if(a.toMap().size() != b.toMap().size())
+            return false;
+        for(const std::pair<const JKSN::JKSNValue, JKSN::JKSNValue> &item : a.toMap()) {
+            auto it = b.toMap().find(item.first);
+            if(it == b.toMap().end() || !sameBits(item.second, it->second))
+                return false;
+        }
+        return true;
+    default:
+        return a == b;
+    }
+}
+
+static JKSN::JKSNValue roundTrip(const JKSN::JKSNValue &value, std::string &output, JKSN::JKSNEncodeStats *stats = nullptr) {
+    JKSN::JKSNEncoder encoder;
+    encoder.setXorArrays(true);
+    encoder.setStats(stats);
+    output = encoder.dump(value, false);
+    std::istringstream input(output);
+    return JKSN::JKSNDecoder().parse(input, false);
+}
+
+static bool rejected(const std::string &stream) {
+    try {
+        JKSN::parse(stream);
+    } catch(const JKSN::JKSNDecodeError &) {
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const double inf = std::numeric_limits<double>::infinity();
+    std::string output;
+    JKSN::JKSNValue doubles = {12.5, 12.5, 12.75, 12.625, 13.0, 13.0, 12.875, 12.5, 12.5, 12.75};
+    assert(sameBits(roundTrip(doubles, output), doubles) && uint8_t(output[0]) == 0xe0);
+    /* Off by default, so that other decoders can read the output */
+    assert(uint8_t(JKSN::JKSNEncoder().dump(doubles, false)[0]) != 0xe0);
+    JKSN::JKSNValue floats = {1.5f, 1.5f, 1.75f, 2.0f, 2.0f, 1.625f, 1.5f, 1.5f, 1.5f, 1.5f};
+    assert(sameBits(roundTrip(floats, output), floats) && uint8_t(output[0]) == 0xe1);
+    /* NaN, infinities and both zeros keep their bits */
+    JKSN::JKSNValue special = {0.0, -0.0, 0.0, nan, nan, -nan, inf, -inf, 1.0, -0.0};
+    assert(sameBits(roundTrip(special, output), special));
+    JKSN::JKSNValue special_floats = {0.0f, -0.0f, float(nan), float(inf), -float(inf), 0.0f};
+    assert(sameBits(roundTrip(special_floats, output), special_floats));
+    /* Columns of a swapped array are compressed on their own */
+    std::vector<JKSN::JKSNValue> rows;
+    for(int i = 0; i < 20; i++)
+        rows.push_back(JKSN::JKSNValue::fromMap({
+            {"lat", 31.25 + i / 64.0},
+            {"lon", 121.5 - (i % 4) / 32.0},
+            {"level", float(i % 3)}
+        }));
+    JKSN::JKSNValue table(rows);
+    JKSN::JKSNEncodeStats stats;
+    assert(sameBits(roundTrip(table, output, &stats), table) && stats.swaps == 1 && stats.xors == 3);
+    /* Sizes the stream cannot back are rejected before anything that large is allocated */
+    assert(rejected(std::string("jk!\xe0\x01\xff\xff\xff\xff\x0f", 10)));
+    assert(rejected(std::string("jk!\xe0\x80\x80\x40\x80\x80\x40\x00", 10)));
+    assert(rejected(std::string("jk!\xe1\x03\x01\x00", 7)));
+    JKSN::dump(table, std::cout);
+    return 0;
+}
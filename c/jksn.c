@@ -17,11 +17,73 @@
   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
 */
 
+/* fseeko and ftello with 64-bit offsets, also on 32-bit systems */
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
 #include <assert.h>
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/types.h>
 #include "jksn.h"
+#ifdef _WIN32
+typedef __int64 jksn_off_t;
+#define jksn_fseeko _fseeki64
+#define jksn_ftello _ftelli64
+#else
+typedef off_t jksn_off_t;
+#define jksn_fseeko fseeko
+#define jksn_ftello ftello
+#endif
+
+/*
+  Hot path counters and probes, compiled in with -DJKSN_INSTRUMENT. The
+  counters need C11 atomics. Probes are USDT probes of provider `jksn`,
+  available where <sys/sdt.h> is.
+*/
+#ifdef JKSN_INSTRUMENT
+#include <stdatomic.h>
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define JKSN_PROBE1(name, a) DTRACE_PROBE1(jksn, name, a)
+#define JKSN_PROBE2(name, a, b) DTRACE_PROBE2(jksn, name, a, b)
+#endif
+#endif
+static struct {
+    atomic_uint_least64_t allocations;
+    atomic_uint_least64_t allocated_bytes;
+    atomic_uint_least64_t arena_allocations;
+    atomic_uint_least64_t arena_allocated_bytes;
+    atomic_uint_least64_t parse_values[JKSN_FAMILY_COUNT];
+    atomic_uint_least64_t utf8_to_utf16_bytes;
+    atomic_uint_least64_t utf16_to_utf8_bytes;
+    atomic_uint_least64_t encode_calls;
+    atomic_uint_least64_t encode_ns;
+    atomic_uint_least64_t decode_calls;
+    atomic_uint_least64_t decode_ns;
+} jksn_counters;
+#define JKSN_COUNT(counter, n) atomic_fetch_add_explicit(&jksn_counters.counter, (uint64_t) (n), memory_order_relaxed)
+#define JKSN_CALL_BEGIN(probe, a) uint64_t jksn_call_start; JKSN_PROBE1(probe##__entry, a); jksn_call_start = jksn_now_ns()
+#define JKSN_CALL_END(kind, probe, retval, size) \
+    JKSN_COUNT(kind##_calls, 1); \
+    JKSN_COUNT(kind##_ns, jksn_now_ns() - jksn_call_start); \
+    JKSN_PROBE2(probe##__return, retval, size)
+#else
+#define JKSN_COUNT(counter, n) ((void) 0)
+#define JKSN_CALL_BEGIN(probe, a) ((void) 0)
+#define JKSN_CALL_END(kind, probe, retval, size) ((void) 0)
+#endif
+#ifndef JKSN_PROBE1
+#define JKSN_PROBE1(name, a) ((void) 0)
+#define JKSN_PROBE2(name, a, b) ((void) 0)
+#endif
 
 typedef struct jksn_proxy {
     const jksn_t *origin; /* weak reference */
@@ -38,6 +100,43 @@ struct jksn_cache {
     intmax_t lastint;
     jksn_utf8string texthash[256];
     jksn_blobstring blobhash[256];
+    size_t texthash_capacity[256];
+    size_t blobhash_capacity[256];
+    jksn_allocator allocator; /* all NULL means the C library */
+    struct jksn_arena *scratch; /* encoder proxies, reset after every dump */
+    jksn_encode_stats *stats; /* weak reference */
+    jksn_effort effort;
+    uint64_t time_budget; /* microseconds, 0 for none */
+    /* Per dump: set for JKSN_EFFORT_FASTEST, or once the time budget is spent */
+    int fast;
+    /* Per dump: strings and blobs from this size on are left in place by jksn_dump_segments, or 0 */
+    size_t segment_min;
+    unsigned countdown;
+    uint64_t deadline; /* nanoseconds on the monotonic clock */
+    /* Per parse: the input of JKSN_PARSE_BORROW, which strings and blobs may point into, or NULL */
+    const char *borrowed;
+    size_t borrowed_size;
+};
+
+struct jksn_arena_block {
+    struct jksn_arena_block *next;
+    size_t size;
+    size_t used;
+};
+
+struct jksn_arena {
+    size_t block_size;
+    struct jksn_arena_block *first;
+    struct jksn_arena_block *current;
+    char *last; /* most recent allocation, can be grown in place */
+    jksn_allocator allocator;
+};
+
+/* Open addressing, each slot holds a member position plus one, or 0 */
+struct jksn_object_index {
+    const jksn_t *object;
+    size_t mask;
+    size_t slots[1];
 };
 
 struct jksn_swap_columns {
@@ -45,7 +144,39 @@ struct jksn_swap_columns {
     struct jksn_swap_columns *next;
 };
 
+struct jksn_block_entry {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t records;
+    uint64_t first; /* records in the blocks before, not stored */
+};
+
+struct jksn_block_writer {
+    FILE *fp;
+    uint64_t offset; /* where the next block goes */
+    size_t count;
+    size_t capacity;
+    struct jksn_block_entry *entries;
+};
+
+struct jksn_block_reader {
+    FILE *fp;
+    size_t count;
+    struct jksn_block_entry *entries;
+    jksn_blobstring buffer; /* last block read, reused */
+    size_t buffer_capacity;
+};
+
 static const size_t jksn_varint_size = (sizeof (intmax_t)*8)/7 + 1;
+/* Every arena allocation is preceded by its size, padded to this alignment */
+#define JKSN_ARENA_ALIGN 16
+#define JKSN_ARENA_HEADER ((sizeof (size_t) + JKSN_ARENA_ALIGN - 1) & ~(size_t) (JKSN_ARENA_ALIGN - 1))
+/* A block archive starts with jksn_block_magic and ends with the block count and jksn_block_trailer */
+static const char jksn_block_magic[8] = {'j', 'k', '!', 'b', 'l', 'o', 'c', 'k'};
+static const char jksn_block_trailer[8] = {'j', 'k', '!', 'i', 'n', 'd', 'e', 'x'};
+#define JKSN_BLOCK_ENTRY_SIZE 24
+#define JKSN_BLOCK_TRAILER_SIZE 16
+#define JKSN_ARENA_BLOCK_HEADER ((sizeof (struct jksn_arena_block) + JKSN_ARENA_ALIGN - 1) & ~(size_t) (JKSN_ARENA_ALIGN - 1))
 
 static const char *jksn_error_messages[] = {
     "OK",
@@ -53,12 +184,17 @@ static const char *jksn_error_messages[] = {
     "JKSNDecodeError: JKSN stream may be truncated or corrupted",
     "JKSNEncodeError: cannot encode unrecognizable type of value",
     "JKSNDecodeError: JKSN stream contains an invalid control byte",
-    "JKSNDecodeError: this JKSN decoder does not support JSON literals",
+    "JKSNDecodeError: JKSN stream contains an invalid JSON literal",
     "JKSNDecodeError: this build of JKSN decoder does not support variable length integers",
     "JKSNError: this build of JKSN decoder does not support long double numbers",
     "JKSNDecodeError: JKSN stream requires a non-existing hash",
     "JKSNDecodeError: JKSN stream contains an invalid delta encoded integer",
-    "JKSNDecodeError: JKSN row-col swapped array requires an array but not found"
+    "JKSNDecodeError: JKSN row-col swapped array requires an array but not found",
+    "JKSNEncodeError: output buffer is too small",
+    "JKSNChecksumError: JKSN stream corrupted",
+    "JKSNError: cannot read or write the block archive",
+    "JKSNDecodeError: not a JKSN block archive",
+    "JKSNError: block or record index out of range"
 };
 typedef enum {
     JKSN_EOK,
@@ -71,46 +207,224 @@ typedef enum {
     JKSN_ELONGDOUBLE,
     JKSN_EHASH,
     JKSN_EDELTA,
-    JKSN_ESWAPARRAY
+    JKSN_ESWAPARRAY,
+    JKSN_ESPACE,
+    JKSN_ECHECKSUM,
+    JKSN_EIO,
+    JKSN_EARCHIVE,
+    JKSN_ERANGE
 } jksn_error_message_no;
 
+/* What follows each control byte, so that the decoder dispatches with one lookup */
+typedef enum {
+    JKSN_CONTROL_INVALID,
+    JKSN_CONTROL_CONSTANT,
+    JKSN_CONTROL_INT,
+    JKSN_CONTROL_FLOAT,
+    JKSN_CONTROL_DOUBLE,
+    JKSN_CONTROL_LONG_DOUBLE,
+    JKSN_CONTROL_UTF16,
+    JKSN_CONTROL_UTF8,
+    JKSN_CONTROL_BLOB,
+    JKSN_CONTROL_TEXT_HASH,
+    JKSN_CONTROL_BLOB_HASH,
+    JKSN_CONTROL_CLEAR_HASH,
+    JKSN_CONTROL_REFRESH,
+    JKSN_CONTROL_ARRAY,
+    JKSN_CONTROL_OBJECT,
+    JKSN_CONTROL_SWAPPED,
+    JKSN_CONTROL_LENGTHLESS,
+    JKSN_CONTROL_PADDING,
+    JKSN_CONTROL_DELTA,
+    JKSN_CONTROL_CHECKSUM,
+    JKSN_CONTROL_DELAYED_CHECKSUM,
+    JKSN_CONTROL_PRAGMA,
+    JKSN_CONTROL_JSON
+} jksn_control_kind;
+
+typedef struct {
+    uint8_t kind; /* jksn_control_kind */
+    /* Bytes of the integer or length field: 0 if it is `value` itself, or JKSN_VARINT */
+    uint8_t width;
+    /* Inline integer or length, sign of a varint, or the jksn_data_type of a constant */
+    int8_t value;
+} jksn_control;
+
+#define JKSN_VARINT 0x80
+
+#define X { JKSN_CONTROL_INVALID, 0, 0 }
+#define K(type) { JKSN_CONTROL_CONSTANT, 0, type }
+#define L(kind, n) { JKSN_CONTROL_##kind, 0, n }
+#define W(kind, width) { JKSN_CONTROL_##kind, width, 0 }
+#define V(kind, sign) { JKSN_CONTROL_##kind, JKSN_VARINT, sign }
+static const jksn_control jksn_control_table[256] = {
+    /* 0x00 special values, 0x02 and 0x03 are told apart by the control byte */
+    K(JKSN_UNDEFINED), K(JKSN_NULL), K(JKSN_BOOL), K(JKSN_BOOL), X, X, X, X, X, X, X, X, X, X, X, W(JSON, 0),
+    /* 0x10 integers */
+    L(INT, 0), L(INT, 1), L(INT, 2), L(INT, 3), L(INT, 4), L(INT, 5), L(INT, 6), L(INT, 7),
+    L(INT, 8), L(INT, 9), L(INT, 10), W(INT, 4), W(INT, 2), W(INT, 1), V(INT, -1), V(INT, 1),
+    /* 0x20 floating point numbers, the constants are all doubles */
+    K(JKSN_DOUBLE), X, X, X, X, X, X, X, X, X, X, W(LONG_DOUBLE, 10), W(DOUBLE, 8), W(FLOAT, 4), K(JKSN_DOUBLE), K(JKSN_DOUBLE),
+    /* 0x30 UTF-16 strings */
+    L(UTF16, 0), L(UTF16, 1), L(UTF16, 2), L(UTF16, 3), L(UTF16, 4), L(UTF16, 5), L(UTF16, 6), L(UTF16, 7),
+    L(UTF16, 8), L(UTF16, 9), L(UTF16, 10), L(UTF16, 11), L(TEXT_HASH, 0), W(UTF16, 2), W(UTF16, 1), V(UTF16, 1),
+    /* 0x40 UTF-8 strings */
+    L(UTF8, 0), L(UTF8, 1), L(UTF8, 2), L(UTF8, 3), L(UTF8, 4), L(UTF8, 5), L(UTF8, 6), L(UTF8, 7),
+    L(UTF8, 8), L(UTF8, 9), L(UTF8, 10), L(UTF8, 11), L(UTF8, 12), W(UTF8, 2), W(UTF8, 1), V(UTF8, 1),
+    /* 0x50 blob strings */
+    L(BLOB, 0), L(BLOB, 1), L(BLOB, 2), L(BLOB, 3), L(BLOB, 4), L(BLOB, 5), L(BLOB, 6), L(BLOB, 7),
+    L(BLOB, 8), L(BLOB, 9), L(BLOB, 10), L(BLOB, 11), L(BLOB_HASH, 0), W(BLOB, 2), W(BLOB, 1), V(BLOB, 1),
+    /* 0x60 */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    /* 0x70 hashtable refreshers */
+    L(CLEAR_HASH, 0), L(REFRESH, 1), L(REFRESH, 2), L(REFRESH, 3), L(REFRESH, 4), L(REFRESH, 5), L(REFRESH, 6), L(REFRESH, 7),
+    L(REFRESH, 8), L(REFRESH, 9), L(REFRESH, 10), L(REFRESH, 11), L(REFRESH, 12), W(REFRESH, 2), W(REFRESH, 1), V(REFRESH, 1),
+    /* 0x80 arrays */
+    L(ARRAY, 0), L(ARRAY, 1), L(ARRAY, 2), L(ARRAY, 3), L(ARRAY, 4), L(ARRAY, 5), L(ARRAY, 6), L(ARRAY, 7),
+    L(ARRAY, 8), L(ARRAY, 9), L(ARRAY, 10), L(ARRAY, 11), L(ARRAY, 12), W(ARRAY, 2), W(ARRAY, 1), V(ARRAY, 1),
+    /* 0x90 objects */
+    L(OBJECT, 0), L(OBJECT, 1), L(OBJECT, 2), L(OBJECT, 3), L(OBJECT, 4), L(OBJECT, 5), L(OBJECT, 6), L(OBJECT, 7),
+    L(OBJECT, 8), L(OBJECT, 9), L(OBJECT, 10), L(OBJECT, 11), L(OBJECT, 12), W(OBJECT, 2), W(OBJECT, 1), V(OBJECT, 1),
+    /* 0xa0 row-col swapped arrays */
+    K(JKSN_UNSPECIFIED), L(SWAPPED, 1), L(SWAPPED, 2), L(SWAPPED, 3), L(SWAPPED, 4), L(SWAPPED, 5), L(SWAPPED, 6), L(SWAPPED, 7),
+    L(SWAPPED, 8), L(SWAPPED, 9), L(SWAPPED, 10), L(SWAPPED, 11), L(SWAPPED, 12), W(SWAPPED, 2), W(SWAPPED, 1), V(SWAPPED, 1),
+    /* 0xb0 */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    /* 0xc0 lengthless arrays and padding */
+    X, X, X, X, X, X, X, X, L(LENGTHLESS, 0), X, L(PADDING, 0), X, X, X, X, X,
+    /* 0xd0 delta encoded integers */
+    L(DELTA, 0), L(DELTA, 1), L(DELTA, 2), L(DELTA, 3), L(DELTA, 4), L(DELTA, 5), L(DELTA, -5), L(DELTA, -4),
+    L(DELTA, -3), L(DELTA, -2), L(DELTA, -1), W(DELTA, 4), W(DELTA, 2), W(DELTA, 1), V(DELTA, -1), V(DELTA, 1),
+    /* 0xe0 */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    /* 0xf0 checksums and pragmas */
+    W(CHECKSUM, 1), W(CHECKSUM, 4), W(CHECKSUM, 16), W(CHECKSUM, 20), W(CHECKSUM, 32), W(CHECKSUM, 64), X, X,
+    W(DELAYED_CHECKSUM, 1), W(DELAYED_CHECKSUM, 4), W(DELAYED_CHECKSUM, 16), W(DELAYED_CHECKSUM, 20), W(DELAYED_CHECKSUM, 32), W(DELAYED_CHECKSUM, 64), X, L(PRAGMA, 0)
+};
+#undef X
+#undef K
+#undef L
+#undef W
+#undef V
+
+/* A container being filled, or a prefix waiting for the value after it */
+typedef enum {
+    JKSN_FRAME_ARRAY,
+    JKSN_FRAME_OBJECT,
+    JKSN_FRAME_SWAPPED,
+    JKSN_FRAME_LENGTHLESS,
+    JKSN_FRAME_DISCARD,
+    JKSN_FRAME_TRAILER,
+    JKSN_FRAME_JSON
+} jksn_frame_kind;
+
+struct jksn_parse_frame {
+    jksn_frame_kind kind;
+    jksn_t *node; /* owned until the frame completes */
+    size_t index; /* children filled, or capacity of a lengthless array */
+    size_t remaining; /* columns or values to discard still expected, or trailing bytes to skip */
+    jksn_t *column_name; /* owned, waiting for its column */
+};
+
+struct jksn_parse_stack {
+    struct jksn_parse_frame *frames;
+    size_t depth;
+    size_t capacity;
+};
+
+/* An array or object of a JSON literal being filled */
+struct jksn_json_frame {
+    jksn_t *node; /* owned until the frame completes */
+    size_t capacity; /* of the children of node */
+    jksn_t *key; /* owned, waiting for its value */
+};
+
+struct jksn_json_stack {
+    struct jksn_json_frame *frames;
+    size_t depth;
+    size_t capacity;
+    jksn_t *value; /* owned, complete but not yet in a container */
+};
+
 static inline void *jksn_malloc(size_t size);
 static inline void *jksn_calloc(size_t nmemb, size_t size);
 static inline void *jksn_realloc(void *ptr, size_t size);
-static jksn_proxy *jksn_proxy_new(const jksn_t *origin, uint8_t control, const jksn_blobstring *data, const jksn_blobstring *buf);
-static jksn_proxy *jksn_proxy_free(jksn_proxy *object);
+static inline void *jksn_tree_malloc(const jksn_allocator *allocator, size_t size);
+static inline void *jksn_tree_calloc(const jksn_allocator *allocator, size_t nmemb, size_t size);
+static inline void *jksn_tree_realloc(const jksn_allocator *allocator, void *ptr, size_t size);
+static inline void jksn_tree_free(const jksn_allocator *allocator, void *ptr);
+static int jksn_cache_store(char **slot, size_t *slot_size, size_t *slot_capacity, const char *data, size_t size);
+static void *jksn_arena_malloc(void *ctx, size_t size);
+static void *jksn_arena_realloc(void *ctx, void *ptr, size_t size);
+static jksn_proxy *jksn_proxy_new(const jksn_t *origin, uint8_t control, const jksn_blobstring *data, const jksn_blobstring *buf, const jksn_allocator *allocator);
+static jksn_proxy *jksn_proxy_free(jksn_proxy *object, const jksn_allocator *allocator);
 static size_t jksn_proxy_size(const jksn_proxy *object, size_t depth);
 static char *jksn_proxy_output(char output[], const jksn_proxy *object);
-static jksn_error_message_no jksn_dump_value(jksn_proxy **result, const jksn_t *object, jksn_cache *cache);
-static jksn_error_message_no jksn_dump_int(jksn_proxy **result, const jksn_t *object);
-static jksn_error_message_no jksn_dump_float(jksn_proxy **result, const jksn_t *object);
-static jksn_error_message_no jksn_dump_double(jksn_proxy **result, const jksn_t *object);
-static jksn_error_message_no jksn_dump_longdouble(jksn_proxy **result, const jksn_t *object);
-static jksn_error_message_no jksn_dump_string(jksn_proxy **result, const jksn_t *object);
-static jksn_error_message_no jksn_dump_blob(jksn_proxy **result, const jksn_t *object);
-static jksn_error_message_no jksn_dump_array(jksn_proxy **result, const jksn_t *object, jksn_cache *cache);
-static jksn_error_message_no jksn_dump_object(jksn_proxy **result, const jksn_t *object, jksn_cache *cache);
-static void jksn_optimize(jksn_proxy *object, jksn_cache *cache);
+static int jksn_dump_uninstrumented(const jksn_t *object, jksn_blobstring **result, /*bool*/ int header, jksn_cache *cache);
+static int jksn_dump_into_uninstrumented(const jksn_t *object, char *buffer, size_t capacity, size_t *written, /*bool*/ int header, jksn_cache *cache);
+static int jksn_dump_segments_uninstrumented(const jksn_t *object, jksn_segment **segments, size_t *count, jksn_blobstring **storage, size_t min_size, /*bool*/ int header, jksn_cache *cache);
+static int jksn_dump_batch_uninstrumented(const jksn_t *const *objects, size_t count, jksn_blobstring **result, size_t **offsets, /*bool*/ int header, /*bool*/ int shared, jksn_cache *cache);
+static void jksn_proxy_segments(const jksn_proxy *object, size_t min_size, char *storage, size_t *used, jksn_segment *segments, size_t *count, size_t *begin);
+static int jksn_parse_uninstrumented(const jksn_blobstring *buffer, jksn_t **result, size_t *bytes_parsed, jksn_cache *cache, const jksn_allocator *allocator, unsigned flags);
+static void jksn_dump_begin(jksn_cache *cache);
+static void jksn_dump_finish(jksn_proxy *result, jksn_cache *cache);
+static void jksn_cache_forget(jksn_cache *cache);
+static jksn_error_message_no jksn_dump_proxy(jksn_proxy **result, const jksn_t *object, jksn_cache *cache);
+static jksn_error_message_no jksn_dump_value(jksn_proxy **result, const jksn_t *object, jksn_cache *cache, const jksn_allocator *allocator);
+static jksn_error_message_no jksn_dump_int(jksn_proxy **result, const jksn_t *object, const jksn_allocator *allocator);
+static jksn_error_message_no jksn_dump_float(jksn_proxy **result, const jksn_t *object, const jksn_allocator *allocator);
+static jksn_error_message_no jksn_dump_double(jksn_proxy **result, const jksn_t *object, const jksn_allocator *allocator);
+static jksn_error_message_no jksn_dump_longdouble(jksn_proxy **result, const jksn_t *object, const jksn_allocator *allocator);
+static jksn_error_message_no jksn_dump_string(jksn_proxy **result, const jksn_t *object, jksn_cache *cache, const jksn_allocator *allocator);
+static jksn_error_message_no jksn_dump_blob(jksn_proxy **result, const jksn_t *object, jksn_cache *cache, const jksn_allocator *allocator);
+static jksn_error_message_no jksn_dump_array(jksn_proxy **result, const jksn_t *object, jksn_cache *cache, const jksn_allocator *allocator);
+static jksn_error_message_no jksn_dump_object(jksn_proxy **result, const jksn_t *object, jksn_cache *cache, const jksn_allocator *allocator);
+static void jksn_optimize(jksn_proxy *object, jksn_cache *cache, const jksn_allocator *allocator);
+static uint64_t jksn_now_ns(void);
+static void jksn_stats_add_dump(jksn_encode_stats *stats, const jksn_proxy *result, uint64_t start, uint64_t built, uint64_t optimized);
 static size_t jksn_encode_int(char result[], uintmax_t object, size_t size);
-static struct jksn_swap_columns *jksn_swap_columns_free(struct jksn_swap_columns *columns);
-static jksn_error_message_no jksn_parse_value(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed, jksn_cache *cache);
-static jksn_error_message_no jksn_parse_float(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed);
-static jksn_error_message_no jksn_parse_double(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed);
-static jksn_error_message_no jksn_parse_longdouble(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed);
+static struct jksn_swap_columns *jksn_swap_columns_free(struct jksn_swap_columns *columns, const jksn_allocator *allocator);
+static jksn_error_message_no jksn_parse_value(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed, jksn_cache *cache, const jksn_allocator *allocator, unsigned flags);
+static struct jksn_parse_frame *jksn_parse_push(struct jksn_parse_stack *stack, jksn_frame_kind kind, jksn_t *node, size_t remaining);
+static jksn_error_message_no jksn_parse_loop(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed, jksn_cache *cache, const jksn_allocator *allocator, unsigned flags, struct jksn_parse_stack *stack);
+static jksn_error_message_no jksn_merge_column(jksn_t *rows, const jksn_t *column_name, jksn_t *column_values, const jksn_allocator *allocator);
+static struct jksn_json_frame *jksn_json_push(struct jksn_json_stack *stack, jksn_t *node);
+static jksn_error_message_no jksn_parse_json(jksn_t **result, const char *text, size_t size, const jksn_allocator *allocator);
+static jksn_error_message_no jksn_decode_length(uintmax_t *result, const jksn_control *entry, const char *buffer, size_t size, size_t *bytes_parsed);
+static jksn_error_message_no jksn_decode_signed(intmax_t *result, const jksn_control *entry, const char *buffer, size_t size, size_t *bytes_parsed);
+static jksn_error_message_no jksn_parse_string(jksn_t **result, const jksn_control *entry, const char *buffer, size_t size, size_t *bytes_parsed, jksn_cache *cache, const jksn_allocator *allocator, unsigned flags);
+static jksn_error_message_no jksn_parse_float(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed, const jksn_allocator *allocator);
+static jksn_error_message_no jksn_parse_double(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed, const jksn_allocator *allocator);
+static jksn_error_message_no jksn_parse_longdouble(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed, const jksn_allocator *allocator);
 static jksn_error_message_no jksn_decode_int(uintmax_t *result, const char *buffer, size_t bufsize, size_t size, size_t *bytes_parsed);
 static size_t jksn_utf8_to_utf16(const char *utf8str, uint16_t *utf16str, size_t utf8size, int strict);
 static size_t jksn_utf16_to_utf8(const uint16_t *utf16str, char *utf8str, size_t utf16size);
 static int jksn_compare(const jksn_t *obj1, const jksn_t *obj2);
-static jksn_t *jksn_duplicate(const jksn_t *object);
+static size_t jksn_key_hash(jksn_data_type type, const char *buf, size_t size);
+static size_t jksn_value_hash(const jksn_t *object);
+static jksn_t *jksn_object_find(const jksn_object_index *index, const jksn_t *key, size_t hash);
+static jksn_t *jksn_duplicate(const jksn_t *object, const jksn_allocator *allocator);
+static jksn_t *jksn_free_tree(jksn_t *object, const jksn_allocator *allocator, const char *borrowed, size_t borrowed_size);
 static uint8_t jksn_djbhash(const char *buf, size_t size);
+static uint32_t jksn_crc32(const char *buf, size_t size);
+static void jksn_block_encode_u64(char *buf, uint64_t number);
+static uint64_t jksn_block_decode_u64(const char *buf);
+static jksn_error_message_no jksn_block_seek(FILE *fp, uint64_t offset);
+static jksn_error_message_no jksn_block_read_index(FILE *fp, struct jksn_block_entry **entries, size_t *count, uint64_t *end);
+static jksn_error_message_no jksn_block_write_index(FILE *fp, const struct jksn_block_entry *entries, size_t count);
+static jksn_error_message_no jksn_block_fill(FILE *fp, const struct jksn_block_entry *entry, char *buf);
 static inline int jksn_is_little_endian(void);
 static inline uintmax_t jksn_intmaxabs(intmax_t x) { return x >= 0 ? (uintmax_t) x : (uintmax_t) -x; }
 
 static inline void *jksn_malloc(size_t size) {
+    JKSN_COUNT(allocations, 1);
+    JKSN_COUNT(allocated_bytes, size);
     return malloc(size != 0 ? size : 1);
 }
 
 static inline void *jksn_calloc(size_t nmemb, size_t size) {
+    JKSN_COUNT(allocations, 1);
+    JKSN_COUNT(allocated_bytes, nmemb * size);
     if(nmemb != 0 && size != 0)
         return calloc(nmemb, size);
     else
@@ -118,11 +432,67 @@ static inline void *jksn_calloc(size_t nmemb, size_t size) {
 }
 
 static inline void *jksn_realloc(void *ptr, size_t size) {
+    JKSN_COUNT(allocations, 1);
+    JKSN_COUNT(allocated_bytes, size);
     return realloc(ptr, size != 0 ? size : 1);
 }
 
+/* Arenas count their own bumps, and the blocks they take come from jksn_malloc */
+static inline void jksn_tree_count(const jksn_allocator *allocator, size_t size) {
+    if(allocator->malloc != jksn_arena_malloc) {
+        JKSN_COUNT(allocations, 1);
+        JKSN_COUNT(allocated_bytes, size);
+    }
+    (void) size;
+}
+
+static inline void *jksn_tree_malloc(const jksn_allocator *allocator, size_t size) {
+    if(allocator) {
+        jksn_tree_count(allocator, size);
+        return allocator->malloc(allocator->ctx, size != 0 ? size : 1);
+    } else
+        return jksn_malloc(size);
+}
+
+static inline void *jksn_tree_calloc(const jksn_allocator *allocator, size_t nmemb, size_t size) {
+    if(allocator) {
+        void *result;
+        jksn_tree_count(allocator, nmemb * size);
+        result = allocator->malloc(allocator->ctx, nmemb != 0 && size != 0 ? nmemb * size : 1);
+        if(result && nmemb != 0 && size != 0)
+            memset(result, 0, nmemb * size);
+        return result;
+    } else
+        return jksn_calloc(nmemb, size);
+}
+
+static inline void *jksn_tree_realloc(const jksn_allocator *allocator, void *ptr, size_t size) {
+    if(allocator) {
+        jksn_tree_count(allocator, size);
+        return allocator->realloc(allocator->ctx, ptr, size != 0 ? size : 1);
+    } else
+        return jksn_realloc(ptr, size);
+}
+
+static inline void jksn_tree_free(const jksn_allocator *allocator, void *ptr) {
+    if(!allocator)
+        free(ptr);
+    else if(allocator->free && ptr)
+        allocator->free(allocator->ctx, ptr);
+}
+
 jksn_cache *jksn_cache_new(void) {
-    return jksn_calloc(1, sizeof (struct jksn_cache));
+    jksn_cache *cache = jksn_calloc(1, sizeof (struct jksn_cache));
+    if(cache)
+        cache->effort = JKSN_EFFORT_BALANCED;
+    return cache;
+}
+
+jksn_cache *jksn_cache_new_with_allocator(const jksn_allocator *allocator) {
+    jksn_cache *cache = jksn_cache_new();
+    if(cache && allocator)
+        cache->allocator = *allocator;
+    return cache;
 }
 
 jksn_cache *jksn_cache_free(jksn_cache *cache) {
@@ -132,20 +502,210 @@ jksn_cache *jksn_cache_free(jksn_cache *cache) {
         for(i = 0; i < 256; i++)
             if(cache->texthash[i].str) {
                 cache->texthash[i].size = 0;
+                cache->texthash_capacity[i] = 0;
                 free(cache->texthash[i].str);
                 cache->texthash[i].str = NULL;
             }
         for(i = 0; i < 256; i++)
             if(cache->blobhash[i].buf) {
                 cache->blobhash[i].size = 0;
+                cache->blobhash_capacity[i] = 0;
                 free(cache->blobhash[i].buf);
                 cache->blobhash[i].buf = NULL;
             }
+        cache->scratch = jksn_arena_free(cache->scratch);
         free(cache);
     }
     return NULL;
 }
 
+void jksn_cache_set_stats(jksn_cache *cache, jksn_encode_stats *stats) {
+    cache->stats = stats;
+}
+
+void jksn_cache_set_effort(jksn_cache *cache, jksn_effort effort) {
+    cache->effort = effort;
+}
+
+void jksn_cache_set_time_budget(jksn_cache *cache, uint64_t microseconds) {
+    cache->time_budget = microseconds;
+}
+
+const char *jksn_family_name(jksn_family family) {
+    static const char *const names[JKSN_FAMILY_COUNT] = {
+        "constant", "int", "delta int", "float", "utf-16", "utf-8", "blob", "text hash",
+        "blob hash", "array", "swapped array", "object", "other"
+    };
+    return (unsigned) family < JKSN_FAMILY_COUNT ? names[family] : "unknown";
+}
+
+int jksn_encode_stats_print(const jksn_encode_stats *stats, FILE *fp) {
+    uint64_t total_values = 0;
+    uint64_t total_bytes = 0;
+    size_t i;
+    if(fprintf(fp, "%llu dumps: build %.3f ms, optimize %.3f ms, output %.3f ms\n",
+               (unsigned long long) stats->dumps, (double) stats->build_ns/1e6, (double) stats->optimize_ns/1e6, (double) stats->output_ns/1e6) < 0)
+        return JKSN_EIO;
+    fprintf(fp, "%-14s %12s %14s\n", "family", "values", "bytes");
+    for(i = 0; i < JKSN_FAMILY_COUNT; i++) {
+        total_values += stats->values[i];
+        total_bytes += stats->bytes[i];
+        if(stats->values[i] != 0)
+            fprintf(fp, "%-14s %12llu %14llu\n", jksn_family_name((jksn_family) i),
+                    (unsigned long long) stats->values[i], (unsigned long long) stats->bytes[i]);
+    }
+    fprintf(fp, "%-14s %12llu %14llu\n", "total", (unsigned long long) total_values, (unsigned long long) total_bytes);
+    fprintf(fp, "text hash: %llu hits, %llu misses, %llu collisions\n",
+            (unsigned long long) stats->text_hits, (unsigned long long) stats->text_misses, (unsigned long long) stats->text_collisions);
+    fprintf(fp, "blob hash: %llu hits, %llu misses, %llu collisions\n",
+            (unsigned long long) stats->blob_hits, (unsigned long long) stats->blob_misses, (unsigned long long) stats->blob_collisions);
+    if(fprintf(fp, "swapped arrays: %llu of %llu candidates, %lld bytes saved\n",
+               (unsigned long long) stats->swaps, (unsigned long long) stats->swap_candidates, (long long) stats->swap_bytes_saved) < 0)
+        return JKSN_EIO;
+    return JKSN_EOK;
+}
+
+/*
+  Both layouts of an array are built before one is chosen, and each may
+  contain arrays of its own. The decisions made inside the discarded one
+  are taken back, so that only those in the output are counted. So are
+  those of a dump that fails.
+*/
+struct jksn_layout_counters {
+    uint64_t swap_candidates;
+    uint64_t swaps;
+    int64_t swap_bytes_saved;
+};
+
+static void jksn_layout_save(struct jksn_layout_counters *counters, const jksn_encode_stats *stats) {
+    if(stats) {
+        counters->swap_candidates = stats->swap_candidates;
+        counters->swaps = stats->swaps;
+        counters->swap_bytes_saved = stats->swap_bytes_saved;
+    }
+}
+
+static void jksn_layout_restore(const struct jksn_layout_counters *counters, jksn_encode_stats *stats) {
+    stats->swap_candidates = counters->swap_candidates;
+    stats->swaps = counters->swaps;
+    stats->swap_bytes_saved = counters->swap_bytes_saved;
+}
+
+int jksn_instrument_snapshot(jksn_instrument_counters *result) {
+#ifdef JKSN_INSTRUMENT
+    size_t i;
+    result->allocations = atomic_load_explicit(&jksn_counters.allocations, memory_order_relaxed);
+    result->allocated_bytes = atomic_load_explicit(&jksn_counters.allocated_bytes, memory_order_relaxed);
+    result->arena_allocations = atomic_load_explicit(&jksn_counters.arena_allocations, memory_order_relaxed);
+    result->arena_allocated_bytes = atomic_load_explicit(&jksn_counters.arena_allocated_bytes, memory_order_relaxed);
+    for(i = 0; i < JKSN_FAMILY_COUNT; i++)
+        result->parse_values[i] = atomic_load_explicit(&jksn_counters.parse_values[i], memory_order_relaxed);
+    result->utf8_to_utf16_bytes = atomic_load_explicit(&jksn_counters.utf8_to_utf16_bytes, memory_order_relaxed);
+    result->utf16_to_utf8_bytes = atomic_load_explicit(&jksn_counters.utf16_to_utf8_bytes, memory_order_relaxed);
+    result->encode_calls = atomic_load_explicit(&jksn_counters.encode_calls, memory_order_relaxed);
+    result->encode_ns = atomic_load_explicit(&jksn_counters.encode_ns, memory_order_relaxed);
+    result->decode_calls = atomic_load_explicit(&jksn_counters.decode_calls, memory_order_relaxed);
+    result->decode_ns = atomic_load_explicit(&jksn_counters.decode_ns, memory_order_relaxed);
+    return 1;
+#else
+    memset(result, 0, sizeof *result);
+    return 0;
+#endif
+}
+
+void jksn_instrument_reset(void) {
+#ifdef JKSN_INSTRUMENT
+    size_t i;
+    atomic_store_explicit(&jksn_counters.allocations, 0, memory_order_relaxed);
+    atomic_store_explicit(&jksn_counters.allocated_bytes, 0, memory_order_relaxed);
+    atomic_store_explicit(&jksn_counters.arena_allocations, 0, memory_order_relaxed);
+    atomic_store_explicit(&jksn_counters.arena_allocated_bytes, 0, memory_order_relaxed);
+    for(i = 0; i < JKSN_FAMILY_COUNT; i++)
+        atomic_store_explicit(&jksn_counters.parse_values[i], 0, memory_order_relaxed);
+    atomic_store_explicit(&jksn_counters.utf8_to_utf16_bytes, 0, memory_order_relaxed);
+    atomic_store_explicit(&jksn_counters.utf16_to_utf8_bytes, 0, memory_order_relaxed);
+    atomic_store_explicit(&jksn_counters.encode_calls, 0, memory_order_relaxed);
+    atomic_store_explicit(&jksn_counters.encode_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&jksn_counters.decode_calls, 0, memory_order_relaxed);
+    atomic_store_explicit(&jksn_counters.decode_ns, 0, memory_order_relaxed);
+#endif
+}
+
+/* Wall time, so that time spent blocked or preempted counts against a budget */
+static uint64_t jksn_now_ns(void) {
+    struct timespec now;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#else
+    timespec_get(&now, TIME_UTC);
+#endif
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+static jksn_family jksn_control_family(uint8_t control) {
+    switch(control & 0xf0) {
+    case 0x00:
+        return control <= 0x03 ? JKSN_FAMILY_CONSTANT : JKSN_FAMILY_OTHER;
+    case 0x10:
+        return JKSN_FAMILY_INT;
+    case 0x20:
+        return control >= 0x2b && control <= 0x2d ? JKSN_FAMILY_FLOAT : JKSN_FAMILY_CONSTANT;
+    case 0x30:
+        return control == 0x3c ? JKSN_FAMILY_TEXT_HASH : JKSN_FAMILY_UTF16;
+    case 0x40:
+        return JKSN_FAMILY_UTF8;
+    case 0x50:
+        return control == 0x5c ? JKSN_FAMILY_BLOB_HASH : JKSN_FAMILY_BLOB;
+    case 0x80:
+        return JKSN_FAMILY_ARRAY;
+    case 0x90:
+        return JKSN_FAMILY_OBJECT;
+    case 0xa0:
+        return control == 0xa0 ? JKSN_FAMILY_CONSTANT : JKSN_FAMILY_SWAPPED_ARRAY;
+    case 0xd0:
+        return JKSN_FAMILY_DELTA_INT;
+    default:
+        return JKSN_FAMILY_OTHER;
+    }
+}
+
+static void jksn_stats_count_families(jksn_encode_stats *stats, const jksn_proxy *object) {
+    while(object) {
+        jksn_family family = jksn_control_family(object->control);
+        stats->values[family]++;
+        stats->bytes[family] += jksn_proxy_size(object, 1);
+        jksn_stats_count_families(stats, object->first_child);
+        object = object->next_sibling;
+    }
+}
+
+/* Called right after the output is written */
+static void jksn_stats_add_dump(jksn_encode_stats *stats, const jksn_proxy *result, uint64_t start, uint64_t built, uint64_t optimized) {
+    stats->output_ns += jksn_now_ns() - optimized;
+    stats->build_ns += built - start;
+    stats->optimize_ns += optimized - built;
+    stats->dumps++;
+    jksn_stats_count_families(stats, result);
+}
+
+/* Copy into a hashtable slot, reusing its buffer when it is large enough */
+static int jksn_cache_store(char **slot, size_t *slot_size, size_t *slot_capacity, const char *data, size_t size) {
+    if(size > *slot_capacity || !*slot) {
+        char *new_slot = jksn_realloc(*slot, size);
+        if(!new_slot) {
+            free(*slot);
+            *slot = NULL;
+            *slot_size = *slot_capacity = 0;
+            return 0;
+        }
+        *slot = new_slot;
+        *slot_capacity = size;
+    }
+    memcpy(*slot, data, size);
+    *slot_size = size;
+    return 1;
+}
+
 jksn_blobstring *jksn_blobstring_free(jksn_blobstring *blobstring) {
     if(blobstring) {
         blobstring->size = 0;
@@ -157,50 +717,201 @@ jksn_blobstring *jksn_blobstring_free(jksn_blobstring *blobstring) {
 }
 
 jksn_t *jksn_free(jksn_t *object) {
-    if(object) {
+    return jksn_free_with_allocator(object, NULL);
+}
+
+jksn_t *jksn_free_with_allocator(jksn_t *object, const jksn_allocator *allocator) {
+    return jksn_free_tree(object, allocator, NULL, 0);
+}
+
+jksn_t *jksn_free_borrowed(jksn_t *object, const jksn_blobstring *buffer, const jksn_allocator *allocator) {
+    return buffer ? jksn_free_tree(object, allocator, buffer->buf, buffer->size) : jksn_free_tree(object, allocator, NULL, 0);
+}
+
+static inline int jksn_is_borrowed(const char *ptr, const char *borrowed, size_t borrowed_size) {
+    return borrowed && (uintptr_t) ptr >= (uintptr_t) borrowed && (uintptr_t) ptr - (uintptr_t) borrowed < borrowed_size;
+}
+
+/* Strings and blobs pointing into borrowed are left alone */
+static jksn_t *jksn_free_tree(jksn_t *object, const jksn_allocator *allocator, const char *borrowed, size_t borrowed_size) {
+    /* Containers wait here instead of recursing, so that deep trees cannot overflow the stack */
+    jksn_t *local_pending[32];
+    jksn_t **pending = local_pending;
+    size_t depth = 0;
+    size_t capacity = sizeof local_pending / sizeof local_pending[0];
+    if(allocator && !allocator->free)
+        return NULL;
+    while(object) {
         size_t i;
         switch(object->data_type) {
         case JKSN_STRING:
-            object->data_string.size = 0;
-            free(object->data_string.str);
-            object->data_string.str = NULL;
+            if(!jksn_is_borrowed(object->data_string.str, borrowed, borrowed_size))
+                jksn_tree_free(allocator, object->data_string.str);
             break;
         case JKSN_BLOB:
-            object->data_blob.size = 0;
-            free(object->data_blob.buf);
-            object->data_blob.buf = NULL;
+            if(!jksn_is_borrowed(object->data_blob.buf, borrowed, borrowed_size))
+                jksn_tree_free(allocator, object->data_blob.buf);
             break;
         case JKSN_ARRAY:
-            for(i = 0; i < object->data_array.size; i++)
-                jksn_free(object->data_array.children[i]);
-            for(i = 0; i < object->data_array.size; i++)
-                object->data_array.children[i] = NULL;
-            object->data_array.size = 0;
-            free(object->data_array.children);
-            object->data_array.children = NULL;
-            break;
         case JKSN_OBJECT:
-            for(i = 0; i < object->data_object.size; i++) {
-                jksn_free(object->data_object.children[i].key);
-                jksn_free(object->data_object.children[i].value);
+            {
+                size_t children = object->data_type == JKSN_ARRAY ? object->data_array.size : object->data_object.size*2;
+                if(capacity - depth < children) {
+                    size_t new_capacity = capacity;
+                    jksn_t **tmpptr;
+                    while(new_capacity - depth < children)
+                        new_capacity *= 2;
+                    tmpptr = pending == local_pending ? jksn_malloc(new_capacity * sizeof (jksn_t *)) : jksn_realloc(pending, new_capacity * sizeof (jksn_t *));
+                    if(tmpptr) {
+                        if(pending == local_pending)
+                            memcpy(tmpptr, local_pending, depth * sizeof (jksn_t *));
+                        pending = tmpptr;
+                        capacity = new_capacity;
+                    }
+                }
+                if(object->data_type == JKSN_ARRAY)
+                    for(i = 0; i < object->data_array.size; i++) {
+                        if(depth < capacity)
+                            pending[depth++] = object->data_array.children[i];
+                        else
+                            jksn_free_tree(object->data_array.children[i], allocator, borrowed, borrowed_size);
+                    }
+                else
+                    for(i = 0; i < object->data_object.size; i++) {
+                        if(depth < capacity)
+                            pending[depth++] = object->data_object.children[i].key;
+                        else
+                            jksn_free_tree(object->data_object.children[i].key, allocator, borrowed, borrowed_size);
+                        if(depth < capacity)
+                            pending[depth++] = object->data_object.children[i].value;
+                        else
+                            jksn_free_tree(object->data_object.children[i].value, allocator, borrowed, borrowed_size);
+                    }
+                if(object->data_type == JKSN_ARRAY)
+                    jksn_tree_free(allocator, object->data_array.children);
+                else
+                    jksn_tree_free(allocator, object->data_object.children);
+                break;
             }
-            for(i = 0; i < object->data_object.size; i++)
-                object->data_object.children[i].value =
-                    object->data_object.children[i].key = NULL;
-            object->data_object.size = 0;
-            free(object->data_object.children);
-            object->data_object.children = NULL;
-            break;
         default:
             break;
         }
-        free(object);
+        jksn_tree_free(allocator, object);
+        object = NULL;
+        while(!object && depth)
+            object = pending[--depth];
+    }
+    if(pending != local_pending)
+        free(pending);
+    return NULL;
+}
+
+jksn_arena *jksn_arena_new(size_t block_size) {
+    jksn_arena *arena = jksn_calloc(1, sizeof (jksn_arena));
+    if(arena) {
+        arena->block_size = block_size != 0 ? block_size : 65536;
+        arena->allocator.malloc = jksn_arena_malloc;
+        arena->allocator.realloc = jksn_arena_realloc;
+        arena->allocator.free = NULL;
+        arena->allocator.ctx = arena;
+    }
+    return arena;
+}
+
+jksn_arena *jksn_arena_free(jksn_arena *arena) {
+    if(arena) {
+        struct jksn_arena_block *block = arena->first;
+        while(block) {
+            struct jksn_arena_block *next_block = block->next;
+            free(block);
+            block = next_block;
+        }
+        arena->first = arena->current = NULL;
+        arena->last = NULL;
+        free(arena);
     }
     return NULL;
 }
 
-static jksn_proxy *jksn_proxy_new(const jksn_t *origin, uint8_t control, const jksn_blobstring *data, const jksn_blobstring *buf) {
-    jksn_proxy *result = jksn_calloc(1, sizeof (jksn_proxy));
+void jksn_arena_reset(jksn_arena *arena) {
+    struct jksn_arena_block *block;
+    for(block = arena->first; block; block = block->next)
+        block->used = 0;
+    arena->current = arena->first;
+    arena->last = NULL;
+}
+
+const jksn_allocator *jksn_arena_allocator(jksn_arena *arena) {
+    return &arena->allocator;
+}
+
+static void *jksn_arena_malloc(void *ctx, size_t size) {
+    jksn_arena *arena = ctx;
+    size_t needed = JKSN_ARENA_HEADER + ((size + JKSN_ARENA_ALIGN - 1) & ~(size_t) (JKSN_ARENA_ALIGN - 1));
+    struct jksn_arena_block *block = arena->current;
+    char *result;
+    if(needed < size)
+        return NULL;
+    JKSN_COUNT(arena_allocations, 1);
+    JKSN_COUNT(arena_allocated_bytes, size);
+    /* Blocks kept by jksn_arena_reset are reused before new ones are made */
+    while(block && block->size - block->used < needed)
+        block = block->next && block->next->used == 0 ? block->next : NULL;
+    if(!block) {
+        size_t block_size = needed > arena->block_size ? needed : arena->block_size;
+        block = jksn_malloc(JKSN_ARENA_BLOCK_HEADER + block_size);
+        if(!block)
+            return NULL;
+        block->size = block_size;
+        block->used = 0;
+        if(arena->current) {
+            block->next = arena->current->next;
+            arena->current->next = block;
+        } else {
+            block->next = NULL;
+            arena->first = block;
+        }
+    }
+    arena->current = block;
+    result = (char *) block + JKSN_ARENA_BLOCK_HEADER + block->used + JKSN_ARENA_HEADER;
+    block->used += needed;
+    *(size_t *) (result - JKSN_ARENA_HEADER) = size;
+    arena->last = result;
+    return result;
+}
+
+static void *jksn_arena_realloc(void *ctx, void *ptr, size_t size) {
+    jksn_arena *arena = ctx;
+    size_t oldsize;
+    void *result;
+    if(!ptr)
+        return jksn_arena_malloc(ctx, size);
+    oldsize = *(size_t *) ((char *) ptr - JKSN_ARENA_HEADER);
+    if(size <= oldsize) {
+        *(size_t *) ((char *) ptr - JKSN_ARENA_HEADER) = size;
+        return ptr;
+    }
+    if(ptr == arena->last) {
+        /* The most recent allocation grows in place while its block has room */
+        struct jksn_arena_block *block = arena->current;
+        size_t offset = (size_t) ((char *) ptr - ((char *) block + JKSN_ARENA_BLOCK_HEADER));
+        size_t needed = (size + JKSN_ARENA_ALIGN - 1) & ~(size_t) (JKSN_ARENA_ALIGN - 1);
+        if(needed >= size && needed <= block->size - offset) {
+            JKSN_COUNT(arena_allocations, 1);
+            JKSN_COUNT(arena_allocated_bytes, size);
+            block->used = offset + needed;
+            *(size_t *) ((char *) ptr - JKSN_ARENA_HEADER) = size;
+            return ptr;
+        }
+    }
+    result = jksn_arena_malloc(ctx, size);
+    if(result)
+        memcpy(result, ptr, oldsize);
+    return result;
+}
+
+static jksn_proxy *jksn_proxy_new(const jksn_t *origin, uint8_t control, const jksn_blobstring *data, const jksn_blobstring *buf, const jksn_allocator *allocator) {
+    jksn_proxy *result = jksn_tree_calloc(allocator, 1, sizeof (jksn_proxy));
     if(result) {
         result->origin = origin;
         result->control = control;
@@ -212,21 +923,23 @@ static jksn_proxy *jksn_proxy_new(const jksn_t *origin, uint8_t control, const j
     return result;
 }
 
-static jksn_proxy *jksn_proxy_free(jksn_proxy *object) {
+static jksn_proxy *jksn_proxy_free(jksn_proxy *object, const jksn_allocator *allocator) {
+    if(allocator && !allocator->free)
+        return NULL;
     while(object) {
         jksn_proxy *this_object = object;
         object->data.size = 0;
-        free(object->data.buf);
+        jksn_tree_free(allocator, object->data.buf);
         object->data.buf = NULL;
         object->buf.size = 0;
-        free(object->buf.buf);
+        jksn_tree_free(allocator, object->buf.buf);
         object->buf.buf = NULL;
         if(object->first_child) {
-            jksn_proxy_free(object->first_child);
+            jksn_proxy_free(object->first_child, allocator);
             object->first_child = NULL;
         }
         object = object->next_sibling;
-        free(this_object);
+        jksn_tree_free(allocator, this_object);
     }
     return NULL;
 }
@@ -263,7 +976,15 @@ static char *jksn_proxy_output(char output[], const jksn_proxy *object) {
     return output;
 }
 
-int jksn_dump(const jksn_t *object, jksn_blobstring **result, /*bool*/ int header, jksn_cache *cache_) {
+int jksn_dump(const jksn_t *object, jksn_blobstring **result, /*bool*/ int header, jksn_cache *cache) {
+    int retval;
+    JKSN_CALL_BEGIN(dump, object);
+    retval = jksn_dump_uninstrumented(object, result, header, cache);
+    JKSN_CALL_END(encode, dump, retval, result && *result ? (*result)->size : 0);
+    return retval;
+}
+
+static int jksn_dump_uninstrumented(const jksn_t *object, jksn_blobstring **result, /*bool*/ int header, jksn_cache *cache_) {
     if(result)
         *result = NULL;
     if(!object)
@@ -274,30 +995,196 @@ int jksn_dump(const jksn_t *object, jksn_blobstring **result, /*bool*/ int heade
             return JKSN_ENOMEM;
         else {
             jksn_proxy *result_value = NULL;
-            jksn_error_message_no retval = jksn_dump_value(&result_value, object, cache);
+            struct jksn_layout_counters layout = {0, 0, 0};
+            uint64_t start = cache->stats ? jksn_now_ns() : 0;
+            jksn_error_message_no retval;
+            jksn_layout_save(&layout, cache->stats);
+            jksn_dump_begin(cache);
+            retval = jksn_dump_proxy(&result_value, object, cache);
             if(retval == JKSN_EOK) {
-                jksn_optimize(result_value, cache);
+                uint64_t built = cache->stats ? jksn_now_ns() : 0;
+                uint64_t optimized;
+                jksn_dump_finish(result_value, cache);
+                optimized = cache->stats ? jksn_now_ns() : 0;
                 if(result) {
+                    size_t header_size = header ? 3 : 0;
                     *result = jksn_malloc(sizeof (jksn_blobstring));
-                    if(header) {
-                        const char *output_end;
-                        (*result)->size = jksn_proxy_size(result_value, 0) + 3;
+                    if(*result) {
+                        (*result)->size = jksn_proxy_size(result_value, 0) + header_size;
                         (*result)->buf = jksn_malloc((*result)->size);
-                        (*result)->buf[0] = 'j';
-                        (*result)->buf[1] = 'k';
-                        (*result)->buf[2] = '!';
-                        output_end = jksn_proxy_output((*result)->buf + 3, result_value);
-                        assert((size_t) (output_end - (*result)->buf) == (*result)->size);
-                    } else {
+                        if(!(*result)->buf)
+                            *result = jksn_blobstring_free(*result);
+                    }
+                    if(*result) {
                         const char *output_end;
-                        (*result)->size = jksn_proxy_size(result_value, 0);
-                        (*result)->buf = jksn_malloc((*result)->size);
-                        output_end = jksn_proxy_output((*result)->buf, result_value);
+                        if(header) {
+                            (*result)->buf[0] = 'j';
+                            (*result)->buf[1] = 'k';
+                            (*result)->buf[2] = '!';
+                        }
+                        output_end = jksn_proxy_output((*result)->buf + header_size, result_value);
                         assert((size_t) (output_end - (*result)->buf) == (*result)->size);
+                    } else
+                        retval = JKSN_ENOMEM;
+                }
+                if(cache->stats && retval == JKSN_EOK)
+                    jksn_stats_add_dump(cache->stats, result_value, start, built, optimized);
+            }
+            if(cache->stats && retval != JKSN_EOK)
+                jksn_layout_restore(&layout, cache->stats);
+            if(cache->scratch)
+                jksn_arena_reset(cache->scratch);
+            if(cache != cache_)
+                jksn_cache_free(cache);
+            return retval;
+        }
+    }
+}
+
+int jksn_dump_into(const jksn_t *object, char *buffer, size_t capacity, size_t *written, /*bool*/ int header, jksn_cache *cache) {
+    int retval;
+    JKSN_CALL_BEGIN(dump, object);
+    retval = jksn_dump_into_uninstrumented(object, buffer, capacity, written, header, cache);
+    JKSN_CALL_END(encode, dump, retval, written ? *written : 0);
+    return retval;
+}
+
+static int jksn_dump_into_uninstrumented(const jksn_t *object, char *buffer, size_t capacity, size_t *written, /*bool*/ int header, jksn_cache *cache_) {
+    if(written)
+        *written = 0;
+    if(!object)
+        return JKSN_ETYPE;
+    else {
+        jksn_cache *cache = cache_ ? cache_ : jksn_cache_new();
+        if(!cache)
+            return JKSN_ENOMEM;
+        else {
+            jksn_proxy *result_value = NULL;
+            struct jksn_layout_counters layout = {0, 0, 0};
+            uint64_t start = cache->stats ? jksn_now_ns() : 0;
+            jksn_error_message_no retval;
+            jksn_layout_save(&layout, cache->stats);
+            jksn_dump_begin(cache);
+            retval = jksn_dump_proxy(&result_value, object, cache);
+            if(retval == JKSN_EOK) {
+                size_t header_size = header ? 3 : 0;
+                uint64_t built = cache->stats ? jksn_now_ns() : 0;
+                uint64_t optimized = built;
+                /*
+                  jksn_optimize only ever shrinks the stream, so the size
+                  before it is an upper bound. A caller's cache must not be
+                  touched if we are going to fail, so check that first.
+                */
+                size_t size = jksn_proxy_size(result_value, 0) + header_size;
+                if(cache != cache_ || size <= capacity) {
+                    jksn_dump_finish(result_value, cache);
+                    size = jksn_proxy_size(result_value, 0) + header_size;
+                    optimized = cache->stats ? jksn_now_ns() : 0;
+                }
+                if(size <= capacity) {
+                    const char *output_end;
+                    if(header) {
+                        buffer[0] = 'j';
+                        buffer[1] = 'k';
+                        buffer[2] = '!';
+                    }
+                    output_end = jksn_proxy_output(buffer + header_size, result_value);
+                    assert((size_t) (output_end - buffer) == size);
+                    if(cache->stats)
+                        jksn_stats_add_dump(cache->stats, result_value, start, built, optimized);
+                } else
+                    retval = JKSN_ESPACE;
+                if(written)
+                    *written = size;
+            }
+            if(cache->stats && retval != JKSN_EOK)
+                jksn_layout_restore(&layout, cache->stats);
+            if(cache->scratch)
+                jksn_arena_reset(cache->scratch);
+            if(cache != cache_)
+                jksn_cache_free(cache);
+            return retval;
+        }
+    }
+}
+
+int jksn_dump_segments(const jksn_t *object, jksn_segment **segments, size_t *count, jksn_blobstring **storage, size_t min_size, /*bool*/ int header, jksn_cache *cache) {
+    int retval;
+    JKSN_CALL_BEGIN(dump, object);
+    retval = jksn_dump_segments_uninstrumented(object, segments, count, storage, min_size, header, cache);
+    JKSN_CALL_END(encode, dump, retval, storage && *storage ? (*storage)->size : 0);
+    return retval;
+}
+
+static int jksn_dump_segments_uninstrumented(const jksn_t *object, jksn_segment **segments, size_t *count, jksn_blobstring **storage, size_t min_size, /*bool*/ int header, jksn_cache *cache_) {
+    *segments = NULL;
+    *count = 0;
+    *storage = NULL;
+    if(!object)
+        return JKSN_ETYPE;
+    else {
+        jksn_cache *cache = cache_ ? cache_ : jksn_cache_new();
+        if(!cache)
+            return JKSN_ENOMEM;
+        else {
+            jksn_proxy *result_value = NULL;
+            struct jksn_layout_counters layout = {0, 0, 0};
+            uint64_t start = cache->stats ? jksn_now_ns() : 0;
+            jksn_error_message_no retval;
+            jksn_layout_save(&layout, cache->stats);
+            jksn_dump_begin(cache);
+            cache->segment_min = min_size;
+            retval = jksn_dump_proxy(&result_value, object, cache);
+            if(retval == JKSN_EOK) {
+                size_t header_size = header ? 3 : 0;
+                size_t used = header_size;
+                size_t begin = 0;
+                uint64_t built = cache->stats ? jksn_now_ns() : 0;
+                uint64_t optimized;
+                jksn_dump_finish(result_value, cache);
+                optimized = cache->stats ? jksn_now_ns() : 0;
+                /* Counted first, so that the segments can point into storage once it is allocated */
+                jksn_proxy_segments(result_value, min_size, NULL, &used, NULL, count, &begin);
+                if(begin != used)
+                    ++*count;
+                *storage = jksn_malloc(sizeof (jksn_blobstring));
+                if(*storage) {
+                    (*storage)->size = used;
+                    (*storage)->buf = jksn_malloc(used != 0 ? used : 1);
+                    *segments = jksn_malloc((*count != 0 ? *count : 1) * sizeof (jksn_segment));
+                    if(!(*storage)->buf || !*segments) {
+                        free(*segments);
+                        *segments = NULL;
+                        *storage = jksn_blobstring_free(*storage);
+                    }
+                }
+                if(*storage) {
+                    size_t filled = 0;
+                    used = header_size;
+                    begin = 0;
+                    if(header) {
+                        (*storage)->buf[0] = 'j';
+                        (*storage)->buf[1] = 'k';
+                        (*storage)->buf[2] = '!';
                     }
+                    jksn_proxy_segments(result_value, min_size, (*storage)->buf, &used, *segments, &filled, &begin);
+                    if(begin != used) {
+                        (*segments)[filled].data = (*storage)->buf + begin;
+                        (*segments)[filled++].size = used - begin;
+                    }
+                    assert(filled == *count && used == (*storage)->size);
+                    if(cache->stats)
+                        jksn_stats_add_dump(cache->stats, result_value, start, built, optimized);
+                } else {
+                    *count = 0;
+                    retval = JKSN_ENOMEM;
                 }
             }
-            jksn_proxy_free(result_value);
+            cache->segment_min = 0;
+            if(cache->stats && retval != JKSN_EOK)
+                jksn_layout_restore(&layout, cache->stats);
+            if(cache->scratch)
+                jksn_arena_reset(cache->scratch);
             if(cache != cache_)
                 jksn_cache_free(cache);
             return retval;
@@ -305,93 +1192,258 @@ int jksn_dump(const jksn_t *object, jksn_blobstring **result, /*bool*/ int heade
     }
 }
 
-static jksn_error_message_no jksn_dump_value(jksn_proxy **result, const jksn_t *object, jksn_cache *cache) {
+int jksn_dump_batch(const jksn_t *const *objects, size_t count, jksn_blobstring **result, size_t **offsets, /*bool*/ int header, /*bool*/ int shared, jksn_cache *cache) {
+    int retval;
+    JKSN_CALL_BEGIN(dump, count != 0 ? objects[0] : NULL);
+    retval = jksn_dump_batch_uninstrumented(objects, count, result, offsets, header, shared, cache);
+    JKSN_CALL_END(encode, dump, retval, *result ? (*result)->size : 0);
+    return retval;
+}
+
+static int jksn_dump_batch_uninstrumented(const jksn_t *const *objects, size_t count, jksn_blobstring **result, size_t **offsets, /*bool*/ int header, /*bool*/ int shared, jksn_cache *cache_) {
+    jksn_cache *cache;
+    size_t capacity = 256;
+    size_t header_size = header ? 3 : 0;
+    size_t i;
+    jksn_error_message_no retval = JKSN_EOK;
+    *result = NULL;
+    *offsets = NULL;
+    for(i = 0; i < count; i++)
+        if(!objects[i])
+            return JKSN_ETYPE;
+    cache = cache_ ? cache_ : jksn_cache_new();
+    if(!cache)
+        return JKSN_ENOMEM;
+    *result = jksn_malloc(sizeof (jksn_blobstring));
+    *offsets = jksn_malloc((count + 1) * sizeof (size_t));
+    if(*result) {
+        (*result)->size = 0;
+        (*result)->buf = jksn_malloc(capacity);
+    }
+    if(!*result || !(*result)->buf || !*offsets)
+        retval = JKSN_ENOMEM;
+    /* One output buffer and one scratch arena for all the messages */
+    for(i = 0; i < count && retval == JKSN_EOK; i++) {
+        jksn_proxy *result_value = NULL;
+        struct jksn_layout_counters layout = {0, 0, 0};
+        uint64_t start = cache->stats ? jksn_now_ns() : 0;
+        (*offsets)[i] = (*result)->size;
+        if(!shared)
+            jksn_cache_forget(cache);
+        jksn_layout_save(&layout, cache->stats);
+        jksn_dump_begin(cache);
+        retval = jksn_dump_proxy(&result_value, objects[i], cache);
+        if(retval == JKSN_EOK) {
+            uint64_t built = cache->stats ? jksn_now_ns() : 0;
+            uint64_t optimized;
+            size_t size;
+            jksn_dump_finish(result_value, cache);
+            optimized = cache->stats ? jksn_now_ns() : 0;
+            size = jksn_proxy_size(result_value, 0) + header_size;
+            if((*result)->size + size > capacity) {
+                char *new_buf;
+                while((*result)->size + size > capacity)
+                    capacity *= 2;
+                new_buf = jksn_realloc((*result)->buf, capacity);
+                if(new_buf)
+                    (*result)->buf = new_buf;
+                else
+                    retval = JKSN_ENOMEM;
+            }
+            if(retval == JKSN_EOK) {
+                char *output = (*result)->buf + (*result)->size;
+                if(header) {
+                    output[0] = 'j';
+                    output[1] = 'k';
+                    output[2] = '!';
+                }
+                jksn_proxy_output(output + header_size, result_value);
+                (*result)->size += size;
+                if(cache->stats)
+                    jksn_stats_add_dump(cache->stats, result_value, start, built, optimized);
+            }
+        }
+        if(cache->stats && retval != JKSN_EOK)
+            jksn_layout_restore(&layout, cache->stats);
+        if(cache->scratch)
+            jksn_arena_reset(cache->scratch);
+    }
+    if(retval == JKSN_EOK)
+        (*offsets)[count] = (*result)->size;
+    else {
+        *result = jksn_blobstring_free(*result);
+        free(*offsets);
+        *offsets = NULL;
+    }
+    if(cache != cache_)
+        jksn_cache_free(cache);
+    return retval;
+}
+
+/*
+  Generated bytes go to storage, and strings and blobs of at least
+  min_size bytes stay where the tree keeps them. With storage NULL, only
+  counts the bytes and the segments. begin is where the pending run of
+  generated bytes starts.
+*/
+static void jksn_proxy_segments(const jksn_proxy *object, size_t min_size, char *storage, size_t *used, jksn_segment *segments, size_t *count, size_t *begin) {
+    while(object) {
+        int in_place = ((object->control & 0xf0) == 0x40 || (object->control & 0xf0) == 0x50) && min_size != 0 && object->buf.size >= min_size;
+        if(storage) {
+            storage[*used] = (char) object->control;
+            if(object->data.size != 0)
+                memcpy(storage + *used + 1, object->data.buf, object->data.size);
+        }
+        *used += 1 + object->data.size;
+        if(in_place) {
+            if(segments) {
+                segments[*count].data = storage + *begin;
+                segments[*count].size = *used - *begin;
+                segments[*count + 1].data = object->buf.buf;
+                segments[*count + 1].size = object->buf.size;
+            }
+            *count += 2;
+            *begin = *used;
+        } else {
+            if(storage && object->buf.size != 0)
+                memcpy(storage + *used, object->buf.buf, object->buf.size);
+            *used += object->buf.size;
+        }
+        if(object->first_child)
+            jksn_proxy_segments(object->first_child, min_size, storage, used, segments, count, begin);
+        object = object->next_sibling;
+    }
+}
+
+static void jksn_dump_begin(jksn_cache *cache) {
+    cache->fast = cache->effort == JKSN_EFFORT_FASTEST;
+    cache->countdown = 0;
+    if(cache->time_budget != 0)
+        cache->deadline = jksn_now_ns() + cache->time_budget * 1000;
+}
+
+/*
+  Values built on the fast path carry no hash, so a tree with any of them
+  is not optimized. The decoder still remembers its strings and integers,
+  so the cache forgets its own to avoid referring to stale ones later.
+*/
+static void jksn_dump_finish(jksn_proxy *result, jksn_cache *cache) {
+    if(!cache->fast) {
+        jksn_optimize(result, cache, jksn_arena_allocator(cache->scratch));
+        return;
+    }
+    jksn_cache_forget(cache);
+}
+
+static void jksn_cache_forget(jksn_cache *cache) {
+    size_t i;
+    cache->haslastint = 0;
+    for(i = 0; i < 256; i++) {
+        cache->texthash[i].size = 0;
+        cache->blobhash[i].size = 0;
+    }
+}
+
+static jksn_error_message_no jksn_dump_proxy(jksn_proxy **result, const jksn_t *object, jksn_cache *cache) {
+    *result = NULL;
+    if(!cache->scratch) {
+        cache->scratch = jksn_arena_new(16384);
+        if(!cache->scratch)
+            return JKSN_ENOMEM;
+    }
+    return jksn_dump_value(result, object, cache, jksn_arena_allocator(cache->scratch));
+}
+
+static jksn_error_message_no jksn_dump_value(jksn_proxy **result, const jksn_t *object, jksn_cache *cache, const jksn_allocator *allocator) {
     *result = NULL;
+    /* Only reads the clock every 64 values */
+    if(cache->time_budget != 0 && !cache->fast && ++cache->countdown % 64 == 0 && jksn_now_ns() >= cache->deadline)
+        cache->fast = 1;
     switch(object->data_type) {
     case JKSN_UNDEFINED:
-        *result = jksn_proxy_new(object, 0x00, NULL, NULL);
+        *result = jksn_proxy_new(object, 0x00, NULL, NULL, allocator);
         return *result ? JKSN_EOK : JKSN_ENOMEM;
     case JKSN_NULL:
-        *result = jksn_proxy_new(object, 0x01, NULL, NULL);
+        *result = jksn_proxy_new(object, 0x01, NULL, NULL, allocator);
         return *result ? JKSN_EOK : JKSN_ENOMEM;
     case JKSN_BOOL:
-        *result = jksn_proxy_new(object, object->data_bool ? 0x03 : 0x02, NULL, NULL);
+        *result = jksn_proxy_new(object, object->data_bool ? 0x03 : 0x02, NULL, NULL, allocator);
         return *result ? JKSN_EOK : JKSN_ENOMEM;
     case JKSN_INT:
-        return jksn_dump_int(result, object);
+        return jksn_dump_int(result, object, allocator);
     case JKSN_FLOAT:
-        return jksn_dump_float(result, object);
+        return jksn_dump_float(result, object, allocator);
     case JKSN_DOUBLE:
-        return jksn_dump_double(result, object);
+        return jksn_dump_double(result, object, allocator);
     case JKSN_LONG_DOUBLE:
-        return jksn_dump_longdouble(result, object);
+        return jksn_dump_longdouble(result, object, allocator);
     case JKSN_STRING:
-        return jksn_dump_string(result, object);
+        return jksn_dump_string(result, object, cache, allocator);
     case JKSN_BLOB:
-        return jksn_dump_blob(result, object);
+        return jksn_dump_blob(result, object, cache, allocator);
     case JKSN_ARRAY:
-        return jksn_dump_array(result, object, cache);
+        return jksn_dump_array(result, object, cache, allocator);
     case JKSN_OBJECT:
-        return jksn_dump_object(result, object, cache);
+        return jksn_dump_object(result, object, cache, allocator);
     case JKSN_UNSPECIFIED:
-        *result = jksn_proxy_new(object, 0xa0, NULL, NULL);
+        *result = jksn_proxy_new(object, 0xa0, NULL, NULL, allocator);
         return *result ? JKSN_EOK : JKSN_ENOMEM;
     default:
         return JKSN_ETYPE;
     }
 }
 
-static jksn_error_message_no jksn_dump_int(jksn_proxy **result, const jksn_t *object) {
+static jksn_error_message_no jksn_dump_int(jksn_proxy **result, const jksn_t *object, const jksn_allocator *allocator) {
     if(object->data_int >= 0 && object->data_int <= 0xa)
-        *result = jksn_proxy_new(object, 0x10 | object->data_int, NULL, NULL);
+        *result = jksn_proxy_new(object, 0x10 | object->data_int, NULL, NULL, allocator);
     else if(object->data_int >= -0x80 && object->data_int <= 0x7f) {
-        jksn_blobstring data = {1, jksn_malloc(1)};
+        jksn_blobstring data = {1, jksn_tree_malloc(allocator, 1)};
         if(!data.buf)
             return JKSN_ENOMEM;
         jksn_encode_int(data.buf, (uintmax_t) object->data_int, 1);
-        *result = jksn_proxy_new(object, 0x1d, &data, NULL);
+        *result = jksn_proxy_new(object, 0x1d, &data, NULL, allocator);
     } else if(object->data_int >= -0x8000 && object->data_int <= 0x7fff) {
-        jksn_blobstring data = {2, jksn_malloc(2)};
+        jksn_blobstring data = {2, jksn_tree_malloc(allocator, 2)};
         if(!data.buf)
             return JKSN_ENOMEM;
         jksn_encode_int(data.buf, (uintmax_t) object->data_int, 2);
-        *result = jksn_proxy_new(object, 0x1c, &data, NULL);
+        *result = jksn_proxy_new(object, 0x1c, &data, NULL, allocator);
     } else if((object->data_int >= -0x80000000LL && object->data_int <= -0x200000) ||
               (object->data_int >= 0x200000 && object->data_int <= 0x7fffffff)) {
-        jksn_blobstring data = {4, jksn_malloc(4)};
+        jksn_blobstring data = {4, jksn_tree_malloc(allocator, 4)};
         if(!data.buf)
             return JKSN_ENOMEM;
         jksn_encode_int(data.buf, (uintmax_t) object->data_int, 4);
-        *result = jksn_proxy_new(object, 0x1b, &data, NULL);
+        *result = jksn_proxy_new(object, 0x1b, &data, NULL, allocator);
     } else if(object->data_int >= 0) {
-        jksn_blobstring data = {0, jksn_malloc(jksn_varint_size)};
+        jksn_blobstring data = {0, jksn_tree_malloc(allocator, jksn_varint_size)};
         if(!data.buf)
             return JKSN_ENOMEM;
         data.size = jksn_encode_int(data.buf, (uintmax_t) object->data_int, 0);
-        *result = jksn_proxy_new(object, 0x1f, &data, NULL);
+        *result = jksn_proxy_new(object, 0x1f, &data, NULL, allocator);
     } else {
-        jksn_blobstring data = {0, jksn_malloc(jksn_varint_size)};
+        jksn_blobstring data = {0, jksn_tree_malloc(allocator, jksn_varint_size)};
         if(!data.buf)
             return JKSN_ENOMEM;
         data.size = jksn_encode_int(data.buf, (uintmax_t) -object->data_int, 0);
-        *result = jksn_proxy_new(object, 0x1e, &data, NULL);
+        *result = jksn_proxy_new(object, 0x1e, &data, NULL, allocator);
     }
     return *result ? JKSN_EOK : JKSN_ENOMEM;
 }
 
-static jksn_error_message_no jksn_dump_float(jksn_proxy **result, const jksn_t *object) {
+static jksn_error_message_no jksn_dump_float(jksn_proxy **result, const jksn_t *object, const jksn_allocator *allocator) {
     if(isnan(object->data_float)) {
-        *result = jksn_proxy_new(object, 0x20, NULL, NULL);
+        *result = jksn_proxy_new(object, 0x20, NULL, NULL, allocator);
         return *result ? JKSN_EOK : JKSN_ENOMEM;
     } else if(isinf(object->data_float)) {
-        *result = jksn_proxy_new(object, object->data_float >= 0.0f ? 0x2f : 0x2e, NULL, NULL);
+        *result = jksn_proxy_new(object, object->data_float >= 0.0f ? 0x2f : 0x2e, NULL, NULL, allocator);
         return *result ? JKSN_EOK : JKSN_ENOMEM;
     } else {
         const union {
             float data_float;
             uint8_t data_int[4];
         } conv = {object->data_float};
-        jksn_blobstring data = {4, jksn_malloc(4)};
+        jksn_blobstring data = {4, jksn_tree_malloc(allocator, 4)};
         assert(sizeof (float) == 4);
         if(!data.buf)
             return JKSN_ENOMEM;
@@ -406,24 +1458,24 @@ static jksn_error_message_no jksn_dump_float(jksn_proxy **result, const jksn_t *
             data.buf[2] = (char) conv.data_int[2];
             data.buf[3] = (char) conv.data_int[3];
         }
-        *result = jksn_proxy_new(object, 0x2d, &data, NULL);
+        *result = jksn_proxy_new(object, 0x2d, &data, NULL, allocator);
         return *result ? JKSN_EOK : JKSN_ENOMEM;
     }
 }
 
-static jksn_error_message_no jksn_dump_double(jksn_proxy **result, const jksn_t *object) {
+static jksn_error_message_no jksn_dump_double(jksn_proxy **result, const jksn_t *object, const jksn_allocator *allocator) {
     if(isnan(object->data_double)) {
-        *result = jksn_proxy_new(object, 0x20, NULL, NULL);
+        *result = jksn_proxy_new(object, 0x20, NULL, NULL, allocator);
         return *result ? JKSN_EOK : JKSN_ENOMEM;
     } else if(isinf(object->data_double)) {
-        *result = jksn_proxy_new(object, object->data_double >= 0.0 ? 0x2f : 0x2e, NULL, NULL);
+        *result = jksn_proxy_new(object, object->data_double >= 0.0 ? 0x2f : 0x2e, NULL, NULL, allocator);
         return *result ? JKSN_EOK : JKSN_ENOMEM;
     } else {
         const union {
             double data_double;
             uint8_t data_int[8];
         } conv = {object->data_double};
-        jksn_blobstring data = {8, jksn_malloc(8)};
+        jksn_blobstring data = {8, jksn_tree_malloc(allocator, 8)};
         assert(sizeof (double) == 8);
         if(!data.buf)
             return JKSN_ENOMEM;
@@ -446,24 +1498,24 @@ static jksn_error_message_no jksn_dump_double(jksn_proxy **result, const jksn_t
             data.buf[6] = (char) conv.data_int[6];
             data.buf[7] = (char) conv.data_int[7];
         }
-        *result = jksn_proxy_new(object, 0x2c, &data, NULL);
+        *result = jksn_proxy_new(object, 0x2c, &data, NULL, allocator);
         return *result ? JKSN_EOK : JKSN_ENOMEM;
     }
 }
 
-static jksn_error_message_no jksn_dump_longdouble(jksn_proxy **result, const jksn_t *object) {
+static jksn_error_message_no jksn_dump_longdouble(jksn_proxy **result, const jksn_t *object, const jksn_allocator *allocator) {
     if(isnan(object->data_long_double)) {
-        *result = jksn_proxy_new(object, 0x20, NULL, NULL);
+        *result = jksn_proxy_new(object, 0x20, NULL, NULL, allocator);
         return *result ? JKSN_EOK : JKSN_ENOMEM;
     } else if(isinf(object->data_long_double)) {
-        *result = jksn_proxy_new(object, object->data_long_double >= 0.0L ? 0x2f : 0x2e, NULL, NULL);
+        *result = jksn_proxy_new(object, object->data_long_double >= 0.0L ? 0x2f : 0x2e, NULL, NULL, allocator);
         return *result ? JKSN_EOK : JKSN_ENOMEM;
     } else if(sizeof (long double) == 12) {
         const union {
             long double data_long_double;
             uint8_t data_int[12];
         } conv = {object->data_long_double};
-        jksn_blobstring data = {10, jksn_malloc(10)};
+        jksn_blobstring data = {10, jksn_tree_malloc(allocator, 10)};
         if(!data.buf)
             return JKSN_ENOMEM;
         if(jksn_is_little_endian()) {
@@ -489,14 +1541,14 @@ static jksn_error_message_no jksn_dump_longdouble(jksn_proxy **result, const jks
             data.buf[8] = (char) conv.data_int[10];
             data.buf[9] = (char) conv.data_int[11];
         }
-        *result = jksn_proxy_new(object, 0x2b, &data, NULL);
+        *result = jksn_proxy_new(object, 0x2b, &data, NULL, allocator);
         return *result ? JKSN_EOK : JKSN_ENOMEM;
     } else if(sizeof (long double) == 16) {
         const union {
             long double data_long_double;
             uint8_t data_int[16];
         } conv = {object->data_long_double};
-        jksn_blobstring data = {10, jksn_malloc(10)};
+        jksn_blobstring data = {10, jksn_tree_malloc(allocator, 10)};
         if(!data.buf)
             return JKSN_ENOMEM;
         if(jksn_is_little_endian()) {
@@ -522,16 +1574,22 @@ static jksn_error_message_no jksn_dump_longdouble(jksn_proxy **result, const jks
             data.buf[8] = (char) conv.data_int[14];
             data.buf[9] = (char) conv.data_int[15];
         }
-        *result = jksn_proxy_new(object, 0x2b, &data, NULL);
+        *result = jksn_proxy_new(object, 0x2b, &data, NULL, allocator);
         return *result ? JKSN_EOK : JKSN_ENOMEM;
     } else
         return JKSN_ELONGDOUBLE;
 }
 
-static jksn_error_message_no jksn_dump_string(jksn_proxy **result, const jksn_t *object) {
-    size_t utf16size = jksn_utf8_to_utf16(object->data_string.str, NULL, object->data_string.size, 1);
+static jksn_error_message_no jksn_dump_string(jksn_proxy **result, const jksn_t *object, jksn_cache *cache, const jksn_allocator *allocator) {
+    /*
+      Long strings stay UTF-8 for jksn_dump_segments, which leaves them in
+      place. Proxies live in the scratch arena, which never frees, so buf
+      may point into object.
+    */
+    int in_place = cache->segment_min != 0 && object->data_string.size >= cache->segment_min;
+    size_t utf16size = cache->fast || in_place ? (size_t) (ssize_t) -1 : jksn_utf8_to_utf16(object->data_string.str, NULL, object->data_string.size, 1);
     if(utf16size != (size_t) (ssize_t) -1 && utf16size*2 < object->data_string.size) {
-        uint16_t *utf16str = jksn_malloc(utf16size*2);
+        uint16_t *utf16str = jksn_tree_malloc(allocator, utf16size*2);
         jksn_blobstring buf = {0, (char *) utf16str};
         size_t i;
         if(!utf16str)
@@ -542,94 +1600,99 @@ static jksn_error_message_no jksn_dump_string(jksn_proxy **result, const jksn_t
             for(i = 0; i < utf16size; i++)
                 utf16str[i] = (utf16str[i] << 8) | (utf16str[i] >> 8);
         if(utf16size <= 0xb)
-            *result = jksn_proxy_new(object, 0x30 | utf16size, NULL, &buf);
+            *result = jksn_proxy_new(object, 0x30 | utf16size, NULL, &buf, allocator);
         else if(utf16size <= 0xff) {
-            jksn_blobstring data = {1, jksn_malloc(1)};
+            jksn_blobstring data = {1, jksn_tree_malloc(allocator, 1)};
             if(!data.buf) {
-                free(utf16str);
+                jksn_tree_free(allocator, utf16str);
                 return JKSN_ENOMEM;
             }
             jksn_encode_int(data.buf, utf16size, 1);
-            *result = jksn_proxy_new(object, 0x3e, &data, &buf);
+            *result = jksn_proxy_new(object, 0x3e, &data, &buf, allocator);
         } else if(utf16size <= 0xffff) {
-            jksn_blobstring data = {2, jksn_malloc(2)};
+            jksn_blobstring data = {2, jksn_tree_malloc(allocator, 2)};
             if(!data.buf) {
-                free(utf16str);
+                jksn_tree_free(allocator, utf16str);
                 return JKSN_ENOMEM;
             }
             jksn_encode_int(data.buf, utf16size, 2);
-            *result = jksn_proxy_new(object, 0x3d, &data, &buf);
+            *result = jksn_proxy_new(object, 0x3d, &data, &buf, allocator);
         } else {
-            jksn_blobstring data = {0, jksn_malloc(jksn_varint_size)};
+            jksn_blobstring data = {0, jksn_tree_malloc(allocator, jksn_varint_size)};
             if(!data.buf) {
-                free(utf16str);
+                jksn_tree_free(allocator, utf16str);
                 return JKSN_ENOMEM;
             }
             data.size = jksn_encode_int(data.buf, utf16size, 0);
-            *result = jksn_proxy_new(object, 0x3f, &data, &buf);
+            *result = jksn_proxy_new(object, 0x3f, &data, &buf, allocator);
         }
     } else {
-        jksn_blobstring buf = {object->data_string.size, jksn_malloc(object->data_string.size)};
+        jksn_blobstring buf = {object->data_string.size, in_place ? object->data_string.str : jksn_tree_malloc(allocator, object->data_string.size)};
         if(!buf.buf)
             return JKSN_ENOMEM;
-        memcpy(buf.buf, object->data_string.str, object->data_string.size);
+        if(!in_place)
+            memcpy(buf.buf, object->data_string.str, object->data_string.size);
         if(buf.size <= 0xc)
-            *result = jksn_proxy_new(object, 0x40 | buf.size, NULL, &buf);
+            *result = jksn_proxy_new(object, 0x40 | buf.size, NULL, &buf, allocator);
         else if(buf.size <= 0xff) {
-            jksn_blobstring data = {1, jksn_malloc(1)};
+            jksn_blobstring data = {1, jksn_tree_malloc(allocator, 1)};
             if(!data.buf)
                 return JKSN_ENOMEM;
             jksn_encode_int(data.buf, buf.size, 1);
-            *result = jksn_proxy_new(object, 0x4e, &data, &buf);
+            *result = jksn_proxy_new(object, 0x4e, &data, &buf, allocator);
         } else if(buf.size <= 0xffff) {
-            jksn_blobstring data = {2, jksn_malloc(2)};
+            jksn_blobstring data = {2, jksn_tree_malloc(allocator, 2)};
             if(!data.buf)
                 return JKSN_ENOMEM;
             jksn_encode_int(data.buf, buf.size, 2);
-            *result = jksn_proxy_new(object, 0x4d, &data, &buf);
+            *result = jksn_proxy_new(object, 0x4d, &data, &buf, allocator);
         } else {
-            jksn_blobstring data = {0, jksn_malloc(jksn_varint_size)};
+            jksn_blobstring data = {0, jksn_tree_malloc(allocator, jksn_varint_size)};
             if(!data.buf)
                 return JKSN_ENOMEM;
             data.size = jksn_encode_int(data.buf, buf.size, 0);
-            *result = jksn_proxy_new(object, 0x4f, &data, &buf);
+            *result = jksn_proxy_new(object, 0x4f, &data, &buf, allocator);
         }
     }
     if(*result) {
-        (*result)->hash = jksn_djbhash((*result)->buf.buf, (*result)->buf.size);
+        if(!cache->fast)
+            (*result)->hash = jksn_djbhash((*result)->buf.buf, (*result)->buf.size);
         return JKSN_EOK;
     } else
         return JKSN_ENOMEM;
 }
 
-static jksn_error_message_no jksn_dump_blob(jksn_proxy **result, const jksn_t *object) {
-    jksn_blobstring buf = {object->data_blob.size, jksn_malloc(object->data_blob.size)};
+static jksn_error_message_no jksn_dump_blob(jksn_proxy **result, const jksn_t *object, jksn_cache *cache, const jksn_allocator *allocator) {
+    int in_place = cache->segment_min != 0 && object->data_blob.size >= cache->segment_min;
+    jksn_blobstring buf = {object->data_blob.size, in_place ? object->data_blob.buf : jksn_tree_malloc(allocator, object->data_blob.size)};
     if(!buf.buf)
         return JKSN_ENOMEM;
-    memcpy(buf.buf, object->data_blob.buf, object->data_blob.size);
+    if(!in_place)
+        memcpy(buf.buf, object->data_blob.buf, object->data_blob.size);
     if(object->data_blob.size <= 0xb)
-        *result = jksn_proxy_new(object, 0x50 | object->data_blob.size, NULL, &object->data_blob);
+        *result = jksn_proxy_new(object, 0x50 | object->data_blob.size, NULL, &buf, allocator);
     else if(object->data_blob.size <= 0xff) {
-        jksn_blobstring data = {1, jksn_malloc(1)};
+        jksn_blobstring data = {1, jksn_tree_malloc(allocator, 1)};
         if(!data.buf)
             return JKSN_ENOMEM;
         jksn_encode_int(data.buf, object->data_blob.size, 1);
-        *result = jksn_proxy_new(object, 0x5e, &data, &object->data_blob);
+        *result = jksn_proxy_new(object, 0x5e, &data, &buf, allocator);
     } else if(object->data_blob.size <= 0xffff) {
-        jksn_blobstring data = {2, jksn_malloc(2)};
+        jksn_blobstring data = {2, jksn_tree_malloc(allocator, 2)};
         if(!data.buf)
             return JKSN_ENOMEM;
         jksn_encode_int(data.buf, object->data_blob.size, 2);
-        *result = jksn_proxy_new(object, 0x5d, &data, &object->data_blob);
+        *result = jksn_proxy_new(object, 0x5d, &data, &buf, allocator);
     } else {
-        jksn_blobstring data = {0, jksn_malloc(jksn_varint_size)};
+        jksn_blobstring data = {0, jksn_tree_malloc(allocator, jksn_varint_size)};
         if(!data.buf)
             return JKSN_ENOMEM;
         data.size = jksn_encode_int(data.buf, object->data_blob.size, 0);
-        *result = jksn_proxy_new(object, 0x5f, &data, &object->data_blob);
+        *result = jksn_proxy_new(object, 0x5f, &data, &buf, allocator);
     }
     if(*result) {
-        (*result)->hash = jksn_djbhash((*result)->buf.buf, (*result)->buf.size);
+        if(!cache->fast)
+            (*result)->hash = jksn_djbhash((*result)->buf.buf, (*result)->buf.size);
         return JKSN_EOK;
     } else
         return JKSN_ENOMEM;
@@ -646,27 +1709,27 @@ static int jksn_test_swap_availability(const jksn_t *object) {
     return columns;
 }
 
-static jksn_error_message_no jksn_encode_straight_array(jksn_proxy **result, const jksn_t *object, jksn_cache *cache) {
+static jksn_error_message_no jksn_encode_straight_array(jksn_proxy **result, const jksn_t *object, jksn_cache *cache, const jksn_allocator *allocator) {
     if(object->data_array.size <= 0xc)
-        *result = jksn_proxy_new(object, 0x80 | object->data_array.size, NULL, NULL);
+        *result = jksn_proxy_new(object, 0x80 | object->data_array.size, NULL, NULL, allocator);
     else if(object->data_array.size <= 0xff) {
-        jksn_blobstring data = {1, jksn_malloc(1)};
+        jksn_blobstring data = {1, jksn_tree_malloc(allocator, 1)};
         if(!data.buf)
             return JKSN_ENOMEM;
         jksn_encode_int(data.buf, object->data_array.size, 1);
-        *result = jksn_proxy_new(object, 0x8e, &data, NULL);
+        *result = jksn_proxy_new(object, 0x8e, &data, NULL, allocator);
     } else if(object->data_array.size <= 0xffff) {
-        jksn_blobstring data = {2, jksn_malloc(2)};
+        jksn_blobstring data = {2, jksn_tree_malloc(allocator, 2)};
         if(!data.buf)
             return JKSN_ENOMEM;
         jksn_encode_int(data.buf, object->data_array.size, 2);
-        *result = jksn_proxy_new(object, 0x8d, &data, NULL);
+        *result = jksn_proxy_new(object, 0x8d, &data, NULL, allocator);
     } else {
-        jksn_blobstring data = {0, jksn_malloc(jksn_varint_size)};
+        jksn_blobstring data = {0, jksn_tree_malloc(allocator, jksn_varint_size)};
         if(!data.buf)
             return JKSN_ENOMEM;
         data.size = jksn_encode_int(data.buf, object->data_array.size, 0);
-        *result = jksn_proxy_new(object, 0x8f, &data, NULL);
+        *result = jksn_proxy_new(object, 0x8f, &data, NULL, allocator);
     }
     if(!*result)
         return JKSN_ENOMEM;
@@ -674,7 +1737,7 @@ static jksn_error_message_no jksn_encode_straight_array(jksn_proxy **result, con
         size_t i;
         jksn_proxy **next_sibling = &(*result)->first_child;
         for(i = 0; i < object->data_array.size; i++) {
-            jksn_error_message_no retval = jksn_dump_value(next_sibling, object->data_array.children[i], cache);
+            jksn_error_message_no retval = jksn_dump_value(next_sibling, object->data_array.children[i], cache, allocator);
             if(retval != JKSN_EOK)
                 return retval;
             next_sibling = &(*next_sibling)->next_sibling;
@@ -683,7 +1746,7 @@ static jksn_error_message_no jksn_encode_straight_array(jksn_proxy **result, con
     }
 }
 
-static jksn_error_message_no jksn_encode_swapped_array(jksn_proxy **result, const jksn_t *object, jksn_cache *cache) {
+static jksn_error_message_no jksn_encode_swapped_array(jksn_proxy **result, const jksn_t *object, jksn_cache *cache, const jksn_allocator *allocator) {
     struct jksn_swap_columns *columns = NULL;
     size_t columns_size = 0;
     size_t row;
@@ -697,9 +1760,9 @@ static jksn_error_message_no jksn_encode_swapped_array(jksn_proxy **result, cons
                 next_column = &(*next_column)->next;
             }
             if(!*next_column) {
-                *next_column = jksn_calloc(1, sizeof (struct jksn_swap_columns));
+                *next_column = jksn_tree_calloc(allocator, 1, sizeof (struct jksn_swap_columns));
                 if(!*next_column) {
-                    columns = jksn_swap_columns_free(columns);
+                    columns = jksn_swap_columns_free(columns, allocator);
                     return JKSN_ENOMEM;
                 }
                 (*next_column)->key = object->data_array.children[row]->data_object.children[column].key;
@@ -708,34 +1771,34 @@ static jksn_error_message_no jksn_encode_swapped_array(jksn_proxy **result, cons
         }
     }
     if(columns_size <= 0xc)
-        *result = jksn_proxy_new(object, 0xa0 | columns_size, NULL, NULL);
+        *result = jksn_proxy_new(object, 0xa0 | columns_size, NULL, NULL, allocator);
     else if(columns_size <= 0xff) {
-        jksn_blobstring data = {1, jksn_malloc(1)};
+        jksn_blobstring data = {1, jksn_tree_malloc(allocator, 1)};
         if(!data.buf) {
-            columns = jksn_swap_columns_free(columns);
+            columns = jksn_swap_columns_free(columns, allocator);
             return JKSN_ENOMEM;
         }
         jksn_encode_int(data.buf, columns_size, 1);
-        *result = jksn_proxy_new(object, 0xae, &data, NULL);
+        *result = jksn_proxy_new(object, 0xae, &data, NULL, allocator);
     } else if(columns_size <= 0xffff) {
-        jksn_blobstring data = {2, jksn_malloc(2)};
+        jksn_blobstring data = {2, jksn_tree_malloc(allocator, 2)};
         if(!data.buf) {
-            columns = jksn_swap_columns_free(columns);
+            columns = jksn_swap_columns_free(columns, allocator);
             return JKSN_ENOMEM;
         }
         jksn_encode_int(data.buf, columns_size, 2);
-        *result = jksn_proxy_new(object, 0xad, &data, NULL);
+        *result = jksn_proxy_new(object, 0xad, &data, NULL, allocator);
     } else {
-        jksn_blobstring data = {0, jksn_malloc(jksn_varint_size)};
+        jksn_blobstring data = {0, jksn_tree_malloc(allocator, jksn_varint_size)};
         if(!data.buf) {
-            columns = jksn_swap_columns_free(columns);
+            columns = jksn_swap_columns_free(columns, allocator);
             return JKSN_ENOMEM;
         }
         data.size = jksn_encode_int(data.buf, columns_size, 0);
-        *result = jksn_proxy_new(object, 0xaf, &data, NULL);
+        *result = jksn_proxy_new(object, 0xaf, &data, NULL, allocator);
     }
     if(!*result) {
-        columns = jksn_swap_columns_free(columns);
+        columns = jksn_swap_columns_free(columns, allocator);
         return JKSN_ENOMEM;
     } else {
         jksn_proxy **next_sibling = &(*result)->first_child;
@@ -743,17 +1806,17 @@ static jksn_error_message_no jksn_encode_swapped_array(jksn_proxy **result, cons
         while(next_column) {
             jksn_error_message_no retval;
             size_t row;
-            jksn_t *row_array = jksn_malloc(sizeof (jksn_t));
+            jksn_t *row_array = jksn_tree_malloc(allocator, sizeof (jksn_t));
             if(!row_array) {
-                columns = jksn_swap_columns_free(columns);
+                columns = jksn_swap_columns_free(columns, allocator);
                 return JKSN_ENOMEM;
             }
             row_array->data_type = JKSN_ARRAY;
             row_array->data_array.size = object->data_array.size;
-            row_array->data_array.children = jksn_malloc(object->data_array.size * sizeof (jksn_t *));
+            row_array->data_array.children = jksn_tree_malloc(allocator, object->data_array.size * sizeof (jksn_t *));
             if(!row_array->data_array.children) {
-                free(row_array);
-                columns = jksn_swap_columns_free(columns);
+                jksn_tree_free(allocator, row_array);
+                columns = jksn_swap_columns_free(columns, allocator);
                 return JKSN_ENOMEM;
             }
             for(row = 0; row < object->data_array.size; row++) {
@@ -766,19 +1829,19 @@ static jksn_error_message_no jksn_encode_swapped_array(jksn_proxy **result, cons
                         break;
                     }
             }
-            retval = jksn_dump_value(next_sibling, next_column->key, cache);
+            retval = jksn_dump_value(next_sibling, next_column->key, cache, allocator);
             if(retval != JKSN_EOK) {
-                free(row_array->data_array.children);
-                free(row_array);
-                columns = jksn_swap_columns_free(columns);
+                jksn_tree_free(allocator, row_array->data_array.children);
+                jksn_tree_free(allocator, row_array);
+                columns = jksn_swap_columns_free(columns, allocator);
                 return retval;
             }
             next_sibling = &(*next_sibling)->next_sibling;
-            retval = jksn_dump_array(next_sibling, row_array, cache);
-            free(row_array->data_array.children);
-            free(row_array);
+            retval = jksn_dump_array(next_sibling, row_array, cache, allocator);
+            jksn_tree_free(allocator, row_array->data_array.children);
+            jksn_tree_free(allocator, row_array);
             if(retval != JKSN_EOK) {
-                columns = jksn_swap_columns_free(columns);
+                columns = jksn_swap_columns_free(columns, allocator);
                 return retval;
             }
             next_sibling = &(*next_sibling)->next_sibling;
@@ -786,48 +1849,70 @@ static jksn_error_message_no jksn_encode_swapped_array(jksn_proxy **result, cons
             columns_size--;
         }
         assert(columns_size == 0);
-        columns = jksn_swap_columns_free(columns);
+        columns = jksn_swap_columns_free(columns, allocator);
         return JKSN_EOK;
     }
 }
 
-static jksn_error_message_no jksn_dump_array(jksn_proxy **result, const jksn_t *object, jksn_cache *cache) {
-    jksn_error_message_no retval = jksn_encode_straight_array(result, object, cache);
-    if(retval != JKSN_EOK)
+static jksn_error_message_no jksn_dump_array(jksn_proxy **result, const jksn_t *object, jksn_cache *cache, const jksn_allocator *allocator) {
+    jksn_encode_stats *stats = cache->stats;
+    struct jksn_layout_counters before_straight = {0, 0, 0};
+    jksn_error_message_no retval;
+    jksn_layout_save(&before_straight, stats);
+    retval = jksn_encode_straight_array(result, object, cache, allocator);
+    if(retval != JKSN_EOK || cache->fast)
         return retval;
     if(jksn_test_swap_availability(object)) {
         jksn_proxy *result_swapped = NULL;
-        retval = jksn_encode_swapped_array(&result_swapped, object, cache);
-        if(retval == JKSN_EOK && jksn_proxy_size(result_swapped, 3) < jksn_proxy_size(*result, 3)) {
-            jksn_proxy_free(*result);
+        struct jksn_layout_counters before_swapped = {0, 0, 0};
+        jksn_layout_save(&before_swapped, stats);
+        /* Hashing can still change the sizes below the third level, which only JKSN_EFFORT_SMALLEST looks at */
+        size_t depth = cache->effort == JKSN_EFFORT_SMALLEST ? 0 : 3;
+        retval = jksn_encode_swapped_array(&result_swapped, object, cache, allocator);
+        if(retval == JKSN_EOK && jksn_proxy_size(result_swapped, depth) < jksn_proxy_size(*result, depth)) {
+            if(stats) {
+                /* Keep what the swapped layout counted, drop what the straight one did */
+                stats->swap_candidates -= before_swapped.swap_candidates - before_straight.swap_candidates;
+                stats->swaps -= before_swapped.swaps - before_straight.swaps;
+                stats->swap_bytes_saved -= before_swapped.swap_bytes_saved - before_straight.swap_bytes_saved;
+                stats->swap_candidates++;
+                stats->swaps++;
+                stats->swap_bytes_saved += (int64_t) jksn_proxy_size(*result, 0) - (int64_t) jksn_proxy_size(result_swapped, 0);
+            }
+            jksn_proxy_free(*result, allocator);
             *result = result_swapped;
-        } else
-            result_swapped = jksn_proxy_free(result_swapped);
+        } else {
+            if(stats) {
+                jksn_layout_restore(&before_swapped, stats);
+                stats->swap_candidates += retval == JKSN_EOK;
+            }
+            result_swapped = jksn_proxy_free(result_swapped, allocator);
+        }
     }
     return JKSN_EOK;
 }
 
-static jksn_error_message_no jksn_dump_object(jksn_proxy **result, const jksn_t *object, jksn_cache *cache) {
+static jksn_error_message_no jksn_dump_object(jksn_proxy **result, const jksn_t *object, jksn_cache *cache, const jksn_allocator *allocator) {
     if(object->data_object.size <= 0xc)
-        *result = jksn_proxy_new(object, 0x90 | object->data_object.size, NULL, NULL);
+        *result = jksn_proxy_new(object, 0x90 | object->data_object.size, NULL, NULL, allocator);
     else if(object->data_object.size <= 0xff) {
-        jksn_blobstring data = {1, jksn_malloc(1)};
+        jksn_blobstring data = {1, jksn_tree_malloc(allocator, 1)};
         if(!data.buf)
             return JKSN_ENOMEM;
         jksn_encode_int(data.buf, object->data_object.size, 1);
-        *result = jksn_proxy_new(object, 0x9e, &data, NULL);
+        *result = jksn_proxy_new(object, 0x9e, &data, NULL, allocator);
     } else if(object->data_object.size <= 0xffff) {
-        jksn_blobstring data = {2, jksn_malloc(2)};
+        jksn_blobstring data = {2, jksn_tree_malloc(allocator, 2)};
         if(!data.buf)
             return JKSN_ENOMEM;
         jksn_encode_int(data.buf, object->data_object.size, 2);
-        *result = jksn_proxy_new(object, 0x9d, &data, NULL);
+        *result = jksn_proxy_new(object, 0x9d, &data, NULL, allocator);
     } else {
-        jksn_blobstring data = {0, jksn_malloc(jksn_varint_size)};
+        jksn_blobstring data = {0, jksn_tree_malloc(allocator, jksn_varint_size)};
         if(!data.buf)
             return JKSN_ENOMEM;
         data.size = jksn_encode_int(data.buf, object->data_object.size, 0);
-        *result = jksn_proxy_new(object, 0x9f, &data, NULL);
+        *result = jksn_proxy_new(object, 0x9f, &data, NULL, allocator);
     }
     if(!*result)
         return JKSN_ENOMEM;
@@ -835,15 +1920,15 @@ static jksn_error_message_no jksn_dump_object(jksn_proxy **result, const jksn_t
         size_t i;
         jksn_proxy **next_sibling = &(*result)->first_child;
         for(i = 0; i < object->data_object.size; i++) {
-            jksn_error_message_no retval = jksn_dump_value(next_sibling, object->data_object.children[i].key, cache);
+            jksn_error_message_no retval = jksn_dump_value(next_sibling, object->data_object.children[i].key, cache, allocator);
             if(retval != JKSN_EOK) {
-                *result = jksn_proxy_free(*result);
+                *result = jksn_proxy_free(*result, allocator);
                 return retval;
             }
             next_sibling = &(*next_sibling)->next_sibling;
-            retval = jksn_dump_value(next_sibling, object->data_object.children[i].value, cache);
+            retval = jksn_dump_value(next_sibling, object->data_object.children[i].value, cache, allocator);
             if(retval != JKSN_EOK) {
-                *result = jksn_proxy_free(*result);
+                *result = jksn_proxy_free(*result, allocator);
                 return retval;
             }
             next_sibling = &(*next_sibling)->next_sibling;
@@ -852,7 +1937,7 @@ static jksn_error_message_no jksn_dump_object(jksn_proxy **result, const jksn_t
     }
 }
 
-static void jksn_optimize(jksn_proxy *object, jksn_cache *cache) {
+static void jksn_optimize(jksn_proxy *object, jksn_cache *cache, const jksn_allocator *allocator) {
     while(object) {
         uint8_t control = object->control & 0xf0;
         switch(control) {
@@ -868,14 +1953,14 @@ static void jksn_optimize(jksn_proxy *object, jksn_cache *cache) {
                         new_control = 0xd0 | (delta + 11);
                     else if(delta >= -0x80 && delta <= 0x7f) {
                         new_data.size = 1;
-                        new_data.buf = jksn_malloc(1);
+                        new_data.buf = jksn_tree_malloc(allocator, 1);
                         if(new_data.buf) {
                             new_control = 0xdd;
                             jksn_encode_int(new_data.buf, (uintmax_t) delta, 1);
                         }
                     } else if(delta >= -0x8000 && delta <= 0x7fff) {
                         new_data.size = 2;
-                        new_data.buf = jksn_malloc(2);
+                        new_data.buf = jksn_tree_malloc(allocator, 2);
                         if(new_data.buf) {
                             new_control = 0xdc;
                             jksn_encode_int(new_data.buf, (uintmax_t) delta, 2);
@@ -883,19 +1968,19 @@ static void jksn_optimize(jksn_proxy *object, jksn_cache *cache) {
                     } else if((delta >= -0x80000000LL && delta <= -0x200000) ||
                               (delta >= 0x200000 && delta <= 0x7fffffff)) {
                         new_data.size = 4;
-                        new_data.buf = jksn_malloc(4);
+                        new_data.buf = jksn_tree_malloc(allocator, 4);
                         if(new_data.buf) {
                             new_control = 0xdb;
                             jksn_encode_int(new_data.buf, (uintmax_t) delta, 4);
                         }
                     } else if(delta >= 0) {
-                        new_data.buf = jksn_malloc(jksn_varint_size);
+                        new_data.buf = jksn_tree_malloc(allocator, jksn_varint_size);
                         if(new_data.buf) {
                             new_control = 0xdf;
                             new_data.size = jksn_encode_int(new_data.buf, (uintmax_t) delta, 0);
                         }
                     } else {
-                        new_data.buf = jksn_malloc(jksn_varint_size);
+                        new_data.buf = jksn_tree_malloc(allocator, jksn_varint_size);
                         if(new_data.buf) {
                             new_control = 0xde;
                             new_data.size = jksn_encode_int(new_data.buf, (uintmax_t) -delta, 0);
@@ -904,10 +1989,10 @@ static void jksn_optimize(jksn_proxy *object, jksn_cache *cache) {
                     if(new_control != 0) {
                         if(new_data.size < object->data.size) {
                             object->control = new_control;
-                            free(object->data.buf);
+                            jksn_tree_free(allocator, object->data.buf);
                             object->data = new_data;
                         } else
-                            free(new_data.buf);
+                            jksn_tree_free(allocator, new_data.buf);
                     }
                 }
             } else
@@ -916,55 +2001,64 @@ static void jksn_optimize(jksn_proxy *object, jksn_cache *cache) {
             break;
         case 0x30:
         case 0x40:
-            if(object->buf.size > 1) {
-                if(cache->texthash[object->hash].size == object->origin->data_string.size &&
-                   !memcmp(cache->texthash[object->hash].str, object->origin->data_string.str, object->origin->data_string.size)) {
-                    jksn_blobstring new_data = {1, jksn_malloc(1)};
-                    if(new_data.buf) {
-                        new_data.buf[0] = (char) object->hash;
-                        object->control = 0x3c;
-                        object->data = new_data;
-                        object->buf.size = 0;
-                        free(object->buf.buf);
-                        object->buf.buf = NULL;
-                    }
-                } else {
-                    free(cache->texthash[object->hash].str);
-                    cache->texthash[object->hash].str = jksn_malloc(object->origin->data_string.size);
-                    if(cache->texthash[object->hash].str) {
-                        cache->texthash[object->hash].size = object->origin->data_string.size;
-                        memcpy(cache->texthash[object->hash].str, object->origin->data_string.str, object->origin->data_string.size);
-                    } else
-                        cache->texthash[object->hash].size = 0;
+            if(object->buf.size > 1 &&
+               cache->texthash[object->hash].size == object->origin->data_string.size &&
+               !memcmp(cache->texthash[object->hash].str, object->origin->data_string.str, object->origin->data_string.size)) {
+                jksn_blobstring new_data = {1, jksn_tree_malloc(allocator, 1)};
+                if(new_data.buf) {
+                    new_data.buf[0] = (char) object->hash;
+                    object->control = 0x3c;
+                    jksn_tree_free(allocator, object->data.buf);
+                    object->data = new_data;
+                    object->buf.size = 0;
+                    jksn_tree_free(allocator, object->buf.buf);
+                    object->buf.buf = NULL;
+                    if(cache->stats)
+                        cache->stats->text_hits++;
+                }
+            } else {
+                if(cache->stats && object->buf.size > 1) {
+                    cache->stats->text_misses++;
+                    if(cache->texthash[object->hash].str)
+                        cache->stats->text_collisions++;
                 }
+                /* Strings left in place are not copied either: the slot is only never referred to */
+                if(cache->segment_min != 0 && object->buf.size >= cache->segment_min)
+                    cache->texthash[object->hash].size = 0;
+                else
+                    jksn_cache_store(&cache->texthash[object->hash].str, &cache->texthash[object->hash].size, &cache->texthash_capacity[object->hash], object->origin->data_string.str, object->origin->data_string.size);
             }
             break;
         case 0x50:
-            if(object->buf.size > 1) {
-                if(cache->blobhash[object->hash].size == object->origin->data_blob.size &&
-                   !memcmp(cache->blobhash[object->hash].buf, object->origin->data_blob.buf, object->origin->data_blob.size)) {
-                    jksn_blobstring new_data = {1, jksn_malloc(1)};
-                    if(new_data.buf) {
-                        new_data.buf[0] = (char) object->hash;
-                        object->control = 0x5c;
-                        object->data = new_data;
-                        object->buf.size = 0;
-                        free(object->buf.buf);
-                        object->buf.buf = NULL;
-                    }
-                } else {
-                    free(cache->blobhash[object->hash].buf);
-                    cache->blobhash[object->hash].buf = jksn_malloc(object->origin->data_blob.size);
-                    if(cache->blobhash[object->hash].buf) {
-                        cache->blobhash[object->hash].size = object->origin->data_blob.size;
-                        memcpy(cache->blobhash[object->hash].buf, object->origin->data_blob.buf, object->origin->data_blob.size);
-                    } else
-                        cache->blobhash[object->hash].size = 0;
+            if(object->buf.size > 1 &&
+               cache->blobhash[object->hash].size == object->origin->data_blob.size &&
+               !memcmp(cache->blobhash[object->hash].buf, object->origin->data_blob.buf, object->origin->data_blob.size)) {
+                jksn_blobstring new_data = {1, jksn_tree_malloc(allocator, 1)};
+                if(new_data.buf) {
+                    new_data.buf[0] = (char) object->hash;
+                    object->control = 0x5c;
+                    jksn_tree_free(allocator, object->data.buf);
+                    object->data = new_data;
+                    object->buf.size = 0;
+                    jksn_tree_free(allocator, object->buf.buf);
+                    object->buf.buf = NULL;
+                    if(cache->stats)
+                        cache->stats->blob_hits++;
                 }
+            } else {
+                if(cache->stats && object->buf.size > 1) {
+                    cache->stats->blob_misses++;
+                    if(cache->blobhash[object->hash].buf)
+                        cache->stats->blob_collisions++;
+                }
+                if(cache->segment_min != 0 && object->buf.size >= cache->segment_min)
+                    cache->blobhash[object->hash].size = 0;
+                else
+                    jksn_cache_store(&cache->blobhash[object->hash].buf, &cache->blobhash[object->hash].size, &cache->blobhash_capacity[object->hash], object->origin->data_blob.buf, object->origin->data_blob.size);
             }
             break;
         default:
-            jksn_optimize(object->first_child, cache);
+            jksn_optimize(object->first_child, cache, allocator);
         }
         object = object->next_sibling;
     }
@@ -1003,17 +2097,35 @@ static size_t jksn_encode_int(char result[], uintmax_t number, size_t size) {
     return size;
 }
 
-static struct jksn_swap_columns *jksn_swap_columns_free(struct jksn_swap_columns *columns) {
+static struct jksn_swap_columns *jksn_swap_columns_free(struct jksn_swap_columns *columns, const jksn_allocator *allocator) {
+    if(allocator && !allocator->free)
+        return NULL;
     struct jksn_swap_columns *column = columns;
     while(column) {
         struct jksn_swap_columns *next_column = column->next;
-        free(column);
+        jksn_tree_free(allocator, column);
         column = next_column;
     }
     return NULL;
 }
 
-int jksn_parse(const jksn_blobstring *buffer, jksn_t **result, size_t *bytes_parsed, jksn_cache *cache_) {
+int jksn_parse(const jksn_blobstring *buffer, jksn_t **result, size_t *bytes_parsed, jksn_cache *cache) {
+    return jksn_parse_with_allocator(buffer, result, bytes_parsed, cache, NULL);
+}
+
+int jksn_parse_with_allocator(const jksn_blobstring *buffer, jksn_t **result, size_t *bytes_parsed, jksn_cache *cache, const jksn_allocator *allocator) {
+    return jksn_parse_with_flags(buffer, result, bytes_parsed, cache, allocator, 0);
+}
+
+int jksn_parse_with_flags(const jksn_blobstring *buffer, jksn_t **result, size_t *bytes_parsed, jksn_cache *cache, const jksn_allocator *allocator, unsigned flags) {
+    int retval;
+    JKSN_CALL_BEGIN(parse, buffer ? buffer->size : 0);
+    retval = jksn_parse_uninstrumented(buffer, result, bytes_parsed, cache, allocator, flags);
+    JKSN_CALL_END(decode, parse, retval, bytes_parsed ? *bytes_parsed : 0);
+    return retval;
+}
+
+static int jksn_parse_uninstrumented(const jksn_blobstring *buffer, jksn_t **result, size_t *bytes_parsed, jksn_cache *cache_, const jksn_allocator *allocator, unsigned flags) {
     *result = NULL;
     if(bytes_parsed)
         *bytes_parsed = 0;
@@ -1025,12 +2137,16 @@ int jksn_parse(const jksn_blobstring *buffer, jksn_t **result, size_t *bytes_par
             return JKSN_ENOMEM;
         else {
             jksn_error_message_no retval;
+            if(!allocator && cache->allocator.malloc)
+                allocator = &cache->allocator;
+            cache->borrowed = flags & JKSN_PARSE_BORROW ? buffer->buf : NULL;
+            cache->borrowed_size = buffer->size;
             if(buffer->size >= 3 && buffer->buf[0] == 'j' && buffer->buf[1] == 'k' && buffer->buf[2] == '!') {
                 if(bytes_parsed)
                     *bytes_parsed += 3;
-                retval = jksn_parse_value(result, buffer->buf + 3, buffer->size - 3, bytes_parsed, cache);
+                retval = jksn_parse_value(result, buffer->buf + 3, buffer->size - 3, bytes_parsed, cache, allocator, flags);
             } else
-                retval = jksn_parse_value(result, buffer->buf, buffer->size, bytes_parsed, cache);
+                retval = jksn_parse_value(result, buffer->buf, buffer->size, bytes_parsed, cache, allocator, flags);
             if(cache != cache_)
                 jksn_cache_free(cache);
             return retval;
@@ -1038,977 +2154,956 @@ int jksn_parse(const jksn_blobstring *buffer, jksn_t **result, size_t *bytes_par
     }
 }
 
-static jksn_error_message_no jksn_parse_value(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed, jksn_cache *cache) {
+static inline jksn_t *jksn_parse_free(jksn_t *object, const jksn_cache *cache, const jksn_allocator *allocator) {
+    return jksn_free_tree(object, allocator, cache->borrowed, cache->borrowed_size);
+}
+
+static jksn_error_message_no jksn_parse_value(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed, jksn_cache *cache, const jksn_allocator *allocator, unsigned flags) {
+    /* Shallow documents never touch the heap for their frames */
+    struct jksn_parse_frame local_frames[32];
+    struct jksn_parse_stack stack;
+    size_t consumed = 0;
+    jksn_error_message_no retval;
+    stack.frames = local_frames;
+    stack.depth = 0;
+    stack.capacity = sizeof local_frames / sizeof local_frames[0];
     *result = NULL;
-    if(!size)
-        return JKSN_ETRUNC;
-    else {
-        uint8_t control = (uint8_t) buffer[0];
-        uint8_t ctrlhi = control & 0xf0;
+    retval = jksn_parse_loop(result, buffer, size, &consumed, cache, allocator, flags, &stack);
+    if(retval != JKSN_EOK)
+        while(stack.depth) {
+            struct jksn_parse_frame *frame = &stack.frames[--stack.depth];
+            jksn_parse_free(frame->node, cache, allocator);
+            jksn_parse_free(frame->column_name, cache, allocator);
+        }
+    if(stack.frames != local_frames)
+        free(stack.frames);
+    if(retval == JKSN_EOK && bytes_parsed)
+        *bytes_parsed += consumed;
+    return retval;
+}
+
+static struct jksn_parse_frame *jksn_parse_push(struct jksn_parse_stack *stack, jksn_frame_kind kind, jksn_t *node, size_t remaining) {
+    struct jksn_parse_frame *frame;
+    if(stack->depth == stack->capacity) {
+        size_t capacity = stack->capacity * 2;
+        struct jksn_parse_frame *frames;
+        if(stack->depth == 32) {
+            /* Still in local_frames of jksn_parse_value */
+            frames = jksn_malloc(capacity * sizeof (struct jksn_parse_frame));
+            if(frames)
+                memcpy(frames, stack->frames, stack->depth * sizeof (struct jksn_parse_frame));
+        } else
+            frames = jksn_realloc(stack->frames, capacity * sizeof (struct jksn_parse_frame));
+        if(!frames)
+            return NULL;
+        stack->frames = frames;
+        stack->capacity = capacity;
+    }
+    frame = &stack->frames[stack->depth++];
+    frame->kind = kind;
+    frame->node = node;
+    frame->index = 0;
+    frame->remaining = remaining;
+    frame->column_name = NULL;
+    return frame;
+}
+
+static jksn_error_message_no jksn_parse_loop(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed, jksn_cache *cache, const jksn_allocator *allocator, unsigned flags, struct jksn_parse_stack *stack) {
+    const char *const begin = buffer;
+    for(;;) {
+        jksn_t *value = NULL;
+        uint8_t control;
+        const jksn_control *entry;
+        size_t field_size = 0;
+        uintmax_t length;
+        jksn_error_message_no retval;
+        if(!size)
+            return JKSN_ETRUNC;
+        control = (uint8_t) buffer[0];
+        entry = &jksn_control_table[control];
+        JKSN_COUNT(parse_values[jksn_control_family(control)], 1);
         buffer++;
         size--;
-        if(bytes_parsed)
-            (*bytes_parsed)++;
-        switch(ctrlhi) {
-        /* Special values */
-        case 0x00:
+        switch(entry->kind) {
+        case JKSN_CONTROL_CONSTANT:
+            value = jksn_tree_malloc(allocator, sizeof (jksn_t));
+            if(!value)
+                return JKSN_ENOMEM;
+            value->data_type = (jksn_data_type) entry->value;
             switch(control) {
-            case 0x00:
-                *result = jksn_malloc(sizeof (jksn_t));
-                if(!*result)
-                    return JKSN_ENOMEM;
-                (*result)->data_type = JKSN_UNDEFINED;
-                return JKSN_EOK;
-            case 0x01:
-                *result = jksn_malloc(sizeof (jksn_t));
-                if(!*result)
-                    return JKSN_ENOMEM;
-                (*result)->data_type = JKSN_NULL;
-                return JKSN_EOK;
             case 0x02:
-                *result = jksn_malloc(sizeof (jksn_t));
-                if(!*result)
-                    return JKSN_ENOMEM;
-                (*result)->data_type = JKSN_BOOL;
-                (*result)->data_bool = 0;
-                return JKSN_EOK;
             case 0x03:
-                *result = jksn_malloc(sizeof (jksn_t));
-                if(!*result)
-                    return JKSN_ENOMEM;
-                (*result)->data_type = JKSN_BOOL;
-                (*result)->data_bool = 1;
-                return JKSN_EOK;
-            case 0x0f:
-                return JKSN_EJSON;
+                value->data_bool = control & 1;
+                break;
+            case 0x20:
+                value->data_double = NAN;
+                break;
+            case 0x2e:
+                value->data_double = -INFINITY;
+                break;
+            case 0x2f:
+                value->data_double = INFINITY;
+                break;
             }
             break;
-        /* Integers */
-        case 0x10:
+        case JKSN_CONTROL_INT:
+        case JKSN_CONTROL_DELTA:
             {
-                jksn_error_message_no retval;
-                uintmax_t uresint;
-                intmax_t resint;
-                switch(control) {
-                case 0x1b:
-                    retval = jksn_decode_int(&uresint, buffer, size, 4, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    resint = (intmax_t) (int32_t) uresint;
-                    break;
-                case 0x1c:
-                    retval = jksn_decode_int(&uresint, buffer, size, 2, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    resint = (intmax_t) (int16_t) uresint;
-                    break;
-                case 0x1d:
-                    retval = jksn_decode_int(&uresint, buffer, size, 1, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    resint = (intmax_t) (int8_t) uresint;
-                    break;
-                case 0x1e:
-                    retval = jksn_decode_int(&uresint, buffer, size, 0, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    if((intmax_t) uresint < 0)
-                        return JKSN_EVARINT;
-                    resint = -(intmax_t) uresint;
-                    break;
-                case 0x1f:
-                    retval = jksn_decode_int(&uresint, buffer, size, 0, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    if((intmax_t) uresint < 0)
-                        return JKSN_EVARINT;
-                    resint = (intmax_t) uresint;
-                    break;
-                default:
-                    resint = (intmax_t) (control & 0xf);
+                intmax_t number;
+                retval = jksn_decode_signed(&number, entry, buffer, size, &field_size);
+                if(retval != JKSN_EOK)
+                    return retval;
+                buffer += field_size;
+                size -= field_size;
+                if(entry->kind == JKSN_CONTROL_DELTA) {
+                    if(!cache->haslastint)
+                        return JKSN_EDELTA;
+                    number += cache->lastint;
                 }
-                *result = jksn_malloc(sizeof (jksn_t));
-                if(!*result)
+                value = jksn_tree_malloc(allocator, sizeof (jksn_t));
+                if(!value)
                     return JKSN_ENOMEM;
-                (*result)->data_type = JKSN_INT;
-                (*result)->data_int = resint;
-                cache->lastint = resint;
+                value->data_type = JKSN_INT;
+                value->data_int = number;
+                cache->lastint = number;
                 cache->haslastint = 1;
-                return JKSN_EOK;
-            }
-        /* Floating point numbers */
-        case 0x20:
-            switch(control) {
-            case 0x20:
-                *result = jksn_malloc(sizeof (jksn_t));
-                if(!*result)
-                    return JKSN_ENOMEM;
-                (*result)->data_type = JKSN_DOUBLE;
-                (*result)->data_double = NAN;
-                return JKSN_EOK;
-            case 0x2b:
-                return jksn_parse_longdouble(result, buffer, size, bytes_parsed);
-            case 0x2c:
-                return jksn_parse_double(result, buffer, size, bytes_parsed);
-            case 0x2d:
-                return jksn_parse_float(result, buffer, size, bytes_parsed);
-            case 0x2e:
-                *result = jksn_malloc(sizeof (jksn_t));
-                if(!*result)
-                    return JKSN_ENOMEM;
-                (*result)->data_type = JKSN_DOUBLE;
-                (*result)->data_double = -INFINITY;
-                return JKSN_EOK;
-            case 0x2f:
-                *result = jksn_malloc(sizeof (jksn_t));
-                if(!*result)
-                    return JKSN_ENOMEM;
-                (*result)->data_type = JKSN_DOUBLE;
-                (*result)->data_double = INFINITY;
-                return JKSN_EOK;
+                break;
             }
-        /* UTF-16 strings */
-        case 0x30:
+        case JKSN_CONTROL_FLOAT:
+            retval = jksn_parse_float(&value, buffer, size, &field_size, allocator);
+            if(retval != JKSN_EOK)
+                return retval;
+            buffer += field_size;
+            size -= field_size;
+            break;
+        case JKSN_CONTROL_DOUBLE:
+            retval = jksn_parse_double(&value, buffer, size, &field_size, allocator);
+            if(retval != JKSN_EOK)
+                return retval;
+            buffer += field_size;
+            size -= field_size;
+            break;
+        case JKSN_CONTROL_LONG_DOUBLE:
+            retval = jksn_parse_longdouble(&value, buffer, size, &field_size, allocator);
+            if(retval != JKSN_EOK)
+                return retval;
+            buffer += field_size;
+            size -= field_size;
+            break;
+        case JKSN_CONTROL_UTF16:
+        case JKSN_CONTROL_UTF8:
+        case JKSN_CONTROL_BLOB:
+        case JKSN_CONTROL_TEXT_HASH:
+        case JKSN_CONTROL_BLOB_HASH:
+            retval = jksn_parse_string(&value, entry, buffer, size, &field_size, cache, allocator, flags);
+            if(retval != JKSN_EOK)
+                return retval;
+            buffer += field_size;
+            size -= field_size;
+            break;
+        case JKSN_CONTROL_CLEAR_HASH:
             {
-                jksn_error_message_no retval;
-                uintmax_t str_size;
-                size_t varint_size = 0;
-                uint16_t *utf16str;
                 size_t i;
-                uint8_t hashvalue;
-                switch(control) {
-                case 0x3c:
-                    if(!size--)
-                        return JKSN_ETRUNC;
-                    hashvalue = (uint8_t) (buffer++)[0];
-                    if(bytes_parsed)
-                        (*bytes_parsed)++;
-                    if(cache->texthash[hashvalue].size == 0)
-                        return JKSN_EHASH;
-                    *result = jksn_malloc(sizeof (jksn_t));
-                    if(!*result)
-                        return JKSN_ENOMEM;
-                    (*result)->data_type = JKSN_STRING;
-                    (*result)->data_string.str = jksn_malloc(cache->texthash[hashvalue].size + 1);
-                    (*result)->data_string.size = cache->texthash[hashvalue].size;
-                    if(!(*result)->data_string.str) {
-                        free(*result);
-                        *result = NULL;
-                        return JKSN_ENOMEM;
-                    }
-                    memcpy((*result)->data_string.str, cache->texthash[hashvalue].str, cache->texthash[hashvalue].size);
-                    (*result)->data_string.str[cache->texthash[hashvalue].size] = '\0';
-                    return JKSN_EOK;
-                case 0x3d:
-                    retval = jksn_decode_int(&str_size, buffer, size, 2, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += 2;
-                    size -= 2;
-                    break;
-                case 0x3e:
-                    retval = jksn_decode_int(&str_size, buffer, size, 1, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer++;
-                    size--;
-                    break;
-                case 0x3f:
-                    retval = jksn_decode_int(&str_size, buffer, size, 0, &varint_size);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += varint_size;
-                    size -= varint_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += varint_size;
-                    break;
-                default:
-                    str_size = control & 0xf;
-                }
-                if(size < str_size*2)
-                    return JKSN_ETRUNC;
-                utf16str = jksn_malloc(str_size*2);
-                if(!utf16str)
-                    return JKSN_ENOMEM;
-                memcpy((char *) utf16str, buffer, str_size*2);
-                hashvalue = jksn_djbhash((char *) utf16str, str_size*2);
-                if(!jksn_is_little_endian())
-                    for(i = 0; i < str_size; i++)
-                        utf16str[i] = (utf16str[i] << 8) | (utf16str[i] >> 8);
-                *result = jksn_malloc(sizeof (jksn_t));
-                if(!*result)
-                    return JKSN_ENOMEM;
-                (*result)->data_type = JKSN_STRING;
-                (*result)->data_string.size = jksn_utf16_to_utf8(utf16str, NULL, str_size);
-                (*result)->data_string.str = jksn_malloc((*result)->data_string.size + 1);
-                if(!(*result)->data_string.str) {
-                    free(utf16str);
-                    free(*result);
-                    *result = NULL;
-                    return JKSN_ENOMEM;
+                for(i = 0; i < 256; i++) {
+                    cache->texthash[i].size = 0;
+                    cache->texthash_capacity[i] = 0;
+                    free(cache->texthash[i].str);
+                    cache->texthash[i].str = NULL;
                 }
-                jksn_utf16_to_utf8(utf16str, (*result)->data_string.str, str_size);
-                free(utf16str);
-                utf16str = NULL;
-                (*result)->data_string.str[(*result)->data_string.size] = '\0';
-                buffer += str_size*2;
-                size -= str_size*2;
-                if(bytes_parsed)
-                    *bytes_parsed += str_size*2;
-                free(cache->texthash[hashvalue].str);
-                cache->texthash[hashvalue].str = jksn_malloc((*result)->data_string.size);
-                if(cache->texthash[hashvalue].str) {
-                    cache->texthash[hashvalue].size = (*result)->data_string.size;
-                    memcpy(cache->texthash[hashvalue].str, (*result)->data_string.str, (*result)->data_string.size);
-                } else {
-                    cache->texthash[hashvalue].size = 0;
-                    free((*result)->data_string.str);
-                    free(*result);
-                    *result = NULL;
-                    return JKSN_ENOMEM;
+                for(i = 0; i < 256; i++) {
+                    cache->blobhash[i].size = 0;
+                    cache->blobhash_capacity[i] = 0;
+                    free(cache->blobhash[i].buf);
+                    cache->blobhash[i].buf = NULL;
                 }
-                return JKSN_EOK;
+                continue;
             }
-        /* UTF-8 strings */
-        case 0x40:
-            {
-                jksn_error_message_no retval;
-                uintmax_t str_size;
-                size_t varint_size = 0;
-                uint8_t hashvalue;
-                switch(control) {
-                case 0x4d:
-                    retval = jksn_decode_int(&str_size, buffer, size, 2, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += 2;
-                    size -= 2;
-                    break;
-                case 0x4e:
-                    retval = jksn_decode_int(&str_size, buffer, size, 1, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer++;
-                    size--;
-                    break;
-                case 0x4f:
-                    retval = jksn_decode_int(&str_size, buffer, size, 0, &varint_size);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += varint_size;
-                    size -= varint_size;
-                    if(bytes_parsed)
-                        bytes_parsed += varint_size;
-                    break;
-                default:
-                    str_size = control & 0xf;
-                }
-                if(size < str_size)
+        case JKSN_CONTROL_REFRESH:
+            retval = jksn_decode_length(&length, entry, buffer, size, &field_size);
+            if(retval != JKSN_EOK)
+                return retval;
+            buffer += field_size;
+            size -= field_size;
+            if(length != 0 && !jksn_parse_push(stack, JKSN_FRAME_DISCARD, NULL, length))
+                return JKSN_ENOMEM;
+            continue;
+        case JKSN_CONTROL_ARRAY:
+        case JKSN_CONTROL_OBJECT:
+        case JKSN_CONTROL_SWAPPED:
+        case JKSN_CONTROL_LENGTHLESS:
+            if(entry->kind != JKSN_CONTROL_LENGTHLESS) {
+                retval = jksn_decode_length(&length, entry, buffer, size, &field_size);
+                if(retval != JKSN_EOK)
+                    return retval;
+                buffer += field_size;
+                size -= field_size;
+                /* Every child takes at least one byte */
+                if(length > size)
                     return JKSN_ETRUNC;
-                *result = jksn_malloc(sizeof (jksn_t));
-                if(!*result)
-                    return JKSN_ENOMEM;
-                (*result)->data_type = JKSN_STRING;
-                (*result)->data_string.size = str_size;
-                (*result)->data_string.str = jksn_malloc(str_size + 1);
-                if(!(*result)->data_string.str) {
-                    free(*result);
-                    *result = NULL;
+            } else
+                length = 2;
+            value = jksn_tree_malloc(allocator, sizeof (jksn_t));
+            if(!value)
+                return JKSN_ENOMEM;
+            if(entry->kind == JKSN_CONTROL_OBJECT) {
+                value->data_type = JKSN_OBJECT;
+                value->data_object.size = (size_t) length;
+                value->data_object.children = jksn_tree_calloc(allocator, (size_t) length, sizeof (jksn_keyvalue));
+                if(!value->data_object.children) {
+                    jksn_tree_free(allocator, value);
                     return JKSN_ENOMEM;
                 }
-                memcpy((*result)->data_string.str, buffer, str_size);
-                (*result)->data_string.str[str_size] = '\0';
-                buffer += str_size;
-                size -= str_size;
-                if(bytes_parsed)
-                    *bytes_parsed += str_size;
-                hashvalue = jksn_djbhash((*result)->data_string.str, str_size);
-                free(cache->texthash[hashvalue].str);
-                cache->texthash[hashvalue].str = jksn_malloc(str_size);
-                if(cache->texthash[hashvalue].str) {
-                    cache->texthash[hashvalue].size = str_size;
-                    memcpy(cache->texthash[hashvalue].str, (*result)->data_string.str, str_size);
-                } else {
-                    cache->texthash[hashvalue].size = 0;
-                    free((*result)->data_string.str);
-                    free(*result);
-                    *result = NULL;
+            } else {
+                value->data_type = JKSN_ARRAY;
+                value->data_array.size = entry->kind == JKSN_CONTROL_ARRAY ? (size_t) length : 0;
+                value->data_array.children = entry->kind != JKSN_CONTROL_SWAPPED ? jksn_tree_calloc(allocator, (size_t) length, sizeof (jksn_t *)) : NULL;
+                if(entry->kind != JKSN_CONTROL_SWAPPED && !value->data_array.children) {
+                    jksn_tree_free(allocator, value);
                     return JKSN_ENOMEM;
                 }
-                return JKSN_EOK;
             }
-        /* Blob strings */
-        case 0x50:
-            {
-                jksn_error_message_no retval;
-                uintmax_t blob_size;
-                size_t varint_size = 0;
-                uint8_t hashvalue;
-                switch(control) {
-                case 0x5d:
-                    retval = jksn_decode_int(&blob_size, buffer, size, 2, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += 2;
-                    size -= 2;
-                    break;
-                case 0x5e:
-                    retval = jksn_decode_int(&blob_size, buffer, size, 1, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer++;
-                    size--;
-                    break;
-                case 0x5f:
-                    retval = jksn_decode_int(&blob_size, buffer, size, 0, &varint_size);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += varint_size;
-                    size -= varint_size;
-                    if(bytes_parsed)
-                        bytes_parsed += varint_size;
-                    break;
-                default:
-                    blob_size = control & 0xf;
-                }
-                if(size < blob_size)
-                    return JKSN_ETRUNC;
-                *result = jksn_malloc(sizeof (jksn_t));
-                if(!*result)
-                    return JKSN_ENOMEM;
-                (*result)->data_type = JKSN_BLOB;
-                (*result)->data_blob.size = blob_size;
-                (*result)->data_blob.buf = jksn_malloc(blob_size + 1);
-                if(!(*result)->data_blob.buf) {
-                    free(*result);
-                    *result = NULL;
-                    return JKSN_ENOMEM;
-                }
-                memcpy((*result)->data_blob.buf, buffer, blob_size);
-                (*result)->data_blob.buf[blob_size] = '\0';
-                buffer += blob_size;
-                size -= blob_size;
-                if(bytes_parsed)
-                    *bytes_parsed += blob_size;
-                hashvalue = jksn_djbhash((*result)->data_blob.buf, blob_size);
-                free(cache->blobhash[hashvalue].buf);
-                cache->blobhash[hashvalue].buf = jksn_malloc(blob_size);
-                if(cache->blobhash[hashvalue].buf) {
-                    cache->blobhash[hashvalue].size = blob_size;
-                    memcpy(cache->blobhash[hashvalue].buf, (*result)->data_blob.buf, blob_size);
-                } else {
-                    cache->blobhash[hashvalue].size = 0;
-                    free((*result)->data_blob.buf);
-                    free(*result);
-                    *result = NULL;
+            /* Empty containers are complete values */
+            if(length != 0) {
+                struct jksn_parse_frame *frame = jksn_parse_push(stack,
+                    entry->kind == JKSN_CONTROL_ARRAY ? JKSN_FRAME_ARRAY :
+                    entry->kind == JKSN_CONTROL_OBJECT ? JKSN_FRAME_OBJECT :
+                    entry->kind == JKSN_CONTROL_SWAPPED ? JKSN_FRAME_SWAPPED : JKSN_FRAME_LENGTHLESS,
+                    value, (size_t) length);
+                if(!frame) {
+                    jksn_parse_free(value, cache, allocator);
                     return JKSN_ENOMEM;
                 }
+                if(entry->kind == JKSN_CONTROL_LENGTHLESS)
+                    frame->index = (size_t) length;
+                continue;
+            }
+            break;
+        case JKSN_CONTROL_PADDING:
+            continue;
+        /* Ignore checksums */
+        case JKSN_CONTROL_CHECKSUM:
+            if(size < entry->width)
+                return JKSN_ETRUNC;
+            buffer += entry->width;
+            size -= entry->width;
+            continue;
+        case JKSN_CONTROL_DELAYED_CHECKSUM:
+            if(!jksn_parse_push(stack, JKSN_FRAME_TRAILER, NULL, entry->width))
+                return JKSN_ENOMEM;
+            continue;
+        /* Ignore pragmas */
+        case JKSN_CONTROL_PRAGMA:
+            if(!jksn_parse_push(stack, JKSN_FRAME_DISCARD, NULL, 1))
+                return JKSN_ENOMEM;
+            continue;
+        /* The JSON text follows as a string, which the frame parses */
+        case JKSN_CONTROL_JSON:
+            if(!size)
+                return JKSN_ETRUNC;
+            switch(jksn_control_table[(uint8_t) buffer[0]].kind) {
+            case JKSN_CONTROL_UTF16:
+            case JKSN_CONTROL_UTF8:
+            case JKSN_CONTROL_BLOB:
+            case JKSN_CONTROL_TEXT_HASH:
+            case JKSN_CONTROL_BLOB_HASH:
+                break;
+            default:
+                return JKSN_EJSON;
+            }
+            if(!jksn_parse_push(stack, JKSN_FRAME_JSON, NULL, 1))
+                return JKSN_ENOMEM;
+            continue;
+        default:
+            return JKSN_ECONTROL;
+        }
+        /* Hand the complete value to the innermost frame, completing frames as far as it goes */
+        while(value) {
+            struct jksn_parse_frame *frame;
+            if(!stack->depth) {
+                *result = value;
+                *bytes_parsed = (size_t) (buffer - begin);
                 return JKSN_EOK;
             }
-        /* Hashtable refreshers */
-        case 0x70:
-            {
-                jksn_error_message_no retval;
-                uintmax_t value_len;
-                size_t varint_size = 0;
-                size_t i;
-                switch(control) {
-                case 0x70:
-                    for(i = 0; i < 256; i++) {
-                        cache->texthash[i].size = 0;
-                        free(cache->texthash[i].str);
-                        cache->texthash[i].str = NULL;
-                    }
-                    for(i = 0; i < 256; i++) {
-                        cache->blobhash[i].size = 0;
-                        free(cache->blobhash[i].buf);
-                        cache->blobhash[i].buf = NULL;
-                    }
-                    return jksn_parse_value(result, buffer, size, bytes_parsed, cache);
-                case 0x7d:
-                    retval = jksn_decode_int(&value_len, buffer, size, 2, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += 2;
-                    size -= 2;
-                    break;
-                case 0x7e:
-                    retval = jksn_decode_int(&value_len, buffer, size, 1, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer++;
-                    size--;
-                    break;
-                case 0x7f:
-                    retval = jksn_decode_int(&value_len, buffer, size, 0, &varint_size);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += varint_size;
-                    size -= varint_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += varint_size;
-                    break;
-                default:
-                    value_len = control & 0xf;
+            frame = &stack->frames[stack->depth-1];
+            switch(frame->kind) {
+            case JKSN_FRAME_ARRAY:
+                frame->node->data_array.children[frame->index++] = value;
+                value = NULL;
+                if(frame->index == frame->node->data_array.size) {
+                    value = frame->node;
+                    stack->depth--;
                 }
-                while(value_len--) {
-                    jksn_t *tmp = NULL;
-                    size_t bytes_skipped = 0;
-                    retval = jksn_parse_value(&tmp, buffer, size, &bytes_skipped, cache);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    jksn_free(tmp);
-                    buffer += bytes_skipped;
-                    size -= bytes_skipped;
-                    if(bytes_parsed)
-                        *bytes_parsed += bytes_skipped;
-                }
-                return jksn_parse_value(result, buffer, size, bytes_parsed, cache);
-            }
-        /* Arrays */
-        case 0x80:
-            {
-                jksn_error_message_no retval;
-                uintmax_t array_len;
-                size_t varint_size = 0;
-                size_t i;
-                switch(control) {
-                case 0x8d:
-                    retval = jksn_decode_int(&array_len, buffer, size, 2, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += 2;
-                    size -= 2;
+                break;
+            case JKSN_FRAME_OBJECT:
+                if(!frame->column_name) {
+                    frame->column_name = value;
+                    value = NULL;
                     break;
-                case 0x8e:
-                    retval = jksn_decode_int(&array_len, buffer, size, 1, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer++;
-                    size--;
-                    break;
-                case 0x8f:
-                    retval = jksn_decode_int(&array_len, buffer, size, 0, &varint_size);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += varint_size;
-                    size -= varint_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += varint_size;
-                    break;
-                default:
-                    array_len = control & 0xf;
-                }
-                *result = jksn_malloc(sizeof (jksn_t));
-                if(!*result)
-                    return JKSN_ENOMEM;
-                (*result)->data_type = JKSN_ARRAY;
-                (*result)->data_array.size = array_len;
-                (*result)->data_array.children = jksn_calloc(array_len, sizeof (jksn_t *));
-                if(!(*result)->data_array.children) {
-                    free(*result);
-                    *result = NULL;
-                    return JKSN_ENOMEM;
                 }
-                for(i = 0; i < array_len; i++) {
-                    size_t child_size = 0;
-                    retval = jksn_parse_value(&(*result)->data_array.children[i], buffer, size, &child_size, cache);
-                    if(retval != JKSN_EOK) {
-                        *result = jksn_free(*result);
-                        return retval;
-                    }
-                    buffer += child_size;
-                    size -= child_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += child_size;
+                frame->node->data_object.children[frame->index].key = frame->column_name;
+                frame->node->data_object.children[frame->index++].value = value;
+                frame->column_name = value = NULL;
+                if(frame->index == frame->node->data_object.size) {
+                    value = frame->node;
+                    stack->depth--;
                 }
-                return JKSN_EOK;
-            }
-        /* Objects */
-        case 0x90:
-            {
-                jksn_error_message_no retval;
-                uintmax_t object_len;
-                size_t varint_size = 0;
-                size_t i;
-                switch(control) {
-                case 0x9d:
-                    retval = jksn_decode_int(&object_len, buffer, size, 2, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += 2;
-                    size -= 2;
-                    break;
-                case 0x9e:
-                    retval = jksn_decode_int(&object_len, buffer, size, 1, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer++;
-                    size--;
-                    break;
-                case 0x9f:
-                    retval = jksn_decode_int(&object_len, buffer, size, 0, &varint_size);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += varint_size;
-                    size -= varint_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += varint_size;
+                break;
+            case JKSN_FRAME_SWAPPED:
+                if(!frame->column_name) {
+                    frame->column_name = value;
+                    value = NULL;
                     break;
-                default:
-                    object_len = control & 0xf;
                 }
-                *result = jksn_malloc(sizeof (jksn_t));
-                if(!*result)
-                    return JKSN_ENOMEM;
-                (*result)->data_type = JKSN_OBJECT;
-                (*result)->data_object.size = object_len;
-                (*result)->data_object.children = jksn_calloc(object_len, sizeof (jksn_keyvalue));
-                if(!(*result)->data_object.children) {
-                    free(*result);
-                    *result = NULL;
-                    return JKSN_ENOMEM;
+                retval = jksn_merge_column(frame->node, frame->column_name, value, allocator);
+                jksn_parse_free(value, cache, allocator);
+                frame->column_name = jksn_parse_free(frame->column_name, cache, allocator);
+                value = NULL;
+                if(retval != JKSN_EOK)
+                    return retval;
+                if(--frame->remaining == 0) {
+                    value = frame->node;
+                    stack->depth--;
                 }
-                for(i = 0; i < object_len; i++) {
-                    size_t child_size = 0;
-                    retval = jksn_parse_value(&(*result)->data_object.children[i].key, buffer, size, &child_size, cache);
-                    if(retval != JKSN_EOK) {
-                        *result = jksn_free(*result);
-                        return retval;
+                break;
+            case JKSN_FRAME_LENGTHLESS:
+                {
+                    jksn_t *node = frame->node;
+                    if(value->data_type == JKSN_UNSPECIFIED) {
+                        jksn_parse_free(value, cache, allocator);
+                        if(frame->index > node->data_array.size) {
+                            jksn_t **tmpptr = jksn_tree_realloc(allocator, node->data_array.children, node->data_array.size * sizeof (jksn_t *));
+                            if(tmpptr)
+                                node->data_array.children = tmpptr;
+                        }
+                        value = node;
+                        stack->depth--;
+                        break;
                     }
-                    buffer += child_size;
-                    size -= child_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += child_size;
-                    child_size = 0;
-                    retval = jksn_parse_value(&(*result)->data_object.children[i].value, buffer, size, &child_size, cache);
-                    if(retval != JKSN_EOK) {
-                        *result = jksn_free(*result);
-                        return retval;
+                    if(node->data_array.size == frame->index) {
+                        size_t capacity = frame->index + frame->index/2;
+                        jksn_t **tmpptr = jksn_tree_realloc(allocator, node->data_array.children, capacity * sizeof (jksn_t *));
+                        if(!tmpptr) {
+                            jksn_parse_free(value, cache, allocator);
+                            return JKSN_ENOMEM;
+                        }
+                        node->data_array.children = tmpptr;
+                        frame->index = capacity;
                     }
-                    buffer += child_size;
-                    size -= child_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += child_size;
-                }
-                return JKSN_EOK;
-            }
-        /* Row-col swapped arrays */
-        case 0xa0:
-            {
-                jksn_error_message_no retval;
-                uintmax_t column_len;
-                size_t varint_size = 0;
-                size_t column_id;
-                switch(control) {
-                case 0xa0:
-                    *result = jksn_malloc(sizeof (jksn_t));
-                    if(!*result)
-                        return JKSN_ENOMEM;
-                    (*result)->data_type = JKSN_UNSPECIFIED;
-                    return JKSN_EOK;
-                case 0xad:
-                    retval = jksn_decode_int(&column_len, buffer, size, 2, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += 2;
-                    size -= 2;
+                    node->data_array.children[node->data_array.size++] = value;
+                    value = NULL;
                     break;
-                case 0xa3:
-                    retval = jksn_decode_int(&column_len, buffer, size, 1, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer++;
-                    size--;
-                    break;
-                case 0xa4:
-                    retval = jksn_decode_int(&column_len, buffer, size, 0, &varint_size);
+                }
+            case JKSN_FRAME_DISCARD:
+                jksn_parse_free(value, cache, allocator);
+                value = NULL;
+                if(--frame->remaining == 0)
+                    stack->depth--;
+                break;
+            case JKSN_FRAME_TRAILER:
+                if(size < frame->remaining) {
+                    jksn_parse_free(value, cache, allocator);
+                    return JKSN_ETRUNC;
+                }
+                buffer += frame->remaining;
+                size -= frame->remaining;
+                stack->depth--;
+                break;
+            case JKSN_FRAME_JSON:
+                {
+                    jksn_t *json;
+                    stack->depth--;
+                    retval = jksn_parse_json(&json, value->data_type == JKSN_STRING ? value->data_string.str : value->data_blob.buf,
+                                             value->data_type == JKSN_STRING ? value->data_string.size : value->data_blob.size, allocator);
+                    jksn_parse_free(value, cache, allocator);
                     if(retval != JKSN_EOK)
                         return retval;
-                    buffer += varint_size;
-                    size -= varint_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += varint_size;
+                    value = json;
                     break;
-                default:
-                    column_len = control & 0xf;
                 }
-                *result = jksn_malloc(sizeof (jksn_t));
-                if(!*result)
+            }
+        }
+    }
+}
+
+/* Spread one column of a row-col swapped array over the rows, which are created as needed */
+static jksn_error_message_no jksn_merge_column(jksn_t *rows, const jksn_t *column_name, jksn_t *column_values, const jksn_allocator *allocator) {
+    size_t row;
+    if(column_values->data_type != JKSN_ARRAY)
+        return JKSN_ESWAPARRAY;
+    if(rows->data_array.size < column_values->data_array.size) {
+        size_t i;
+        jksn_t **tmpptr = jksn_tree_realloc(allocator, rows->data_array.children, column_values->data_array.size * sizeof (jksn_t *));
+        if(!tmpptr)
+            return JKSN_ENOMEM;
+        rows->data_array.children = tmpptr;
+        for(i = rows->data_array.size; i < column_values->data_array.size; i++) {
+            tmpptr[i] = jksn_tree_malloc(allocator, sizeof (jksn_t));
+            if(!tmpptr[i])
+                return JKSN_ENOMEM;
+            tmpptr[i]->data_type = JKSN_OBJECT;
+            tmpptr[i]->data_object.size = 0;
+            tmpptr[i]->data_object.children = NULL;
+            rows->data_array.size++;
+        }
+    }
+    for(row = 0; row < column_values->data_array.size; row++)
+        if(column_values->data_array.children[row]->data_type != JKSN_UNSPECIFIED) {
+            jksn_t *target = rows->data_array.children[row];
+            size_t oldsize = target->data_object.size;
+            jksn_keyvalue *tmpptr = jksn_tree_realloc(allocator, target->data_object.children, (oldsize + 1) * sizeof (jksn_keyvalue));
+            if(!tmpptr)
+                return JKSN_ENOMEM;
+            target->data_object.children = tmpptr;
+            tmpptr[oldsize].key = jksn_duplicate(column_name, allocator);
+            if(!tmpptr[oldsize].key)
+                return JKSN_ENOMEM;
+            tmpptr[oldsize].value = column_values->data_array.children[row];
+            column_values->data_array.children[row] = NULL;
+            target->data_object.size++;
+        }
+    return JKSN_EOK;
+}
+
+static jksn_error_message_no jksn_decode_length(uintmax_t *result, const jksn_control *entry, const char *buffer, size_t size, size_t *bytes_parsed) {
+    switch(entry->width) {
+    case 0:
+        *result = (uintmax_t) (uint8_t) entry->value;
+        return JKSN_EOK;
+    case JKSN_VARINT:
+        return jksn_decode_int(result, buffer, size, 0, bytes_parsed);
+    default:
+        return jksn_decode_int(result, buffer, size, entry->width, bytes_parsed);
+    }
+}
+
+static jksn_error_message_no jksn_decode_signed(intmax_t *result, const jksn_control *entry, const char *buffer, size_t size, size_t *bytes_parsed) {
+    uintmax_t number;
+    jksn_error_message_no retval;
+    if(entry->width == 0) {
+        *result = entry->value;
+        return JKSN_EOK;
+    }
+    retval = jksn_decode_int(&number, buffer, size, entry->width == JKSN_VARINT ? 0 : entry->width, bytes_parsed);
+    if(retval != JKSN_EOK)
+        return retval;
+    switch(entry->width) {
+    case 1:
+        *result = (intmax_t) (int8_t) number;
+        break;
+    case 2:
+        *result = (intmax_t) (int16_t) number;
+        break;
+    case 4:
+        *result = (intmax_t) (int32_t) number;
+        break;
+    default:
+        if((intmax_t) number < 0)
+            return JKSN_EVARINT;
+        *result = entry->value < 0 ? -(intmax_t) number : (intmax_t) number;
+    }
+    return JKSN_EOK;
+}
+
+/*
+  JSON literals: 0x0f followed by a string holding JSON text. The text is
+  parsed into a tree as if it had been JKSN, without recursion, so deeply
+  nested text needs no more stack than deeply nested JKSN. Integers that
+  fit in intmax_t become JKSN_INT, other numbers JKSN_DOUBLE.
+*/
+static int jksn_json_is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static const char *jksn_json_skip_space(const char *text, const char *end) {
+    while(text != end && jksn_json_is_space(*text))
+        text++;
+    return text;
+}
+
+static int jksn_json_hex4(const char *text, uint16_t *result) {
+    size_t i;
+    *result = 0;
+    for(i = 0; i < 4; i++) {
+        char c = text[i];
+        uint16_t digit;
+        if(c >= '0' && c <= '9')
+            digit = (uint16_t) (c - '0');
+        else if(c >= 'a' && c <= 'f')
+            digit = (uint16_t) (c - 'a' + 10);
+        else if(c >= 'A' && c <= 'F')
+            digit = (uint16_t) (c - 'A' + 10);
+        else
+            return 0;
+        *result = (uint16_t) (*result << 4 | digit);
+    }
+    return 1;
+}
+
+static int jksn_json_unescape(char escape, char *result) {
+    switch(escape) {
+    case '"':
+    case '\\':
+    case '/':
+        *result = escape;
+        return 1;
+    case 'b':
+        *result = '\b';
+        return 1;
+    case 'f':
+        *result = '\f';
+        return 1;
+    case 'n':
+        *result = '\n';
+        return 1;
+    case 'r':
+        *result = '\r';
+        return 1;
+    case 't':
+        *result = '\t';
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* *text is just after the opening quote, and is left after the closing one */
+static jksn_error_message_no jksn_json_parse_string(jksn_t **result, const char **text, const char *end, const jksn_allocator *allocator) {
+    const char *p = *text;
+    char *str;
+    size_t size = 0;
+    /* Escapes never grow when decoded, so the text bounds the size */
+    while(p != end && *p != '"') {
+        if(*p == '\\') {
+            if(++p == end)
+                return JKSN_EJSON;
+        } else if((uint8_t) *p < 0x20)
+            return JKSN_EJSON;
+        p++;
+    }
+    if(p == end)
+        return JKSN_EJSON;
+    *result = jksn_tree_malloc(allocator, sizeof (jksn_t));
+    if(!*result)
+        return JKSN_ENOMEM;
+    (*result)->data_type = JKSN_STRING;
+    (*result)->data_string.size = 0;
+    (*result)->data_string.str = str = jksn_tree_malloc(allocator, (size_t) (p - *text) + 1);
+    if(!str) {
+        jksn_tree_free(allocator, *result);
+        *result = NULL;
+        return JKSN_ENOMEM;
+    }
+    for(p = *text; *p != '"'; ) {
+        if(*p != '\\')
+            str[size++] = *p++;
+        else if(p[1] == 'u') {
+            uint16_t units[2];
+            size_t count = 1;
+            if(end - p < 6 || !jksn_json_hex4(p + 2, &units[0]))
+                break;
+            /* A surrogate pair is written as two escapes, a lone surrogate becomes U+FFFD */
+            if((units[0] & 0xfc00) == 0xd800 && end - p >= 12 && p[6] == '\\' && p[7] == 'u' &&
+               jksn_json_hex4(p + 8, &units[1]) && (units[1] & 0xfc00) == 0xdc00)
+                count = 2;
+            size += jksn_utf16_to_utf8(units, str + size, count);
+            p += count * 6;
+        } else if(jksn_json_unescape(p[1], &str[size])) {
+            size++;
+            p += 2;
+        } else
+            break;
+    }
+    if(*p != '"') {
+        jksn_free_with_allocator(*result, allocator);
+        *result = NULL;
+        return JKSN_EJSON;
+    }
+    str[size] = '\0';
+    (*result)->data_string.size = size;
+    *text = p + 1;
+    return JKSN_EOK;
+}
+
+static jksn_error_message_no jksn_json_parse_number(jksn_t **result, const char **text, const char *end, const jksn_allocator *allocator) {
+    const char *p = *text;
+    int negative = 0;
+    int integral = 1;
+    uintmax_t magnitude = 0;
+    if(p != end && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    if(p == end || *p < '0' || *p > '9')
+        return JKSN_EJSON;
+    if(*p == '0')
+        p++;
+    else
+        for(; p != end && *p >= '0' && *p <= '9'; p++) {
+            unsigned digit = (unsigned) (*p - '0');
+            if(magnitude > (UINTMAX_MAX - digit) / 10)
+                integral = 0;
+            else
+                magnitude = magnitude * 10 + digit;
+        }
+    if(p != end && *p == '.') {
+        integral = 0;
+        if(++p == end || *p < '0' || *p > '9')
+            return JKSN_EJSON;
+        while(p != end && *p >= '0' && *p <= '9')
+            p++;
+    }
+    if(p != end && (*p == 'e' || *p == 'E')) {
+        integral = 0;
+        if(++p != end && (*p == '+' || *p == '-'))
+            p++;
+        if(p == end || *p < '0' || *p > '9')
+            return JKSN_EJSON;
+        while(p != end && *p >= '0' && *p <= '9')
+            p++;
+    }
+    if(magnitude > (uintmax_t) INTMAX_MAX + (uintmax_t) negative)
+        integral = 0;
+    *result = jksn_tree_malloc(allocator, sizeof (jksn_t));
+    if(!*result)
+        return JKSN_ENOMEM;
+    if(integral) {
+        (*result)->data_type = JKSN_INT;
+        /* -INTMAX_MAX-1 has no positive counterpart */
+        (*result)->data_int = negative ? -(intmax_t) (magnitude - 1) - 1 : (intmax_t) magnitude;
+    } else {
+        /* strtod wants a terminated string */
+        char local[64];
+        size_t size = (size_t) (p - *text);
+        char *copy = size < sizeof local ? local : jksn_malloc(size + 1);
+        if(!copy) {
+            jksn_tree_free(allocator, *result);
+            *result = NULL;
+            return JKSN_ENOMEM;
+        }
+        memcpy(copy, *text, size);
+        copy[size] = '\0';
+        (*result)->data_type = JKSN_DOUBLE;
+        (*result)->data_double = strtod(copy, NULL);
+        if(copy != local)
+            free(copy);
+    }
+    *text = p;
+    return JKSN_EOK;
+}
+
+static jksn_error_message_no jksn_json_parse_literal(jksn_t **result, const char **text, const char *end, const jksn_allocator *allocator) {
+    static const struct {
+        const char *word;
+        jksn_data_type type;
+        int value;
+    } literals[3] = {{"null", JKSN_NULL, 0}, {"true", JKSN_BOOL, 1}, {"false", JKSN_BOOL, 0}};
+    size_t i;
+    for(i = 0; i < 3; i++) {
+        size_t size = strlen(literals[i].word);
+        if((size_t) (end - *text) >= size && memcmp(*text, literals[i].word, size) == 0) {
+            *result = jksn_tree_malloc(allocator, sizeof (jksn_t));
+            if(!*result)
+                return JKSN_ENOMEM;
+            (*result)->data_type = literals[i].type;
+            (*result)->data_bool = literals[i].value;
+            *text += size;
+            return JKSN_EOK;
+        }
+    }
+    return JKSN_EJSON;
+}
+
+/* The key of the next member, then the colon */
+static jksn_error_message_no jksn_json_parse_key(jksn_t **result, const char **text, const char *end, const jksn_allocator *allocator) {
+    jksn_error_message_no retval;
+    *text = jksn_json_skip_space(*text, end);
+    if(*text == end || **text != '"')
+        return JKSN_EJSON;
+    ++*text;
+    retval = jksn_json_parse_string(result, text, end, allocator);
+    if(retval != JKSN_EOK)
+        return retval;
+    *text = jksn_json_skip_space(*text, end);
+    if(*text == end || **text != ':') {
+        *result = jksn_free_with_allocator(*result, allocator);
+        return JKSN_EJSON;
+    }
+    ++*text;
+    return JKSN_EOK;
+}
+
+static jksn_error_message_no jksn_json_parse_loop(jksn_t **result, const char *text, const char *end, const jksn_allocator *allocator, struct jksn_json_stack *stack) {
+    for(;;) {
+        jksn_error_message_no retval;
+        text = jksn_json_skip_space(text, end);
+        if(text == end)
+            return JKSN_EJSON;
+        switch(*text) {
+        case '[':
+        case '{':
+            {
+                struct jksn_json_frame *frame;
+                jksn_t *node = jksn_tree_malloc(allocator, sizeof (jksn_t));
+                if(!node)
                     return JKSN_ENOMEM;
-                (*result)->data_type = JKSN_ARRAY;
-                (*result)->data_array.size = 0;
-                (*result)->data_array.children = NULL;
-                for(column_id = 0; column_id < column_len; column_id++) {
-                    jksn_t *column_name = NULL;
-                    jksn_t *column_values = NULL;
-                    size_t child_size = 0;
-                    size_t row;
-                    retval = jksn_parse_value(&column_name, buffer, size, &child_size, cache);
-                    if(retval != JKSN_EOK) {
-                        *result = jksn_free(*result);
-                        return retval;
-                    }
-                    buffer += child_size;
-                    size -= child_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += child_size;
-                    child_size = 0;
-                    retval = jksn_parse_value(&column_values, buffer, size, &child_size, cache);
-                    if(retval != JKSN_EOK) {
-                        column_name = jksn_free(column_name);
-                        *result = jksn_free(*result);
-                        return retval;
-                    }
-                    buffer += child_size;
-                    size -= child_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += child_size;
-                    if(column_values->data_type != JKSN_ARRAY) {
-                        column_name = jksn_free(column_name);
-                        column_values = jksn_free(column_values);
-                        *result = jksn_free(*result);
-                        return JKSN_ESWAPARRAY;
-                    }
-                    if((*result)->data_array.size < column_values->data_array.size) {
-                        jksn_t **tmpptr = jksn_realloc((*result)->data_array.children, column_values->data_array.size * sizeof (jksn_t *));
-                        if(tmpptr) {
-                            size_t i;
-                            size_t oldsize = (*result)->data_array.size;
-                            (*result)->data_array.size = column_values->data_array.size;
-                            (*result)->data_array.children = tmpptr;
-                            for(i = oldsize; i < column_values->data_array.size; i++)
-                                tmpptr[i] = NULL;
-                            for(i = oldsize; i < column_values->data_array.size; i++) {
-                                tmpptr[i] = jksn_malloc(sizeof (jksn_t));
-                                if(!tmpptr[i]) {
-                                    column_name = jksn_free(column_name);
-                                    column_values = jksn_free(column_values);
-                                    *result = jksn_free(*result);
-                                    return JKSN_ENOMEM;
-                                }
-                                tmpptr[i]->data_type = JKSN_OBJECT;
-                                tmpptr[i]->data_object.size = 0;
-                                tmpptr[i]->data_object.children = NULL;
-                            }
-                        } else {
-                            *result = jksn_free(*result);
-                            return JKSN_ENOMEM;
-                        }
-                    }
-                    for(row = 0; row < column_values->data_array.size; row++)
-                        if(column_values->data_array.children[row]->data_type != JKSN_UNSPECIFIED) {
-                            size_t oldsize = (*result)->data_array.children[row]->data_object.size;
-                            jksn_keyvalue *tmpptr = jksn_realloc((*result)->data_array.children[row]->data_object.children, (oldsize + 1) * sizeof (jksn_keyvalue));
-                            if(!tmpptr) {
-                                column_name = jksn_free(column_name);
-                                column_values = jksn_free(column_values);
-                                *result = jksn_free(*result);
-                                return JKSN_ENOMEM;
-                            }
-                            tmpptr[oldsize].key = jksn_duplicate(column_name);
-                            if(!tmpptr[oldsize].key) {
-                                tmpptr[oldsize].value = NULL;
-                                column_name = jksn_free(column_name);
-                                column_values = jksn_free(column_values);
-                                *result = jksn_free(*result);
-                                return JKSN_ENOMEM;
-                            }
-                            tmpptr[oldsize].value = column_values->data_array.children[row];
-                            column_values->data_array.children[row] = NULL;
-                            (*result)->data_array.children[row]->data_object.children = tmpptr;
-                            (*result)->data_array.children[row]->data_object.size++;
-                        }
-                    jksn_free(column_name);
-                    jksn_free(column_values);
+                if(*text == '[') {
+                    node->data_type = JKSN_ARRAY;
+                    node->data_array.size = 0;
+                    node->data_array.children = NULL;
+                } else {
+                    node->data_type = JKSN_OBJECT;
+                    node->data_object.size = 0;
+                    node->data_object.children = NULL;
                 }
-                return JKSN_EOK;
-            }
-        case 0xc0:
-            switch(control) {
-            /* Lengthless arrays */
-            case 0xc8:
-                {
-                    size_t capacity = 2;
-                    *result = jksn_malloc(sizeof (jksn_t));
-                    if(!*result)
-                        return JKSN_ENOMEM;
-                    (*result)->data_type = JKSN_ARRAY;
-                    (*result)->data_array.size = 0;
-                    (*result)->data_array.children = jksn_calloc(2, sizeof (jksn_t *));
-                    for(;;) {
-                        jksn_error_message_no retval;
-                        size_t child_size = 0;
-                        if((*result)->data_array.size == capacity) {
-                            capacity += capacity/2;
-                            jksn_t **tmpptr = jksn_realloc((*result)->data_array.children, capacity * sizeof (jksn_t *));
-                            if(tmpptr)
-                                (*result)->data_array.children = tmpptr;
-                            else {
-                                *result = jksn_free(*result);
-                                return JKSN_ENOMEM;
-                            }
-                        }
-                        assert(capacity > (*result)->data_array.size);
-                        retval = jksn_parse_value(&(*result)->data_array.children[(*result)->data_array.size], buffer, size, &child_size, cache);
-                        if(retval != JKSN_EOK) {
-                            *result = jksn_free(*result);
-                            return retval;
-                        }
-                        buffer += child_size;
-                        size -= child_size;
-                        if(bytes_parsed)
-                            *bytes_parsed += child_size;
-                        if((*result)->data_array.children[(*result)->data_array.size]->data_type != JKSN_UNSPECIFIED)
-                            (*result)->data_array.size++;
-                        else
-                            break;
-                    }
-                    if(capacity > (*result)->data_array.size) {
-                        jksn_t **tmpptr = jksn_realloc((*result)->data_array.children, (*result)->data_array.size * sizeof (jksn_t *));
-                        if(tmpptr)
-                            (*result)->data_array.children = tmpptr;
-                    }
-                    return JKSN_EOK;
+                frame = jksn_json_push(stack, node);
+                if(!frame) {
+                    jksn_free_with_allocator(node, allocator);
+                    return JKSN_ENOMEM;
                 }
-            /* Padding byte */
-            case 0xca:
-                return jksn_parse_value(result, buffer, size, bytes_parsed, cache);
-            }
-            break;
-        /* Delta encoded integers */
-        case 0xd0:
-            {
-                jksn_error_message_no retval;
-                uintmax_t delta;
-                switch(control) {
-                case 0xd0: case 0xd1: case 0xd2: case 0xd3: case 0xd4: case 0xd5:
-                    if(!cache->haslastint)
-                        return JKSN_EDELTA;
-                    cache->lastint += (intmax_t) (control & 0xf);
-                    break;
-                case 0xd6: case 0xd7: case 0xd8: case 0xd9: case 0xda:
-                    if(!cache->haslastint)
-                        return JKSN_EDELTA;
-                    cache->lastint += ((intmax_t) (control & 0xf)) - 11;
-                    break;
-                case 0xdb:
-                    retval = jksn_decode_int(&delta, buffer, size, 4, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    if(!cache->haslastint)
-                        return JKSN_EDELTA;
-                    cache->lastint += (int32_t) delta;
-                    break;
-                case 0xdc:
-                    retval = jksn_decode_int(&delta, buffer, size, 2, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    if(!cache->haslastint)
-                        return JKSN_EDELTA;
-                    cache->lastint += (int16_t) delta;
-                    break;
-                case 0xdd:
-                    retval = jksn_decode_int(&delta, buffer, size, 1, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    if(!cache->haslastint)
-                        return JKSN_EDELTA;
-                    cache->lastint += (int8_t) delta;
-                    break;
-                case 0xde:
-                    retval = jksn_decode_int(&delta, buffer, size, 0, bytes_parsed);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    if((intmax_t) delta < 0)
-                        return JKSN_EVARINT;
-                    if(!cache->haslastint)
-                        return JKSN_EDELTA;
-                    cache->lastint -= (intmax_t) delta;
+                text = jksn_json_skip_space(text + 1, end);
+                if(text != end && *text == (node->data_type == JKSN_ARRAY ? ']' : '}')) {
+                    text++;
+                    stack->value = node;
+                    stack->depth--;
                     break;
-                case 0xdf:
-                    retval = jksn_decode_int(&delta, buffer, size, 0, bytes_parsed);
+                }
+                if(node->data_type == JKSN_OBJECT) {
+                    retval = jksn_json_parse_key(&frame->key, &text, end, allocator);
                     if(retval != JKSN_EOK)
                         return retval;
-                    if((intmax_t) delta < 0)
-                        return JKSN_EVARINT;
-                    if(!cache->haslastint)
-                        return JKSN_EDELTA;
-                    cache->lastint += (intmax_t) delta;
-                    break;
                 }
-                cache->haslastint = 1;
-                *result = jksn_malloc(sizeof (jksn_t));
-                if(!*result)
-                    return JKSN_ENOMEM;
-                (*result)->data_type = JKSN_INT;
-                (*result)->data_int = cache->lastint;
+                continue;
+            }
+        case '"':
+            text++;
+            retval = jksn_json_parse_string(&stack->value, &text, end, allocator);
+            if(retval != JKSN_EOK)
+                return retval;
+            break;
+        case 'n':
+        case 't':
+        case 'f':
+            retval = jksn_json_parse_literal(&stack->value, &text, end, allocator);
+            if(retval != JKSN_EOK)
+                return retval;
+            break;
+        default:
+            retval = jksn_json_parse_number(&stack->value, &text, end, allocator);
+            if(retval != JKSN_EOK)
+                return retval;
+            break;
+        }
+        /* Hand the complete value to the innermost container, closing containers as far as it goes */
+        for(;;) {
+            struct jksn_json_frame *frame;
+            jksn_t *node;
+            if(!stack->depth) {
+                if(jksn_json_skip_space(text, end) != end)
+                    return JKSN_EJSON;
+                *result = stack->value;
+                stack->value = NULL;
                 return JKSN_EOK;
             }
-        case 0xf0:
-            {
-                jksn_error_message_no retval;
-                jksn_t *tmp;
-                size_t child_size = 0;
-                switch(control) {
-                /* Ignore checksums */
-                case 0xf0:
-                    if(size < 1)
-                        return JKSN_ETRUNC;
-                    buffer++;
-                    size--;
-                    if(bytes_parsed)
-                        (*bytes_parsed)++;
-                    return jksn_parse_value(result, buffer, size, bytes_parsed, cache);
-                case 0xf1:
-                    if(size < 4)
-                        return JKSN_ETRUNC;
-                    buffer += 4;
-                    size -= 4;
-                    if(bytes_parsed)
-                        *bytes_parsed += 4;
-                    return jksn_parse_value(result, buffer, size, bytes_parsed, cache);
-                case 0xf2:
-                    if(size < 16)
-                        return JKSN_ETRUNC;
-                    buffer += 16;
-                    size -= 16;
-                    if(bytes_parsed)
-                        *bytes_parsed += 16;
-                    return jksn_parse_value(result, buffer, size, bytes_parsed, cache);
-                case 0xf3:
-                    if(size < 20)
-                        return JKSN_ETRUNC;
-                    buffer += 20;
-                    size -= 20;
-                    if(bytes_parsed)
-                        *bytes_parsed += 20;
-                    return jksn_parse_value(result, buffer, size, bytes_parsed, cache);
-                case 0xf4:
-                    if(size < 32)
-                        return JKSN_ETRUNC;
-                    buffer += 32;
-                    size -= 32;
-                    if(bytes_parsed)
-                        *bytes_parsed += 32;
-                    return jksn_parse_value(result, buffer, size, bytes_parsed, cache);
-                case 0xf5:
-                    if(size < 64)
-                        return JKSN_ETRUNC;
-                    buffer += 64;
-                    size -= 64;
-                    if(bytes_parsed)
-                        *bytes_parsed += 64;
-                    return jksn_parse_value(result, buffer, size, bytes_parsed, cache);
-                case 0xf8:
-                    retval = jksn_parse_value(result, buffer, size, &child_size, cache);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += child_size;
-                    size -= child_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += child_size;
-                    if(size < 1)
-                        return JKSN_ETRUNC;
-                    buffer++;
-                    size--;
-                    if(bytes_parsed)
-                        (*bytes_parsed)++;
-                    return JKSN_EOK;
-                case 0xf9:
-                    retval = jksn_parse_value(result, buffer, size, &child_size, cache);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += child_size;
-                    size -= child_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += child_size;
-                    if(size < 4)
-                        return JKSN_ETRUNC;
-                    buffer += 4;
-                    size -= 4;
-                    if(bytes_parsed)
-                        *bytes_parsed += 4;
-                    return JKSN_EOK;
-                case 0xfa:
-                    retval = jksn_parse_value(result, buffer, size, &child_size, cache);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += child_size;
-                    size -= child_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += child_size;
-                    if(size < 16)
-                        return JKSN_ETRUNC;
-                    buffer += 16;
-                    size -= 16;
-                    if(bytes_parsed)
-                        *bytes_parsed += 16;
-                    return JKSN_EOK;
-                case 0xfb:
-                    retval = jksn_parse_value(result, buffer, size, &child_size, cache);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += child_size;
-                    size -= child_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += child_size;
-                    if(size < 20)
-                        return JKSN_ETRUNC;
-                    buffer += 20;
-                    size -= 20;
-                    if(bytes_parsed)
-                        *bytes_parsed += 20;
-                    return JKSN_EOK;
-                case 0xfc:
-                    retval = jksn_parse_value(result, buffer, size, &child_size, cache);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += child_size;
-                    size -= child_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += child_size;
-                    if(size < 32)
-                        return JKSN_ETRUNC;
-                    buffer += 32;
-                    size -= 32;
-                    if(bytes_parsed)
-                        *bytes_parsed += 32;
-                    return JKSN_EOK;
-                case 0xfd:
-                    retval = jksn_parse_value(result, buffer, size, &child_size, cache);
-                    if(retval != JKSN_EOK)
-                        return retval;
-                    buffer += child_size;
-                    size -= child_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += child_size;
-                    if(size < 64)
-                        return JKSN_ETRUNC;
-                    buffer += 64;
-                    size -= 64;
-                    if(bytes_parsed)
-                        *bytes_parsed += 64;
-                    return JKSN_EOK;
-                /* Ignore pragmas */
-                case 0xff:
-                    retval = jksn_parse_value(&tmp, buffer, size, &child_size, cache);
+            frame = &stack->frames[stack->depth-1];
+            node = frame->node;
+            if(node->data_type == JKSN_ARRAY) {
+                if(node->data_array.size == frame->capacity) {
+                    size_t capacity = frame->capacity != 0 ? frame->capacity*2 : 4;
+                    jksn_t **tmpptr = jksn_tree_realloc(allocator, node->data_array.children, capacity * sizeof (jksn_t *));
+                    if(!tmpptr)
+                        return JKSN_ENOMEM;
+                    node->data_array.children = tmpptr;
+                    frame->capacity = capacity;
+                }
+                node->data_array.children[node->data_array.size++] = stack->value;
+            } else {
+                if(node->data_object.size == frame->capacity) {
+                    size_t capacity = frame->capacity != 0 ? frame->capacity*2 : 4;
+                    jksn_keyvalue *tmpptr = jksn_tree_realloc(allocator, node->data_object.children, capacity * sizeof (jksn_keyvalue));
+                    if(!tmpptr)
+                        return JKSN_ENOMEM;
+                    node->data_object.children = tmpptr;
+                    frame->capacity = capacity;
+                }
+                node->data_object.children[node->data_object.size].key = frame->key;
+                node->data_object.children[node->data_object.size++].value = stack->value;
+                frame->key = NULL;
+            }
+            stack->value = NULL;
+            text = jksn_json_skip_space(text, end);
+            if(text != end && *text == ',') {
+                text++;
+                if(node->data_type == JKSN_OBJECT) {
+                    retval = jksn_json_parse_key(&frame->key, &text, end, allocator);
                     if(retval != JKSN_EOK)
                         return retval;
-                    tmp = jksn_free(tmp);
-                    buffer += child_size;
-                    size -= child_size;
-                    if(bytes_parsed)
-                        *bytes_parsed += child_size;
-                    return jksn_parse_value(result, buffer, size, bytes_parsed, cache);
                 }
+                break;
+            } else if(text != end && *text == (node->data_type == JKSN_ARRAY ? ']' : '}')) {
+                text++;
+                stack->value = node;
+                stack->depth--;
+            } else
+                return JKSN_EJSON;
+        }
+    }
+}
+
+static struct jksn_json_frame *jksn_json_push(struct jksn_json_stack *stack, jksn_t *node) {
+    struct jksn_json_frame *frame;
+    if(stack->depth == stack->capacity) {
+        size_t capacity = stack->capacity*2;
+        struct jksn_json_frame *frames;
+        if(stack->depth == 32) {
+            /* Still in local_frames of jksn_parse_json */
+            frames = jksn_malloc(capacity * sizeof (struct jksn_json_frame));
+            if(frames)
+                memcpy(frames, stack->frames, stack->depth * sizeof (struct jksn_json_frame));
+        } else
+            frames = jksn_realloc(stack->frames, capacity * sizeof (struct jksn_json_frame));
+        if(!frames)
+            return NULL;
+        stack->frames = frames;
+        stack->capacity = capacity;
+    }
+    frame = &stack->frames[stack->depth++];
+    frame->node = node;
+    frame->capacity = 0;
+    frame->key = NULL;
+    return frame;
+}
+
+static jksn_error_message_no jksn_parse_json(jksn_t **result, const char *text, size_t size, const jksn_allocator *allocator) {
+    jksn_error_message_no retval;
+    struct jksn_json_frame local_frames[32];
+    struct jksn_json_stack stack;
+    stack.frames = local_frames;
+    stack.depth = 0;
+    stack.capacity = sizeof local_frames / sizeof local_frames[0];
+    stack.value = NULL;
+    *result = NULL;
+    retval = jksn_json_parse_loop(result, text, text + size, allocator, &stack);
+    if(retval != JKSN_EOK) {
+        jksn_free_with_allocator(stack.value, allocator);
+        while(stack.depth) {
+            struct jksn_json_frame *frame = &stack.frames[--stack.depth];
+            jksn_free_with_allocator(frame->node, allocator);
+            jksn_free_with_allocator(frame->key, allocator);
+        }
+    }
+    if(stack.frames != local_frames)
+        free(stack.frames);
+    return retval;
+}
+
+static jksn_error_message_no jksn_parse_string(jksn_t **result, const jksn_control *entry, const char *buffer, size_t size, size_t *bytes_parsed, jksn_cache *cache, const jksn_allocator *allocator, unsigned flags) {
+    jksn_error_message_no retval;
+    uintmax_t str_size;
+    size_t field_size = 0;
+    uint8_t hashvalue;
+    *result = NULL;
+    if(entry->kind == JKSN_CONTROL_TEXT_HASH || entry->kind == JKSN_CONTROL_BLOB_HASH) {
+        const char *cached;
+        size_t cached_size;
+        if(!size)
+            return JKSN_ETRUNC;
+        hashvalue = (uint8_t) buffer[0];
+        *bytes_parsed += 1;
+        if(entry->kind == JKSN_CONTROL_TEXT_HASH) {
+            cached = cache->texthash[hashvalue].str;
+            cached_size = cache->texthash[hashvalue].size;
+        } else {
+            cached = cache->blobhash[hashvalue].buf;
+            cached_size = cache->blobhash[hashvalue].size;
+        }
+        if(cached_size == 0)
+            return JKSN_EHASH;
+        *result = jksn_tree_malloc(allocator, sizeof (jksn_t));
+        if(!*result)
+            return JKSN_ENOMEM;
+        (*result)->data_type = entry->kind == JKSN_CONTROL_TEXT_HASH ? JKSN_STRING : JKSN_BLOB;
+        (*result)->data_blob.buf = jksn_tree_malloc(allocator, cached_size + 1);
+        (*result)->data_blob.size = cached_size;
+        if(!(*result)->data_blob.buf) {
+            jksn_tree_free(allocator, *result);
+            *result = NULL;
+            return JKSN_ENOMEM;
+        }
+        memcpy((*result)->data_blob.buf, cached, cached_size);
+        (*result)->data_blob.buf[cached_size] = '\0';
+        return JKSN_EOK;
+    }
+    retval = jksn_decode_length(&str_size, entry, buffer, size, &field_size);
+    if(retval != JKSN_EOK)
+        return retval;
+    buffer += field_size;
+    size -= field_size;
+    *bytes_parsed += field_size;
+    if(entry->kind == JKSN_CONTROL_UTF16) {
+        uint16_t *utf16str;
+        size_t i;
+        if(size / 2 < str_size)
+            return JKSN_ETRUNC;
+        utf16str = jksn_malloc((size_t) str_size*2);
+        if(!utf16str)
+            return JKSN_ENOMEM;
+        memcpy((char *) utf16str, buffer, (size_t) str_size*2);
+        hashvalue = jksn_djbhash((char *) utf16str, (size_t) str_size*2);
+        if(!jksn_is_little_endian())
+            for(i = 0; i < str_size; i++)
+                utf16str[i] = (uint16_t) ((utf16str[i] << 8) | (utf16str[i] >> 8));
+        *result = jksn_tree_malloc(allocator, sizeof (jksn_t));
+        if(!*result) {
+            free(utf16str);
+            return JKSN_ENOMEM;
+        }
+        (*result)->data_type = JKSN_STRING;
+        (*result)->data_string.size = jksn_utf16_to_utf8(utf16str, NULL, (size_t) str_size);
+        (*result)->data_string.str = jksn_tree_malloc(allocator, (*result)->data_string.size + 1);
+        if(!(*result)->data_string.str) {
+            free(utf16str);
+            jksn_tree_free(allocator, *result);
+            *result = NULL;
+            return JKSN_ENOMEM;
+        }
+        jksn_utf16_to_utf8(utf16str, (*result)->data_string.str, (size_t) str_size);
+        free(utf16str);
+        (*result)->data_string.str[(*result)->data_string.size] = '\0';
+        *bytes_parsed += (size_t) str_size*2;
+    } else {
+        if(size < str_size)
+            return JKSN_ETRUNC;
+        *result = jksn_tree_malloc(allocator, sizeof (jksn_t));
+        if(!*result)
+            return JKSN_ENOMEM;
+        (*result)->data_type = entry->kind == JKSN_CONTROL_UTF8 ? JKSN_STRING : JKSN_BLOB;
+        (*result)->data_blob.size = (size_t) str_size;
+        /* Empty ones are copied, as they may sit at the very end of the input */
+        if((flags & JKSN_PARSE_BORROW) && str_size != 0)
+            (*result)->data_blob.buf = (char *) buffer;
+        else {
+            (*result)->data_blob.buf = jksn_tree_malloc(allocator, (size_t) str_size + 1);
+            if(!(*result)->data_blob.buf) {
+                jksn_tree_free(allocator, *result);
+                *result = NULL;
+                return JKSN_ENOMEM;
             }
+            memcpy((*result)->data_blob.buf, buffer, (size_t) str_size);
+            (*result)->data_blob.buf[str_size] = '\0';
         }
-        return JKSN_ECONTROL;
+        hashvalue = jksn_djbhash(buffer, (size_t) str_size);
+        *bytes_parsed += (size_t) str_size;
+    }
+    if(entry->kind == JKSN_CONTROL_BLOB ?
+        !jksn_cache_store(&cache->blobhash[hashvalue].buf, &cache->blobhash[hashvalue].size, &cache->blobhash_capacity[hashvalue], (*result)->data_blob.buf, (*result)->data_blob.size) :
+        !jksn_cache_store(&cache->texthash[hashvalue].str, &cache->texthash[hashvalue].size, &cache->texthash_capacity[hashvalue], (*result)->data_string.str, (*result)->data_string.size)) {
+        *result = jksn_parse_free(*result, cache, allocator);
+        return JKSN_ENOMEM;
     }
+    return JKSN_EOK;
 }
 
-static jksn_error_message_no jksn_parse_float(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed) {
+static jksn_error_message_no jksn_parse_float(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed, const jksn_allocator *allocator) {
     assert(sizeof (float) == 4);
     if(size < 4)
         return JKSN_ETRUNC;
@@ -2022,7 +3117,7 @@ static jksn_error_message_no jksn_parse_float(jksn_t **result, const char *buffe
             ((uint32_t) (uint8_t) buffer[2]) << 8 |
             ((uint32_t) (uint8_t) buffer[3])
         };
-        *result = jksn_malloc(sizeof (jksn_t));
+        *result = jksn_tree_malloc(allocator, sizeof (jksn_t));
         if(!*result)
             return JKSN_ENOMEM;
         (*result)->data_type = JKSN_FLOAT;
@@ -2033,7 +3128,7 @@ static jksn_error_message_no jksn_parse_float(jksn_t **result, const char *buffe
     }
 }
 
-static jksn_error_message_no jksn_parse_double(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed) {
+static jksn_error_message_no jksn_parse_double(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed, const jksn_allocator *allocator) {
     assert(sizeof (double) == 8);
     if(size < 8)
         return JKSN_ETRUNC;
@@ -2051,7 +3146,7 @@ static jksn_error_message_no jksn_parse_double(jksn_t **result, const char *buff
             ((uint64_t) (uint8_t) buffer[6]) << 8 |
             ((uint64_t) (uint8_t) buffer[7])
         };
-        *result = jksn_malloc(sizeof (jksn_t));
+        *result = jksn_tree_malloc(allocator, sizeof (jksn_t));
         if(!*result)
             return JKSN_ENOMEM;
         (*result)->data_type = JKSN_DOUBLE;
@@ -2062,7 +3157,7 @@ static jksn_error_message_no jksn_parse_double(jksn_t **result, const char *buff
     }
 }
 
-static jksn_error_message_no jksn_parse_longdouble(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed) {
+static jksn_error_message_no jksn_parse_longdouble(jksn_t **result, const char *buffer, size_t size, size_t *bytes_parsed, const jksn_allocator *allocator) {
     if(size < 10)
         return JKSN_ETRUNC;
     else if(sizeof (long double) == 12) {
@@ -2070,7 +3165,7 @@ static jksn_error_message_no jksn_parse_longdouble(jksn_t **result, const char *
             uint8_t data_int[12];
             long double data_long_double;
         } conv;
-        *result = jksn_malloc(sizeof (jksn_t));
+        *result = jksn_tree_malloc(allocator, sizeof (jksn_t));
         if(!*result)
             return JKSN_ENOMEM;
         if(jksn_is_little_endian()) {
@@ -2110,7 +3205,7 @@ static jksn_error_message_no jksn_parse_longdouble(jksn_t **result, const char *
             uint8_t data_int[16];
             long double data_long_double;
         } conv;
-        *result = jksn_malloc(sizeof (jksn_t));
+        *result = jksn_tree_malloc(allocator, sizeof (jksn_t));
         if(!*result)
             return JKSN_ENOMEM;
         if(jksn_is_little_endian()) {
@@ -2219,6 +3314,8 @@ static int jksn_utf8_check_continuation(const char *utf8str, size_t length, size
 
 static size_t jksn_utf8_to_utf16(const char *utf8str, uint16_t *utf16str, size_t utf8size, int strict) {
     size_t reslen = 0;
+    if(utf16str)
+        JKSN_COUNT(utf8_to_utf16_bytes, utf8size);
     while(utf8size) {
         if((uint8_t) utf8str[0] < 0x80) {
             if(utf16str)
@@ -2283,6 +3380,8 @@ static size_t jksn_utf8_to_utf16(const char *utf8str, uint16_t *utf16str, size_t
 
 static size_t jksn_utf16_to_utf8(const uint16_t *utf16str, char *utf8str, size_t utf16size) {
     size_t reslen = 0;
+    if(utf8str)
+        JKSN_COUNT(utf16_to_utf8_bytes, utf16size * 2);
     while(utf16size) {
         if(utf16str[0] < 0x80) {
             if(utf8str)
@@ -2364,55 +3463,55 @@ static int jksn_compare(const jksn_t *obj1, const jksn_t *obj2) {
     }
 }
 
-static jksn_t *jksn_duplicate(const jksn_t *object) {
-    jksn_t *result = object ? jksn_malloc(sizeof (jksn_t)) : NULL;
+static jksn_t *jksn_duplicate(const jksn_t *object, const jksn_allocator *allocator) {
+    jksn_t *result = object ? jksn_tree_malloc(allocator, sizeof (jksn_t)) : NULL;
     if(result) {
         size_t i;
         *result = *object;
         switch(object->data_type) {
         case JKSN_STRING:
-            result->data_string.str = jksn_malloc(object->data_string.size + 1);
+            result->data_string.str = jksn_tree_malloc(allocator, object->data_string.size + 1);
             if(!result->data_string.str) {
-                free(result);
-                result = NULL;
+                jksn_tree_free(allocator, result);
+                return NULL;
             }
             memcpy(result->data_string.str, object->data_string.str, object->data_string.size);
             result->data_string.str[object->data_string.size] = '\0';
             break;
         case JKSN_BLOB:
-            result->data_blob.buf = jksn_malloc(object->data_blob.size + 1);
+            result->data_blob.buf = jksn_tree_malloc(allocator, object->data_blob.size + 1);
             if(!result->data_blob.buf) {
-                free(result);
-                result = NULL;
+                jksn_tree_free(allocator, result);
+                return NULL;
             }
             memcpy(result->data_blob.buf, object->data_blob.buf, object->data_blob.size);
             result->data_blob.buf[object->data_blob.size] = '\0';
             break;
         case JKSN_ARRAY:
-            result->data_array.children = jksn_calloc(object->data_array.size, sizeof (jksn_t *));
+            result->data_array.children = jksn_tree_calloc(allocator, object->data_array.size, sizeof (jksn_t *));
             if(!result->data_array.children) {
-                free(result);
-                result = NULL;
+                jksn_tree_free(allocator, result);
+                return NULL;
             }
             for(i = 0; i < object->data_array.size; i++)
-                if(!(result->data_array.children[i] = jksn_duplicate(object->data_array.children[i]))) {
-                    result = jksn_free(result);
+                if(!(result->data_array.children[i] = jksn_duplicate(object->data_array.children[i], allocator))) {
+                    result = jksn_free_with_allocator(result, allocator);
                     break;
                 }
             break;
         case JKSN_OBJECT:
-            result->data_object.children = jksn_calloc(object->data_object.size, sizeof (jksn_keyvalue));
+            result->data_object.children = jksn_tree_calloc(allocator, object->data_object.size, sizeof (jksn_keyvalue));
             if(!result->data_object.children) {
-                free(result);
-                result = NULL;
+                jksn_tree_free(allocator, result);
+                return NULL;
             }
             for(i = 0; i < object->data_object.size; i++) {
-                if(!(result->data_object.children[i].key = jksn_duplicate(object->data_object.children[i].key))) {
-                    result = jksn_free(result);
+                if(!(result->data_object.children[i].key = jksn_duplicate(object->data_object.children[i].key, allocator))) {
+                    result = jksn_free_with_allocator(result, allocator);
                     break;
                 }
-                if(!(result->data_object.children[i].value = jksn_duplicate(object->data_object.children[i].value))) {
-                    result = jksn_free(result);
+                if(!(result->data_object.children[i].value = jksn_duplicate(object->data_object.children[i].value, allocator))) {
+                    result = jksn_free_with_allocator(result, allocator);
                     break;
                 }
             }
@@ -2440,6 +3539,460 @@ static inline int jksn_is_little_endian(void) {
     return endiantest.byte == 1;
 }
 
+jksn_t *jksn_object_get(const jksn_t *object, const jksn_t *key) {
+    size_t i;
+    if(!object || !key || object->data_type != JKSN_OBJECT)
+        return NULL;
+    for(i = object->data_object.size; i--; )
+        if(!jksn_compare(object->data_object.children[i].key, key))
+            return object->data_object.children[i].value;
+    return NULL;
+}
+
+jksn_t *jksn_object_get_str(const jksn_t *object, const char *key) {
+    jksn_t key_object;
+    if(!key)
+        return NULL;
+    key_object.data_type = JKSN_STRING;
+    key_object.data_string.size = strlen(key);
+    key_object.data_string.str = (char *) key;
+    return jksn_object_get(object, &key_object);
+}
+
+jksn_object_index *jksn_object_index_new(const jksn_t *object) {
+    jksn_object_index *index;
+    size_t capacity = 16;
+    size_t i;
+    if(!object || object->data_type != JKSN_OBJECT)
+        return NULL;
+    /* At most half full */
+    while(capacity / 2 < object->data_object.size)
+        capacity *= 2;
+    index = jksn_calloc(1, sizeof (jksn_object_index) + (capacity - 1) * sizeof (size_t));
+    if(!index)
+        return NULL;
+    index->object = object;
+    index->mask = capacity - 1;
+    for(i = 0; i < object->data_object.size; i++) {
+        const jksn_t *key = object->data_object.children[i].key;
+        size_t slot = jksn_value_hash(key) & index->mask;
+        /* A repeated key takes over the slot of the earlier one */
+        while(index->slots[slot] && jksn_compare(object->data_object.children[index->slots[slot] - 1].key, key))
+            slot = (slot + 1) & index->mask;
+        index->slots[slot] = i + 1;
+    }
+    return index;
+}
+
+jksn_object_index *jksn_object_index_free(jksn_object_index *index) {
+    free(index);
+    return NULL;
+}
+
+jksn_t *jksn_object_index_get(const jksn_object_index *index, const jksn_t *key) {
+    if(!index || !key)
+        return NULL;
+    return jksn_object_find(index, key, jksn_value_hash(key));
+}
+
+jksn_t *jksn_object_index_get_str(const jksn_object_index *index, const char *key) {
+    jksn_t key_object;
+    if(!index || !key)
+        return NULL;
+    key_object.data_type = JKSN_STRING;
+    key_object.data_string.size = strlen(key);
+    key_object.data_string.str = (char *) key;
+    return jksn_object_find(index, &key_object, jksn_key_hash(JKSN_STRING, key, key_object.data_string.size));
+}
+
+static jksn_t *jksn_object_find(const jksn_object_index *index, const jksn_t *key, size_t hash) {
+    const jksn_t *object = index->object;
+    size_t slot = hash & index->mask;
+    while(index->slots[slot]) {
+        const jksn_keyvalue *member = &object->data_object.children[index->slots[slot] - 1];
+        if(!jksn_compare(member->key, key))
+            return member->value;
+        slot = (slot + 1) & index->mask;
+    }
+    return NULL;
+}
+
+/* FNV-1a, consistent with jksn_compare for the key types an object can hold */
+static size_t jksn_key_hash(jksn_data_type type, const char *buf, size_t size) {
+    uint64_t result = 14695981039346656037ULL ^ (uint64_t) type;
+    size_t i;
+    for(i = 0; i < size; i++)
+        result = (result ^ (uint8_t) buf[i]) * 1099511628211ULL;
+    return (size_t) (result ^ (result >> 32));
+}
+
+static size_t jksn_value_hash(const jksn_t *object) {
+    switch(object->data_type) {
+    case JKSN_BOOL:
+        return jksn_key_hash(JKSN_BOOL, object->data_bool ? "\1" : "", object->data_bool ? 1 : 0);
+    case JKSN_INT:
+        return jksn_key_hash(JKSN_INT, (const char *) &object->data_int, sizeof object->data_int);
+    case JKSN_FLOAT:
+    case JKSN_DOUBLE:
+    case JKSN_LONG_DOUBLE:
+        {
+            /* -0.0 equals 0.0, NaN equals nothing and may go anywhere */
+            double number = object->data_type == JKSN_FLOAT ? (double) object->data_float :
+                            object->data_type == JKSN_DOUBLE ? object->data_double : (double) object->data_long_double;
+            if(number == 0)
+                number = 0;
+            return jksn_key_hash(object->data_type, (const char *) &number, sizeof number);
+        }
+    case JKSN_STRING:
+        return jksn_key_hash(JKSN_STRING, object->data_string.str, object->data_string.size);
+    case JKSN_BLOB:
+        return jksn_key_hash(JKSN_BLOB, object->data_blob.buf, object->data_blob.size);
+    default:
+        return jksn_key_hash(object->data_type, NULL, 0);
+    }
+}
+
+int jksn_block_writer_new(jksn_block_writer **result, FILE *fp, int append) {
+    jksn_error_message_no retval = JKSN_EOK;
+    jksn_block_writer *writer = jksn_calloc(1, sizeof (jksn_block_writer));
+    *result = NULL;
+    if(!writer)
+        return JKSN_ENOMEM;
+    writer->fp = fp;
+    if(append) {
+        /* New blocks overwrite the old index, a longer one is written on close */
+        retval = jksn_block_read_index(fp, &writer->entries, &writer->count, &writer->offset);
+        writer->capacity = writer->count;
+    } else {
+        writer->offset = sizeof jksn_block_magic;
+        if(fseek(fp, 0, SEEK_SET) != 0 || fwrite(jksn_block_magic, 1, sizeof jksn_block_magic, fp) != sizeof jksn_block_magic)
+            retval = JKSN_EIO;
+    }
+    if(retval != JKSN_EOK) {
+        free(writer->entries);
+        free(writer);
+        return retval;
+    }
+    *result = writer;
+    return JKSN_EOK;
+}
+
+int jksn_block_write(jksn_block_writer *writer, const jksn_t *records) {
+    jksn_blobstring *stream = NULL;
+    char checksum[5];
+    uint32_t crc;
+    int retval;
+    if(!records || records->data_type != JKSN_ARRAY)
+        return JKSN_ETYPE;
+    if(writer->count == writer->capacity) {
+        size_t new_capacity = writer->capacity != 0 ? writer->capacity*2 : 16;
+        struct jksn_block_entry *tmpptr = jksn_realloc(writer->entries, new_capacity * sizeof (struct jksn_block_entry));
+        if(!tmpptr)
+            return JKSN_ENOMEM;
+        writer->entries = tmpptr;
+        writer->capacity = new_capacity;
+    }
+    /* Without a cache, the block refers to no hash or integer of the blocks before */
+    retval = jksn_dump(records, &stream, 0, NULL);
+    if(retval != JKSN_EOK)
+        return retval;
+    crc = jksn_crc32(stream->buf, stream->size);
+    checksum[0] = (char) 0xf1;
+    checksum[1] = (char) (uint8_t) (crc >> 24);
+    checksum[2] = (char) (uint8_t) (crc >> 16);
+    checksum[3] = (char) (uint8_t) (crc >> 8);
+    checksum[4] = (char) (uint8_t) crc;
+    if(jksn_block_seek(writer->fp, writer->offset) != JKSN_EOK ||
+       fwrite(checksum, 1, sizeof checksum, writer->fp) != sizeof checksum ||
+       fwrite(stream->buf, 1, stream->size, writer->fp) != stream->size)
+        retval = JKSN_EIO;
+    else {
+        struct jksn_block_entry *entry = &writer->entries[writer->count];
+        entry->offset = writer->offset;
+        entry->size = sizeof checksum + stream->size;
+        entry->records = records->data_array.size;
+        entry->first = writer->count != 0 ? entry[-1].first + entry[-1].records : 0;
+        writer->offset += entry->size;
+        writer->count++;
+    }
+    jksn_blobstring_free(stream);
+    return retval;
+}
+
+int jksn_block_writer_close(jksn_block_writer *writer) {
+    jksn_error_message_no retval = JKSN_EOK;
+    if(writer) {
+        if(jksn_block_seek(writer->fp, writer->offset) != JKSN_EOK)
+            retval = JKSN_EIO;
+        else
+            retval = jksn_block_write_index(writer->fp, writer->entries, writer->count);
+        free(writer->entries);
+        free(writer);
+    }
+    return retval;
+}
+
+int jksn_block_reader_new(jksn_block_reader **result, FILE *fp) {
+    jksn_error_message_no retval;
+    uint64_t end;
+    jksn_block_reader *reader = jksn_calloc(1, sizeof (jksn_block_reader));
+    *result = NULL;
+    if(!reader)
+        return JKSN_ENOMEM;
+    reader->fp = fp;
+    retval = jksn_block_read_index(fp, &reader->entries, &reader->count, &end);
+    if(retval != JKSN_EOK) {
+        free(reader);
+        return retval;
+    }
+    *result = reader;
+    return JKSN_EOK;
+}
+
+jksn_block_reader *jksn_block_reader_free(jksn_block_reader *reader) {
+    if(reader) {
+        free(reader->entries);
+        free(reader->buffer.buf);
+        free(reader);
+    }
+    return NULL;
+}
+
+size_t jksn_block_count(const jksn_block_reader *reader) {
+    return reader->count;
+}
+
+uint64_t jksn_block_record_count(const jksn_block_reader *reader) {
+    if(reader->count != 0)
+        return reader->entries[reader->count-1].first + reader->entries[reader->count-1].records;
+    else
+        return 0;
+}
+
+int jksn_block_info(const jksn_block_reader *reader, size_t block, uint64_t *offset, uint64_t *size, uint64_t *records) {
+    if(block >= reader->count)
+        return JKSN_ERANGE;
+    if(offset)
+        *offset = reader->entries[block].offset;
+    if(size)
+        *size = reader->entries[block].size;
+    if(records)
+        *records = reader->entries[block].records;
+    return JKSN_EOK;
+}
+
+int jksn_block_load(jksn_block_reader *reader, size_t block, jksn_blobstring **result) {
+    jksn_error_message_no retval;
+    *result = NULL;
+    if(block >= reader->count)
+        return JKSN_ERANGE;
+    if(reader->entries[block].size > (size_t) -1)
+        return JKSN_ENOMEM;
+    *result = jksn_malloc(sizeof (jksn_blobstring));
+    if(!*result)
+        return JKSN_ENOMEM;
+    (*result)->size = (size_t) reader->entries[block].size;
+    (*result)->buf = jksn_malloc((*result)->size);
+    if(!(*result)->buf) {
+        free(*result);
+        *result = NULL;
+        return JKSN_ENOMEM;
+    }
+    retval = jksn_block_fill(reader->fp, &reader->entries[block], (*result)->buf);
+    if(retval != JKSN_EOK)
+        *result = jksn_blobstring_free(*result);
+    return retval;
+}
+
+int jksn_block_parse(const jksn_blobstring *block, jksn_t **result) {
+    jksn_blobstring value;
+    size_t bytes_parsed = 0;
+    uint32_t crc;
+    int retval;
+    *result = NULL;
+    if(block->size < 5 || (uint8_t) block->buf[0] != 0xf1)
+        return JKSN_EARCHIVE;
+    crc = (uint32_t) (uint8_t) block->buf[1] << 24 | (uint32_t) (uint8_t) block->buf[2] << 16 |
+          (uint32_t) (uint8_t) block->buf[3] << 8 | (uint32_t) (uint8_t) block->buf[4];
+    value.size = block->size - 5;
+    value.buf = block->buf + 5;
+    if(jksn_crc32(value.buf, value.size) != crc)
+        return JKSN_ECHECKSUM;
+    retval = jksn_parse(&value, result, &bytes_parsed, NULL);
+    if(retval == JKSN_EOK && ((*result)->data_type != JKSN_ARRAY || bytes_parsed != value.size)) {
+        *result = jksn_free(*result);
+        retval = JKSN_EARCHIVE;
+    }
+    return retval;
+}
+
+int jksn_block_read(jksn_block_reader *reader, size_t block, jksn_t **result) {
+    jksn_error_message_no retval;
+    *result = NULL;
+    if(block >= reader->count)
+        return JKSN_ERANGE;
+    if(reader->entries[block].size > (size_t) -1)
+        return JKSN_ENOMEM;
+    if(reader->buffer_capacity < reader->entries[block].size) {
+        char *tmpptr = jksn_realloc(reader->buffer.buf, (size_t) reader->entries[block].size);
+        if(!tmpptr)
+            return JKSN_ENOMEM;
+        reader->buffer.buf = tmpptr;
+        reader->buffer_capacity = (size_t) reader->entries[block].size;
+    }
+    reader->buffer.size = (size_t) reader->entries[block].size;
+    retval = jksn_block_fill(reader->fp, &reader->entries[block], reader->buffer.buf);
+    if(retval != JKSN_EOK)
+        return retval;
+    retval = jksn_block_parse(&reader->buffer, result);
+    if(retval == JKSN_EOK && (*result)->data_array.size != reader->entries[block].records) {
+        *result = jksn_free(*result);
+        retval = JKSN_EARCHIVE;
+    }
+    return retval;
+}
+
+int jksn_block_read_record(jksn_block_reader *reader, uint64_t record, jksn_t **result) {
+    size_t low = 0;
+    size_t high = reader->count;
+    size_t index;
+    jksn_t *block = NULL;
+    int retval;
+    *result = NULL;
+    if(record >= jksn_block_record_count(reader))
+        return JKSN_ERANGE;
+    /* The last block starting at or before the record holds it, empty blocks are passed over */
+    while(high - low > 1) {
+        size_t middle = low + (high - low)/2;
+        if(reader->entries[middle].first <= record)
+            low = middle;
+        else
+            high = middle;
+    }
+    retval = jksn_block_read(reader, low, &block);
+    if(retval != JKSN_EOK)
+        return retval;
+    index = (size_t) (record - reader->entries[low].first);
+    *result = block->data_array.children[index];
+    block->data_array.children[index] = NULL;
+    jksn_free(block);
+    return JKSN_EOK;
+}
+
+static uint32_t jksn_crc32(const char *buf, size_t size) {
+    /* The CRC-32 of zlib, half a byte at a time */
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+    };
+    uint32_t crc = 0xffffffff;
+    size_t i;
+    for(i = 0; i < size; i++) {
+        crc ^= (uint8_t) buf[i];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+    }
+    return ~crc;
+}
+
+static void jksn_block_encode_u64(char *buf, uint64_t number) {
+    size_t i;
+    for(i = 0; i < 8; i++)
+        buf[i] = (char) (uint8_t) (number >> (56 - i*8));
+}
+
+static uint64_t jksn_block_decode_u64(const char *buf) {
+    uint64_t result = 0;
+    size_t i;
+    for(i = 0; i < 8; i++)
+        result = (result << 8) | (uint8_t) buf[i];
+    return result;
+}
+
+/* Offsets that do not fit in jksn_off_t fail like any other seek */
+static jksn_error_message_no jksn_block_seek(FILE *fp, uint64_t offset) {
+    const uint64_t max_offset = ((uint64_t) 1 << (sizeof (jksn_off_t) * 8 - 1)) - 1;
+    if(offset > max_offset || jksn_fseeko(fp, (jksn_off_t) offset, SEEK_SET) != 0)
+        return JKSN_EIO;
+    return JKSN_EOK;
+}
+
+static jksn_error_message_no jksn_block_read_index(FILE *fp, struct jksn_block_entry **entries, size_t *count, uint64_t *end) {
+    char buf[JKSN_BLOCK_ENTRY_SIZE];
+    jksn_off_t file_size;
+    uint64_t block_count;
+    uint64_t offset = sizeof jksn_block_magic;
+    uint64_t first = 0;
+    size_t i;
+    *entries = NULL;
+    *count = 0;
+    if(jksn_fseeko(fp, 0, SEEK_END) != 0 || (file_size = jksn_ftello(fp)) < 0)
+        return JKSN_EIO;
+    if((uint64_t) file_size < sizeof jksn_block_magic + JKSN_BLOCK_TRAILER_SIZE)
+        return JKSN_EARCHIVE;
+    if(fseek(fp, 0, SEEK_SET) != 0 || fread(buf, 1, sizeof jksn_block_magic, fp) != sizeof jksn_block_magic)
+        return JKSN_EIO;
+    if(memcmp(buf, jksn_block_magic, sizeof jksn_block_magic) != 0)
+        return JKSN_EARCHIVE;
+    if(jksn_block_seek(fp, (uint64_t) file_size - JKSN_BLOCK_TRAILER_SIZE) != JKSN_EOK || fread(buf, 1, JKSN_BLOCK_TRAILER_SIZE, fp) != JKSN_BLOCK_TRAILER_SIZE)
+        return JKSN_EIO;
+    if(memcmp(buf + 8, jksn_block_trailer, sizeof jksn_block_trailer) != 0)
+        return JKSN_EARCHIVE;
+    block_count = jksn_block_decode_u64(buf);
+    if(block_count > ((uint64_t) file_size - sizeof jksn_block_magic - JKSN_BLOCK_TRAILER_SIZE) / JKSN_BLOCK_ENTRY_SIZE)
+        return JKSN_EARCHIVE;
+    *end = (uint64_t) file_size - JKSN_BLOCK_TRAILER_SIZE - block_count * JKSN_BLOCK_ENTRY_SIZE;
+    if(jksn_block_seek(fp, *end) != JKSN_EOK)
+        return JKSN_EIO;
+    *entries = jksn_malloc((size_t) block_count * sizeof (struct jksn_block_entry));
+    if(!*entries)
+        return JKSN_ENOMEM;
+    for(i = 0; i < (size_t) block_count; i++) {
+        struct jksn_block_entry *entry = &(*entries)[i];
+        if(fread(buf, 1, JKSN_BLOCK_ENTRY_SIZE, fp) != JKSN_BLOCK_ENTRY_SIZE)
+            break;
+        entry->offset = jksn_block_decode_u64(buf);
+        entry->size = jksn_block_decode_u64(buf + 8);
+        entry->records = jksn_block_decode_u64(buf + 16);
+        entry->first = first;
+        /* Blocks are in file order and lie between the magic and the index */
+        if(entry->offset < offset || entry->offset > *end || entry->size > *end - entry->offset || entry->records > (uint64_t) -1 - first)
+            break;
+        offset = entry->offset + entry->size;
+        first += entry->records;
+    }
+    if(i != (size_t) block_count) {
+        free(*entries);
+        *entries = NULL;
+        return ferror(fp) ? JKSN_EIO : JKSN_EARCHIVE;
+    }
+    *count = (size_t) block_count;
+    return JKSN_EOK;
+}
+
+static jksn_error_message_no jksn_block_write_index(FILE *fp, const struct jksn_block_entry *entries, size_t count) {
+    char buf[JKSN_BLOCK_ENTRY_SIZE];
+    size_t i;
+    for(i = 0; i < count; i++) {
+        jksn_block_encode_u64(buf, entries[i].offset);
+        jksn_block_encode_u64(buf + 8, entries[i].size);
+        jksn_block_encode_u64(buf + 16, entries[i].records);
+        if(fwrite(buf, 1, JKSN_BLOCK_ENTRY_SIZE, fp) != JKSN_BLOCK_ENTRY_SIZE)
+            return JKSN_EIO;
+    }
+    jksn_block_encode_u64(buf, count);
+    memcpy(buf + 8, jksn_block_trailer, sizeof jksn_block_trailer);
+    if(fwrite(buf, 1, JKSN_BLOCK_TRAILER_SIZE, fp) != JKSN_BLOCK_TRAILER_SIZE || fflush(fp) != 0)
+        return JKSN_EIO;
+    return JKSN_EOK;
+}
+
+static jksn_error_message_no jksn_block_fill(FILE *fp, const struct jksn_block_entry *entry, char *buf) {
+    if(jksn_block_seek(fp, entry->offset) != JKSN_EOK || fread(buf, 1, (size_t) entry->size, fp) != (size_t) entry->size)
+        return JKSN_EIO;
+    return JKSN_EOK;
+}
+
 const char *jksn_errcode(int errcode) {
     if(errcode >= 0 && (size_t) errcode < sizeof jksn_error_messages/sizeof jksn_error_messages[0])
         return jksn_error_messages[errcode];
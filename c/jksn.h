@@ -23,6 +23,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 typedef struct {
     size_t size;
@@ -81,16 +82,213 @@ typedef struct jksn_t {
 
 typedef struct jksn_cache jksn_cache;
 
+/*
+  Allocator used for the nodes, strings and children arrays of a parsed
+  tree. `malloc` and `realloc` are required. `free` may be NULL if the
+  memory is released in bulk (e.g. by an arena); jksn_free_with_allocator
+  then returns without walking the tree.
+*/
+typedef struct jksn_allocator {
+    void *(*malloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *ptr, size_t size);
+    void (*free)(void *ctx, void *ptr);
+    void *ctx;
+} jksn_allocator;
+
+typedef struct jksn_arena jksn_arena;
+
+/* Flags of jksn_parse_with_flags */
+enum {
+    /*
+      UTF-8 strings and blobs point into the buffer instead of being
+      copied, and are not NUL-terminated. The buffer must outlive the
+      tree, which is freed with jksn_free_borrowed. UTF-16 strings and
+      back-references are still copied.
+    */
+    JKSN_PARSE_BORROW = 1
+};
+
+/* A piece of scatter-gather output, see jksn_dump_segments */
+typedef struct jksn_segment {
+    const char *data;
+    size_t size;
+} jksn_segment;
+
+typedef struct jksn_object_index jksn_object_index;
+typedef struct jksn_block_writer jksn_block_writer;
+typedef struct jksn_block_reader jksn_block_reader;
+
+/* Control byte families, after hashing and delta encoding */
+typedef enum {
+    JKSN_FAMILY_CONSTANT, /* undefined, null, booleans, NaN, infinities, unspecified */
+    JKSN_FAMILY_INT,
+    JKSN_FAMILY_DELTA_INT,
+    JKSN_FAMILY_FLOAT, /* float, double and long double */
+    JKSN_FAMILY_UTF16,
+    JKSN_FAMILY_UTF8,
+    JKSN_FAMILY_BLOB,
+    JKSN_FAMILY_TEXT_HASH, /* back-references to a remembered string */
+    JKSN_FAMILY_BLOB_HASH,
+    JKSN_FAMILY_ARRAY,
+    JKSN_FAMILY_SWAPPED_ARRAY,
+    JKSN_FAMILY_OBJECT,
+    JKSN_FAMILY_OTHER,
+    JKSN_FAMILY_COUNT
+} jksn_family;
+
+/*
+  How hard jksn_dump and jksn_dump_into look for a smaller encoding.
+  JKSN_EFFORT_FASTEST writes every value as it is, without swapped arrays,
+  UTF-16 strings, delta integers or back-references. The default,
+  JKSN_EFFORT_BALANCED, tries all of them. JKSN_EFFORT_SMALLEST also
+  compares whole subtrees when choosing how to lay out an array.
+*/
+typedef enum {
+    JKSN_EFFORT_FASTEST,
+    JKSN_EFFORT_BALANCED,
+    JKSN_EFFORT_SMALLEST
+} jksn_effort;
+
+/*
+  Counters for tuning payloads, collected by jksn_dump and jksn_dump_into
+  with a cache they are attached to. They add up over every dump until
+  cleared with memset. Times are wall time on the monotonic clock.
+*/
+typedef struct jksn_encode_stats {
+    /* The bytes of arrays and objects do not include their children */
+    uint64_t values[JKSN_FAMILY_COUNT];
+    uint64_t bytes[JKSN_FAMILY_COUNT];
+    /* Strings longer than one byte looked up in the hashtables. A collision is a miss that evicts another string */
+    uint64_t text_hits;
+    uint64_t text_misses;
+    uint64_t text_collisions;
+    uint64_t blob_hits;
+    uint64_t blob_misses;
+    uint64_t blob_collisions;
+    /* Swapped layouts tried for arrays in the output, and their size against a straight array before hashing */
+    uint64_t swap_candidates;
+    uint64_t swaps;
+    int64_t swap_bytes_saved;
+    uint64_t dumps;
+    uint64_t build_ns;
+    uint64_t optimize_ns;
+    uint64_t output_ns;
+} jksn_encode_stats;
+
+/*
+  Process-wide counters of a library built with JKSN_INSTRUMENT defined,
+  for metrics agents to poll from any thread. Without it nothing is
+  counted, and jksn_instrument_snapshot returns 0 and fills in zeros.
+*/
+typedef struct jksn_instrument_counters {
+    uint64_t allocations; /* heap calls by the library, and calls through a user jksn_allocator */
+    uint64_t allocated_bytes;
+    uint64_t arena_allocations; /* bumps in arenas, whose blocks count as allocations */
+    uint64_t arena_allocated_bytes;
+    uint64_t parse_values[JKSN_FAMILY_COUNT]; /* control bytes read, by family */
+    uint64_t utf8_to_utf16_bytes; /* input bytes of each conversion */
+    uint64_t utf16_to_utf8_bytes;
+    uint64_t encode_calls;
+    uint64_t encode_ns;
+    uint64_t decode_calls;
+    uint64_t decode_ns;
+} jksn_instrument_counters;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 jksn_cache *jksn_cache_new(void);
+jksn_cache *jksn_cache_new_with_allocator(const jksn_allocator *allocator);
 jksn_cache *jksn_cache_free(jksn_cache *cache);
+/* The cache does not own stats, NULL stops collecting */
+void jksn_cache_set_stats(jksn_cache *cache, jksn_encode_stats *stats);
+/* JKSN_EFFORT_BALANCED by default */
+void jksn_cache_set_effort(jksn_cache *cache, jksn_effort effort);
+/* Once a dump has taken this much wall time, the rest of it is written as with JKSN_EFFORT_FASTEST. 0 means no limit */
+void jksn_cache_set_time_budget(jksn_cache *cache, uint64_t microseconds);
+const char *jksn_family_name(jksn_family family);
+int jksn_encode_stats_print(const jksn_encode_stats *stats, FILE *fp);
+/*bool*/ int jksn_instrument_snapshot(jksn_instrument_counters *result);
+void jksn_instrument_reset(void);
 int jksn_dump(const jksn_t *object, jksn_blobstring **result, /*bool*/ int header, jksn_cache *cache);
+/*
+  Writes into a caller-provided buffer. If it is too small, returns nonzero
+  and sets *written to the size needed. That size is exact without a cache.
+  With a cache it is an upper bound, so the cache is left untouched on
+  failure. A reused cache also reuses its scratch memory.
+*/
+int jksn_dump_into(const jksn_t *object, char *buffer, size_t capacity, size_t *written, /*bool*/ int header, jksn_cache *cache);
+/*
+  Scatter-gather output, for writev or sendmsg. Strings and blobs of at
+  least min_size bytes are not copied: their segments point into object,
+  which must be kept alive and unchanged until they are written, and such
+  strings stay UTF-8. The other segments point into *storage. Free
+  *segments with free and *storage with jksn_blobstring_free.
+*/
+int jksn_dump_segments(const jksn_t *object, jksn_segment **segments, size_t *count, jksn_blobstring **storage, size_t min_size, /*bool*/ int header, jksn_cache *cache);
+/*
+  Many messages into one buffer: message i is the bytes from (*offsets)[i]
+  to (*offsets)[i + 1], and the table has count + 1 entries. With shared
+  set, later messages may refer to the strings and the last integer of
+  earlier ones, and must be decoded in order with one cache. Otherwise
+  the cache forgets them before each message, so each decodes on its own.
+  Free *result with jksn_blobstring_free and *offsets with free.
+*/
+int jksn_dump_batch(const jksn_t *const *objects, size_t count, jksn_blobstring **result, size_t **offsets, /*bool*/ int header, /*bool*/ int shared, jksn_cache *cache);
 int jksn_parse(const jksn_blobstring *buffer, jksn_t **result, size_t *bytes_parsed, jksn_cache *cache);
+int jksn_parse_with_allocator(const jksn_blobstring *buffer, jksn_t **result, size_t *bytes_parsed, jksn_cache *cache, const jksn_allocator *allocator);
+int jksn_parse_with_flags(const jksn_blobstring *buffer, jksn_t **result, size_t *bytes_parsed, jksn_cache *cache, const jksn_allocator *allocator, unsigned flags);
 jksn_t *jksn_free(jksn_t *object);
+jksn_t *jksn_free_with_allocator(jksn_t *object, const jksn_allocator *allocator);
+/* Frees a tree parsed with JKSN_PARSE_BORROW, but not the strings and blobs inside buffer */
+jksn_t *jksn_free_borrowed(jksn_t *object, const jksn_blobstring *buffer, const jksn_allocator *allocator);
+jksn_arena *jksn_arena_new(size_t block_size);
+jksn_arena *jksn_arena_free(jksn_arena *arena);
+void jksn_arena_reset(jksn_arena *arena);
+const jksn_allocator *jksn_arena_allocator(jksn_arena *arena);
 jksn_blobstring *jksn_blobstring_free(jksn_blobstring *blobstring);
+/*
+  Member lookup, NULL if object is not an object or has no such key. If
+  a key is repeated, the last member wins. The members are scanned.
+*/
+jksn_t *jksn_object_get(const jksn_t *object, const jksn_t *key);
+jksn_t *jksn_object_get_str(const jksn_t *object, const char *key);
+/*
+  A hash index over the members of an object that is looked up many
+  times, kept apart from the tree. It refers to object, so build a new
+  one after changing the members, and free it before the object.
+  jksn_object_index_new returns NULL if object is not an object or out
+  of memory.
+*/
+jksn_object_index *jksn_object_index_new(const jksn_t *object);
+jksn_object_index *jksn_object_index_free(jksn_object_index *index);
+jksn_t *jksn_object_index_get(const jksn_object_index *index, const jksn_t *key);
+jksn_t *jksn_object_index_get_str(const jksn_object_index *index, const char *key);
+/*
+  Block archives hold many records in blocks that decode on their own,
+  followed by an index of where each block is. fp must be opened in
+  binary mode, for both reading and writing if append is nonzero.
+  jksn_block_write stores the items of an array as one block, and
+  jksn_block_writer_close writes the index and frees the writer.
+*/
+int jksn_block_writer_new(jksn_block_writer **result, FILE *fp, /*bool*/ int append);
+int jksn_block_write(jksn_block_writer *writer, const jksn_t *records);
+int jksn_block_writer_close(jksn_block_writer *writer);
+int jksn_block_reader_new(jksn_block_reader **result, FILE *fp);
+jksn_block_reader *jksn_block_reader_free(jksn_block_reader *reader);
+size_t jksn_block_count(const jksn_block_reader *reader);
+uint64_t jksn_block_record_count(const jksn_block_reader *reader);
+int jksn_block_info(const jksn_block_reader *reader, size_t block, uint64_t *offset, uint64_t *size, uint64_t *records);
+/*
+  jksn_block_read returns a block as an array, jksn_block_read_record one
+  record of the whole archive. To decode blocks in parallel, load them
+  with jksn_block_load, then call jksn_block_parse from any thread.
+*/
+int jksn_block_read(jksn_block_reader *reader, size_t block, jksn_t **result);
+int jksn_block_read_record(jksn_block_reader *reader, uint64_t record, jksn_t **result);
+int jksn_block_load(jksn_block_reader *reader, size_t block, jksn_blobstring **result);
+int jksn_block_parse(const jksn_blobstring *block, jksn_t **result);
 const char *jksn_errcode(int errcode);
 
 #ifdef __cplusplus
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "jksn.h"
+
+static jksn_t *new_value(jksn_data_type type) {
+    jksn_t *value = calloc(1, sizeof (jksn_t));
+    value->data_type = type;
+    return value;
+}
+
+static jksn_t *new_int(intmax_t number) {
+    jksn_t *value = new_value(JKSN_INT);
+    value->data_int = number;
+    return value;
+}
+
+static jksn_t *new_string(const char *str) {
+    jksn_t *value = new_value(JKSN_STRING);
+    value->data_string.size = strlen(str);
+    value->data_string.str = malloc(value->data_string.size + 1);
+    memcpy(value->data_string.str, str, value->data_string.size + 1);
+    return value;
+}
+
+static jksn_t *new_array(size_t size) {
+    jksn_t *value = new_value(JKSN_ARRAY);
+    value->data_array.size = size;
+    value->data_array.children = calloc(size, sizeof (jksn_t *));
+    return value;
+}
+
+static jksn_t *new_record(size_t i) {
+    static const char *keys[] = {"id", "name", "score", "active", "tags"};
+    char buf[32];
+    size_t j;
+    jksn_t *value = new_value(JKSN_OBJECT);
+    value->data_object.size = 5;
+    value->data_object.children = calloc(5, sizeof (jksn_keyvalue));
+    for(j = 0; j < 5; j++)
+        value->data_object.children[j].key = new_string(keys[j]);
+    value->data_object.children[0].value = new_int((intmax_t) i);
+    snprintf(buf, sizeof buf, "user_%u", (unsigned) (i % 1000));
+    value->data_object.children[1].value = new_string(buf);
+    value->data_object.children[2].value = new_value(JKSN_DOUBLE);
+    value->data_object.children[2].value->data_double = (double) i * 0.25;
+    value->data_object.children[3].value = new_value(JKSN_BOOL);
+    value->data_object.children[3].value->data_bool = i % 3 != 0;
+    value->data_object.children[4].value = new_array(2);
+    snprintf(buf, sizeof buf, "tag_%u", (unsigned) (i % 7));
+    value->data_object.children[4].value->data_array.children[0] = new_string(buf);
+    value->data_object.children[4].value->data_array.children[1] = new_int((intmax_t) (i % 100));
+    return value;
+}
+
+static void bench(const char *name, const jksn_blobstring *stream, int rounds) {
+    clock_t start = clock();
+    clock_t stop;
+    long us;
+    int i;
+    for(i = 0; i < rounds; i++) {
+        jksn_t *result = NULL;
+        int retval = jksn_parse(stream, &result, NULL, NULL);
+        if(retval) {
+            printf("%s: %s\n", name, jksn_errcode(retval));
+            return;
+        }
+        jksn_free(result);
+    }
+    stop = clock();
+    us = (long) ((double) (stop - start) * 1000000.0 / CLOCKS_PER_SEC) / rounds;
+    printf("%s: %u bytes, %ld us per parse, %g MB/s\n", name, (unsigned) stream->size, us, us ? (double) stream->size / (double) us : 0.0);
+}
+
+static void bench_value(const char *name, jksn_t *value, int rounds) {
+    jksn_blobstring *stream = NULL;
+    int retval = jksn_dump(value, &stream, 0, NULL);
+    if(retval) {
+        printf("%s: %s\n", name, jksn_errcode(retval));
+        return;
+    }
+    bench(name, stream, rounds);
+    jksn_blobstring_free(stream);
+}
+
+int main(void) {
+    static const size_t records = 20000;
+    static const size_t depth = 1000000;
+    jksn_t *table = new_array(records);
+    jksn_t *wrapped = new_array(records);
+    jksn_t *ints = new_array(200000);
+    jksn_blobstring deep;
+    size_t i;
+    /* Plain arrays of objects, not swapped, to exercise the per-value path */
+    for(i = 0; i < records; i++) {
+        wrapped->data_array.children[i] = new_array(1);
+        wrapped->data_array.children[i]->data_array.children[0] = new_record(i);
+    }
+    bench_value("records", wrapped, 10);
+    for(i = 0; i < records; i++)
+        table->data_array.children[i] = new_record(i);
+    bench_value("swapped records", table, 10);
+    for(i = 0; i < ints->data_array.size; i++)
+        ints->data_array.children[i] = new_int((intmax_t) (i * 37 % 1000));
+    bench_value("integers", ints, 10);
+    /* Nesting deep enough to overflow a recursive decoder */
+    deep.size = depth + 1;
+    deep.buf = malloc(deep.size);
+    memset(deep.buf, 0x81, depth);
+    deep.buf[depth] = (char) 0x80;
+    bench("deep nesting", &deep, 1);
+    free(deep.buf);
+    jksn_free(wrapped);
+    jksn_free(table);
+    jksn_free(ints);
+    return 0;
+}
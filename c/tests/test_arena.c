@@ -0,0 +1,39 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "jksn.h"
+
+char buf[4096];
+
+int main(void) {
+    int retval;
+    int round;
+    jksn_blobstring bufin = { .size = 0, .buf = buf };
+    jksn_blobstring *bufout[2];
+    jksn_t *result;
+    size_t bytes_parsed;
+    jksn_arena *arena = jksn_arena_new(64);
+    assert(arena);
+    bufin.size = fread(bufin.buf, 1, 4096, stdin);
+    /* The second round reuses the blocks kept by jksn_arena_reset */
+    for(round = 0; round < 2; round++) {
+        retval = jksn_parse_with_allocator(&bufin, &result, &bytes_parsed, NULL, jksn_arena_allocator(arena));
+        if(retval != 0) {
+            fprintf(stderr, "Parse error %d: %s\n", retval, jksn_errcode(retval));
+            return retval;
+        }
+        assert(bufin.size == bytes_parsed);
+        retval = jksn_dump(result, &bufout[round], 1, NULL);
+        if(retval != 0) {
+            fprintf(stderr, "Dump error %d: %s\n", retval, jksn_errcode(retval));
+            return retval;
+        }
+        jksn_arena_reset(arena);
+    }
+    assert(bufout[0]->size == bufout[1]->size && memcmp(bufout[0]->buf, bufout[1]->buf, bufout[0]->size) == 0);
+    fwrite(bufout[0]->buf, 1, bufout[0]->size, stdout);
+    bufout[0] = jksn_blobstring_free(bufout[0]);
+    bufout[1] = jksn_blobstring_free(bufout[1]);
+    arena = jksn_arena_free(arena);
+    return retval;
+}
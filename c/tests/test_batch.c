@@ -0,0 +1,77 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jksn.h"
+
+jksn_t key[] = {
+    { JKSN_STRING, { .data_string = { 4, "type" } } },
+    { JKSN_STRING, { .data_string = { 3, "seq" } } }
+};
+
+jksn_t type = { JKSN_STRING, { .data_string = { 4, "tick" } } };
+
+jksn_t seq[] = {
+    { JKSN_INT, { .data_int = 1000 } },
+    { JKSN_INT, { .data_int = 1001 } },
+    { JKSN_INT, { .data_int = 1002 } }
+};
+
+jksn_keyvalue children[][2] = {
+    { { &key[0], &type }, { &key[1], &seq[0] } },
+    { { &key[0], &type }, { &key[1], &seq[1] } },
+    { { &key[0], &type }, { &key[1], &seq[2] } }
+};
+
+jksn_t messages[] = {
+    { JKSN_OBJECT, { .data_object = { .size = 2, .children = children[0] } } },
+    { JKSN_OBJECT, { .data_object = { .size = 2, .children = children[1] } } },
+    { JKSN_OBJECT, { .data_object = { .size = 2, .children = children[2] } } }
+};
+
+const jksn_t *batch[] = { &messages[0], &messages[1], &messages[2] };
+
+int main(void) {
+    jksn_cache *cache = jksn_cache_new();
+    jksn_cache *single = jksn_cache_new();
+    jksn_cache *parse_cache = jksn_cache_new();
+    jksn_blobstring *result;
+    jksn_blobstring *shared_result;
+    size_t *offsets;
+    size_t *shared_offsets;
+    size_t i;
+    int retval = jksn_dump_batch(batch, 3, &result, &offsets, 1, 0, cache);
+    fprintf(stderr, "retval = %d (%s)\n", retval, jksn_errcode(retval));
+    assert(retval == 0 && offsets[0] == 0 && offsets[3] == result->size);
+    /* Independent messages are what separate caches write */
+    for(i = 0; i < 3; i++) {
+        jksn_blobstring *expected;
+        retval = jksn_dump(batch[i], &expected, 1, NULL);
+        assert(retval == 0 && offsets[i + 1] - offsets[i] == expected->size);
+        assert(!memcmp(result->buf + offsets[i], expected->buf, expected->size));
+        jksn_blobstring_free(expected);
+    }
+    cache = jksn_cache_free(cache);
+    /* Shared ones are what one cache writes, and need one cache to decode */
+    retval = jksn_dump_batch(batch, 3, &shared_result, &shared_offsets, 0, 1, NULL);
+    assert(retval == 0 && shared_result->size < result->size - 9);
+    for(i = 0; i < 3; i++) {
+        jksn_blobstring message = { shared_offsets[i + 1] - shared_offsets[i], shared_result->buf + shared_offsets[i] };
+        jksn_blobstring *expected;
+        jksn_t *parsed;
+        retval = jksn_dump(batch[i], &expected, 0, single);
+        assert(retval == 0 && message.size == expected->size && !memcmp(message.buf, expected->buf, expected->size));
+        retval = jksn_parse(&message, &parsed, NULL, parse_cache);
+        assert(retval == 0 && parsed->data_object.size == 2);
+        jksn_free(parsed);
+        jksn_blobstring_free(expected);
+    }
+    fwrite(result->buf + offsets[2], 1, offsets[3] - offsets[2], stdout);
+    jksn_blobstring_free(shared_result);
+    free(shared_offsets);
+    jksn_blobstring_free(result);
+    free(offsets);
+    jksn_cache_free(parse_cache);
+    jksn_cache_free(single);
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jksn.h"
+
+static jksn_t *new_records(size_t first, size_t size) {
+    /* [first, first+1, ..., first+size-1] */
+    jksn_t *value = calloc(1, sizeof (jksn_t));
+    size_t i;
+    value->data_type = JKSN_ARRAY;
+    value->data_array.size = size;
+    value->data_array.children = calloc(size, sizeof (jksn_t *));
+    for(i = 0; i < size; i++) {
+        value->data_array.children[i] = calloc(1, sizeof (jksn_t));
+        value->data_array.children[i]->data_type = JKSN_INT;
+        value->data_array.children[i]->data_int = (intmax_t) (first + i);
+    }
+    return value;
+}
+
+static void write_blocks(FILE *fp, int append, size_t first, size_t blocks) {
+    jksn_block_writer *writer;
+    size_t i;
+    int retval = jksn_block_writer_new(&writer, fp, append);
+    assert(retval == 0);
+    for(i = 0; i < blocks; i++) {
+        jksn_t *records = new_records(first + i*100, 100);
+        retval = jksn_block_write(writer, records);
+        assert(retval == 0);
+        jksn_free(records);
+    }
+    retval = jksn_block_writer_close(writer);
+    assert(retval == 0);
+}
+
+int main(void) {
+    FILE *fp = tmpfile();
+    jksn_block_reader *reader;
+    jksn_blobstring *block;
+    jksn_t *result;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t records;
+    size_t i;
+    int retval;
+    assert(fp);
+    write_blocks(fp, 0, 0, 3);
+    /* Appending leaves the first blocks where they are */
+    write_blocks(fp, 1, 300, 2);
+    retval = jksn_block_reader_new(&reader, fp);
+    fprintf(stderr, "retval = %d (%s)\n", retval, jksn_errcode(retval));
+    assert(retval == 0);
+    assert(jksn_block_count(reader) == 5 && jksn_block_record_count(reader) == 500);
+    for(i = 0; i < jksn_block_count(reader); i++) {
+        jksn_block_info(reader, i, &offset, &size, &records);
+        printf("block %u: offset %u, %u bytes, %u records\n", (unsigned) i, (unsigned) offset, (unsigned) size, (unsigned) records);
+    }
+    for(i = 0; i < 500; i += 99) {
+        retval = jksn_block_read_record(reader, i, &result);
+        assert(retval == 0 && result->data_type == JKSN_INT && result->data_int == (intmax_t) i);
+        jksn_free(result);
+    }
+    assert(jksn_block_read_record(reader, 500, &result) != 0 && !result);
+    retval = jksn_block_load(reader, 4, &block);
+    assert(retval == 0);
+    retval = jksn_block_parse(block, &result);
+    assert(retval == 0 && result->data_array.size == 100 && result->data_array.children[0]->data_int == 400);
+    jksn_free(result);
+    /* A damaged block fails its checksum */
+    block->buf[block->size-1] ^= 1;
+    retval = jksn_block_parse(block, &result);
+    fprintf(stderr, "retval = %d (%s)\n", retval, jksn_errcode(retval));
+    assert(retval != 0 && !result);
+    jksn_blobstring_free(block);
+    jksn_block_reader_free(reader);
+    fclose(fp);
+    return 0;
+}
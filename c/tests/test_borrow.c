@@ -0,0 +1,58 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "jksn.h"
+
+jksn_t strings[] = {
+    { JKSN_STRING, { .data_string = { 10, "attachment" } } },
+    { JKSN_BLOB, { .data_blob = { 16, "\x89PNG\r\n\x1a\n\0\0\0\rIHDR" } } },
+    { JKSN_STRING, { .data_string = { 6, "\xe5\x90\x8d\xe5\x89\x8d" } } },
+    { JKSN_STRING, { .data_string = { 10, "attachment" } } }
+};
+
+jksn_t *children[] = { &strings[0], &strings[1], &strings[2], &strings[3] };
+
+jksn_t object = {
+    JKSN_ARRAY,
+    {
+        .data_array = {
+            .size = 4,
+            .children = children
+        }
+    }
+};
+
+static int points_into(const char *ptr, const jksn_blobstring *buffer) {
+    return ptr >= buffer->buf && ptr < buffer->buf + buffer->size;
+}
+
+int main(void) {
+    jksn_blobstring *encoded;
+    jksn_blobstring *redumped;
+    jksn_t *result;
+    size_t bytes_parsed;
+    int retval = jksn_dump(&object, &encoded, 1, NULL);
+    assert(retval == 0);
+    retval = jksn_parse_with_flags(encoded, &result, &bytes_parsed, NULL, NULL, JKSN_PARSE_BORROW);
+    fprintf(stderr, "retval = %d (%s)\n", retval, jksn_errcode(retval));
+    assert(retval == 0 && bytes_parsed == encoded->size);
+    /* UTF-8 strings and blobs are borrowed, UTF-16 strings and back-references are copied */
+    assert(points_into(result->data_array.children[0]->data_string.str, encoded));
+    assert(points_into(result->data_array.children[1]->data_blob.buf, encoded));
+    assert(!points_into(result->data_array.children[2]->data_string.str, encoded));
+    assert(!points_into(result->data_array.children[3]->data_string.str, encoded));
+    /* A truncated stream frees what it parsed so far, but not the borrowed bytes */
+    {
+        jksn_blobstring truncated = { encoded->size - 1, encoded->buf };
+        jksn_t *partial;
+        retval = jksn_parse_with_flags(&truncated, &partial, NULL, NULL, NULL, JKSN_PARSE_BORROW);
+        assert(retval != 0 && !partial);
+    }
+    retval = jksn_dump(result, &redumped, 1, NULL);
+    assert(retval == 0 && redumped->size == encoded->size && !memcmp(redumped->buf, encoded->buf, encoded->size));
+    fwrite(redumped->buf, 1, redumped->size, stdout);
+    result = jksn_free_borrowed(result, encoded, NULL);
+    redumped = jksn_blobstring_free(redumped);
+    encoded = jksn_blobstring_free(encoded);
+    return 0;
+}
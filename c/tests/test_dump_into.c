@@ -0,0 +1,55 @@
+#include <assert.h>
+#include <stdio.h>
+#include "jksn.h"
+
+jksn_t key[] = {
+    { JKSN_STRING, { .data_string = { 4, "name" } } },
+    { JKSN_STRING, { .data_string = { 4, "blob" } } },
+};
+
+jksn_t value[] = {
+    { JKSN_STRING, { .data_string = { 5, "Jason" } } },
+    { JKSN_BLOB, { .data_blob = { 4, "\x00\x01\x02\x03" } } },
+    { JKSN_STRING, { .data_string = { 7, "Jackson" } } },
+    { JKSN_BLOB, { .data_blob = { 4, "\x04\x05\x06\x07" } } },
+};
+
+jksn_keyvalue object_jason_kv[] = {
+    { &key[0], &value[0] }, { &key[1], &value[1] }
+};
+
+jksn_keyvalue object_jackson_kv[] = {
+    { &key[0], &value[2] }, { &key[1], &value[3] }
+};
+
+jksn_t object_jason_jackson[] = {
+    { JKSN_OBJECT, { .data_object = { .size = 2, .children = object_jason_kv } } },
+    { JKSN_OBJECT, { .data_object = { .size = 2, .children = object_jackson_kv } } },
+};
+
+jksn_t *object_array[] = {
+    &object_jason_jackson[0], &object_jason_jackson[1]
+};
+
+jksn_t object = {
+    JKSN_ARRAY,
+    {
+        .data_array = {
+            .size = 2,
+            .children = object_array
+        }
+    }
+};
+
+char buf[4096];
+
+int main(void) {
+    size_t written;
+    int retval = jksn_dump_into(&object, buf, 8, &written, 1, NULL);
+    fprintf(stderr, "retval = %d (%s), %zu bytes required\n", retval, jksn_errcode(retval), written);
+    assert(retval != 0 && written > 8);
+    retval = jksn_dump_into(&object, buf, written, &written, 1, NULL);
+    fprintf(stderr, "retval = %d (%s)\n", retval, jksn_errcode(retval));
+    fwrite(buf, 1, written, stdout);
+    return retval;
+}
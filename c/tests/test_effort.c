@@ -0,0 +1,80 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jksn.h"
+
+static jksn_t *new_string(const char *str) {
+    jksn_t *value = calloc(1, sizeof (jksn_t));
+    value->data_type = JKSN_STRING;
+    value->data_string.size = strlen(str);
+    value->data_string.str = malloc(value->data_string.size);
+    memcpy(value->data_string.str, str, value->data_string.size);
+    return value;
+}
+
+static jksn_t *new_records(size_t size) {
+    /* [{"id": 1000, "name": "name"}, {"id": 1001, "name": "名前"}, ...] */
+    jksn_t *value = calloc(1, sizeof (jksn_t));
+    size_t i;
+    value->data_type = JKSN_ARRAY;
+    value->data_array.size = size;
+    value->data_array.children = calloc(size, sizeof (jksn_t *));
+    for(i = 0; i < size; i++) {
+        jksn_t *record = calloc(1, sizeof (jksn_t));
+        record->data_type = JKSN_OBJECT;
+        record->data_object.size = 2;
+        record->data_object.children = calloc(2, sizeof (jksn_keyvalue));
+        record->data_object.children[0].key = new_string("id");
+        record->data_object.children[0].value = calloc(1, sizeof (jksn_t));
+        record->data_object.children[0].value->data_type = JKSN_INT;
+        record->data_object.children[0].value->data_int = (intmax_t) (1000 + i);
+        record->data_object.children[1].key = new_string("name");
+        record->data_object.children[1].value = new_string(i % 2 ? "\xe5\x90\x8d\xe5\x89\x8d" : "name");
+        value->data_array.children[i] = record;
+    }
+    return value;
+}
+
+int main(void) {
+    jksn_t *records = new_records(50);
+    jksn_cache *cache = jksn_cache_new();
+    jksn_cache *parse_cache = jksn_cache_new();
+    const jksn_effort efforts[] = {JKSN_EFFORT_BALANCED, JKSN_EFFORT_FASTEST, JKSN_EFFORT_BALANCED, JKSN_EFFORT_SMALLEST};
+    jksn_blobstring *expected;
+    jksn_blobstring *encoded[5];
+    size_t i;
+    int retval;
+    /* Values are compared through what a fresh cache makes of them */
+    retval = jksn_dump(records, &expected, 0, NULL);
+    assert(retval == 0);
+    for(i = 0; i < 4; i++) {
+        jksn_cache_set_effort(cache, efforts[i]);
+        retval = jksn_dump(records, &encoded[i], 0, cache);
+        assert(retval == 0);
+    }
+    fprintf(stderr, "fastest %u, balanced %u, smallest %u\n", (unsigned) encoded[1]->size, (unsigned) encoded[0]->size, (unsigned) encoded[3]->size);
+    assert(encoded[1]->size > encoded[0]->size && encoded[3]->size <= encoded[0]->size);
+    /* A later dump must not refer back to what the fastest one left out */
+    jksn_cache_set_effort(cache, JKSN_EFFORT_BALANCED);
+    jksn_cache_set_time_budget(cache, 1);
+    retval = jksn_dump(records, &encoded[4], 0, cache);
+    assert(retval == 0);
+    for(i = 0; i < 5; i++) {
+        jksn_t *result;
+        jksn_blobstring *redumped;
+        retval = jksn_parse(encoded[i], &result, NULL, parse_cache);
+        fprintf(stderr, "retval = %d (%s)\n", retval, jksn_errcode(retval));
+        assert(retval == 0);
+        retval = jksn_dump(result, &redumped, 0, NULL);
+        assert(retval == 0 && redumped->size == expected->size && !memcmp(redumped->buf, expected->buf, expected->size));
+        jksn_blobstring_free(redumped);
+        jksn_free(result);
+        jksn_blobstring_free(encoded[i]);
+    }
+    jksn_blobstring_free(expected);
+    jksn_cache_free(parse_cache);
+    jksn_cache_free(cache);
+    jksn_free(records);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include <assert.h>
+#include <stdio.h>
+#include "jksn.h"
+
+int main(void) {
+    /* ["name", "名前", 1000, 1001] */
+    jksn_t items[] = {
+        { JKSN_STRING, { .data_string = { 4, "name" } } },
+        { JKSN_STRING, { .data_string = { 6, "\xe5\x90\x8d\xe5\x89\x8d" } } },
+        { JKSN_INT, { .data_int = 1000 } },
+        { JKSN_INT, { .data_int = 1001 } },
+    };
+    jksn_t *children[] = { &items[0], &items[1], &items[2], &items[3] };
+    jksn_t object = { JKSN_ARRAY, { .data_array = { 4, children } } };
+    jksn_instrument_counters counters;
+    jksn_blobstring *result;
+    jksn_cache *cache;
+    char buffer[256];
+    size_t written;
+    int i;
+    jksn_t *parsed;
+    int enabled;
+    int retval;
+    jksn_instrument_reset();
+    retval = jksn_dump(&object, &result, 1, NULL);
+    assert(retval == 0);
+    retval = jksn_parse(result, &parsed, NULL, NULL);
+    fprintf(stderr, "retval = %d (%s)\n", retval, jksn_errcode(retval));
+    assert(retval == 0);
+    enabled = jksn_instrument_snapshot(&counters);
+    printf("instrumented: %d\n", enabled);
+    printf("allocations: %llu, %llu bytes\n", (unsigned long long) counters.allocations, (unsigned long long) counters.allocated_bytes);
+    printf("encode: %llu calls, decode: %llu calls\n", (unsigned long long) counters.encode_calls, (unsigned long long) counters.decode_calls);
+    if(enabled) {
+        /* The UTF-16 form of the second string is shorter, so both directions are used */
+        assert(counters.allocations != 0 && counters.encode_calls == 1 && counters.decode_calls == 1);
+        assert(counters.parse_values[JKSN_FAMILY_ARRAY] == 1 && counters.parse_values[JKSN_FAMILY_UTF16] == 1);
+        assert(counters.parse_values[JKSN_FAMILY_INT] == 1 && counters.parse_values[JKSN_FAMILY_DELTA_INT] == 1);
+        assert(counters.utf8_to_utf16_bytes == 6 && counters.utf16_to_utf8_bytes == 4);
+    } else
+        assert(counters.allocations == 0 && counters.encode_calls == 0);
+    /* A warmed-up cache dumps from its arena without touching the heap */
+    cache = jksn_cache_new();
+    for(i = 0; i < 2; i++) {
+        retval = jksn_dump_into(&object, buffer, sizeof buffer, &written, 1, cache);
+        assert(retval == 0);
+    }
+    jksn_instrument_reset();
+    retval = jksn_dump_into(&object, buffer, sizeof buffer, &written, 1, cache);
+    assert(retval == 0);
+    jksn_instrument_snapshot(&counters);
+    printf("reused cache: %llu allocations, %llu arena allocations\n", (unsigned long long) counters.allocations, (unsigned long long) counters.arena_allocations);
+    if(enabled)
+        assert(counters.allocations == 0 && counters.arena_allocations != 0);
+    jksn_cache_free(cache);
+    jksn_free(parsed);
+    jksn_blobstring_free(result);
+    return 0;
+}
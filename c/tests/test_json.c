@@ -0,0 +1,102 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jksn.h"
+
+/* 0x0f and the JSON text as a UTF-8 string, as a JKSN stream without header */
+static jksn_blobstring *json_literal(const char *json, size_t size) {
+    jksn_t text = { JKSN_STRING, { .data_string = { size, (char *) json } } };
+    jksn_blobstring *string;
+    jksn_blobstring *result = malloc(sizeof (jksn_blobstring));
+    int retval = jksn_dump(&text, &string, 0, NULL);
+    assert(retval == 0 && result);
+    result->size = string->size + 1;
+    result->buf = malloc(result->size);
+    result->buf[0] = 0x0f;
+    memcpy(result->buf + 1, string->buf, string->size);
+    jksn_blobstring_free(string);
+    return result;
+}
+
+static int parse_json(const char *json, jksn_t **result) {
+    jksn_blobstring *literal = json_literal(json, strlen(json));
+    int retval = jksn_parse(literal, result, NULL, NULL);
+    jksn_blobstring_free(literal);
+    return retval;
+}
+
+static int json_error(int retval) {
+    return strstr(jksn_errcode(retval), "invalid JSON literal") != NULL;
+}
+
+int main(void) {
+    static const char json[] = "{\"name\": \"caf\\u00e9 \\ud83d\\ude00\\n\", \"count\": -42, \"big\": 18446744073709551616,"
+                               " \"ratio\": 2.5e-1, \"flags\": [true, false, null, {}, []], \"nested\": {\"x\": [1, [2]]}}";
+    jksn_t *result;
+    jksn_t *value;
+    jksn_blobstring *output;
+    jksn_arena *arena;
+    char *deep;
+    size_t i;
+    int retval = parse_json(json, &result);
+    fprintf(stderr, "retval = %d (%s)\n", retval, jksn_errcode(retval));
+    assert(retval == 0 && result->data_type == JKSN_OBJECT && result->data_object.size == 6);
+    value = jksn_object_get_str(result, "name");
+    assert(value && value->data_string.size == 11 && memcmp(value->data_string.str, "caf\xc3\xa9 \xf0\x9f\x98\x80\n", 11) == 0);
+    assert(jksn_object_get_str(result, "count")->data_int == -42);
+    assert(jksn_object_get_str(result, "big")->data_type == JKSN_DOUBLE && jksn_object_get_str(result, "big")->data_double == 18446744073709551616.0);
+    assert(jksn_object_get_str(result, "ratio")->data_double == 0.25);
+    value = jksn_object_get_str(result, "flags");
+    assert(value->data_array.size == 5 && value->data_array.children[0]->data_bool && !value->data_array.children[1]->data_bool);
+    assert(value->data_array.children[2]->data_type == JKSN_NULL && value->data_array.children[3]->data_object.size == 0);
+    value = jksn_object_get_str(jksn_object_get_str(result, "nested"), "x");
+    assert(value->data_array.size == 2 && value->data_array.children[1]->data_array.children[0]->data_int == 2);
+    retval = jksn_dump(result, &output, 1, NULL);
+    assert(retval == 0);
+    fwrite(output->buf, 1, output->size, stdout);
+    output = jksn_blobstring_free(output);
+    result = jksn_free(result);
+    /* Extremes of integers, and lone surrogates */
+    assert(parse_json("[-9223372036854775808, 9223372036854775807, 9223372036854775808, \"\\udc00\"]", &result) == 0);
+    assert(result->data_array.children[0]->data_int == INTMAX_MIN && result->data_array.children[1]->data_int == INTMAX_MAX);
+    assert(result->data_array.children[2]->data_type == JKSN_DOUBLE);
+    assert(memcmp(result->data_array.children[3]->data_string.str, "\xef\xbf\xbd", 3) == 0);
+    result = jksn_free(result);
+    /* Invalid text is rejected */
+    assert(json_error(parse_json("[1,", &result)) && !result);
+    assert(json_error(parse_json("{\"a\" 1}", &result)));
+    assert(json_error(parse_json("[1] 2", &result)));
+    assert(json_error(parse_json("01", &result)));
+    assert(json_error(parse_json("\"\\x\"", &result)));
+    assert(json_error(parse_json("\"\\u12\"", &result)));
+    assert(json_error(parse_json("tru", &result)));
+    assert(json_error(parse_json("", &result)));
+    /* So is a JSON literal without a string after it */
+    {
+        char buf[] = { 0x0f, 0x11 };
+        jksn_blobstring bufin = { sizeof buf, buf };
+        assert(json_error(jksn_parse(&bufin, &result, NULL, NULL)));
+    }
+    /* Deep nesting needs no deep call stack, and an arena works as well */
+    deep = malloc(200001);
+    for(i = 0; i < 100000; i++) {
+        deep[i] = '[';
+        deep[200000 - 1 - i] = ']';
+    }
+    deep[200000] = '\0';
+    {
+        jksn_blobstring *literal = json_literal(deep, 200000);
+        arena = jksn_arena_new(0);
+        retval = jksn_parse_with_allocator(literal, &result, NULL, NULL, jksn_arena_allocator(arena));
+        assert(retval == 0 && result->data_type == JKSN_ARRAY && result->data_array.size == 1);
+        arena = jksn_arena_free(arena);
+        retval = jksn_parse(literal, &result, NULL, NULL);
+        assert(retval == 0);
+        result = jksn_free(result);
+        jksn_blobstring_free(literal);
+    }
+    free(deep);
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "jksn.h"
+
+int main(void) {
+    /* {"k0": 0, ..., "k9": 9, "k3": 33} */
+    char buf[64];
+    size_t size = 0;
+    int i;
+    int retval;
+    jksn_blobstring bufin;
+    jksn_t *result;
+    jksn_t key = { JKSN_STRING, { .data_string = { 2, "k7" } } };
+    jksn_t hand_built = { JKSN_OBJECT, { .data_object = { 0, NULL } } };
+    jksn_keyvalue member;
+    jksn_object_index *index;
+    buf[size++] = (char) 0x9b;
+    for(i = 0; i < 10; i++) {
+        buf[size++] = 0x42;
+        buf[size++] = 'k';
+        buf[size++] = (char) ('0' + i);
+        buf[size++] = (char) (0x10 + i);
+    }
+    buf[size++] = 0x42;
+    buf[size++] = 'k';
+    buf[size++] = '3';
+    buf[size++] = 0x1d;
+    buf[size++] = 33;
+    bufin.size = size;
+    bufin.buf = buf;
+    retval = jksn_parse(&bufin, &result, NULL, NULL);
+    fprintf(stderr, "retval = %d (%s)\n", retval, jksn_errcode(retval));
+    assert(retval == 0);
+    index = jksn_object_index_new(result);
+    assert(index);
+    for(i = 0; i < 10; i++) {
+        char name[3] = { 'k', (char) ('0' + i), '\0' };
+        jksn_t *value = jksn_object_index_get_str(index, name);
+        assert(value && value->data_type == JKSN_INT);
+        assert(jksn_object_get_str(result, name) == value);
+        printf("%s: %d\n", name, (int) value->data_int);
+    }
+    assert(jksn_object_index_get(index, &key)->data_int == 7);
+    assert(jksn_object_get(result, &key)->data_int == 7);
+    assert(jksn_object_index_get_str(index, "k10") == NULL);
+    assert(jksn_object_get_str(result, "k10") == NULL);
+    index = jksn_object_index_free(index);
+    /* After changing the members, a new index finds them */
+    result->data_object.size--;
+    index = jksn_object_index_new(result);
+    assert(jksn_object_index_get_str(index, "k3")->data_int == 3);
+    index = jksn_object_index_free(index);
+    /* Objects built by hand carry nothing else, and non-objects have no index */
+    hand_built.data_object.size = 1;
+    hand_built.data_object.children = &member;
+    member.key = &key;
+    member.value = &key;
+    assert(jksn_object_get(&hand_built, &key) == &key && jksn_object_get_str(&hand_built, "k3") == NULL);
+    index = jksn_object_index_new(&hand_built);
+    assert(jksn_object_index_get_str(index, "k7") == &key);
+    index = jksn_object_index_free(index);
+    assert(jksn_object_index_new(&key) == NULL && jksn_object_get(&key, &key) == NULL);
+    result->data_object.size = 11;
+    result = jksn_free(result);
+    return retval;
+}
@@ -0,0 +1,98 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jksn.h"
+
+static char attachment_data[1 << 20];
+static char body_data[8192];
+
+jksn_t key[] = {
+    { JKSN_STRING, { .data_string = { 10, "attachment" } } },
+    { JKSN_STRING, { .data_string = { 4, "body" } } },
+    { JKSN_STRING, { .data_string = { 2, "id" } } }
+};
+
+jksn_t value[] = {
+    { JKSN_BLOB, { .data_blob = { sizeof attachment_data, attachment_data } } },
+    { JKSN_STRING, { .data_string = { sizeof body_data, body_data } } },
+    { JKSN_INT, { .data_int = 42 } }
+};
+
+jksn_keyvalue object_children[] = {
+    { &key[0], &value[0] }, { &key[1], &value[1] }, { &key[2], &value[2] }
+};
+
+jksn_t object = {
+    JKSN_OBJECT,
+    {
+        .data_object = {
+            .size = 3,
+            .children = object_children
+        }
+    }
+};
+
+static jksn_blobstring *join(const jksn_segment *segments, size_t count) {
+    jksn_blobstring *result = malloc(sizeof (jksn_blobstring));
+    size_t i;
+    result->size = 0;
+    for(i = 0; i < count; i++)
+        result->size += segments[i].size;
+    result->buf = malloc(result->size);
+    result->size = 0;
+    for(i = 0; i < count; i++) {
+        memcpy(result->buf + result->size, segments[i].data, segments[i].size);
+        result->size += segments[i].size;
+    }
+    return result;
+}
+
+int main(void) {
+    jksn_cache *cache = jksn_cache_new();
+    jksn_cache *parse_cache = jksn_cache_new();
+    jksn_segment *segments;
+    jksn_blobstring *storage;
+    jksn_blobstring *expected;
+    jksn_blobstring *joined;
+    size_t count;
+    size_t i;
+    int round;
+    int found = 0;
+    int retval;
+    memset(attachment_data, 0x5a, sizeof attachment_data);
+    memset(body_data, 'b', sizeof body_data);
+    retval = jksn_dump(&object, &expected, 1, NULL);
+    assert(retval == 0);
+    /* Values left in place are not remembered, so later dumps still decode */
+    for(round = 0; round < 2; round++) {
+        jksn_t *result;
+        jksn_blobstring *redumped;
+        retval = jksn_dump_segments(&object, &segments, &count, &storage, 4096, 1, cache);
+        fprintf(stderr, "retval = %d (%s)\n", retval, jksn_errcode(retval));
+        assert(retval == 0);
+        for(i = 0; i < count; i++)
+            found = found || segments[i].data == attachment_data;
+        assert(found && storage->size < 64);
+        joined = join(segments, count);
+        if(round == 0)
+            assert(joined->size == expected->size && !memcmp(joined->buf, expected->buf, expected->size));
+        retval = jksn_parse(joined, &result, NULL, parse_cache);
+        assert(retval == 0);
+        retval = jksn_dump(result, &redumped, 1, NULL);
+        assert(retval == 0 && redumped->size == expected->size && !memcmp(redumped->buf, expected->buf, expected->size));
+        jksn_blobstring_free(redumped);
+        jksn_free(result);
+        jksn_blobstring_free(joined);
+        jksn_blobstring_free(storage);
+        free(segments);
+    }
+    jksn_blobstring_free(expected);
+    retval = jksn_dump(&value[2], &expected, 1, NULL);
+    assert(retval == 0);
+    fwrite(expected->buf, 1, expected->size, stdout);
+    jksn_blobstring_free(expected);
+    jksn_cache_free(parse_cache);
+    jksn_cache_free(cache);
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "jksn.h"
+
+jksn_t key[] = {
+    { JKSN_STRING, { .data_string = { 4, "name" } } },
+    { JKSN_STRING, { .data_string = { 5, "email" } } },
+    { JKSN_STRING, { .data_string = { 3, "age" } } },
+};
+
+jksn_t value[] = {
+    { JKSN_STRING, { .data_string = { 5, "Jason" } } },
+    { JKSN_STRING, { .data_string = { 17, "jason@example.com" } } },
+
+    { JKSN_STRING, { .data_string = { 7, "Jackson" } } },
+    { JKSN_INT, { .data_int = 17 } },
+    { JKSN_STRING, { .data_string = { 19, "jackson@example.com" } } },
+};
+
+jksn_keyvalue object_jason_kv[] = {
+    { &key[0], &value[0] }, { &key[1], &value[1] }
+};
+
+jksn_keyvalue object_jackson_kv[] = {
+    { &key[0], &value[2] }, { &key[2], &value[3] }, { &key[1], &value[4] }
+};
+
+jksn_t object_jason_jackson[] = {
+    { JKSN_OBJECT, { .data_object = { .size = 2, .children = object_jason_kv } } },
+    { JKSN_OBJECT, { .data_object = { .size = 3, .children = object_jackson_kv } } },
+};
+
+jksn_t *object_array[] = {
+    &object_jason_jackson[0], &object_jason_jackson[1]
+};
+
+jksn_t object = {
+    JKSN_ARRAY,
+    {
+        .data_array = {
+            .size = 2,
+            .children = object_array
+        }
+    }
+};
+
+int main(void) {
+    jksn_encode_stats stats;
+    jksn_cache *cache = jksn_cache_new();
+    jksn_blobstring *result;
+    char buffer[256];
+    size_t written;
+    uint64_t bytes = 0;
+    size_t i;
+    int retval;
+    memset(&stats, 0, sizeof stats);
+    jksn_cache_set_stats(cache, &stats);
+    retval = jksn_dump(&object, &result, 1, cache);
+    fprintf(stderr, "retval = %d (%s)\n", retval, jksn_errcode(retval));
+    assert(retval == 0);
+    /* The second dump refers back to every string of the first */
+    retval = jksn_dump_into(&object, buffer, sizeof buffer, &written, 0, cache);
+    assert(retval == 0);
+    /* Too small: nothing is written, so nothing is counted */
+    retval = jksn_dump_into(&object, buffer, 4, NULL, 0, cache);
+    assert(retval != 0);
+    jksn_encode_stats_print(&stats, stderr);
+    for(i = 0; i < JKSN_FAMILY_COUNT; i++)
+        bytes += stats.bytes[i];
+    assert(stats.dumps == 2 && bytes + 3 == result->size + written);
+    assert(stats.swaps == 2 && stats.swap_candidates == 2);
+    assert(stats.text_hits == 7 && stats.text_misses == 7 && stats.text_collisions == 0);
+    assert(stats.values[JKSN_FAMILY_SWAPPED_ARRAY] == 2 && stats.values[JKSN_FAMILY_CONSTANT] == 2);
+    fwrite(result->buf, 1, result->size, stdout);
+    fwrite(buffer, 1, written, stdout);
+    result = jksn_blobstring_free(result);
+    cache = jksn_cache_free(cache);
+    return 0;
+}